@@ -52,6 +52,7 @@ struct liBalancerFunc {
 struct liAction {
 	gint refcount;
 	liActionType type;
+	guint time_ndx; /** 1 + index in srv->action_names of the action name the action was created by; 0 if unknown */
 
 	union {
 		liOptionSet setting;
@@ -72,6 +73,17 @@ struct liAction {
 	} data;
 };
 
+/* time spent in function and balancer actions, per worker and action name (wrk->action_times);
+ * only every LI_ACTION_TIME_SAMPLE-th action (on average) is timed to keep the overhead low.
+ */
+#define LI_ACTION_TIME_SAMPLE 16
+
+struct liActionTime {
+	guint64 samples;
+	guint64 usec;             /** sum of the sampled times */
+	guint64 usec_max;
+};
+
 /* no new/free function, so just use the struct direct (i.e. not a pointer) */
 LI_API void li_action_stack_init(liActionStack *as);
 LI_API void li_action_stack_reset(liVRequest *vr, liActionStack *as);
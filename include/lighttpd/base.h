@@ -37,6 +37,9 @@
 #include <lighttpd/chunk_parser.h>
 
 #include <lighttpd/waitqueue.h>
+#include <lighttpd/timerwheel.h>
+#include <lighttpd/histogram.h>
+#include <lighttpd/stats_shm.h>
 #include <lighttpd/radix.h>
 
 #include <lighttpd/log.h>
@@ -0,0 +1,45 @@
+#ifndef _LIGHTTPD_HISTOGRAM_H_
+#define _LIGHTTPD_HISTOGRAM_H_
+
+#include <lighttpd/settings.h>
+
+/*
+ * log-linear histogram (like HdrHistogram): values below LI_HISTOGRAM_SUB_BUCKETS*2 have their own bucket,
+ * every further power of two is split into LI_HISTOGRAM_SUB_BUCKETS linear buckets, so the relative error
+ * stays below 1/LI_HISTOGRAM_SUB_BUCKETS. values >= 2^LI_HISTOGRAM_MAX_BITS end up in the last bucket.
+ * the histogram is not locked; use one per worker and merge copies to read them.
+ */
+
+#define LI_HISTOGRAM_SUB_BITS 4
+#define LI_HISTOGRAM_SUB_BUCKETS (1 << LI_HISTOGRAM_SUB_BITS)
+#define LI_HISTOGRAM_MAX_BITS 36
+#define LI_HISTOGRAM_BUCKETS ((LI_HISTOGRAM_MAX_BITS - LI_HISTOGRAM_SUB_BITS + 1) * LI_HISTOGRAM_SUB_BUCKETS)
+
+typedef struct liHistogram liHistogram;
+struct liHistogram {
+	guint64 count;
+	guint64 sum;
+	guint64 max;
+	guint64 buckets[LI_HISTOGRAM_BUCKETS];
+};
+
+LI_API void li_histogram_reset(liHistogram *h);
+
+LI_API void li_histogram_record(liHistogram *h, guint64 value);
+
+/* adds all values from src to dest */
+LI_API void li_histogram_merge(liHistogram *dest, const liHistogram *src);
+
+/* returns the upper bound of the bucket containing the value at the given percentile (0-100); 0 if empty */
+LI_API guint64 li_histogram_percentile(const liHistogram *h, gdouble percentile);
+
+/* number of values <= value; only counts buckets with an upper bound <= value, so values in the bucket
+ * containing value (but not ending at it) are left out */
+LI_API guint64 li_histogram_count_upto(const liHistogram *h, guint64 value);
+
+/* bucket index for a value and the range of values in a bucket */
+LI_API guint li_histogram_bucket(guint64 value);
+LI_API guint64 li_histogram_bucket_lower(guint bucket);
+LI_API guint64 li_histogram_bucket_upper(guint bucket);
+
+#endif
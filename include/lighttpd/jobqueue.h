@@ -35,6 +35,11 @@ struct liJobQueue {
 
 	GAsyncQueue *async_queue;
 	ev_async async_queue_watcher;
+
+	/* statistics, read only */
+	guint64 jobs_run;
+	guint64 run_usec;         /** time spent running jobs */
+	guint64 run_usec_max;     /** longest single run of the queue */
 };
 
 LI_API void li_job_queue_init(liJobQueue *jq, struct ev_loop *loop);
@@ -6,7 +6,9 @@
 #endif
 
 /*
- * Logging uses a dedicated thread in order to prevent blocking write io from blocking normal operations in worker threads.
+ * Logging uses dedicated threads in order to prevent blocking write io from blocking normal operations in worker threads.
+ * Log targets are sharded over "log.threads" writer threads, so a stalled target only blocks the targets of its shard;
+ * if more than "log.queue_limit" bytes are queued for a shard, new entries for it are dropped and counted.
  * Code handling vrequests should use the VR_ERROR(), VR_DEBUG() etc makros. Otherwise the ERROR(), DEBUG() etc makros should be used.
  * Basic examples: VR_WARNING(vr, "%s", "something unexpected happened")   ERROR(srv, "%d is not bigger than %d", 23, 42)
  *
@@ -14,6 +16,10 @@
  * file://
  *
  * Logs are sent once per ev_loop() iteration to the logging thread in order to reduce syscalls and lock contention.
+ *
+ * High volume logs (like the accesslog) should use the per-worker append buffers (li_log_buffer_get/commit):
+ * records for the same target are collected in a block and only handed to the logging thread when the block is full
+ * or after LI_LOG_BUFFER_MAX_LATENCY seconds; the logging thread writes consecutive blocks with a single writev().
  */
 
 /* #include <lighttpd/valgrind/valgrind.h> */
@@ -77,6 +83,11 @@
 #define LOG_FLAG_NONE         (0x0)      /* default flag */
 #define LOG_FLAG_TIMESTAMP    (0x1)      /* prepend a timestamp to the log message */
 #define LOG_FLAG_NOLOCK       (0x1 << 1) /* for internal use only */
+#define LOG_FLAG_BLOCK        (0x1 << 2) /* msg is a block of complete records; no newline is appended */
+
+/* per-worker append buffers: block size handed to the logging thread and max. time a line stays buffered */
+#define LI_LOG_BUFFER_BLOCK_SIZE  (64*1024)
+#define LI_LOG_BUFFER_MAX_LATENCY 1.0
 
 /* embed this into structures that should have their own log context, like liVRequest and liServer.logs */
 struct liLogContext {
@@ -98,30 +109,57 @@ struct liLogEntry {
 	GList queue_link;
 };
 
-struct liLogServerData {
+/* one writer thread; handles all targets whose path hashes to it */
+struct liLogShard {
+	liServer *srv;
+	guint ndx;
 	struct ev_loop *loop;
 	ev_async watcher;
 	liRadixTree *targets;    /** const gchar* path => (liLog*) */
 	liWaitQueue close_queue;
+	GThread *thread;
+
+	/* protected by write_queue_mutex */
 	GQueue write_queue;
 	GStaticMutex write_queue_mutex;
-	GThread *thread;
+	gsize queued_bytes;      /** bytes queued or being written */
+	guint64 dropped, dropped_bytes;
+	guint64 dropped_reported, dropped_bytes_reported;
+
+	/* timestamp format cache */
+	struct {
+		ev_tstamp last_ts;
+		GString *cached;
+	} timestamp;
+};
+
+struct liLogServerData {
+	liLogShard *shards;
+	guint shard_count;
+	gsize queue_limit;       /** max. bytes queued per shard before new entries are dropped; 0 = unlimited */
 	gboolean thread_alive;
 	gboolean thread_finish;
 	gboolean thread_stop;
 
-	/* timestamp format cache */
 	struct {
-		ev_tstamp last_ts;
 		GString *format;
-		GString *cached;
 	} timestamp;
 
 	liLogContext log_context;
 };
 
+struct liLogBuffer {
+	GString *path;
+	GString *data;
+};
+
 struct liLogWorkerData {
 	GQueue log_queue;
+	GQueue *shard_queues;    /** temporary split of log_queue by shard */
+	guint shard_count;
+
+	GHashTable *buffers;     /** GString* path => (liLogBuffer*) */
+	ev_timer flush_timer;
 };
 
 struct liLogMap {
@@ -150,6 +188,17 @@ LI_API void li_log_thread_finish(liServer *srv);
 LI_API void li_log_init(liServer *srv);
 LI_API void li_log_cleanup(liServer *srv);
 
+/* number of writer threads; log targets are distributed by the hash of their path. only before the threads are started */
+LI_API gboolean li_log_set_threads(liServer *srv, guint count);
+
+LI_API void li_log_worker_init(liWorker *wrk);
+/* hands the local log queue to the writer threads; called once per loop iteration */
+LI_API void li_log_worker_submit(liWorker *wrk);
+/* flushes all buffers and pending entries to the logging thread */
+LI_API void li_log_worker_cleanup(liWorker *wrk);
+/* hands all non-empty append buffers to the local log queue */
+LI_API void li_log_worker_flush(liWorker *wrk);
+
 LI_API liLogMap* li_log_map_new(void);
 LI_API liLogMap* li_log_map_new_default(void);
 LI_API void li_log_map_acquire(liLogMap *log_map);
@@ -158,6 +207,13 @@ LI_API void li_log_map_release(liLogMap *log_map);
 LI_API void li_log_context_set(liLogContext *context, liLogMap *log_map);
 
 LI_API gboolean li_log_write_direct(liServer *srv, liWorker *wrk, GString *path, GString *msg);
+
+/* returns the append buffer of the worker for the log target path; append exactly one complete record
+ * (including the line terminator for text logs) to buf->data and call li_log_buffer_commit() afterwards.
+ * must be called from the worker thread.
+ */
+LI_API liLogBuffer* li_log_buffer_get(liWorker *wrk, GString *path);
+LI_API void li_log_buffer_commit(liWorker *wrk, liLogBuffer *buf);
 /* li_log_write is used to write to the errorlog */
 LI_API gboolean li_log_write(liServer *srv, liWorker *wrk, liLogContext* context, liLogLevel log_level, guint flags, const gchar *fmt, ...) G_GNUC_PRINTF(6, 7);
 
@@ -6,6 +6,7 @@
 #include <lighttpd/buffer.h>
 
 typedef struct liMemcachedCon liMemcachedCon;
+typedef struct liMemcachedPool liMemcachedPool;
 typedef struct liMemcachedItem liMemcachedItem;
 typedef struct liMemcachedRequest liMemcachedRequest;
 typedef enum {
@@ -16,6 +17,11 @@ typedef enum {
 	LI_MEMCACHED_RESULT_ERROR /* some error occured */
 } liMemcachedResult;
 
+typedef enum {
+	LI_MEMCACHED_PROTOCOL_ASCII,
+	LI_MEMCACHED_PROTOCOL_BINARY /* quiet multi-gets, no line parsing */
+} liMemcachedProtocol;
+
 typedef void (*liMemcachedCB)(liMemcachedRequest *request, liMemcachedResult result, liMemcachedItem *item, GError **err);
 
 struct liMemcachedItem {
@@ -23,6 +29,7 @@ struct liMemcachedItem {
 	guint32 flags;
 	ev_tstamp ttl;
 	guint64 cas;
+	guint64 value; /* incr/decr: the new value */
 	liBuffer *data;
 };
 
@@ -42,13 +49,41 @@ typedef enum {
 	LI_MEMCACHED_UNKNOWN = 0xff
 } liMemcachedError;
 
-LI_API liMemcachedCon* li_memcached_con_new(struct ev_loop *loop, liSocketAddress addr);
+LI_API liMemcachedCon* li_memcached_con_new(struct ev_loop *loop, liSocketAddress addr, liMemcachedProtocol protocol);
 LI_API void li_memcached_con_acquire(liMemcachedCon* con);
 LI_API void li_memcached_con_release(liMemcachedCon* con); /* thread-safe */
 
 /* these functions are not thread-safe, i.e. must be called in the same context as "loop" from li_memcached_con_new */
 LI_API liMemcachedRequest* li_memcached_get(liMemcachedCon *con, GString *key, liMemcachedCB callback, gpointer cb_data, GError **err);
 LI_API liMemcachedRequest* li_memcached_set(liMemcachedCon *con, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, liMemcachedCB callback, gpointer cb_data, GError **err);
+/* store only if the item still has the cas value from a previous get (result LI_MEMCACHED_EXISTS otherwise) */
+LI_API liMemcachedRequest* li_memcached_cas(liMemcachedCon *con, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, guint64 cas, liMemcachedCB callback, gpointer cb_data, GError **err);
+/* store only if the key doesn't exist yet (result LI_MEMCACHED_NOT_STORED otherwise, for both protocols;
+ * the binary KEY_EEXISTS status is mapped to it) */
+LI_API liMemcachedRequest* li_memcached_add(liMemcachedCon *con, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, liMemcachedCB callback, gpointer cb_data, GError **err);
+/* change a decimal counter, the new value is passed in item->value; missing keys are not created
+ * (result LI_MEMCACHED_NOT_FOUND, use _add to create them). decr doesn't go below 0 */
+LI_API liMemcachedRequest* li_memcached_incr(liMemcachedCon *con, GString *key, guint64 delta, liMemcachedCB callback, gpointer cb_data, GError **err);
+LI_API liMemcachedRequest* li_memcached_decr(liMemcachedCon *con, GString *key, guint64 delta, liMemcachedCB callback, gpointer cb_data, GError **err);
+
+/* pool of servers with ketama consistent hashing; one connection per server,
+ * servers failing to connect (right away or later in the event loop) are ejected
+ * from the continuum for retry_timeout seconds.
+ * like liMemcachedCon the pool may only be used in the context of "loop",
+ * except for _free (which must be the last reference)
+ */
+LI_API liMemcachedPool* li_memcached_pool_new(struct ev_loop *loop, const liSocketAddress *addrs, guint count, liMemcachedProtocol protocol, ev_tstamp retry_timeout);
+LI_API void li_memcached_pool_free(liMemcachedPool *pool);
+
+/* index (in addrs) of the server key currently maps to, -1 if all servers are ejected */
+LI_API gint li_memcached_pool_lookup(liMemcachedPool *pool, GString *key);
+
+LI_API liMemcachedRequest* li_memcached_pool_get(liMemcachedPool *pool, GString *key, liMemcachedCB callback, gpointer cb_data, GError **err);
+LI_API liMemcachedRequest* li_memcached_pool_set(liMemcachedPool *pool, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, liMemcachedCB callback, gpointer cb_data, GError **err);
+LI_API liMemcachedRequest* li_memcached_pool_cas(liMemcachedPool *pool, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, guint64 cas, liMemcachedCB callback, gpointer cb_data, GError **err);
+LI_API liMemcachedRequest* li_memcached_pool_add(liMemcachedPool *pool, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, liMemcachedCB callback, gpointer cb_data, GError **err);
+LI_API liMemcachedRequest* li_memcached_pool_incr(liMemcachedPool *pool, GString *key, guint64 delta, liMemcachedCB callback, gpointer cb_data, GError **err);
+LI_API liMemcachedRequest* li_memcached_pool_decr(liMemcachedPool *pool, GString *key, guint64 delta, liMemcachedCB callback, gpointer cb_data, GError **err);
 
 /* if length(key) <= 250 and all chars x: 0x20 < x < 0x7f the key
  * remains untouched; otherwise it gets replaced with its sha1hex hash
@@ -149,6 +149,7 @@ struct liServerAction {
 	liPlugin *p;
 	liPluginCreateActionCB create_action;
 	gpointer userdata;
+	guint time_ndx; /** see liAction.time_ndx */
 };
 
 struct liServerSetup {
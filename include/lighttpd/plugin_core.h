@@ -7,6 +7,7 @@ typedef enum { LI_ETAG_USE_INODE = 1, LI_ETAG_USE_MTIME = 2, LI_ETAG_USE_SIZE =
 
 enum liCoreOptions {
 	LI_CORE_OPTION_DEBUG_REQUEST_HANDLING = 0,
+	LI_CORE_OPTION_DEBUG_TRACE_SLOW,
 
 	LI_CORE_OPTION_STATIC_RANGE_REQUESTS,
 
@@ -20,11 +21,14 @@ enum liCoreOptions {
 
 enum liCoreOptionPtrs {
 	LI_CORE_OPTION_STATIC_FILE_EXCLUDE_EXTENSIONS = 0,
+	LI_CORE_OPTION_STATIC_PRECOMPRESSED,
 
 	LI_CORE_OPTION_SERVER_NAME,
 	LI_CORE_OPTION_SERVER_TAG,
 
 	LI_CORE_OPTION_MIME_TYPES,
+
+	LI_CORE_OPTION_DEBUG_TRACE_SLOW_LOG,
 };
 
 /* the core plugin always has base index 0, as it is the first plugin loaded */
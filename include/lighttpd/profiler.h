@@ -18,8 +18,9 @@ struct liProfilerMem {
 };
 
 LI_API void li_profiler_enable(gchar *output_path); /* enables the profiler */
+LI_API void li_profiler_enable_sampling(gchar *output_path, guint interval_kb); /* enables the profiler, tracking only about one allocation per interval */
 LI_API void li_profiler_finish();
-LI_API void li_profiler_dump(gint minsize); /* dumps memory statistics to file specified in LI_PROFILE_MEM env var */
+LI_API void li_profiler_dump(gint minsize); /* dumps memory statistics to file specified in LIGHTY_PROFILE_MEM env var; in sampling mode the live bytes per callsite */
 LI_API void li_profiler_hashtable_insert(const gpointer addr, gsize size); /* registers an allocated block with the profiler */
 LI_API void li_profiler_hashtable_remove(const gpointer addr); /* unregisters an allocated block with the profiler */
 
@@ -82,7 +82,8 @@ struct liServer {
 	ev_signal
 		sig_w_INT,
 		sig_w_TERM,
-		sig_w_PIPE;
+		sig_w_PIPE,
+		sig_w_USR2;
 	ev_timer srv_1sec_timer;
 
 	GPtrArray *sockets;          /** array of (server_socket*) */
@@ -97,6 +98,7 @@ struct liServer {
 	GHashTable *optionptrs;   /**< const gchar* => (liServerOptionPtr*) */
 	GHashTable *actions;      /**< const gchar* => (liServerAction*) */
 	GHashTable *setups;       /**< const gchar* => (liServerSetup*) */
+	GPtrArray *action_names;  /**< (gchar*) names of all actions ever registered, never shrinks; see liAction.time_ndx */
 
 	GArray *li_plugins_handle_close; /** list of handle_close callbacks */
 	GArray *li_plugins_handle_vrclose; /** list of handle_vrclose callbacks */
@@ -127,6 +129,9 @@ struct liServer {
 
 	gdouble stat_cache_ttl;
 	gint tasklet_pool_threads;
+
+	GString *stats_shm_path; /** NULL if disabled */
+	liStatsShm *stats_shm;   /** created in prepare, every worker updates its own slot once a second */
 };
 
 
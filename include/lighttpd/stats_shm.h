@@ -0,0 +1,85 @@
+#ifndef _LIGHTTPD_STATS_SHM_H_
+#define _LIGHTTPD_STATS_SHM_H_
+
+#include <lighttpd/settings.h>
+#include <lighttpd/histogram.h>
+
+/*
+ * statistics published in a memory mapped file, so external tools can read them without a request
+ * to the server (see the lighttpd2-stats tool).
+ *
+ * the file starts with a liStatsShmHeader; the worker slots (worker_size bytes each) follow at offset header_size.
+ * each worker only writes its own slot; the slot is protected by a seqlock:
+ * seq is odd while the worker updates the slot, readers retry until they get the same even seq
+ * before and after copying the slot.
+ * readers must check magic, version and the sizes; fields are only appended in new versions.
+ */
+
+#define LI_STATS_SHM_MAGIC 0x6c693273 /* "li2s" */
+#define LI_STATS_SHM_VERSION 1
+
+#define LI_STATS_SHM_ERROR li_stats_shm_error_quark()
+LI_API GQuark li_stats_shm_error_quark(void);
+
+typedef struct liStatsShmHeader liStatsShmHeader;
+struct liStatsShmHeader {
+	guint32 magic;
+	guint32 version;
+	guint32 header_size;       /* offset of the first worker slot */
+	guint32 worker_size;       /* size of a worker slot */
+	guint32 worker_count;
+	guint32 histogram_buckets; /* LI_HISTOGRAM_BUCKETS of the writer */
+	gint64 pid;
+	gint64 started;            /* unix timestamp */
+};
+
+typedef struct liStatsShmWorker liStatsShmWorker;
+struct liStatsShmWorker {
+	gint seq;
+	guint32 ndx;
+	gint64 updated;            /* unix timestamp of the last update */
+
+	guint64 requests;
+	guint64 bytes_in;
+	guint64 bytes_out;
+	guint64 actions_executed;
+	guint64 active_connections;
+
+	/* 5 seconds frame */
+	guint64 requests_5s_diff;
+	guint64 bytes_in_5s_diff;
+	guint64 bytes_out_5s_diff;
+
+	/* in microseconds */
+	liHistogram ttfb;
+	liHistogram duration;
+};
+
+typedef struct liStatsShm liStatsShm;
+struct liStatsShm {
+	gchar *path;
+	gboolean writable;
+	dev_t dev;                 /* identifies the file we created (writable only) */
+	ino_t ino;
+	gpointer map;
+	gsize size;
+	liStatsShmHeader *header;
+};
+
+/* creates a new file, maps it writable and renames it to path (replacing an existing file);
+ * li_stats_shm_free removes the file again, unless another instance replaced it in the meantime */
+LI_API liStatsShm* li_stats_shm_create(const gchar *path, guint worker_count, GError **err);
+/* maps an existing file readonly and checks the header */
+LI_API liStatsShm* li_stats_shm_open(const gchar *path, GError **err);
+LI_API void li_stats_shm_free(liStatsShm *shm);
+
+LI_API liStatsShmWorker* li_stats_shm_worker(liStatsShm *shm, guint ndx);
+
+/* writer: wrap updates of a slot with begin/end */
+LI_API void li_stats_shm_write_begin(liStatsShmWorker *slot);
+LI_API void li_stats_shm_write_end(liStatsShmWorker *slot);
+
+/* reader: copies a consistent snapshot of the slot, returns FALSE if the slot is busy for too long */
+LI_API gboolean li_stats_shm_read(liStatsShmWorker *slot, liStatsShmWorker *dest);
+
+#endif
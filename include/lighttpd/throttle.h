@@ -1,7 +1,8 @@
 #ifndef _LIGHTTPD_THROTTLE_H_
 #define _LIGHTTPD_THROTTLE_H_
 
-#define THROTTLE_GRANULARITY 200 /* defines how frequently (in milliseconds) a magazine is refilled */
+#define THROTTLE_GRANULARITY 10 /* defines how frequently (in milliseconds) a magazine is refilled */
+#define THROTTLE_QUANTUM_MIN 2048 /* smallest share (in bytes) a queued connection or child pool gets in one round */
 
 /* this makro converts a ev_tstamp to a gint. this is needed for atomic access. millisecond precision, can hold two weeks max */
 #define THROTTLE_EVTSTAMP_TO_GINT(x) ((gint) ((x - ((gint)x - (gint)x % (3600*24*14))) * 1000))
@@ -20,6 +21,11 @@ struct liThrottlePool {
 	} data;
 	gint rate; /* bytes/s */
 	gint refcount;
+
+	/* hierarchical pools: traffic of this pool is also limited by the parent pool;
+	 * each child pool counts as one queued connection in its parent */
+	liThrottlePool *parent;
+	liRadixTree *ip_pools; /* IP pools with this pool as parent, protected by srv->action_mutex */
 	gint rearming; /* atomic access, 1 if a worker is currently rearming the magazine */
 	gint last_rearm; /* gint for atomic access. represents a ((gint)ev_tstamp*1000) */
 
@@ -27,7 +33,10 @@ struct liThrottlePool {
 	gint *worker_magazine;
 	gint *worker_last_rearm;
 	gint *worker_num_cons_queued;
-	GQueue** worker_queues;
+	GQueue** worker_queues; /* queued connections */
+	GQueue** worker_child_queues; /* queued child pools */
+	gint *worker_parent_magazine; /* share granted by the parent pool */
+	GList *worker_parent_lnk; /* link in the parent's worker_child_queues, data is NULL if not queued */
 };
 
 struct liThrottleParam {
@@ -36,11 +45,16 @@ struct liThrottleParam {
 };
 
 LI_API void li_throttle_reset(liVRequest *vr);
-LI_API void li_throttle_cb(liWaitQueue *wq, gpointer data);
+LI_API void li_throttle_cb(liTimerWheel *tw, liTimerWheelElem *elem, gpointer data);
 
-LI_API liThrottlePool *li_throttle_pool_new(liServer *srv, liThrottlePoolType type, gpointer param, guint rate);
+/* parent is optional; new pools keep a reference to it. IP pools with a parent are separate from IP pools of other parents */
+LI_API liThrottlePool *li_throttle_pool_new(liServer *srv, liThrottlePoolType type, gpointer param, guint rate, liThrottlePool *parent);
 LI_API void li_throttle_pool_free(liServer *srv, liThrottlePool *pool);
+/* allocates the per worker data, needs srv->worker_count */
+LI_API void li_throttle_pool_prepare(liServer *srv, liThrottlePool *pool);
 
+/* a vrequest is in at most one named and one IP pool. a named pool that is an ancestor of
+ * the IP pool isn't acquired directly, it is charged through the IP pool */
 LI_API void li_throttle_pool_acquire(liVRequest *vr, liThrottlePool *pool);
 LI_API void li_throttle_pool_release(liVRequest *vr, liThrottlePool *pool);
 
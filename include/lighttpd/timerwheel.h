@@ -0,0 +1,57 @@
+#ifndef _LIGHTTPD_TIMERWHEEL_H_
+#define _LIGHTTPD_TIMERWHEEL_H_
+
+#include <lighttpd/settings.h>
+
+#define LI_TIMERWHEEL_BITS 8
+#define LI_TIMERWHEEL_SLOTS (1 << LI_TIMERWHEEL_BITS)
+#define LI_TIMERWHEEL_LEVELS 3
+
+typedef struct liTimerWheelElem liTimerWheelElem;
+typedef struct liTimerWheel liTimerWheel;
+typedef void (*liTimerWheelCB) (liTimerWheel *tw, liTimerWheelElem *elem, gpointer data);
+
+struct liTimerWheelElem {
+	GList link;      /* link.data points to the element */
+	GQueue *slot;    /* NULL if not queued */
+	guint64 expire;  /* in ticks */
+	gpointer data;
+};
+
+struct liTimerWheel {
+	struct ev_loop *loop;
+	ev_timer timer;
+	gdouble tick;    /* length of a tick in seconds */
+	ev_tstamp start;
+	guint64 current; /* last processed tick */
+
+	GQueue slots[LI_TIMERWHEEL_LEVELS][LI_TIMERWHEEL_SLOTS];
+	guint length;
+
+	liTimerWheelCB callback;
+	gpointer data;
+};
+
+/*
+ * hierarchical timer wheel: like a waitqueue, but every element can have its own delay.
+ * the first level has a slot per tick, each further level covers LI_TIMERWHEEL_SLOTS times
+ * the range of the previous one; elements are moved down a level when their slot is reached.
+ * delays longer than the wheel (2^24 ticks) are cut.
+ * li_timerwheel_add and li_timerwheel_remove have O(1) complexity; the ev_timer only runs
+ * while elements are queued.
+ */
+
+/* initializes the wheel; precision is "tick" seconds */
+LI_API void li_timerwheel_init(liTimerWheel *tw, struct ev_loop *loop, liTimerWheelCB callback, gdouble tick, gpointer data);
+
+/* stops the timer; queued elements stay queued */
+LI_API void li_timerwheel_stop(liTimerWheel *tw);
+
+/* (re)schedules the element to expire after "delay" seconds (at least one tick).
+ * the callback is called once for it with the element already removed from the wheel */
+LI_API void li_timerwheel_add(liTimerWheel *tw, liTimerWheelElem *elem, gdouble delay);
+
+/* removes an element from the wheel */
+LI_API void li_timerwheel_remove(liTimerWheel *tw, liTimerWheelElem *elem);
+
+#endif
@@ -28,6 +28,8 @@ typedef struct liActionStack liActionStack;
 
 typedef struct liActionRegexStackElement liActionRegexStackElement;
 
+typedef struct liActionTime liActionTime;
+
 typedef struct liActionFunc liActionFunc;
 
 typedef struct liBalancerFunc liBalancerFunc;
@@ -94,6 +96,8 @@ typedef struct liHttpResponseCtx liHttpResponseCtx;
 
 typedef struct liLogTarget liLogTarget;
 typedef struct liLogEntry liLogEntry;
+typedef struct liLogBuffer liLogBuffer;
+typedef struct liLogShard liLogShard;
 typedef struct liLogServerData liLogServerData;
 typedef struct liLogWorkerData liLogWorkerData;
 typedef struct liLogMap liLogMap;
@@ -239,6 +243,8 @@ typedef struct liConInfo liConInfo;
 
 typedef struct liVRequest liVRequest;
 
+typedef struct liVRequestTrace liVRequestTrace;
+
 typedef struct liFilter liFilter;
 
 typedef struct liFilters liFilters;
@@ -96,6 +96,10 @@ LI_API gboolean li_string_suffix(const GString *str, const gchar *s, gsize len);
 
 LI_API void li_string_append_int(GString *dest, gint64 val);
 
+/** finds the value of the first cookie "name" in a Cookie header value ("a=1; b=2");
+ * pairs are separated by ';' or ',' (the separator of joined headers), value points into cookies */
+LI_API gboolean li_cookie_find(const gchar *cookies, gsize len, const gchar *name, gsize name_len, const gchar **value, gsize *value_len);
+
 LI_API gsize li_dirent_buf_size(DIR * dirp);
 
 LI_API void li_apr_sha1_base64(GString *dest, const GString *passwd);
@@ -87,6 +87,17 @@ struct liFilters {
 	liChunkQueue *in, *out;
 };
 
+/* timestamps of the request phases for "debug.trace_slow", 0 if the phase wasn't reached (yet).
+ * only the cached loop time is stored, so this is cheap enough to do for every request.
+ */
+struct liVRequestTrace {
+	ev_tstamp headers_parsed;  /** all request headers received */
+	ev_tstamp actions_done;    /** the actions finished handling the request headers */
+	ev_tstamp backend;         /** the backend delivered the response headers (indirect handlers only) */
+	ev_tstamp first_byte;      /** response headers sent; set by the connection */
+	ev_tstamp last_byte;       /** response completely sent; set by the connection */
+};
+
 struct liVRequest {
 	liConInfo *coninfo;
 	liWorker *wrk;
@@ -99,6 +110,7 @@ struct liVRequest {
 	liVRequestState state;
 
 	ev_tstamp ts_started;
+	liVRequestTrace trace;
 
 	GPtrArray *plugin_ctx;
 	liPlugin *backend;
@@ -143,9 +155,9 @@ struct liVRequest {
 		} ip;
 		struct {
 			gint rate; /* maximum transfer rate in bytes per second, 0 if unlimited */
-			ev_tstamp last_update;
+			ev_tstamp last_update; /* time up to which the rate was handed out */
 		} con;
-		liWaitQueueElem wqueue_elem;
+		liTimerWheelElem timer_elem;
 	} throttle;
 };
 
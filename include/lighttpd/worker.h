@@ -42,6 +42,16 @@ struct liStatistics {
 	guint64 last_requests;
 	double requests_per_sec;
 	ev_tstamp last_update;
+
+	/* request latencies in microseconds, since start */
+	liHistogram ttfb;         /** time until the response headers were sent */
+	liHistogram duration;     /** time until the response was completely sent */
+
+	/* event loop, in microseconds */
+	liHistogram loop_busy;    /** time spent per loop iteration handling events and jobs (i.e. not waiting for events) */
+	guint64 loop_busy_max_1s; /** longest loop iteration since last_update (loop lag) */
+	guint64 last_loop_busy;   /** loop_busy.sum at last_update */
+	guint64 last_cpu_usec;    /** cpu time of the worker thread at last_update */
 };
 
 #define CUR_TS(wrk) ev_now((wrk)->loop)
@@ -68,7 +78,8 @@ struct liWorker {
 
 	struct ev_loop *loop;
 	ev_prepare loop_prepare;
-	/* ev_check loop_check; */
+	ev_check loop_check;
+	ev_tstamp loop_check_ts;  /** when the current loop iteration started handling events, 0 if unknown */
 	ev_async worker_stop_watcher, worker_stopping_watcher, worker_suspend_watcher, worker_exit_watcher;
 
 	liLogWorkerData logs;
@@ -90,9 +101,12 @@ struct liWorker {
 
 	liWaitQueue io_timeout_queue;
 
-	liWaitQueue throttle_queue;
+	liTimerWheel throttle_wheel;
 
 	guint connection_load;    /** incremented by server_accept_cb, decremented by worker_con_put. use atomic access */
+	guint load_pressure;      /** cpu usage + loop lag during the last second, 0..2000 (permille each); updated by the stats watcher,
+	                            * used by li_server_listen_cb to avoid busy workers. use atomic access
+	                            */
 
 	GArray *timestamps_gmt; /** array of (worker_ts), use only from local worker context and through li_worker_current_timestamp(wrk, LI_GMTIME, ndx) */
 	GArray *timestamps_local;
@@ -107,6 +121,10 @@ struct liWorker {
 	ev_timer stats_watcher;
 	liStatistics stats;
 
+	GArray *action_times;     /** (liActionTime), index is liAction.time_ndx - 1; use only from local worker context */
+	guint action_time_countdown;
+	guint32 action_time_seed;
+
 	/* collect framework */
 	ev_async collect_watcher;
 	GAsyncQueue *collect_queue;
@@ -0,0 +1,111 @@
+
+#include <lighttpd/histogram.h>
+
+static guint histogram_msb(guint64 value) {
+	guint msb = 0;
+
+	while (value >>= 1) msb++;
+
+	return msb;
+}
+
+guint li_histogram_bucket(guint64 value) {
+	guint msb, shift;
+
+	if (value < 2 * LI_HISTOGRAM_SUB_BUCKETS)
+		return (guint) value;
+
+	msb = histogram_msb(value);
+	if (msb >= LI_HISTOGRAM_MAX_BITS)
+		return LI_HISTOGRAM_BUCKETS - 1;
+
+	/* the top SUB_BITS+1 bits select the sub bucket within the power of two */
+	shift = msb - LI_HISTOGRAM_SUB_BITS;
+
+	return shift * LI_HISTOGRAM_SUB_BUCKETS + (guint) (value >> shift);
+}
+
+guint64 li_histogram_bucket_lower(guint bucket) {
+	guint shift;
+
+	if (bucket < 2 * LI_HISTOGRAM_SUB_BUCKETS)
+		return bucket;
+
+	shift = bucket / LI_HISTOGRAM_SUB_BUCKETS - 1;
+
+	return ((guint64) (bucket - shift * LI_HISTOGRAM_SUB_BUCKETS)) << shift;
+}
+
+guint64 li_histogram_bucket_upper(guint bucket) {
+	if (bucket >= LI_HISTOGRAM_BUCKETS - 1)
+		return G_MAXUINT64;
+
+	return li_histogram_bucket_lower(bucket + 1) - 1;
+}
+
+void li_histogram_reset(liHistogram *h) {
+	memset(h, 0, sizeof(*h));
+}
+
+void li_histogram_record(liHistogram *h, guint64 value) {
+	h->buckets[li_histogram_bucket(value)]++;
+	h->count++;
+	h->sum += value;
+	if (value > h->max) h->max = value;
+}
+
+void li_histogram_merge(liHistogram *dest, const liHistogram *src) {
+	guint i;
+
+	if (0 == src->count)
+		return;
+
+	for (i = 0; i < LI_HISTOGRAM_BUCKETS; i++) {
+		dest->buckets[i] += src->buckets[i];
+	}
+
+	dest->count += src->count;
+	dest->sum += src->sum;
+	if (src->max > dest->max) dest->max = src->max;
+}
+
+guint64 li_histogram_count_upto(const liHistogram *h, guint64 value) {
+	guint64 count = 0;
+	guint i, last;
+
+	if (value >= h->max)
+		return h->count;
+
+	/* a bucket only counts if all of its values are <= value */
+	last = li_histogram_bucket(value);
+	if (li_histogram_bucket_upper(last) > value) last--; /* never the case for the exact buckets, last > 0 */
+
+	for (i = 0; i <= last; i++) {
+		count += h->buckets[i];
+	}
+
+	return count;
+}
+
+guint64 li_histogram_percentile(const liHistogram *h, gdouble percentile) {
+	guint64 rank, seen = 0;
+	guint i;
+
+	if (0 == h->count)
+		return 0;
+
+	if (percentile >= 100) return h->max;
+	if (percentile < 0) percentile = 0;
+
+	/* rank of the wanted value, 1-based */
+	rank = (guint64) (percentile / 100 * h->count + 0.5);
+	if (rank < 1) rank = 1;
+
+	for (i = 0; i < LI_HISTOGRAM_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			return MIN(li_histogram_bucket_upper(i), h->max);
+	}
+
+	return h->max;
+}
@@ -6,6 +6,15 @@
 
 static void job_queue_run(liJobQueue* jq, int loops) {
 	int i;
+	ev_tstamp start, now;
+	guint64 usec;
+
+	if (0 == jq->queue.length) {
+		INC_GEN(jq);
+		return;
+	}
+
+	start = ev_time();
 
 	for (i = 0; i < loops; i++) {
 		GQueue *q = &jq->queue;
@@ -15,17 +24,23 @@ static void job_queue_run(liJobQueue* jq, int loops) {
 
 		INC_GEN(jq);
 
-		if (0 == todo) return;
+		if (0 == todo) break;
 
 		while ((todo-- > 0) && (NULL != (l = g_queue_pop_head_link(q)))) {
 			job = LI_CONTAINER_OF(l, liJob, link);
 			job->generation = jq->generation;
 			job->link.data = NULL;
 
+			jq->jobs_run++;
 			job->callback(job);
 		}
 	}
 
+	now = ev_time();
+	usec = (now > start) ? (guint64) ((now - start) * 1000000) : 0;
+	jq->run_usec += usec;
+	if (usec > jq->run_usec_max) jq->run_usec_max = usec;
+
 	if (jq->queue.length > 0) {
 		/* make sure we will run again soon */
 		ev_timer_start(jq->loop, &jq->queue_watcher);
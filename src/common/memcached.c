@@ -19,6 +19,17 @@
  *
  * TODO: retry connect() once (per second?) if we have a request
  *   before we drop all requests
+ *
+ * GET requests are not sent right away; the keys of all GETs queued
+ * while the socket isn't writable are collected and sent as one
+ * "get <key>*" command. memcached answers with the found values in
+ * request order (missing keys are skipped) and a single END, so
+ * handle_read walks the batch and reports the skipped requests as
+ * not found.
+ *
+ * With the binary protocol the batch is sent as quiet GETs (only hits
+ * are answered) followed by a normal GET for the last key; responses
+ * are matched by their opaque value instead of the key.
  */
 
 GQuark li_memcached_error_quark() {
@@ -27,14 +38,36 @@ GQuark li_memcached_error_quark() {
 
 #define BUFFER_CHUNK_SIZE 4*1024
 
+/* max number of keys in one multi-get command */
+#define MAX_GET_BATCH 32
+
+/* binary protocol */
+#define BIN_HEADER_SIZE 24
+#define BIN_MAGIC_REQUEST 0x80
+#define BIN_MAGIC_RESPONSE 0x81
+#define BIN_OP_GET 0x00
+#define BIN_OP_SET 0x01
+#define BIN_OP_ADD 0x02
+#define BIN_OP_INCREMENT 0x05
+#define BIN_OP_DECREMENT 0x06
+#define BIN_OP_GETQ 0x09
+#define BIN_STATUS_OK 0x0000
+#define BIN_STATUS_KEY_ENOENT 0x0001
+#define BIN_STATUS_KEY_EEXISTS 0x0002
+#define BIN_STATUS_ITEM_NOT_STORED 0x0005
+
+/* ketama: 40 md5 digests with 4 points each per server */
+#define KETAMA_DIGESTS_PER_SERVER 40
+
 typedef struct int_request int_request;
 typedef enum {
-	REQ_GET, REQ_SET
+	REQ_GET, REQ_SET, REQ_ADD, REQ_INCR, REQ_DECR
 } req_type;
 
 struct liMemcachedCon {
 	struct ev_loop *loop;
 	liSocketAddress addr;
+	liMemcachedProtocol protocol;
 
 	int refcount;
 
@@ -50,8 +83,17 @@ struct liMemcachedCon {
 
 	GString *tmpstr;
 
+	/* pending multi-get: the last get_batch_count requests in req_queue */
+	GString *get_batch;
+	guint get_batch_count;
+	int_request *get_batch_last;
+
 	GError *err;
 
+	/* called when connect() failed (synchronously or not); used by pools to eject the server */
+	void (*connect_failed_cb)(liMemcachedCon *con, gpointer data);
+	gpointer connect_failed_data;
+
 	/* read buffers */
 	liBuffer *line, *data, *remaining;
 	liMemcachedItem curitem;
@@ -59,6 +101,16 @@ struct liMemcachedCon {
 	/* GET */
 	gsize get_data_size;
 	gboolean get_have_header;
+
+	/* binary protocol: response header, extras and key are read into line */
+	guint32 next_opaque;
+	gboolean bin_have_header, bin_have_extras;
+	struct {
+		guint8 opcode, extlen;
+		guint16 keylen, status;
+		guint32 bodylen, opaque;
+		guint64 cas;
+	} bin_header;
 };
 
 struct int_request {
@@ -69,6 +121,11 @@ struct int_request {
 	guint32 flags;
 	ev_tstamp ttl;
 	liBuffer *data;
+	guint64 cas; /* SET: only store if item wasn't modified (0: always store) */
+	guint64 delta; /* INCR, DECR */
+
+	guint32 opaque; /* binary protocol: matches responses */
+	gboolean batch_end; /* last GET in a multi-get command */
 
 	GList iter;
 };
@@ -149,16 +206,92 @@ static void memcached_stop_io(liMemcachedCon *con) {
 	}
 }
 
+static void bin_append_uint(GString *str, guint64 value, guint bytes) {
+	while (bytes-- > 0) {
+		g_string_append_c(str, (gchar) ((value >> (8*bytes)) & 0xff));
+	}
+}
+
+static guint64 bin_read_uint(const gchar *addr, guint bytes) {
+	const guchar *p = (const guchar*) addr;
+	guint64 value = 0;
+	guint i;
+
+	for (i = 0; i < bytes; i++) {
+		value = (value << 8) | p[i];
+	}
+
+	return value;
+}
+
+/* request header, extras and key; the value is sent separately */
+static void send_binary_request(liMemcachedCon *con, int_request *req, guint8 opcode) {
+	GString *str = con->tmpstr;
+	gboolean store = (REQ_SET == req->type || REQ_ADD == req->type);
+	gboolean arith = (REQ_INCR == req->type || REQ_DECR == req->type);
+	guint8 extlen = store ? 8 : (arith ? 20 : 0);
+	gsize valuelen = (store && NULL != req->data) ? req->data->used : 0;
+
+	g_string_truncate(str, 0);
+	bin_append_uint(str, BIN_MAGIC_REQUEST, 1);
+	bin_append_uint(str, opcode, 1);
+	bin_append_uint(str, req->key->len, 2);
+	bin_append_uint(str, extlen, 1);
+	bin_append_uint(str, 0, 1); /* data type */
+	bin_append_uint(str, 0, 2); /* vbucket */
+	bin_append_uint(str, extlen + req->key->len + valuelen, 4);
+	bin_append_uint(str, req->opaque, 4);
+	bin_append_uint(str, req->cas, 8);
+
+	if (store) {
+		bin_append_uint(str, req->flags, 4);
+		bin_append_uint(str, (guint64) req->ttl, 4);
+	} else if (arith) {
+		bin_append_uint(str, req->delta, 8);
+		bin_append_uint(str, 0, 8); /* initial value */
+		bin_append_uint(str, 0xffffffff, 4); /* don't create missing keys, same as the ascii protocol */
+	}
+
+	g_string_append_len(str, GSTR_LEN(req->key));
+	send_queue_push_gstring(&con->out, str, &con->buf);
+
+	if (0 != valuelen) {
+		send_queue_push_buffer(&con->out, req->data, 0, valuelen);
+	}
+}
+
 static void send_request(liMemcachedCon *con, int_request *req) {
+	if (LI_MEMCACHED_PROTOCOL_BINARY == con->protocol) {
+		guint8 opcode = BIN_OP_GET;
+
+		switch (req->type) {
+		case REQ_GET: opcode = BIN_OP_GET; break;
+		case REQ_SET: opcode = BIN_OP_SET; break;
+		case REQ_ADD: opcode = BIN_OP_ADD; break;
+		case REQ_INCR: opcode = BIN_OP_INCREMENT; break;
+		case REQ_DECR: opcode = BIN_OP_DECREMENT; break;
+		}
+
+		send_binary_request(con, req, opcode);
+		return;
+	}
+
 	switch (req->type) {
 	case REQ_GET:
-		g_string_printf(con->tmpstr, "get %s\r\n", req->key->str);
+		g_string_printf(con->tmpstr, "gets %s\r\n", req->key->str);
 		send_queue_push_gstring(&con->out, con->tmpstr, &con->buf);
 		break;
 	case REQ_SET:
-		/* set <key> <flags> <exptime> <bytes>\r\n */
-
-		g_string_printf(con->tmpstr, "set %s %"G_GUINT32_FORMAT" %"G_GUINT64_FORMAT" %"G_GSIZE_FORMAT"\r\n", req->key->str, req->flags, (guint64) req->ttl, req->data ? req->data->used : 0);
+	case REQ_ADD:
+		/* set <key> <flags> <exptime> <bytes>\r\n
+		 * add <key> <flags> <exptime> <bytes>\r\n
+		 * cas <key> <flags> <exptime> <bytes> <cas unique>\r\n */
+
+		g_string_printf(con->tmpstr, "%s %s %"G_GUINT32_FORMAT" %"G_GUINT64_FORMAT" %"G_GSIZE_FORMAT,
+			(REQ_ADD == req->type) ? "add" : ((0 != req->cas) ? "cas" : "set"),
+			req->key->str, req->flags, (guint64) req->ttl, req->data ? req->data->used : 0);
+		if (0 != req->cas) g_string_append_printf(con->tmpstr, " %"G_GUINT64_FORMAT, req->cas);
+		g_string_append_len(con->tmpstr, CONST_STR_LEN("\r\n"));
 		send_queue_push_gstring(&con->out, con->tmpstr, &con->buf);
 		if (NULL != req->data) {
 			send_queue_push_buffer(&con->out, req->data, 0, req->data->used);
@@ -166,7 +299,69 @@ static void send_request(liMemcachedCon *con, int_request *req) {
 		g_string_assign(con->tmpstr, "\r\n");
 		send_queue_push_gstring(&con->out, con->tmpstr, &con->buf);
 		break;
+	case REQ_INCR:
+	case REQ_DECR:
+		/* incr <key> <value>\r\n */
+		g_string_printf(con->tmpstr, "%s %s %"G_GUINT64_FORMAT"\r\n",
+			(REQ_INCR == req->type) ? "incr" : "decr", req->key->str, req->delta);
+		send_queue_push_gstring(&con->out, con->tmpstr, &con->buf);
+		break;
+	}
+}
+
+static void flush_get_batch(liMemcachedCon *con) {
+	if (0 == con->get_batch_count) return;
+
+	if (LI_MEMCACHED_PROTOCOL_BINARY == con->protocol) {
+		GList *it = con->req_queue.tail;
+		guint i;
+
+		for (i = 1; i < con->get_batch_count; i++) it = it->prev;
+
+		for ( ; NULL != it; it = it->next) {
+			/* only the last GET has to be answered on a miss */
+			send_binary_request(con, it->data, (NULL != it->next) ? BIN_OP_GETQ : BIN_OP_GET);
+		}
+	} else {
+		g_string_append_len(con->get_batch, CONST_STR_LEN("\r\n"));
+		send_queue_push_gstring(&con->out, con->get_batch, &con->buf);
+	}
+
+	con->get_batch_last->batch_end = TRUE;
+	con->get_batch_last = NULL;
+	con->get_batch_count = 0;
+}
+
+static gboolean get_batch_has_key(liMemcachedCon *con, GString *key) {
+	GList *it;
+	guint i;
+
+	/* the batch members are at the tail of req_queue */
+	for (it = con->req_queue.tail, i = 0; NULL != it && i < con->get_batch_count; it = it->prev, i++) {
+		int_request *req = it->data;
+		if (g_string_equal(req->key, key)) return TRUE;
+	}
+
+	return FALSE;
+}
+
+static void batch_get_request(liMemcachedCon *con, int_request *req) {
+	if (LI_MEMCACHED_PROTOCOL_BINARY == con->protocol) {
+		/* keys are encoded in flush_get_batch, responses are matched by opaque */
+		if (con->get_batch_count >= MAX_GET_BATCH) flush_get_batch(con);
+	} else {
+		/* memcached would send duplicate keys only once */
+		if (con->get_batch_count >= MAX_GET_BATCH || get_batch_has_key(con, req->key)) {
+			flush_get_batch(con);
+		}
+
+		if (0 == con->get_batch_count) g_string_assign(con->get_batch, "gets");
+		g_string_append_c(con->get_batch, ' ');
+		g_string_append_len(con->get_batch, GSTR_LEN(req->key));
 	}
+
+	con->get_batch_count++;
+	con->get_batch_last = req;
 }
 
 static gboolean push_request(liMemcachedCon *con, int_request *req, GError **err) {
@@ -174,7 +369,15 @@ static gboolean push_request(liMemcachedCon *con, int_request *req, GError **err
 
 	li_memcached_con_acquire(con);
 
-	send_request(con, req);
+	req->opaque = con->next_opaque++;
+
+	if (REQ_GET == req->type) {
+		batch_get_request(con, req);
+	} else {
+		/* keep the order of requests */
+		flush_get_batch(con);
+		send_request(con, req);
+	}
 
 	req->iter.data = req;
 	g_queue_push_tail_link(&con->req_queue, &req->iter);
@@ -197,8 +400,11 @@ static void free_request(liMemcachedCon *con, int_request *req) {
 
 	switch (req->type) {
 	case REQ_GET:
+	case REQ_INCR:
+	case REQ_DECR:
 		break;
 	case REQ_SET:
+	case REQ_ADD:
 		li_buffer_release(req->data);
 		req->data = NULL;
 		break;
@@ -249,7 +455,7 @@ static void memcached_update_io(liMemcachedCon *con) {
 	if (-1 == con->fd) return; /* not connected or in connect stage */
 
 	if (0 < con->req_queue.length) events = events | EV_READ;
-	if (0 < con->out.length) events = events | EV_WRITE;
+	if (0 < con->out.length || 0 < con->get_batch_count) events = events | EV_WRITE;
 
 	if (0 == events) {
 		memcached_stop_io(con);
@@ -259,6 +465,10 @@ static void memcached_update_io(liMemcachedCon *con) {
 	}
 }
 
+static void memcached_connect_failed(liMemcachedCon *con) {
+	if (NULL != con->connect_failed_cb) con->connect_failed_cb(con, con->connect_failed_data);
+}
+
 static void memcached_connect(liMemcachedCon *con) {
 	int s;
 	struct sockaddr addr;
@@ -307,6 +517,7 @@ static void memcached_connect(liMemcachedCon *con) {
 					g_strerror(errno));
 				close(s);
 				ev_io_set(&con->con_watcher, -1, 0);
+				memcached_connect_failed(con);
 				break;
 			}
 		} else {
@@ -347,6 +558,7 @@ static void memcached_connect(liMemcachedCon *con) {
 		close(s);
 		memcached_stop_io(con);
 		ev_io_set(&con->con_watcher, -1, 0);
+		memcached_connect_failed(con);
 	} else {
 		/* connect succeeded */
 		con->fd = s;
@@ -363,6 +575,7 @@ static void reset_item(liMemcachedItem *item) {
 	item->flags = 0;
 	item->ttl = 0;
 	item->cas = 0;
+	item->value = 0;
 	if (item->data) {
 		li_buffer_release(item->data);
 		item->data = NULL;
@@ -376,12 +589,15 @@ static void close_con(liMemcachedCon *con) {
 	if (con->buf) con->buf->used = 0;
 	reset_item(&con->curitem);
 	send_queue_reset(&con->out);
+	con->get_batch_count = 0;
+	con->get_batch_last = NULL;
 
 	memcached_stop_io(con);
 	close(con->con_watcher.fd);
 	con->fd = -1;
 	ev_io_set(&con->con_watcher, -1, 0);
 	con->cur_req = NULL;
+	con->bin_have_header = FALSE;
 	cancel_all_requests(con);
 	memcached_connect(con);
 }
@@ -504,33 +720,32 @@ static gboolean try_read_line(liMemcachedCon *con) {
 	return FALSE;
 }
 
-static gboolean try_read_data(liMemcachedCon *con, gsize datalen) {
-	liBuffer *data;
+/* fill *pbuf with exactly len bytes; additional data is moved to con->remaining */
+static gboolean try_read_buffer(liMemcachedCon *con, liBuffer **pbuf, gsize len) {
+	liBuffer *buf;
 	ssize_t r;
 
-	datalen += 2; /* \r\n */
-
-	/* if we have remaining data use it for a new line */
-	if ((!con->data || con->data->used == 0) && con->remaining && con->remaining->used > 0) {
-		liBuffer *tmp = con->remaining; con->remaining = con->data; con->data = tmp;
+	/* if we have remaining data use it for the buffer */
+	if ((!*pbuf || (*pbuf)->used == 0) && con->remaining && con->remaining->used > 0) {
+		liBuffer *tmp = con->remaining; con->remaining = *pbuf; *pbuf = tmp;
 	}
 
-	if (!con->data) con->data = li_buffer_new_slice(MAX(BUFFER_CHUNK_SIZE, datalen));
+	if (!*pbuf) *pbuf = li_buffer_new_slice(MAX(BUFFER_CHUNK_SIZE, len));
 
-	if (con->data->alloc_size < datalen) {
-		data = li_buffer_new_slice(MAX(BUFFER_CHUNK_SIZE, datalen));
-		memcpy(data->addr, con->data->addr, (data->used = con->data->used));
-		li_buffer_release(con->data);
-		con->data = data;
+	if ((*pbuf)->alloc_size < len) {
+		buf = li_buffer_new_slice(MAX(BUFFER_CHUNK_SIZE, len));
+		memcpy(buf->addr, (*pbuf)->addr, (buf->used = (*pbuf)->used));
+		li_buffer_release(*pbuf);
+		*pbuf = buf;
 	}
 
-	g_assert(NULL == con->remaining || 0 == con->remaining->used); /* there shouldn't be any data in remaining while we fill con->data */
+	g_assert(NULL == con->remaining || 0 == con->remaining->used); /* there shouldn't be any data in remaining while we fill *pbuf */
 
-	data = con->data;
+	buf = *pbuf;
 
-	if (data->used < datalen) {
+	if (buf->used < len) {
 		/* read more data */
-		r = net_read(con->fd, data->addr + data->used, data->alloc_size - data->used);
+		r = net_read(con->fd, buf->addr + buf->used, buf->alloc_size - buf->used);
 		if (r == 0) {
 			/* EOF */
 			g_clear_error(&con->err);
@@ -553,29 +768,204 @@ static gboolean try_read_data(liMemcachedCon *con, gsize datalen) {
 			return FALSE;
 		}
 
-		data->used += r;
+		buf->used += r;
 	}
 
-	if (data->used >= datalen) {
-		if (data->addr[datalen-2] != '\r' || data->addr[datalen-1] != '\n') {
-			/* Protocol error: data block not terminated with \r\n */
-			g_clear_error(&con->err);
-			g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Protocol error: data block not terminated with \\r\\n");
-			close_con(con);
-			return FALSE;
-		}
-		add_remaining(con, data->addr + datalen, data->used - datalen);
-		data->used = datalen - 2;
-		data->addr[datalen-2] = '\0';
+	if (buf->used >= len) {
+		add_remaining(con, buf->addr + len, buf->used - len);
+		buf->used = len;
 		return TRUE;
 	}
 
 	return FALSE;
 }
 
+static gboolean try_read_data(liMemcachedCon *con, gsize datalen) {
+	liBuffer *data;
+
+	datalen += 2; /* \r\n */
+
+	if (!try_read_buffer(con, &con->data, datalen)) return FALSE;
+
+	data = con->data;
+
+	if (data->addr[datalen-2] != '\r' || data->addr[datalen-1] != '\n') {
+		/* Protocol error: data block not terminated with \r\n */
+		g_clear_error(&con->err);
+		g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Protocol error: data block not terminated with \\r\\n");
+		close_con(con);
+		return FALSE;
+	}
+
+	data->used = datalen - 2;
+	data->addr[datalen-2] = '\0';
+	return TRUE;
+}
+
+
+/* the remaining requests of a multi-get weren't found; stops after the batch end */
+static void get_batch_not_found(liMemcachedCon *con, int_request *cur) {
+	gboolean last;
+
+	do {
+		int_request *next;
+
+		last = cur->batch_end || NULL == cur->iter.next;
+		next = last ? NULL : cur->iter.next->data;
+
+		if (cur->req.callback) {
+			cur->req.callback(&cur->req, LI_MEMCACHED_NOT_FOUND, NULL, NULL);
+		}
+		free_request(con, cur);
+
+		cur = next;
+	} while (!last);
+}
+
+static void handle_read_binary(liMemcachedCon *con) {
+	int_request *cur;
+	liMemcachedResult result;
+	GError *err = NULL;
+
+	if (NULL == con->cur_req && NULL == g_queue_peek_head(&con->req_queue)) {
+		/* unexpected read event, perhaps just eof */
+		g_clear_error(&con->err);
+		g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Connection closed: unexpected read event");
+		close_con(con);
+		return;
+	}
+
+	if (!con->bin_have_header) {
+		const gchar *h;
+
+		if (!try_read_buffer(con, &con->line, BIN_HEADER_SIZE)) return;
+
+		h = con->line->addr;
+		if (BIN_MAGIC_RESPONSE != (guint8) h[0]) {
+			g_clear_error(&con->err);
+			g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Protocol error: invalid response magic 0x%02x", (guint) (guint8) h[0]);
+			close_con(con);
+			return;
+		}
+
+		con->bin_header.opcode = bin_read_uint(h + 1, 1);
+		con->bin_header.keylen = bin_read_uint(h + 2, 2);
+		con->bin_header.extlen = bin_read_uint(h + 4, 1);
+		con->bin_header.status = bin_read_uint(h + 6, 2);
+		con->bin_header.bodylen = bin_read_uint(h + 8, 4);
+		con->bin_header.opaque = bin_read_uint(h + 12, 4);
+		con->bin_header.cas = bin_read_uint(h + 16, 8);
+
+		if ((guint32) con->bin_header.extlen + con->bin_header.keylen > con->bin_header.bodylen) {
+			g_clear_error(&con->err);
+			g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Protocol error: invalid response body length");
+			close_con(con);
+			return;
+		}
+
+		con->line->used = 0;
+		con->bin_have_header = TRUE;
+		con->bin_have_extras = FALSE;
+	}
+
+	if (!con->bin_have_extras) {
+		/* extras and key stay in con->line, the value goes to con->data */
+		gsize len = con->bin_header.extlen + con->bin_header.keylen;
+
+		if (0 < len && !try_read_buffer(con, &con->line, len)) return;
+		con->bin_have_extras = TRUE;
+		if (con->data) con->data->used = 0;
+	}
+
+	if (!try_read_buffer(con, &con->data, con->bin_header.bodylen - con->bin_header.extlen - con->bin_header.keylen)) return;
+
+	con->bin_have_header = FALSE;
+
+	/* quiet GETs aren't answered for missing keys */
+	cur = g_queue_peek_head(&con->req_queue);
+	while (cur->opaque != con->bin_header.opaque) {
+		int_request *next;
+
+		if (REQ_GET != cur->type || cur->batch_end || NULL == cur->iter.next) {
+			g_clear_error(&con->err);
+			g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Protocol error: unexpected response (opaque %"G_GUINT32_FORMAT")", con->bin_header.opaque);
+			close_con(con);
+			return;
+		}
+
+		next = cur->iter.next->data;
+		if (cur->req.callback) {
+			cur->req.callback(&cur->req, LI_MEMCACHED_NOT_FOUND, NULL, NULL);
+		}
+		free_request(con, cur);
+		cur = next;
+	}
+
+	switch (con->bin_header.status) {
+	case BIN_STATUS_OK:
+		result = LI_MEMCACHED_OK;
+		break;
+	case BIN_STATUS_KEY_ENOENT:
+		result = LI_MEMCACHED_NOT_FOUND;
+		break;
+	case BIN_STATUS_KEY_EEXISTS:
+		/* binary ADD on an existing key; report it like the ascii protocol does */
+		result = (REQ_ADD == cur->type) ? LI_MEMCACHED_NOT_STORED : LI_MEMCACHED_EXISTS;
+		break;
+	case BIN_STATUS_ITEM_NOT_STORED:
+		result = LI_MEMCACHED_NOT_STORED;
+		break;
+	default:
+		result = LI_MEMCACHED_RESULT_ERROR;
+		g_set_error(&err, LI_MEMCACHED_ERROR, LI_MEMCACHED_UNKNOWN, "memcached error status 0x%04x: %.*s",
+			(guint) con->bin_header.status, (int) con->data->used, con->data->addr);
+		break;
+	}
+
+	if ((REQ_INCR == cur->type || REQ_DECR == cur->type) && LI_MEMCACHED_OK == result) {
+		reset_item(&con->curitem);
+		con->curitem.key = g_string_new_len(GSTR_LEN(cur->key));
+		if (NULL != con->data && con->data->used >= 8) {
+			con->curitem.value = bin_read_uint(con->data->addr, 8);
+		}
+
+		if (cur->req.callback) {
+			cur->req.callback(&cur->req, result, &con->curitem, NULL);
+		}
+		reset_item(&con->curitem);
+	} else if (REQ_GET == cur->type && LI_MEMCACHED_OK == result) {
+		reset_item(&con->curitem);
+		con->curitem.key = g_string_new_len(GSTR_LEN(cur->key));
+		if (con->bin_header.extlen >= 4) {
+			con->curitem.flags = bin_read_uint(con->line->addr, 4);
+		}
+		con->curitem.cas = con->bin_header.cas;
+		con->curitem.data = con->data;
+		con->data = NULL;
+
+		if (cur->req.callback) {
+			cur->req.callback(&cur->req, result, &con->curitem, NULL);
+		}
+		reset_item(&con->curitem);
+	} else if (cur->req.callback) {
+		cur->req.callback(&cur->req, result, NULL, (NULL != err) ? &err : NULL);
+	}
+
+	g_clear_error(&err);
+	con->line->used = 0;
+	if (con->data) con->data->used = 0;
+
+	free_request(con, cur);
+}
 
 static void handle_read(liMemcachedCon *con) {
 	int_request *cur;
+	liMemcachedResult result;
+
+	if (LI_MEMCACHED_PROTOCOL_BINARY == con->protocol) {
+		handle_read_binary(con);
+		return;
+	}
 
 	if (NULL == (cur = con->cur_req)) {
 		cur = con->cur_req = g_queue_peek_head(&con->req_queue);
@@ -599,6 +989,9 @@ static void handle_read(liMemcachedCon *con) {
 			con->get_have_header = FALSE;
 			break;
 		case REQ_SET:
+		case REQ_ADD:
+		case REQ_INCR:
+		case REQ_DECR:
 			break;
 		}
 	}
@@ -614,12 +1007,9 @@ static void handle_read(liMemcachedCon *con) {
 			con->get_have_header = TRUE;
 
 			if (3 == con->line->used && 0 == memcmp("END", con->line->addr, 3)) {
-				/* key not found */
-				if (cur->req.callback) {
-					cur->req.callback(&cur->req, LI_MEMCACHED_NOT_FOUND, NULL, NULL);
-				}
+				/* key(s) not found */
 				con->cur_req = NULL;
-				free_request(con, cur);
+				get_batch_not_found(con, cur);
 				return;
 			}
 
@@ -664,6 +1054,25 @@ static void handle_read(liMemcachedCon *con) {
 
 			con->line->used = 0;
 
+			/* values are sent in request order, missing keys are skipped */
+			while (!g_string_equal(cur->key, con->curitem.key)) {
+				int_request *next_req;
+
+				if (cur->batch_end || NULL == cur->iter.next) {
+					g_clear_error(&con->err);
+					g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Protocol error: Unexpected key in GET response: '%s'", con->curitem.key->str);
+					close_con(con);
+					return;
+				}
+
+				next_req = cur->iter.next->data;
+				if (cur->req.callback) {
+					cur->req.callback(&cur->req, LI_MEMCACHED_NOT_FOUND, NULL, NULL);
+				}
+				free_request(con, cur);
+				cur = con->cur_req = next_req;
+			}
+
 			goto req_get_header_done;
 
 req_get_header_error:
@@ -678,6 +1087,21 @@ req_get_header_done: ;
 			/* wait for data */
 			if (!try_read_data(con, con->get_data_size)) return;
 		}
+
+		if (!cur->batch_end) {
+			/* more values or END follow for the next requests in the batch */
+			con->curitem.data = con->data;
+			con->data = NULL;
+			if (cur->req.callback) {
+				cur->req.callback(&cur->req, LI_MEMCACHED_OK, &con->curitem, NULL);
+			}
+			reset_item(&con->curitem);
+
+			con->cur_req = NULL;
+			free_request(con, cur);
+			return;
+		}
+
 		/* wait for END\r\n */
 		if (!try_read_line(con)) return;
 
@@ -701,12 +1125,17 @@ req_get_header_done: ;
 		return;
 
 	case REQ_SET:
+	case REQ_ADD:
 		if (!try_read_line(con)) return;
 
 		if (6 == con->line->used && 0 == memcmp("STORED", con->line->addr, 6)) {
-			if (cur->req.callback) {
-				cur->req.callback(&cur->req, LI_MEMCACHED_OK, NULL, NULL);
-			}
+			result = LI_MEMCACHED_OK;
+		} else if (6 == con->line->used && 0 == memcmp("EXISTS", con->line->addr, 6)) {
+			result = LI_MEMCACHED_EXISTS;
+		} else if (9 == con->line->used && 0 == memcmp("NOT_FOUND", con->line->addr, 9)) {
+			result = LI_MEMCACHED_NOT_FOUND;
+		} else if (10 == con->line->used && 0 == memcmp("NOT_STORED", con->line->addr, 10)) {
+			result = LI_MEMCACHED_NOT_STORED;
 		} else {
 			g_clear_error(&con->err);
 			g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Protocol error: unepxected SET response: '%s'", con->line->addr);
@@ -714,6 +1143,52 @@ req_get_header_done: ;
 			return;
 		}
 
+		if (cur->req.callback) {
+			cur->req.callback(&cur->req, result, NULL, NULL);
+		}
+
+		con->cur_req = NULL;
+		free_request(con, cur);
+		return;
+
+	case REQ_INCR:
+	case REQ_DECR:
+		if (!try_read_line(con)) return;
+
+		/* <value>\r\n (decr may pad the value with spaces), NOT_FOUND\r\n or CLIENT_ERROR <message>\r\n */
+		if (9 == con->line->used && 0 == memcmp("NOT_FOUND", con->line->addr, 9)) {
+			if (cur->req.callback) {
+				cur->req.callback(&cur->req, LI_MEMCACHED_NOT_FOUND, NULL, NULL);
+			}
+		} else if (0 == strncmp("CLIENT_ERROR ", con->line->addr, 13)) {
+			GError *err = NULL;
+			g_set_error(&err, LI_MEMCACHED_ERROR, LI_MEMCACHED_UNKNOWN, "memcached error: %s", con->line->addr + 13);
+			if (cur->req.callback) {
+				cur->req.callback(&cur->req, LI_MEMCACHED_RESULT_ERROR, NULL, &err);
+			}
+			g_clear_error(&err);
+		} else {
+			gchar *next;
+			guint64 value = g_ascii_strtoull(con->line->addr, &next, 10);
+
+			while (' ' == *next) next++;
+			if (next == con->line->addr || '\0' != *next) {
+				g_clear_error(&con->err);
+				g_set_error(&con->err, LI_MEMCACHED_ERROR, LI_MEMCACHED_CONNECTION, "Protocol error: unexpected %s response: '%s'",
+					(REQ_INCR == cur->type) ? "INCR" : "DECR", con->line->addr);
+				close_con(con);
+				return;
+			}
+
+			reset_item(&con->curitem);
+			con->curitem.key = g_string_new_len(GSTR_LEN(cur->key));
+			con->curitem.value = value;
+			if (cur->req.callback) {
+				cur->req.callback(&cur->req, LI_MEMCACHED_OK, &con->curitem, NULL);
+			}
+			reset_item(&con->curitem);
+		}
+
 		con->cur_req = NULL;
 		free_request(con, cur);
 		return;
@@ -742,6 +1217,8 @@ static void memcached_io_cb(struct ev_loop *loop, ev_io *w, int revents) {
 		gchar *data;
 		send_item *si;
 
+		flush_get_batch(con);
+
 		si = g_queue_peek_head(&con->out);
 
 		for (i = 0; si && (i < 10); i++) { /* don't send more than 10 chunks */
@@ -792,18 +1269,26 @@ out:
 }
 
 
-liMemcachedCon* li_memcached_con_new(struct ev_loop *loop, liSocketAddress addr) {
+static liMemcachedCon* memcached_con_new(struct ev_loop *loop, liSocketAddress addr, liMemcachedProtocol protocol) {
 	liMemcachedCon* con = g_slice_new0(liMemcachedCon);
 
 	con->refcount = 1;
 	con->loop = loop;
 	con->addr = li_sockaddr_dup(addr);
+	con->protocol = protocol;
 	con->tmpstr = g_string_sized_new(511);
+	con->get_batch = g_string_sized_new(511);
 
 	con->fd = -1;
 	ev_io_init(&con->con_watcher, memcached_io_cb, -1, 0);
 	con->con_watcher.data = con;
 
+	return con;
+}
+
+liMemcachedCon* li_memcached_con_new(struct ev_loop *loop, liSocketAddress addr, liMemcachedProtocol protocol) {
+	liMemcachedCon* con = memcached_con_new(loop, addr, protocol);
+
 	memcached_connect(con);
 
 	return con;
@@ -820,6 +1305,8 @@ static void li_memcached_con_free(liMemcachedCon* con) {
 	}
 
 	send_queue_reset(&con->out);
+	con->get_batch_count = 0;
+	con->get_batch_last = NULL;
 	cancel_all_requests(con);
 
 	li_buffer_release(con->buf);
@@ -830,6 +1317,7 @@ static void li_memcached_con_free(liMemcachedCon* con) {
 
 	li_sockaddr_clear(&con->addr);
 	g_string_free(con->tmpstr, TRUE);
+	g_string_free(con->get_batch, TRUE);
 
 	g_clear_error(&con->err);
 
@@ -850,7 +1338,8 @@ void li_memcached_con_acquire(liMemcachedCon* con) {
 }
 
 
-liMemcachedRequest* li_memcached_get(liMemcachedCon *con, GString *key, liMemcachedCB callback, gpointer cb_data, GError **err) {
+/* checks the key and the connection, returns a new request of the given type */
+static int_request* con_request_new(liMemcachedCon *con, req_type type, GString *key, liMemcachedCB callback, gpointer cb_data, GError **err) {
 	int_request* req;
 
 	if (!li_memcached_is_key_valid(key)) {
@@ -872,9 +1361,13 @@ liMemcachedRequest* li_memcached_get(liMemcachedCon *con, GString *key, liMemcac
 	req->req.callback = callback;
 	req->req.cb_data = cb_data;
 
-	req->type = REQ_GET;
+	req->type = type;
 	req->key = g_string_new_len(GSTR_LEN(key));
 
+	return req;
+}
+
+static liMemcachedRequest* con_request_push(liMemcachedCon *con, int_request *req, GError **err) {
 	if (!push_request(con, req, err)) {
 		free_request(con, req);
 		return NULL;
@@ -883,43 +1376,310 @@ liMemcachedRequest* li_memcached_get(liMemcachedCon *con, GString *key, liMemcac
 	return &req->req;
 }
 
+static liMemcachedRequest* con_store(liMemcachedCon *con, req_type type, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, guint64 cas, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	int_request* req = con_request_new(con, type, key, callback, cb_data, err);
+
+	if (NULL == req) return NULL;
+
+	req->flags = flags;
+	req->ttl = ttl;
+	req->cas = cas;
+	if (NULL != data) {
+		li_buffer_acquire(data);
+		req->data = data;
+	}
+
+	return con_request_push(con, req, err);
+}
+
+static liMemcachedRequest* con_arith(liMemcachedCon *con, req_type type, GString *key, guint64 delta, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	int_request* req = con_request_new(con, type, key, callback, cb_data, err);
+
+	if (NULL == req) return NULL;
+
+	req->delta = delta;
+
+	return con_request_push(con, req, err);
+}
+
+liMemcachedRequest* li_memcached_get(liMemcachedCon *con, GString *key, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	int_request* req = con_request_new(con, REQ_GET, key, callback, cb_data, err);
+
+	if (NULL == req) return NULL;
+
+	return con_request_push(con, req, err);
+}
+
 liMemcachedRequest* li_memcached_set(liMemcachedCon *con, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, liMemcachedCB callback, gpointer cb_data, GError **err) {
-	int_request* req;
+	return con_store(con, REQ_SET, key, flags, ttl, data, 0, callback, cb_data, err);
+}
 
-	if (!li_memcached_is_key_valid(key)) {
-		g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_BAD_KEY, "Invalid key: '%s'", key->str);
-		return NULL;
+liMemcachedRequest* li_memcached_cas(liMemcachedCon *con, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, guint64 cas, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	return con_store(con, REQ_SET, key, flags, ttl, data, cas, callback, cb_data, err);
+}
+
+liMemcachedRequest* li_memcached_add(liMemcachedCon *con, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	return con_store(con, REQ_ADD, key, flags, ttl, data, 0, callback, cb_data, err);
+}
+
+liMemcachedRequest* li_memcached_incr(liMemcachedCon *con, GString *key, guint64 delta, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	return con_arith(con, REQ_INCR, key, delta, callback, cb_data, err);
+}
+
+liMemcachedRequest* li_memcached_decr(liMemcachedCon *con, GString *key, guint64 delta, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	return con_arith(con, REQ_DECR, key, delta, callback, cb_data, err);
+}
+
+typedef struct {
+	guint32 point;
+	guint node;
+} ketama_point;
+
+typedef struct {
+	liMemcachedPool *pool;
+	liSocketAddress addr;
+	liMemcachedCon *con; /* created on first use */
+	ev_tstamp dead_until;
+} pool_node;
+
+struct liMemcachedPool {
+	struct ev_loop *loop;
+	liMemcachedProtocol protocol;
+	ev_tstamp retry_timeout;
+
+	pool_node *nodes;
+	guint nodes_count;
+
+	ketama_point *ring;
+	guint ring_size;
+};
+
+static int ketama_point_cmp(const void *a, const void *b) {
+	const ketama_point *pa = a, *pb = b;
+	if (pa->point == pb->point) return 0;
+	return (pa->point < pb->point) ? -1 : 1;
+}
+
+static guint32 ketama_digest_point(const guint8 *digest, guint i) {
+	return ((guint32) digest[3+i*4] << 24)
+		| ((guint32) digest[2+i*4] << 16)
+		| ((guint32) digest[1+i*4] << 8)
+		| ((guint32) digest[i*4]);
+}
+
+static void ketama_digest(const gchar *str, gsize len, guint8 digest[16]) {
+	GChecksum *hash = g_checksum_new(G_CHECKSUM_MD5);
+	gsize digest_len = 16;
+
+	g_checksum_update(hash, (const guchar*) str, len);
+	g_checksum_get_digest(hash, digest, &digest_len);
+	g_checksum_free(hash);
+}
+
+liMemcachedPool* li_memcached_pool_new(struct ev_loop *loop, const liSocketAddress *addrs, guint count, liMemcachedProtocol protocol, ev_tstamp retry_timeout) {
+	liMemcachedPool *pool;
+	GString *tmpstr;
+	guint i, j, k;
+
+	g_assert(count > 0);
+
+	pool = g_slice_new0(liMemcachedPool);
+	pool->loop = loop;
+	pool->protocol = protocol;
+	pool->retry_timeout = retry_timeout;
+
+	pool->nodes_count = count;
+	pool->nodes = g_slice_alloc0(sizeof(pool_node) * count);
+	for (i = 0; i < count; i++) {
+		pool->nodes[i].pool = pool;
+		pool->nodes[i].addr = li_sockaddr_dup(addrs[i]);
 	}
 
-	if (-1 == con->fd) memcached_connect(con);
-	if (-1 == con->fd) {
-		if (NULL == con->err) {
-			g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_DISABLED, "Not connected");
-		} else if (err) {
-			*err = g_error_copy(con->err);
+	if (count == 1) return pool; /* no hashing needed */
+
+	/* continuum: points "<addr>-<j>" for all servers */
+	tmpstr = g_string_sized_new(63);
+	pool->ring_size = count * KETAMA_DIGESTS_PER_SERVER * 4;
+	pool->ring = g_slice_alloc(sizeof(ketama_point) * pool->ring_size);
+
+	for (i = 0, k = 0; i < count; i++) {
+		for (j = 0; j < KETAMA_DIGESTS_PER_SERVER; j++) {
+			guint8 digest[16];
+			guint d;
+
+			li_sockaddr_to_string(addrs[i], tmpstr, TRUE);
+			g_string_append_printf(tmpstr, "-%u", j);
+			ketama_digest(GSTR_LEN(tmpstr), digest);
+
+			for (d = 0; d < 4; d++, k++) {
+				pool->ring[k].point = ketama_digest_point(digest, d);
+				pool->ring[k].node = i;
+			}
 		}
-		return NULL;
 	}
 
-	req = g_slice_new0(int_request);
-	req->req.callback = callback;
-	req->req.cb_data = cb_data;
+	qsort(pool->ring, pool->ring_size, sizeof(ketama_point), ketama_point_cmp);
 
-	req->type = REQ_SET;
-	req->key = g_string_new_len(GSTR_LEN(key));
-	req->flags = flags;
-	req->ttl = ttl;
-	if (NULL != data) {
-		li_buffer_acquire(data);
-		req->data = data;
+	g_string_free(tmpstr, TRUE);
+
+	return pool;
+}
+
+/* thread-safe, as long as no one else is using the pool anymore */
+void li_memcached_pool_free(liMemcachedPool *pool) {
+	guint i;
+
+	if (!pool) return;
+
+	for (i = 0; i < pool->nodes_count; i++) {
+		if (NULL != pool->nodes[i].con) pool->nodes[i].con->connect_failed_cb = NULL;
+		li_memcached_con_release(pool->nodes[i].con);
+		li_sockaddr_clear(&pool->nodes[i].addr);
 	}
+	g_slice_free1(sizeof(pool_node) * pool->nodes_count, pool->nodes);
 
-	if (!push_request(con, req, err)) {
-		free_request(con, req);
+	if (pool->ring) g_slice_free1(sizeof(ketama_point) * pool->ring_size, pool->ring);
+
+	g_slice_free(liMemcachedPool, pool);
+}
+
+/* first live node on the continuum at or after the hash of key */
+static pool_node* pool_lookup(liMemcachedPool *pool, GString *key) {
+	ev_tstamp now = ev_now(pool->loop);
+	guint8 digest[16];
+	guint32 h;
+	guint lo, hi, i;
+
+	if (NULL == pool->ring) {
+		pool_node *node = &pool->nodes[0];
+		return (node->dead_until > now) ? NULL : node;
+	}
+
+	ketama_digest(GSTR_LEN(key), digest);
+	h = ketama_digest_point(digest, 0);
+
+	lo = 0; hi = pool->ring_size;
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+		if (pool->ring[mid].point < h) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	for (i = 0; i < pool->ring_size; i++) {
+		pool_node *node = &pool->nodes[pool->ring[(lo + i) % pool->ring_size].node];
+		if (node->dead_until <= now) return node;
+	}
+
+	return NULL;
+}
+
+gint li_memcached_pool_lookup(liMemcachedPool *pool, GString *key) {
+	pool_node *node = pool_lookup(pool, key);
+
+	return (NULL == node) ? -1 : (gint) (node - pool->nodes);
+}
+
+/* eject dead server, the keys move to the next server on the continuum */
+static void pool_node_eject(pool_node *node) {
+	node->dead_until = ev_now(node->pool->loop) + node->pool->retry_timeout;
+}
+
+static void pool_node_connect_failed_cb(liMemcachedCon *con, gpointer data) {
+	UNUSED(con);
+
+	pool_node_eject(data);
+}
+
+static liMemcachedCon* pool_node_con(liMemcachedPool *pool, pool_node *node) {
+	if (NULL == node->con) {
+		/* don't use li_memcached_con_new: it connects right away, and a failure must eject the node */
+		liMemcachedCon *con = memcached_con_new(pool->loop, node->addr, pool->protocol);
+		con->connect_failed_cb = pool_node_connect_failed_cb;
+		con->connect_failed_data = node;
+		node->con = con;
+		memcached_connect(con);
+	}
+	return node->con;
+}
+
+/* no socket (not even connecting) and the last attempt failed */
+static gboolean pool_node_failed(pool_node *node) {
+	liMemcachedCon *con = node->con;
+	return -1 == con->fd && -1 == con->con_watcher.fd && NULL != con->err;
+}
+
+static liMemcachedRequest* pool_request(liMemcachedPool *pool, req_type type, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, guint64 cas, guint64 delta, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	guint i;
+
+	if (!li_memcached_is_key_valid(key)) {
+		g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_BAD_KEY, "Invalid key: '%s'", key->str);
 		return NULL;
 	}
 
-	return &req->req;
+	for (i = 0; i < pool->nodes_count; i++) {
+		liMemcachedRequest *req;
+		liMemcachedCon *con;
+		GError *node_err = NULL;
+		pool_node *node = pool_lookup(pool, key);
+
+		if (NULL == node) break;
+
+		con = pool_node_con(pool, node);
+
+		switch (type) {
+		case REQ_GET:
+			req = li_memcached_get(con, key, callback, cb_data, &node_err);
+			break;
+		case REQ_SET:
+		case REQ_ADD:
+			req = con_store(con, type, key, flags, ttl, data, cas, callback, cb_data, &node_err);
+			break;
+		case REQ_INCR:
+		case REQ_DECR:
+		default:
+			req = con_arith(con, type, key, delta, callback, cb_data, &node_err);
+			break;
+		}
+
+		if (NULL != req || !pool_node_failed(node)) {
+			if (NULL != node_err) g_propagate_error(err, node_err);
+			return req;
+		}
+
+		/* e.g. still within the reconnect limit after a failed connect */
+		g_clear_error(&node_err);
+		pool_node_eject(node);
+	}
+
+	g_set_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_DISABLED, "No memcached server available");
+	return NULL;
+}
+
+liMemcachedRequest* li_memcached_pool_get(liMemcachedPool *pool, GString *key, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	return pool_request(pool, REQ_GET, key, 0, 0, NULL, 0, 0, callback, cb_data, err);
+}
+
+liMemcachedRequest* li_memcached_pool_set(liMemcachedPool *pool, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	return pool_request(pool, REQ_SET, key, flags, ttl, data, 0, 0, callback, cb_data, err);
+}
+
+liMemcachedRequest* li_memcached_pool_cas(liMemcachedPool *pool, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, guint64 cas, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	return pool_request(pool, REQ_SET, key, flags, ttl, data, cas, 0, callback, cb_data, err);
+}
+
+liMemcachedRequest* li_memcached_pool_add(liMemcachedPool *pool, GString *key, guint32 flags, ev_tstamp ttl, liBuffer *data, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	return pool_request(pool, REQ_ADD, key, flags, ttl, data, 0, 0, callback, cb_data, err);
+}
+
+liMemcachedRequest* li_memcached_pool_incr(liMemcachedPool *pool, GString *key, guint64 delta, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	return pool_request(pool, REQ_INCR, key, 0, 0, NULL, 0, delta, callback, cb_data, err);
+}
+
+liMemcachedRequest* li_memcached_pool_decr(liMemcachedPool *pool, GString *key, guint64 delta, liMemcachedCB callback, gpointer cb_data, GError **err) {
+	return pool_request(pool, REQ_DECR, key, 0, 0, NULL, 0, delta, callback, cb_data, err);
 }
 
 /* if length(key) <= 250 and all chars x: 0x20 < x < 0x7f the key
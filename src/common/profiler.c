@@ -3,6 +3,10 @@
  * lighty memory profiler
  * prints a backtrace for every object not free()d at exit()
  *
+ * in sampling mode only about one allocation per sample interval is tracked
+ * (weighted with the interval), which is cheap enough for a live server;
+ * the dump then lists the estimated live bytes per allocating callsite.
+ *
  */
 
 
@@ -23,11 +27,28 @@
 #define PROFILER_HASHTABLE_SIZE 65521
 #define PROFILER_STACKFRAMES 36
 
+#define PROFILER_CALLSITES_SIZE 4093
+#define PROFILER_SAMPLE_STACKFRAMES 16
+#define PROFILER_FILTER_SIZE 65536
+#define PROFILER_FILTER_NDX(hash) (((hash) >> 16) & (PROFILER_FILTER_SIZE - 1))
+
+typedef struct profiler_callsite profiler_callsite;
+struct profiler_callsite {
+	guint hash;
+	gsize live_bytes; /* estimated */
+	guint live_blocks; /* sampled blocks */
+	guint64 samples; /* all samples taken here, including freed blocks */
+	profiler_callsite *next;
+	void *stackframes[PROFILER_SAMPLE_STACKFRAMES];
+	gint stackframes_num;
+};
+
 typedef struct profiler_block profiler_block;
 struct profiler_block {
 	gpointer addr;
-	gsize size;
+	gsize size; /* in sampling mode the weight of the sample */
 	profiler_block *next;
+	profiler_callsite *callsite; /* sampling mode only */
 	void *stackframes[PROFILER_STACKFRAMES];
 	gint stackframes_num;
 };
@@ -51,6 +72,14 @@ static profiler_block **profiler_hashtable = NULL;
 static gint profiler_output_fd = 0;
 static gpointer profiler_heap_base = NULL;
 
+/* sampling mode; an interval of 0 tracks every block */
+static guint profiler_sample_interval = 0;
+static gint profiler_sample_bytes = 0;
+static profiler_callsite **profiler_callsites = NULL;
+static guint profiler_callsites_num = 0;
+/* number of sampled blocks per hash slot, so free() only takes the lock for blocks which might be sampled */
+static gint profiler_sample_filter[PROFILER_FILTER_SIZE];
+
 gboolean li_profiler_enabled = FALSE;
 
 
@@ -72,6 +101,7 @@ static profiler_block *profiler_block_new() {
 	block->addr = NULL;
 	block->size = 0;
 	block->next = NULL;
+	block->callsite = NULL;
 	block->stackframes_num = 0;
 
 	return block;
@@ -168,6 +198,112 @@ static void profiler_free(gpointer mem) {
 	free(mem);
 }
 
+static guint profiler_callsite_hash(void **stackframes, gint stackframes_num) {
+	guint hash = 0;
+	gint i;
+
+	for (i = 0; i < stackframes_num; i++) {
+		hash = (hash * 31) ^ profiler_hash(stackframes[i]);
+	}
+
+	return hash;
+}
+
+/* profiler_mutex must be locked */
+static profiler_callsite *profiler_callsite_get(void **stackframes, gint stackframes_num) {
+	profiler_callsite *callsite;
+	guint hash = profiler_callsite_hash(stackframes, stackframes_num);
+
+	for (callsite = profiler_callsites[hash % PROFILER_CALLSITES_SIZE]; callsite != NULL; callsite = callsite->next) {
+		if (callsite->hash == hash && callsite->stackframes_num == stackframes_num
+			&& 0 == memcmp(callsite->stackframes, stackframes, stackframes_num * sizeof(void*)))
+			return callsite;
+	}
+
+	callsite = calloc(1, sizeof(profiler_callsite));
+	assert(callsite);
+	callsite->hash = hash;
+	memcpy(callsite->stackframes, stackframes, stackframes_num * sizeof(void*));
+	callsite->stackframes_num = stackframes_num;
+
+	callsite->next = profiler_callsites[hash % PROFILER_CALLSITES_SIZE];
+	profiler_callsites[hash % PROFILER_CALLSITES_SIZE] = callsite;
+	profiler_callsites_num++;
+
+	return callsite;
+}
+
+static void profiler_sample_insert(const gpointer addr, gsize size) {
+	profiler_block *block;
+	profiler_callsite *callsite;
+	void *stackframes[PROFILER_SAMPLE_STACKFRAMES];
+	gint stackframes_num = 0;
+	gsize weight;
+	guint hash;
+
+	if (size < profiler_sample_interval) {
+		/* sample the allocation which crosses the next multiple of the interval; it stands for interval bytes */
+		guint before = (guint) g_atomic_int_exchange_and_add(&profiler_sample_bytes, (gint) size);
+
+		if ((before & (profiler_sample_interval - 1)) + size < profiler_sample_interval)
+			return;
+
+		weight = profiler_sample_interval;
+	} else {
+		/* big blocks are always sampled */
+		weight = size;
+	}
+
+#ifdef HAVE_EXECINFO_H
+	stackframes_num = backtrace(stackframes, PROFILER_SAMPLE_STACKFRAMES);
+#endif
+
+	hash = profiler_hash(addr);
+
+	g_static_mutex_lock(&profiler_mutex);
+
+	callsite = profiler_callsite_get(stackframes, stackframes_num);
+	callsite->live_bytes += weight;
+	callsite->live_blocks++;
+	callsite->samples++;
+
+	block = profiler_block_new();
+	block->addr = addr;
+	block->size = weight;
+	block->callsite = callsite;
+
+	block->next = profiler_hashtable[hash % PROFILER_HASHTABLE_SIZE];
+	profiler_hashtable[hash % PROFILER_HASHTABLE_SIZE] = block;
+
+	g_atomic_int_inc(&profiler_sample_filter[PROFILER_FILTER_NDX(hash)]);
+
+	g_static_mutex_unlock(&profiler_mutex);
+}
+
+static void profiler_sample_remove(const gpointer addr) {
+	profiler_block *block, **link;
+	guint hash = profiler_hash(addr);
+
+	/* most blocks aren't sampled */
+	if (0 == g_atomic_int_get(&profiler_sample_filter[PROFILER_FILTER_NDX(hash)]))
+		return;
+
+	g_static_mutex_lock(&profiler_mutex);
+
+	for (link = &profiler_hashtable[hash % PROFILER_HASHTABLE_SIZE]; NULL != (block = *link); link = &block->next) {
+		if (block->addr == addr) {
+			*link = block->next;
+			block->callsite->live_bytes -= block->size;
+			block->callsite->live_blocks--;
+			g_atomic_int_add(&profiler_sample_filter[PROFILER_FILTER_NDX(hash)], -1);
+			profiler_block_free(block);
+			break;
+		}
+	}
+
+	g_static_mutex_unlock(&profiler_mutex);
+}
+
 static void profiler_write(gchar *str, gint len) {
 	gint res;
 	gint written = 0;
@@ -245,6 +381,88 @@ static void profiler_dump_frame(guint level, profiler_stackframe *frame, gsize m
 }
 #endif
 
+static int profiler_callsite_cmp(const void *a, const void *b) {
+	const profiler_callsite *ca = *(profiler_callsite* const*) a, *cb = *(profiler_callsite* const*) b;
+
+	if (ca->live_bytes == cb->live_bytes)
+		return 0;
+
+	return (ca->live_bytes > cb->live_bytes) ? -1 : 1;
+}
+
+static void profiler_dump_callsites(gsize minsize) {
+	profiler_callsite **list, *callsite;
+	gchar **symbols;
+	gchar str[1024];
+	guint i, n = 0;
+	gint j, len;
+	gsize total_size = 0;
+	guint total_blocks = 0;
+
+	g_static_mutex_lock(&profiler_mutex);
+
+	len = sprintf(str, "--------------- memory profiler dump @ %ju (sampling every %u bytes) ---------------\n",
+		(uintmax_t) time(NULL), profiler_sample_interval);
+	profiler_write(str, len);
+
+	list = malloc(sizeof(profiler_callsite*) * (profiler_callsites_num + 1));
+	assert(list);
+
+	for (i = 0; i < PROFILER_CALLSITES_SIZE; i++) {
+		for (callsite = profiler_callsites[i]; callsite != NULL; callsite = callsite->next) {
+			total_size += callsite->live_bytes;
+			total_blocks += callsite->live_blocks;
+
+			if (callsite->live_blocks > 0 && callsite->live_bytes >= minsize)
+				list[n++] = callsite;
+		}
+	}
+
+	qsort(list, n, sizeof(profiler_callsite*), profiler_callsite_cmp);
+
+	for (i = 0; i < n; i++) {
+		callsite = list[i];
+
+		len = sprintf(str, "%"G_GSIZE_FORMAT" kilobytes live in %u sampled blocks (%"G_GUINT64_FORMAT" samples total)\n",
+			callsite->live_bytes / 1024, callsite->live_blocks, callsite->samples);
+		profiler_write(str, len);
+
+#ifdef HAVE_EXECINFO_H
+		symbols = backtrace_symbols(callsite->stackframes, callsite->stackframes_num);
+
+		for (j = 0; j < callsite->stackframes_num; j++) {
+			len = snprintf(str, sizeof(str), "    @ %p %s\n", callsite->stackframes[j], symbols ? symbols[j] : "");
+			if (len >= (gint) sizeof(str)) len = sizeof(str) - 1;
+			profiler_write(str, len);
+		}
+
+		free(symbols);
+#else
+		UNUSED(symbols); UNUSED(j);
+#endif
+	}
+
+	free(list);
+
+	len = sprintf(str,
+		"--------------- memory profiler summary ---------------\n"
+		"callsites:    %u\n"
+		"sampled blocks: %u\n"
+		"estimated live size: %"G_GSIZE_FORMAT" kilobytes\n"
+		"heap base / break / size: %p / %p / %"G_GSIZE_FORMAT"\n",
+		profiler_callsites_num,
+		total_blocks,
+		total_size / 1024,
+		profiler_heap_base, sbrk(0), (guintptr)sbrk(0) - (guintptr)profiler_heap_base
+	);
+	profiler_write(str, len);
+
+	len = sprintf(str, "--------------- memory profiler dump end ---------------\n");
+	profiler_write(str, len);
+
+	g_static_mutex_unlock(&profiler_mutex);
+}
+
 /* public functions */
 void li_profiler_enable(gchar *output_path) {
 	GMemVTable t;
@@ -270,6 +488,8 @@ void li_profiler_enable(gchar *output_path) {
 
 	block_free_list = profiler_block_new();
 	profiler_hashtable = calloc(sizeof(profiler_block), PROFILER_HASHTABLE_SIZE);
+	if (profiler_sample_interval)
+		profiler_callsites = calloc(sizeof(profiler_callsite*), PROFILER_CALLSITES_SIZE);
 
 	t.malloc = profiler_malloc;
 	t.realloc = profiler_realloc;
@@ -284,6 +504,18 @@ void li_profiler_enable(gchar *output_path) {
 	li_profiler_enabled = TRUE;
 }
 
+void li_profiler_enable_sampling(gchar *output_path, guint interval_kb) {
+	guint interval = 1024;
+
+	/* power of two, so the sampling check is a mask */
+	interval_kb = MIN(interval_kb, 1024*1024);
+	while (interval < interval_kb * 1024) interval <<= 1;
+
+	profiler_sample_interval = interval;
+
+	li_profiler_enable(output_path);
+}
+
 void li_profiler_finish() {
 	guint i;
 	profiler_block *block, *block_tmp;
@@ -303,6 +535,20 @@ void li_profiler_finish() {
 	}
 
 	free(profiler_hashtable);
+
+	if (profiler_callsites) {
+		profiler_callsite *callsite, *callsite_tmp;
+
+		for (i = 0; i < PROFILER_CALLSITES_SIZE; i++) {
+			for (callsite = profiler_callsites[i]; callsite != NULL;) {
+				callsite_tmp = callsite->next;
+				free(callsite);
+				callsite = callsite_tmp;
+			}
+		}
+
+		free(profiler_callsites);
+	}
 }
 
 
@@ -315,7 +561,14 @@ void li_profiler_dump(gint minsize) {
 	gchar str[1024];
 	gsize total_size = 0;
 	guint total_blocks = 0;
-	profiler_stackframe *tree = calloc(1, sizeof(profiler_stackframe));
+	profiler_stackframe *tree;
+
+	if (profiler_sample_interval) {
+		profiler_dump_callsites(MAX(minsize, 0));
+		return;
+	}
+
+	tree = calloc(1, sizeof(profiler_stackframe));
 
 	g_static_mutex_lock(&profiler_mutex);
 
@@ -394,6 +647,11 @@ void li_profiler_hashtable_insert(const gpointer addr, gsize size) {
 	profiler_block *block;
 	guint hash;
 
+	if (profiler_sample_interval) {
+		profiler_sample_insert(addr, size);
+		return;
+	}
+
 	g_static_mutex_lock(&profiler_mutex);
 
 	hash = profiler_hash(addr);
@@ -415,6 +673,11 @@ void li_profiler_hashtable_remove(const gpointer addr) {
 	profiler_block *block, *block_prev;
 	guint hash;
 
+	if (profiler_sample_interval) {
+		profiler_sample_remove(addr);
+		return;
+	}
+
 	g_static_mutex_lock(&profiler_mutex);
 
 	hash = profiler_hash(addr);
@@ -0,0 +1,194 @@
+
+#include <lighttpd/stats_shm.h>
+
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* a reader gives up after that many tries */
+#define STATS_SHM_READ_TRIES 1000
+
+GQuark li_stats_shm_error_quark(void) {
+	return g_quark_from_static_string("stats-shm-error-quark");
+}
+
+liStatsShm* li_stats_shm_create(const gchar *path, guint worker_count, GError **err) {
+	liStatsShm *shm;
+	liStatsShmHeader *header;
+	gsize size = sizeof(liStatsShmHeader) + worker_count * sizeof(liStatsShmWorker);
+	gchar *tmppath;
+	struct stat st;
+	gpointer map;
+	guint i;
+	int fd;
+
+	/* fill a new file and rename it into place: readers never see it half initialized, and an instance
+	 * still running (graceful restart) keeps its own file mapped and doesn't lose it */
+	tmppath = g_strdup_printf("%s.XXXXXX", path);
+	if (-1 == (fd = g_mkstemp(tmppath))) {
+		g_set_error(err, LI_STATS_SHM_ERROR, 0, "couldn't create '%s': %s", tmppath, g_strerror(errno));
+		g_free(tmppath);
+		return NULL;
+	}
+
+	if (-1 == fchmod(fd, 0644) || -1 == ftruncate(fd, size) || -1 == fstat(fd, &st)) {
+		g_set_error(err, LI_STATS_SHM_ERROR, 0, "couldn't resize '%s': %s", tmppath, g_strerror(errno));
+		close(fd);
+		unlink(tmppath);
+		g_free(tmppath);
+		return NULL;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (MAP_FAILED == map) {
+		g_set_error(err, LI_STATS_SHM_ERROR, 0, "couldn't mmap '%s': %s", tmppath, g_strerror(errno));
+		unlink(tmppath);
+		g_free(tmppath);
+		return NULL;
+	}
+
+	memset(map, 0, size);
+
+	header = map;
+	header->version = LI_STATS_SHM_VERSION;
+	header->header_size = sizeof(liStatsShmHeader);
+	header->worker_size = sizeof(liStatsShmWorker);
+	header->worker_count = worker_count;
+	header->histogram_buckets = LI_HISTOGRAM_BUCKETS;
+	header->pid = getpid();
+	header->started = time(NULL);
+
+	shm = g_slice_new0(liStatsShm);
+	shm->path = g_strdup(path);
+	shm->writable = TRUE;
+	shm->dev = st.st_dev;
+	shm->ino = st.st_ino;
+	shm->map = map;
+	shm->size = size;
+	shm->header = header;
+
+	for (i = 0; i < worker_count; i++) {
+		li_stats_shm_worker(shm, i)->ndx = i;
+	}
+
+	header->magic = LI_STATS_SHM_MAGIC;
+
+	if (-1 == rename(tmppath, path)) {
+		g_set_error(err, LI_STATS_SHM_ERROR, 0, "couldn't rename '%s' to '%s': %s", tmppath, path, g_strerror(errno));
+		unlink(tmppath);
+		g_free(tmppath);
+		shm->writable = FALSE;
+		li_stats_shm_free(shm);
+		return NULL;
+	}
+	g_free(tmppath);
+
+	return shm;
+}
+
+liStatsShm* li_stats_shm_open(const gchar *path, GError **err) {
+	liStatsShm *shm;
+	liStatsShmHeader *header;
+	struct stat st;
+	gpointer map;
+	int fd;
+
+	if (-1 == (fd = open(path, O_RDONLY))) {
+		g_set_error(err, LI_STATS_SHM_ERROR, 0, "couldn't open '%s': %s", path, g_strerror(errno));
+		return NULL;
+	}
+
+	if (-1 == fstat(fd, &st)) {
+		g_set_error(err, LI_STATS_SHM_ERROR, 0, "couldn't stat '%s': %s", path, g_strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	if ((gsize) st.st_size < sizeof(liStatsShmHeader)) {
+		g_set_error(err, LI_STATS_SHM_ERROR, 0, "'%s' is too small", path);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (MAP_FAILED == map) {
+		g_set_error(err, LI_STATS_SHM_ERROR, 0, "couldn't mmap '%s': %s", path, g_strerror(errno));
+		return NULL;
+	}
+
+	header = map;
+	if (LI_STATS_SHM_MAGIC != header->magic
+		|| LI_STATS_SHM_VERSION != header->version
+		|| LI_HISTOGRAM_BUCKETS != header->histogram_buckets
+		|| sizeof(liStatsShmWorker) != header->worker_size
+		|| header->header_size < sizeof(liStatsShmHeader)
+		|| (gsize) st.st_size < header->header_size + (gsize) header->worker_count * header->worker_size) {
+		g_set_error(err, LI_STATS_SHM_ERROR, 0, "'%s' is not a (compatible) statistics file", path);
+		munmap(map, st.st_size);
+		return NULL;
+	}
+
+	shm = g_slice_new0(liStatsShm);
+	shm->path = g_strdup(path);
+	shm->writable = FALSE;
+	shm->map = map;
+	shm->size = st.st_size;
+	shm->header = header;
+
+	return shm;
+}
+
+void li_stats_shm_free(liStatsShm *shm) {
+	if (!shm) return;
+
+	/* only remove the file if it wasn't replaced by a new instance in the meantime */
+	if (shm->writable) {
+		struct stat st;
+
+		if (0 == stat(shm->path, &st) && st.st_dev == shm->dev && st.st_ino == shm->ino) {
+			unlink(shm->path);
+		}
+	}
+
+	munmap(shm->map, shm->size);
+	g_free(shm->path);
+	g_slice_free(liStatsShm, shm);
+}
+
+liStatsShmWorker* li_stats_shm_worker(liStatsShm *shm, guint ndx) {
+	if (ndx >= shm->header->worker_count) return NULL;
+
+	return (liStatsShmWorker*) ((gchar*) shm->map + shm->header->header_size + (gsize) ndx * shm->header->worker_size);
+}
+
+void li_stats_shm_write_begin(liStatsShmWorker *slot) {
+	g_atomic_int_inc(&slot->seq);
+}
+
+void li_stats_shm_write_end(liStatsShmWorker *slot) {
+	g_atomic_int_inc(&slot->seq);
+}
+
+gboolean li_stats_shm_read(liStatsShmWorker *slot, liStatsShmWorker *dest) {
+	guint i;
+
+	for (i = 0; i < STATS_SHM_READ_TRIES; i++) {
+		gint seq = g_atomic_int_get(&slot->seq);
+
+		if (seq & 1) {
+			g_thread_yield();
+			continue;
+		}
+
+		memcpy(dest, slot, sizeof(*dest));
+
+		if (seq == g_atomic_int_get(&slot->seq)) return TRUE;
+	}
+
+	return FALSE;
+}
@@ -0,0 +1,140 @@
+
+#include <lighttpd/timerwheel.h>
+
+#define TW_MASK (LI_TIMERWHEEL_SLOTS - 1)
+/* keep some room so a cut element never lands in the slot currently processed on the top level */
+#define TW_MAX_TICKS ((G_GUINT64_CONSTANT(1) << (LI_TIMERWHEEL_BITS * LI_TIMERWHEEL_LEVELS)) - (G_GUINT64_CONSTANT(1) << (LI_TIMERWHEEL_BITS * (LI_TIMERWHEEL_LEVELS - 1))))
+
+static guint64 tw_now(liTimerWheel *tw) {
+	ev_tstamp diff = ev_now(tw->loop) - tw->start;
+
+	if (diff < 0) return 0;
+
+	return (guint64) (diff / tw->tick);
+}
+
+static void tw_insert(liTimerWheel *tw, liTimerWheelElem *elem) {
+	guint64 diff;
+	guint level;
+	GQueue *slot;
+
+	if (elem->expire < tw->current) elem->expire = tw->current;
+	diff = elem->expire - tw->current;
+	if (diff > TW_MAX_TICKS) {
+		elem->expire = tw->current + TW_MAX_TICKS;
+		diff = TW_MAX_TICKS;
+	}
+
+	/* use the lowest level on which the element shares all higher slot indices with the current tick;
+	 * so it never lands in a slot that was already cascaded */
+	for (level = 0; level < LI_TIMERWHEEL_LEVELS - 1; level++) {
+		if (0 == ((elem->expire ^ tw->current) >> (LI_TIMERWHEEL_BITS * (level + 1)))) break;
+	}
+
+	slot = &tw->slots[level][(elem->expire >> (LI_TIMERWHEEL_BITS * level)) & TW_MASK];
+	g_queue_push_tail_link(slot, &elem->link);
+	elem->slot = slot;
+}
+
+/* moves the elements of the current slot on the given level one level down */
+static void tw_cascade(liTimerWheel *tw, guint level) {
+	GQueue *slot = &tw->slots[level][(tw->current >> (LI_TIMERWHEEL_BITS * level)) & TW_MASK];
+	GQueue elems = *slot;
+	GList *link;
+
+	g_queue_init(slot);
+
+	while (NULL != (link = g_queue_pop_head_link(&elems))) {
+		tw_insert(tw, link->data);
+	}
+}
+
+static void tw_cb(struct ev_loop *loop, ev_timer *w, int revents) {
+	liTimerWheel *tw = w->data;
+	guint64 now = tw_now(tw);
+	UNUSED(loop); UNUSED(revents);
+
+	while (tw->current < now && tw->length > 0) {
+		GQueue *slot;
+		GList *link;
+		guint level = 1;
+
+		tw->current++;
+
+		/* entered a new slot on the higher levels? */
+		while (level < LI_TIMERWHEEL_LEVELS && 0 == (tw->current & ((G_GUINT64_CONSTANT(1) << (LI_TIMERWHEEL_BITS * level)) - 1))) level++;
+		while (--level > 0) tw_cascade(tw, level);
+
+		slot = &tw->slots[0][tw->current & TW_MASK];
+		while (NULL != (link = g_queue_pop_head_link(slot))) {
+			liTimerWheelElem *elem = link->data;
+
+			elem->slot = NULL;
+			tw->length--;
+
+			tw->callback(tw, elem, tw->data);
+		}
+	}
+
+	if (0 == tw->length) {
+		ev_timer_stop(tw->loop, &tw->timer);
+	}
+}
+
+void li_timerwheel_init(liTimerWheel *tw, struct ev_loop *loop, liTimerWheelCB callback, gdouble tick, gpointer data) {
+	guint i, j;
+
+	ev_timer_init(&tw->timer, tw_cb, tick, tick);
+	tw->timer.data = tw;
+
+	tw->loop = loop;
+	tw->tick = tick;
+	tw->start = ev_now(loop);
+	tw->current = 0;
+	tw->length = 0;
+	tw->callback = callback;
+	tw->data = data;
+
+	for (i = 0; i < LI_TIMERWHEEL_LEVELS; i++) {
+		for (j = 0; j < LI_TIMERWHEEL_SLOTS; j++) {
+			g_queue_init(&tw->slots[i][j]);
+		}
+	}
+}
+
+void li_timerwheel_stop(liTimerWheel *tw) {
+	ev_timer_stop(tw->loop, &tw->timer);
+}
+
+void li_timerwheel_add(liTimerWheel *tw, liTimerWheelElem *elem, gdouble delay) {
+	guint64 ticks, now;
+
+	li_timerwheel_remove(tw, elem);
+
+	now = tw_now(tw);
+	/* the wheel doesn't tick while empty */
+	if (0 == tw->length) tw->current = now;
+
+	ticks = (delay > 0) ? (guint64) (delay / tw->tick + 0.999) : 1;
+	if (ticks < 1) ticks = 1;
+
+	elem->link.data = elem;
+	elem->expire = now + ticks;
+	tw_insert(tw, elem);
+	tw->length++;
+
+	if (G_UNLIKELY(!ev_is_active(&tw->timer)))
+		ev_timer_start(tw->loop, &tw->timer);
+}
+
+void li_timerwheel_remove(liTimerWheel *tw, liTimerWheelElem *elem) {
+	if (!elem->slot)
+		return;
+
+	g_queue_unlink(elem->slot, &elem->link);
+	elem->slot = NULL;
+	tw->length--;
+
+	if (G_UNLIKELY(0 == tw->length))
+		ev_timer_stop(tw->loop, &tw->timer);
+}
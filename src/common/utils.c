@@ -807,6 +807,27 @@ void li_string_append_int(GString *dest, gint64 v) {
 	dest->len = len;
 }
 
+gboolean li_cookie_find(const gchar *cookies, gsize len, const gchar *name, gsize name_len, const gchar **value, gsize *value_len) {
+	const gchar *c = cookies, *end = cookies + len;
+
+	while (c < end) {
+		const gchar *pair, *eq;
+
+		while (c < end && (*c == ' ' || *c == ';' || *c == ',')) c++;
+		pair = c;
+		while (c < end && *c != ';' && *c != ',') c++;
+
+		eq = memchr(pair, '=', c - pair);
+		if (eq && (gsize) (eq - pair) == name_len && 0 == memcmp(pair, name, name_len)) {
+			*value = eq + 1;
+			*value_len = c - eq - 1;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
 /* http://womble.decadentplace.org.uk/readdir_r-advisory.html */
 gsize li_dirent_buf_size(DIR * dirp) {
 	glong name_max;
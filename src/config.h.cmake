@@ -97,6 +97,12 @@
 /* ZLIB */
 #cmakedefine  HAVE_ZLIB
 
+/* Brotli */
+#cmakedefine  HAVE_BROTLI
+
+/* Zstandard */
+#cmakedefine  HAVE_ZSTD
+
 /* GLIB */
 #cmakedefine  HAVE_GLIB_H
 #cmakedefine  HAVE_GLIB
@@ -58,6 +58,7 @@ liAction *li_action_new_setting(liOptionSet setting) {
 	liAction *a = g_slice_new(liAction);
 
 	a->refcount = 1;
+	a->time_ndx = 0;
 	a->type = LI_ACTION_TSETTING;
 	a->data.setting = setting;
 
@@ -68,6 +69,7 @@ liAction *li_action_new_settingptr(liOptionPtrSet setting) {
 	liAction *a = g_slice_new(liAction);
 
 	a->refcount = 1;
+	a->time_ndx = 0;
 	a->type = LI_ACTION_TSETTINGPTR;
 	a->data.settingptr = setting;
 
@@ -79,6 +81,7 @@ liAction *li_action_new_function(liActionFuncCB func, liActionCleanupCB fcleanup
 
 	a = g_slice_new(liAction);
 	a->refcount = 1;
+	a->time_ndx = 0;
 	a->type = LI_ACTION_TFUNCTION;
 	a->data.function.func = func;
 	a->data.function.cleanup = fcleanup;
@@ -93,6 +96,7 @@ liAction *li_action_new_list() {
 
 	a = g_slice_new(liAction);
 	a->refcount = 1;
+	a->time_ndx = 0;
 	a->type = LI_ACTION_TLIST;
 	a->data.list = g_array_new(FALSE, TRUE, sizeof(liAction *));
 
@@ -104,6 +108,7 @@ liAction *li_action_new_condition(liCondition *cond, liAction *target, liAction
 
 	a = g_slice_new(liAction);
 	a->refcount = 1;
+	a->time_ndx = 0;
 	a->type = LI_ACTION_TCONDITION;
 	a->data.condition.cond = cond;
 	a->data.condition.target = target;
@@ -117,6 +122,7 @@ liAction *li_action_new_balancer(liBackendSelectCB bselect, liBackendFallbackCB
 
 	a = g_slice_new(liAction);
 	a->refcount = 1;
+	a->time_ndx = 0;
 	a->type = LI_ACTION_TBALANCER;
 	a->data.balancer.select = bselect;
 	a->data.balancer.fallback = bfallback;
@@ -252,13 +258,44 @@ static void action_stack_pop(liServer *srv, liVRequest *vr, liActionStack *as) {
 	g_array_set_size(as->stack, as->stack->len - 1);
 }
 
+/* returns the start timestamp if this execution should be timed, 0 otherwise */
+static ev_tstamp action_time_start(liWorker *wrk, guint time_ndx) {
+	if (0 == time_ndx) return 0;
+
+	if (wrk->action_time_countdown > 1) {
+		wrk->action_time_countdown--;
+		return 0;
+	}
+
+	/* random interval with mean LI_ACTION_TIME_SAMPLE, so actions at a fixed position in every request aren't always skipped */
+	wrk->action_time_seed = wrk->action_time_seed * 1103515245 + 12345;
+	wrk->action_time_countdown = 1 + (wrk->action_time_seed >> 16) % (2 * LI_ACTION_TIME_SAMPLE - 1);
+
+	return ev_time();
+}
+
+static void action_time_end(liWorker *wrk, guint time_ndx, ev_tstamp start) {
+	liActionTime *t;
+	ev_tstamp now = ev_time();
+	guint64 usec = (now > start) ? (guint64) ((now - start) * 1000000) : 0;
+
+	if (time_ndx > wrk->action_times->len)
+		g_array_set_size(wrk->action_times, time_ndx);
+
+	t = &g_array_index(wrk->action_times, liActionTime, time_ndx - 1);
+	t->samples++;
+	t->usec += usec;
+	if (usec > t->usec_max) t->usec_max = usec;
+}
+
 liHandlerResult li_action_execute(liVRequest *vr) {
 	liAction *a;
 	liActionStack *as = &vr->action_stack;
 	action_stack_element *ase;
-	guint ase_ndx;
+	guint ase_ndx, time_ndx;
 	liHandlerResult res;
 	gboolean condres;
+	ev_tstamp ts;
 	liServer *srv = vr->wrk->srv;
 
 	while (NULL != (ase = action_stack_top(as))) {
@@ -326,7 +363,10 @@ liHandlerResult li_action_execute(liVRequest *vr) {
 			action_stack_pop(srv, vr, as);
 			break;
 		case LI_ACTION_TFUNCTION:
+			time_ndx = a->time_ndx;
+			ts = action_time_start(vr->wrk, time_ndx);
 			res = a->data.function.func(vr, a->data.function.param, &ase->data.context);
+			if (ts > 0) action_time_end(vr->wrk, time_ndx, ts);
 			ase = &g_array_index(as->stack, action_stack_element, ase_ndx);
 
 			switch (res) {
@@ -377,7 +417,10 @@ liHandlerResult li_action_execute(liVRequest *vr) {
 				ase->finished = TRUE;
 				break;
 			}
+			time_ndx = a->time_ndx;
+			ts = action_time_start(vr->wrk, time_ndx);
 			res = a->data.balancer.select(vr, ase->backlog_provided, a->data.balancer.param, &ase->data.context);
+			if (ts > 0) action_time_end(vr->wrk, time_ndx, ts);
 			ase = &g_array_index(as->stack, action_stack_element, ase_ndx);
 			switch (res) {
 			case LI_HANDLER_GO_ON:
@@ -160,6 +160,8 @@ int li_lua_config_handle_server_action(liServer *srv, liWorker *wrk, lua_State *
 		lua_error(L);
 	}
 
+	if (0 == a->time_ndx) a->time_ndx = sa->time_ndx;
+
 	return li_lua_push_action(srv, L, a);
 }
 
@@ -1,6 +1,7 @@
 
 #include <lighttpd/base.h>
 #include <lighttpd/plugin_core.h>
+#include <lighttpd/lighttpd-glue.h>
 
 static void li_connection_reset_keep_alive(liConnection *con);
 static G_GNUC_WARN_UNUSED_RESULT gboolean li_connection_internal_error(liConnection *con);
@@ -51,6 +52,13 @@ static void parse_request_body(liConnection *con) {
 	}
 }
 
+/* microseconds since the current request was started */
+static guint64 connection_request_time(liConnection *con) {
+	ev_tstamp diff = CUR_TS(con->wrk) - con->mainvr->ts_started;
+
+	return (diff > 0) ? (guint64) (diff * 1000000) : 0;
+}
+
 static G_GNUC_WARN_UNUSED_RESULT gboolean forward_response_body(liConnection *con) {
 	liVRequest *vr = con->mainvr;
 	if (con->state >= LI_CON_STATE_HANDLE_MAINVR) {
@@ -63,6 +71,8 @@ static G_GNUC_WARN_UNUSED_RESULT gboolean forward_response_body(liConnection *co
 				con->response_headers_sent = FALSE;
 				return li_connection_internal_error(con);
 			}
+			li_histogram_record(&con->wrk->stats.ttfb, connection_request_time(con));
+			vr->trace.first_byte = CUR_TS(con->wrk);
 			li_vrequest_joblist_append(vr);
 		}
 
@@ -83,15 +93,59 @@ static G_GNUC_WARN_UNUSED_RESULT gboolean forward_response_body(liConnection *co
 	return TRUE;
 }
 
+static void connection_trace_phase(GString *dest, const gchar *name, ev_tstamp start, ev_tstamp ts) {
+	if (ts > 0)
+		g_string_append_printf(dest, " %s=%.1f", name, (ts - start) * 1000);
+	else
+		g_string_append_printf(dest, " %s=-", name);
+}
+
+/* one line for requests slower than debug.trace_slow; phases are in milliseconds since the request started */
+static void connection_trace_slow(liConnection *con) {
+	liVRequest *vr = con->mainvr;
+	GString *log_path = CORE_OPTIONPTR(LI_CORE_OPTION_DEBUG_TRACE_SLOW_LOG).string;
+	GString *line;
+	guint len;
+
+	line = g_string_sized_new(255);
+	g_string_append_printf(line, "slow request: ts=%.3f remote=%s method=%s host=%s uri=%s status=%i",
+		vr->ts_started, con->info.remote_addr_str->str,
+		li_http_method_string(vr->request.http_method, &len),
+		vr->request.uri.host->len ? vr->request.uri.host->str : "-",
+		vr->request.uri.raw_orig_path->len ? vr->request.uri.raw_orig_path->str : "-",
+		vr->response.http_status);
+	connection_trace_phase(line, "headers_parsed", vr->ts_started, vr->trace.headers_parsed);
+	connection_trace_phase(line, "actions_done", vr->ts_started, vr->trace.actions_done);
+	connection_trace_phase(line, "backend", vr->ts_started, vr->trace.backend);
+	connection_trace_phase(line, "first_byte", vr->ts_started, vr->trace.first_byte);
+	connection_trace_phase(line, "last_byte", vr->ts_started, vr->trace.last_byte);
+
+	if (log_path && log_path->len) {
+		li_log_write_direct(con->srv, con->wrk, log_path, line);
+	} else {
+		VR_INFO(vr, "%s", line->str);
+		g_string_free(line, TRUE);
+	}
+}
+
 /* don't use con afterwards */
 static void connection_request_done(liConnection *con) {
 	liVRequest *vr = con->mainvr;
 	liServerState s;
+	gint64 trace_slow;
 
 	if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
 		VR_DEBUG(con->mainvr, "response end (keep_alive = %i)", con->info.keep_alive);
 	}
 
+	if (con->response_headers_sent)
+		li_histogram_record(&con->wrk->stats.duration, connection_request_time(con));
+
+	vr->trace.last_byte = CUR_TS(con->wrk);
+	trace_slow = CORE_OPTION(LI_CORE_OPTION_DEBUG_TRACE_SLOW).number;
+	if (trace_slow > 0 && (vr->trace.last_byte - vr->ts_started) * 1000 >= trace_slow)
+		connection_trace_slow(con);
+
 	li_plugins_handle_close(con);
 
 	s = g_atomic_int_get(&con->srv->dest_state);
@@ -0,0 +1,749 @@
+
+/* http load generator for the load test mode of tests/runtests.py (--load);
+ * with --fastcgi or --http-backend it is a minimal backend instead, serving a fixed response
+ * on the listening socket passed as stdin (stand-ins for the mod_fastcgi and mod_proxy load tests).
+ */
+
+#include <lighttpd/utils.h>
+#include <lighttpd/histogram.h>
+
+#include <signal.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define LOADGEN_BUF_SIZE (64*1024)
+#define LOADGEN_MAX_PIPELINE 64
+
+typedef enum {
+	LOADGEN_PARSE_HEADER,
+	LOADGEN_PARSE_BODY_LENGTH,
+	LOADGEN_PARSE_BODY_CLOSE, /* body ends with the connection */
+	LOADGEN_PARSE_CHUNK_SIZE,
+	LOADGEN_PARSE_CHUNK_DATA,
+	LOADGEN_PARSE_CHUNK_TRAILER
+} loadgen_parse_state;
+
+typedef struct loadgen_thread loadgen_thread;
+typedef struct loadgen_conn loadgen_conn;
+
+struct loadgen_conn {
+	loadgen_thread *thread;
+	ev_io watcher;
+	gboolean connecting;
+	guint next_request;
+
+	/* send timestamps of the requests waiting for a response */
+	ev_tstamp sent[LOADGEN_MAX_PIPELINE];
+	guint sent_first, sent_count;
+	guint requests_done; /* on this connection */
+
+	GString *out;
+	gsize out_pos;
+
+	gchar in[LOADGEN_BUF_SIZE];
+	gsize in_len;
+
+	loadgen_parse_state state;
+	goffset remaining;
+	guint status;
+	gboolean close_after;
+};
+
+struct loadgen_thread {
+	GThread *thread;
+	struct ev_loop *loop;
+	ev_timer stop_timer;
+
+	loadgen_conn *conns;
+	guint conns_num;
+
+	guint64 requests, errors, bad_status, bytes_in, connects;
+	liHistogram latency; /* in microseconds */
+};
+
+static struct {
+	struct sockaddr_in addr;
+	GPtrArray *requests; /* GString*, round robin */
+	guint pipeline;
+	gboolean keepalive;
+	gdouble duration;
+} loadgen;
+
+static void loadgen_conn_cb(struct ev_loop *loop, ev_io *w, int revents);
+
+static void loadgen_conn_close(loadgen_conn *conn) {
+	if (-1 != conn->watcher.fd) {
+		ev_io_stop(conn->thread->loop, &conn->watcher);
+		close(conn->watcher.fd);
+		ev_io_set(&conn->watcher, -1, 0);
+	}
+}
+
+static void loadgen_conn_connect(loadgen_conn *conn) {
+	int fd, one = 1;
+
+	loadgen_conn_close(conn);
+
+	conn->sent_first = conn->sent_count = 0;
+	conn->requests_done = 0;
+	g_string_truncate(conn->out, 0);
+	conn->out_pos = 0;
+	conn->in_len = 0;
+	conn->state = LOADGEN_PARSE_HEADER;
+	conn->close_after = FALSE;
+
+	if (-1 == (fd = socket(AF_INET, SOCK_STREAM, 0))) {
+		g_error("couldn't create socket: %s", g_strerror(errno));
+	}
+	li_fd_init(fd);
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	conn->thread->connects++;
+	conn->connecting = TRUE;
+
+	/* errors are reported when the socket gets writable */
+	connect(fd, (struct sockaddr*) &loadgen.addr, sizeof(loadgen.addr));
+
+	ev_io_set(&conn->watcher, fd, EV_WRITE);
+	ev_io_start(conn->thread->loop, &conn->watcher);
+}
+
+/* queues new requests up to the pipeline depth */
+static void loadgen_conn_fill(loadgen_conn *conn) {
+	ev_tstamp now = ev_time();
+
+	while (conn->sent_count < loadgen.pipeline) {
+		/* without keep-alive only one request per connection */
+		if (!loadgen.keepalive && (conn->requests_done + conn->sent_count) > 0) break;
+
+		g_string_append_len(conn->out, GSTR_LEN((GString*) g_ptr_array_index(loadgen.requests, conn->next_request)));
+		conn->next_request = (conn->next_request + 1) % loadgen.requests->len;
+
+		conn->sent[(conn->sent_first + conn->sent_count) % LOADGEN_MAX_PIPELINE] = now;
+		conn->sent_count++;
+	}
+}
+
+static void loadgen_conn_consume(loadgen_conn *conn, gsize len) {
+	conn->in_len -= len;
+	memmove(conn->in, conn->in + len, conn->in_len);
+}
+
+static gboolean loadgen_header_is(const gchar *line, gsize len, const gchar *key) {
+	gsize keylen = strlen(key);
+
+	return len > keylen && 0 == g_ascii_strncasecmp(line, key, keylen) && ':' == line[keylen];
+}
+
+static gboolean loadgen_header_contains(const gchar *line, gsize len, const gchar *token) {
+	gchar *value = g_ascii_strdown(line, len);
+	gboolean res = (NULL != strstr(value, token));
+
+	g_free(value);
+
+	return res;
+}
+
+/* returns -1 on errors, 0 if more data is needed, 1 if a response is complete */
+static gint loadgen_conn_parse(loadgen_conn *conn) {
+	for (;;) {
+		gchar *end, *line, *next;
+		gsize len;
+
+		switch (conn->state) {
+		case LOADGEN_PARSE_HEADER: {
+			gboolean chunked = FALSE, have_length = FALSE, http10;
+
+			if (NULL == (end = g_strstr_len(conn->in, conn->in_len, "\r\n\r\n"))) {
+				return (conn->in_len >= LOADGEN_BUF_SIZE) ? -1 : 0;
+			}
+
+			/* "HTTP/1.x nnn " */
+			if (end - conn->in < 12 || 0 != strncmp(conn->in, "HTTP/1.", 7)) return -1;
+			http10 = ('0' == conn->in[7]);
+			conn->status = (conn->in[9] - '0') * 100 + (conn->in[10] - '0') * 10 + (conn->in[11] - '0');
+			conn->close_after = http10;
+
+			for (line = g_strstr_len(conn->in, end + 2 - conn->in, "\r\n") + 2; line < end; line = next + 2) {
+				next = g_strstr_len(line, end + 2 - line, "\r\n");
+				len = next - line;
+
+				if (loadgen_header_is(line, len, "content-length")) {
+					have_length = TRUE;
+					conn->remaining = g_ascii_strtoll(line + sizeof("content-length:") - 1, NULL, 10);
+				} else if (loadgen_header_is(line, len, "transfer-encoding")) {
+					chunked = loadgen_header_contains(line, len, "chunked");
+				} else if (loadgen_header_is(line, len, "connection")) {
+					if (loadgen_header_contains(line, len, "close")) conn->close_after = TRUE;
+					else if (loadgen_header_contains(line, len, "keep-alive")) conn->close_after = FALSE;
+				}
+			}
+
+			loadgen_conn_consume(conn, end + 4 - conn->in);
+
+			if (chunked) {
+				conn->state = LOADGEN_PARSE_CHUNK_SIZE;
+			} else if (have_length) {
+				conn->state = LOADGEN_PARSE_BODY_LENGTH;
+			} else if (204 == conn->status || 304 == conn->status) {
+				conn->remaining = 0;
+				conn->state = LOADGEN_PARSE_BODY_LENGTH;
+			} else {
+				conn->state = LOADGEN_PARSE_BODY_CLOSE;
+				conn->close_after = TRUE;
+			}
+			break;
+		}
+		case LOADGEN_PARSE_BODY_LENGTH:
+		case LOADGEN_PARSE_CHUNK_DATA:
+			len = MIN((goffset) conn->in_len, conn->remaining);
+			loadgen_conn_consume(conn, len);
+			conn->remaining -= len;
+			if (conn->remaining > 0) return 0;
+
+			if (LOADGEN_PARSE_CHUNK_DATA == conn->state) {
+				conn->state = LOADGEN_PARSE_CHUNK_SIZE;
+				break;
+			}
+
+			conn->state = LOADGEN_PARSE_HEADER;
+			return 1;
+		case LOADGEN_PARSE_BODY_CLOSE:
+			loadgen_conn_consume(conn, conn->in_len);
+			return 0;
+		case LOADGEN_PARSE_CHUNK_SIZE:
+			if (NULL == (end = g_strstr_len(conn->in, conn->in_len, "\r\n"))) {
+				return (conn->in_len >= LOADGEN_BUF_SIZE) ? -1 : 0;
+			}
+
+			conn->remaining = g_ascii_strtoll(conn->in, NULL, 16);
+			loadgen_conn_consume(conn, end + 2 - conn->in);
+
+			if (conn->remaining < 0) return -1;
+
+			if (0 == conn->remaining) {
+				conn->state = LOADGEN_PARSE_CHUNK_TRAILER;
+			} else {
+				conn->remaining += 2; /* CRLF after the data */
+				conn->state = LOADGEN_PARSE_CHUNK_DATA;
+			}
+			break;
+		case LOADGEN_PARSE_CHUNK_TRAILER:
+			if (NULL == (end = g_strstr_len(conn->in, conn->in_len, "\r\n"))) {
+				return (conn->in_len >= LOADGEN_BUF_SIZE) ? -1 : 0;
+			}
+
+			loadgen_conn_consume(conn, end + 2 - conn->in);
+
+			if (end == conn->in) {
+				conn->state = LOADGEN_PARSE_HEADER;
+				return 1;
+			}
+			break;
+		}
+	}
+}
+
+static void loadgen_conn_response_done(loadgen_conn *conn) {
+	loadgen_thread *thread = conn->thread;
+
+	if (0 == conn->sent_count) return; /* unrequested response */
+
+	thread->requests++;
+	if (conn->status < 200 || conn->status >= 400) thread->bad_status++;
+	li_histogram_record(&thread->latency, (guint64) ((ev_time() - conn->sent[conn->sent_first]) * 1000000));
+
+	conn->sent_first = (conn->sent_first + 1) % LOADGEN_MAX_PIPELINE;
+	conn->sent_count--;
+	conn->requests_done++;
+}
+
+static void loadgen_conn_send(loadgen_conn *conn) {
+	loadgen_conn_fill(conn);
+
+	if (conn->out_pos < conn->out->len) {
+		ev_io_stop(conn->thread->loop, &conn->watcher);
+		ev_io_set(&conn->watcher, conn->watcher.fd, EV_READ | EV_WRITE);
+		ev_io_start(conn->thread->loop, &conn->watcher);
+	}
+}
+
+static void loadgen_conn_cb(struct ev_loop *loop, ev_io *w, int revents) {
+	loadgen_conn *conn = w->data;
+	loadgen_thread *thread = conn->thread;
+	ssize_t r;
+	gint res;
+	UNUSED(loop);
+
+	if (conn->connecting) {
+		int err = 0;
+		socklen_t errlen = sizeof(err);
+
+		if (-1 == getsockopt(w->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) || 0 != err) {
+			thread->errors++;
+			loadgen_conn_connect(conn);
+			return;
+		}
+
+		conn->connecting = FALSE;
+		loadgen_conn_fill(conn);
+	}
+
+	if (revents & EV_WRITE) {
+		while (conn->out_pos < conn->out->len) {
+			r = write(w->fd, conn->out->str + conn->out_pos, conn->out->len - conn->out_pos);
+			if (r < 0) {
+				if (EAGAIN == errno || EINTR == errno) break;
+				thread->errors++;
+				loadgen_conn_connect(conn);
+				return;
+			}
+			conn->out_pos += r;
+		}
+
+		if (conn->out_pos == conn->out->len) {
+			g_string_truncate(conn->out, 0);
+			conn->out_pos = 0;
+			ev_io_stop(thread->loop, w);
+			ev_io_set(w, w->fd, EV_READ);
+			ev_io_start(thread->loop, w);
+		}
+	}
+
+	if (revents & EV_READ) {
+		r = read(w->fd, conn->in + conn->in_len, LOADGEN_BUF_SIZE - conn->in_len);
+
+		if (r < 0) {
+			if (EAGAIN == errno || EINTR == errno) return;
+			thread->errors++;
+			loadgen_conn_connect(conn);
+			return;
+		}
+
+		if (0 == r) {
+			/* connection closed */
+			if (LOADGEN_PARSE_BODY_CLOSE == conn->state) {
+				loadgen_conn_response_done(conn);
+			} else if (0 == conn->requests_done || conn->in_len > 0 || LOADGEN_PARSE_HEADER != conn->state) {
+				/* requests pipelined after a keep-alive connection is closed are simply sent again */
+				thread->errors++;
+			}
+			loadgen_conn_connect(conn);
+			return;
+		}
+
+		thread->bytes_in += r;
+		conn->in_len += r;
+
+		while (1 == (res = loadgen_conn_parse(conn))) {
+			loadgen_conn_response_done(conn);
+
+			if (conn->close_after || !loadgen.keepalive) {
+				loadgen_conn_connect(conn);
+				return;
+			}
+		}
+
+		if (-1 == res) {
+			thread->errors++;
+			loadgen_conn_connect(conn);
+			return;
+		}
+
+		loadgen_conn_send(conn);
+	}
+}
+
+static void loadgen_stop_cb(struct ev_loop *loop, ev_timer *w, int revents) {
+	UNUSED(w); UNUSED(revents);
+
+	ev_unloop(loop, EVUNLOOP_ALL);
+}
+
+static gpointer loadgen_thread_cb(gpointer data) {
+	loadgen_thread *thread = data;
+	guint i;
+
+	for (i = 0; i < thread->conns_num; i++) {
+		loadgen_conn_connect(&thread->conns[i]);
+	}
+
+	ev_loop(thread->loop, 0);
+
+	return NULL;
+}
+
+static gboolean loadgen_run(gint connections, gint threads) {
+	loadgen_thread *t, *totals = g_slice_new0(loadgen_thread);
+	ev_tstamp start, duration;
+	gint i;
+	guint j;
+	GError *err = NULL;
+
+	t = g_new0(loadgen_thread, threads);
+
+	for (i = 0; i < threads; i++) {
+		/* distribute the connections over the threads */
+		t[i].conns_num = connections / threads + (i < connections % threads ? 1 : 0);
+		t[i].conns = g_new0(loadgen_conn, t[i].conns_num);
+		t[i].loop = ev_loop_new(EVFLAG_AUTO);
+		li_histogram_reset(&t[i].latency);
+
+		for (j = 0; j < t[i].conns_num; j++) {
+			loadgen_conn *conn = &t[i].conns[j];
+
+			conn->thread = &t[i];
+			conn->out = g_string_sized_new(1023);
+			conn->next_request = (i + j) % loadgen.requests->len;
+			ev_init(&conn->watcher, loadgen_conn_cb);
+			ev_io_set(&conn->watcher, -1, 0);
+			conn->watcher.data = conn;
+		}
+
+		ev_timer_init(&t[i].stop_timer, loadgen_stop_cb, loadgen.duration, 0);
+		ev_timer_start(t[i].loop, &t[i].stop_timer);
+	}
+
+	start = ev_time();
+
+	for (i = 0; i < threads; i++) {
+		if (NULL == (t[i].thread = g_thread_create(loadgen_thread_cb, &t[i], TRUE, &err))) {
+			g_error("g_thread_create failed: %s", err->message);
+		}
+	}
+
+	for (i = 0; i < threads; i++) {
+		g_thread_join(t[i].thread);
+	}
+
+	duration = ev_time() - start;
+
+	li_histogram_reset(&totals->latency);
+	for (i = 0; i < threads; i++) {
+		totals->requests += t[i].requests;
+		totals->errors += t[i].errors;
+		totals->bad_status += t[i].bad_status;
+		totals->bytes_in += t[i].bytes_in;
+		totals->connects += t[i].connects;
+		li_histogram_merge(&totals->latency, &t[i].latency);
+
+		for (j = 0; j < t[i].conns_num; j++) {
+			loadgen_conn_close(&t[i].conns[j]);
+			g_string_free(t[i].conns[j].out, TRUE);
+		}
+		g_free(t[i].conns);
+		ev_loop_destroy(t[i].loop);
+	}
+
+	g_print("connections: %i\n", connections);
+	g_print("threads: %i\n", threads);
+	g_print("pipeline: %u\n", loadgen.pipeline);
+	g_print("keepalive: %i\n", loadgen.keepalive ? 1 : 0);
+	g_print("seconds: %.3f\n", duration);
+	g_print("requests: %" G_GUINT64_FORMAT "\n", totals->requests);
+	g_print("errors: %" G_GUINT64_FORMAT "\n", totals->errors);
+	g_print("bad_status: %" G_GUINT64_FORMAT "\n", totals->bad_status);
+	g_print("connects: %" G_GUINT64_FORMAT "\n", totals->connects);
+	g_print("bytes_in: %" G_GUINT64_FORMAT "\n", totals->bytes_in);
+	g_print("requests_per_sec: %.1f\n", totals->requests / duration);
+	g_print("latency_us_p50: %" G_GUINT64_FORMAT "\n", li_histogram_percentile(&totals->latency, 50));
+	g_print("latency_us_p90: %" G_GUINT64_FORMAT "\n", li_histogram_percentile(&totals->latency, 90));
+	g_print("latency_us_p99: %" G_GUINT64_FORMAT "\n", li_histogram_percentile(&totals->latency, 99));
+	g_print("latency_us_p999: %" G_GUINT64_FORMAT "\n", li_histogram_percentile(&totals->latency, 99.9));
+	g_print("latency_us_max: %" G_GUINT64_FORMAT "\n", totals->latency.max);
+
+	g_free(t);
+	g_slice_free(loadgen_thread, totals);
+
+	return TRUE;
+}
+
+/* backend stand-ins */
+
+#define FCGI_HEADER_LEN 8
+#define FCGI_VERSION_1 1
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_KEEP_CONN 1
+
+typedef struct backend_conn backend_conn;
+struct backend_conn {
+	ev_io watcher;
+	GString *in, *out;
+	gsize out_pos;
+	gboolean close_after;
+	gboolean keep_conn;
+};
+
+static struct {
+	gboolean fastcgi;
+	GString *body;
+	ev_io accept_watcher;
+} backend;
+
+static void backend_conn_free(struct ev_loop *loop, backend_conn *conn) {
+	ev_io_stop(loop, &conn->watcher);
+	close(conn->watcher.fd);
+	g_string_free(conn->in, TRUE);
+	g_string_free(conn->out, TRUE);
+	g_slice_free(backend_conn, conn);
+}
+
+static void backend_http_header(GString *out, gboolean close_after) {
+	g_string_append_printf(out,
+		"HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %" G_GSIZE_FORMAT "\r\n%s\r\n",
+		backend.body->len, close_after ? "Connection: close\r\n" : "");
+}
+
+/* returns FALSE on protocol errors */
+static gboolean backend_http_parse(backend_conn *conn) {
+	gchar *end, *headers;
+	goffset content_length;
+
+	while (!conn->close_after && NULL != (end = g_strstr_len(conn->in->str, conn->in->len, "\r\n\r\n"))) {
+		gsize header_len = end + 4 - conn->in->str;
+
+		headers = g_ascii_strdown(conn->in->str, header_len);
+		if (NULL != strstr(headers, "http/1.0\r\n")) {
+			conn->close_after = (NULL == strstr(headers, "\nconnection: keep-alive"));
+		} else {
+			conn->close_after = (NULL != strstr(headers, "\nconnection: close"));
+		}
+		content_length = (NULL != (end = strstr(headers, "\ncontent-length:"))) ? g_ascii_strtoll(end + 16, NULL, 10) : 0;
+		g_free(headers);
+
+		if (content_length < 0) return FALSE;
+		if ((goffset) conn->in->len < (goffset) header_len + content_length) break;
+
+		g_string_erase(conn->in, 0, header_len + content_length);
+
+		backend_http_header(conn->out, conn->close_after);
+		g_string_append_len(conn->out, GSTR_LEN(backend.body));
+	}
+
+	return TRUE;
+}
+
+static void backend_fastcgi_record(GString *out, guint8 type, guint16 request_id, const gchar *data, gsize len) {
+	guint8 header[FCGI_HEADER_LEN] = {
+		FCGI_VERSION_1, type, request_id >> 8, request_id & 0xff, (len >> 8) & 0xff, len & 0xff, 0, 0
+	};
+
+	g_string_append_len(out, (const gchar*) header, FCGI_HEADER_LEN);
+	g_string_append_len(out, data, len);
+}
+
+static gboolean backend_fastcgi_parse(backend_conn *conn) {
+	while (conn->in->len >= FCGI_HEADER_LEN) {
+		const guint8 *header = (const guint8*) conn->in->str;
+		guint8 type = header[1];
+		guint16 request_id = (header[2] << 8) | header[3];
+		gsize content_len = (header[4] << 8) | header[5], record_len = FCGI_HEADER_LEN + content_len + header[6];
+
+		if (FCGI_VERSION_1 != header[0]) return FALSE;
+		if (conn->in->len < record_len) break;
+
+		if (FCGI_BEGIN_REQUEST == type) {
+			if (content_len < 3) return FALSE;
+			conn->keep_conn = (0 != (header[FCGI_HEADER_LEN + 2] & FCGI_KEEP_CONN));
+		} else if (FCGI_STDIN == type && 0 == content_len) {
+			/* request complete */
+			static const guint8 end_request[8] = { 0, 0, 0, 0, 0 /* FCGI_REQUEST_COMPLETE */, 0, 0, 0 };
+			GString *response = g_string_sized_new(backend.body->len + 127);
+			gsize pos;
+
+			g_string_append_printf(response, "Status: 200\r\nContent-Type: text/plain\r\nContent-Length: %" G_GSIZE_FORMAT "\r\n\r\n", backend.body->len);
+			g_string_append_len(response, GSTR_LEN(backend.body));
+
+			for (pos = 0; pos < response->len; pos += 32768) {
+				backend_fastcgi_record(conn->out, FCGI_STDOUT, request_id, response->str + pos, MIN(response->len - pos, 32768));
+			}
+			backend_fastcgi_record(conn->out, FCGI_STDOUT, request_id, NULL, 0);
+			backend_fastcgi_record(conn->out, FCGI_END_REQUEST, request_id, (const gchar*) end_request, sizeof(end_request));
+
+			g_string_free(response, TRUE);
+
+			if (!conn->keep_conn) conn->close_after = TRUE;
+		}
+		/* FCGI_PARAMS and the stdin data are ignored */
+
+		g_string_erase(conn->in, 0, record_len);
+	}
+
+	return TRUE;
+}
+
+static void backend_conn_cb(struct ev_loop *loop, ev_io *w, int revents) {
+	backend_conn *conn = w->data;
+	gchar buf[16*1024];
+	ssize_t r;
+
+	if (revents & EV_READ) {
+		for (;;) {
+			r = read(w->fd, buf, sizeof(buf));
+			if (r < 0) {
+				if (EAGAIN == errno || EINTR == errno) break;
+				backend_conn_free(loop, conn);
+				return;
+			}
+			if (0 == r) {
+				backend_conn_free(loop, conn);
+				return;
+			}
+			g_string_append_len(conn->in, buf, r);
+			if ((gsize) r < sizeof(buf)) break;
+		}
+
+		if (!(backend.fastcgi ? backend_fastcgi_parse(conn) : backend_http_parse(conn))) {
+			backend_conn_free(loop, conn);
+			return;
+		}
+	}
+
+	while (conn->out_pos < conn->out->len) {
+		r = write(w->fd, conn->out->str + conn->out_pos, conn->out->len - conn->out_pos);
+		if (r < 0) {
+			if (EAGAIN == errno || EINTR == errno) break;
+			backend_conn_free(loop, conn);
+			return;
+		}
+		conn->out_pos += r;
+	}
+
+	if (conn->out_pos == conn->out->len) {
+		g_string_truncate(conn->out, 0);
+		conn->out_pos = 0;
+
+		if (conn->close_after) {
+			backend_conn_free(loop, conn);
+			return;
+		}
+	}
+
+	ev_io_stop(loop, w);
+	ev_io_set(w, w->fd, (conn->out->len > 0) ? (EV_READ | EV_WRITE) : EV_READ);
+	ev_io_start(loop, w);
+}
+
+static void backend_accept_cb(struct ev_loop *loop, ev_io *w, int revents) {
+	backend_conn *conn;
+	int fd;
+	UNUSED(revents);
+
+	while (-1 != (fd = accept(w->fd, NULL, NULL))) {
+		li_fd_init(fd);
+
+		conn = g_slice_new0(backend_conn);
+		conn->in = g_string_sized_new(1023);
+		conn->out = g_string_sized_new(1023);
+
+		ev_io_init(&conn->watcher, backend_conn_cb, fd, EV_READ);
+		conn->watcher.data = conn;
+		ev_io_start(loop, &conn->watcher);
+	}
+}
+
+static void backend_run(gint size) {
+	struct ev_loop *loop = ev_default_loop(0);
+
+	backend.body = g_string_sized_new(size);
+	while (backend.body->len < (gsize) size) {
+		g_string_append_c(backend.body, 'a' + backend.body->len % 26);
+	}
+
+	/* the listening socket is stdin */
+	li_fd_init(STDIN_FILENO);
+	ev_io_init(&backend.accept_watcher, backend_accept_cb, STDIN_FILENO, EV_READ);
+	ev_io_start(loop, &backend.accept_watcher);
+
+	ev_loop(loop, 0);
+
+	g_string_free(backend.body, TRUE);
+}
+
+int main(int argc, char *argv[]) {
+	GError *error = NULL;
+	GOptionContext *context;
+	gboolean res;
+	gint i;
+
+	gint connections = 64, threads = 2, pipeline = 1, duration = 10, size = 100;
+	gboolean no_keepalive = FALSE, http_backend = FALSE;
+	gchar *host = NULL;
+
+	GOptionEntry entries[] = {
+		{ "connections", 'c', 0, G_OPTION_ARG_INT, &connections, "number of connections (default: 64)", "N" },
+		{ "threads", 't', 0, G_OPTION_ARG_INT, &threads, "number of threads (default: 2)", "N" },
+		{ "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "run for N seconds (default: 10)", "N" },
+		{ "pipeline", 'p', 0, G_OPTION_ARG_INT, &pipeline, "requests in flight per connection (default: 1)", "N" },
+		{ "no-keepalive", 'n', 0, G_OPTION_ARG_NONE, &no_keepalive, "one request per connection", NULL },
+		{ "host", 'H', 0, G_OPTION_ARG_STRING, &host, "value of the Host header (default: the address)", "HOST" },
+		{ "fastcgi", 0, 0, G_OPTION_ARG_NONE, &backend.fastcgi, "run as FastCGI backend on the socket in stdin", NULL },
+		{ "http-backend", 0, 0, G_OPTION_ARG_NONE, &http_backend, "run as HTTP backend on the socket in stdin", NULL },
+		{ "size", 's', 0, G_OPTION_ARG_INT, &size, "body size of the backend responses (default: 100)", "BYTES" },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL }
+	};
+
+	g_thread_init(NULL);
+
+	context = g_option_context_new("ADDRESS PORT PATH... - lighttpd2 load generator");
+	g_option_context_add_main_entries(context, entries, NULL);
+
+	res = g_option_context_parse(context, &argc, &argv, &error);
+
+	g_option_context_free(context);
+
+	if (!res) {
+		g_printerr("failed to parse command line arguments: %s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	if (backend.fastcgi || http_backend) {
+		backend_run(MAX(size, 0));
+		return 0;
+	}
+
+	if (argc < 4) {
+		g_printerr("usage: %s [options] ADDRESS PORT PATH...\n", argv[0]);
+		return 1;
+	}
+
+	memset(&loadgen.addr, 0, sizeof(loadgen.addr));
+	loadgen.addr.sin_family = AF_INET;
+	loadgen.addr.sin_port = htons(atoi(argv[2]));
+	if (1 != inet_pton(AF_INET, argv[1], &loadgen.addr.sin_addr)) {
+		g_printerr("invalid IPv4 address '%s'\n", argv[1]);
+		return 1;
+	}
+
+	loadgen.keepalive = !no_keepalive;
+	loadgen.pipeline = CLAMP(pipeline, 1, LOADGEN_MAX_PIPELINE);
+	if (!loadgen.keepalive) loadgen.pipeline = 1;
+	loadgen.duration = MAX(duration, 1);
+
+	loadgen.requests = g_ptr_array_new();
+	for (i = 3; i < argc; i++) {
+		GString *request = g_string_sized_new(127);
+
+		g_string_printf(request, "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n",
+			argv[i], host ? host : argv[1], loadgen.keepalive ? "" : "Connection: close\r\n");
+		g_ptr_array_add(loadgen.requests, request);
+	}
+
+	res = loadgen_run(MAX(connections, 1), CLAMP(threads, 1, MAX(connections, 1)));
+
+	for (i = 0; i < (gint) loadgen.requests->len; i++) {
+		g_string_free(g_ptr_array_index(loadgen.requests, i), TRUE);
+	}
+	g_ptr_array_free(loadgen.requests, TRUE);
+	g_free(host);
+
+	return res ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+
+/* dumps the statistics a server publishes with the "stats.shm" setup; doesn't need any request to the server */
+
+#include <lighttpd/stats_shm.h>
+
+#include <time.h>
+
+static void stats_print_latency(const gchar *name, liHistogram *h) {
+	g_print("%s_p50: %" G_GUINT64_FORMAT "\n", name, li_histogram_percentile(h, 50));
+	g_print("%s_p99: %" G_GUINT64_FORMAT "\n", name, li_histogram_percentile(h, 99));
+	g_print("%s_p999: %" G_GUINT64_FORMAT "\n", name, li_histogram_percentile(h, 99.9));
+	g_print("%s_max: %" G_GUINT64_FORMAT "\n", name, h->max);
+}
+
+static void stats_print_counters(liStatsShmWorker *w) {
+	g_print("requests_abs: %" G_GUINT64_FORMAT "\n", w->requests);
+	g_print("traffic_in_abs: %" G_GUINT64_FORMAT "\n", w->bytes_in);
+	g_print("traffic_out_abs: %" G_GUINT64_FORMAT "\n", w->bytes_out);
+	g_print("actions_executed_abs: %" G_GUINT64_FORMAT "\n", w->actions_executed);
+	g_print("connections_abs: %" G_GUINT64_FORMAT "\n", w->active_connections);
+	g_print("requests_avg_5sec: %" G_GUINT64_FORMAT "\n", w->requests_5s_diff / 5);
+	g_print("traffic_in_avg_5sec: %" G_GUINT64_FORMAT "\n", w->bytes_in_5s_diff / 5);
+	g_print("traffic_out_avg_5sec: %" G_GUINT64_FORMAT "\n", w->bytes_out_5s_diff / 5);
+	stats_print_latency("ttfb_us", &w->ttfb);
+	stats_print_latency("duration_us", &w->duration);
+}
+
+static gboolean stats_dump(liStatsShm *shm, gboolean per_worker) {
+	liStatsShmHeader *header = shm->header;
+	liStatsShmWorker *w = g_slice_new(liStatsShmWorker), *totals = g_slice_new0(liStatsShmWorker);
+	gint64 now = time(NULL), oldest = now;
+	guint i;
+
+	for (i = 0; i < header->worker_count; i++) {
+		if (!li_stats_shm_read(li_stats_shm_worker(shm, i), w)) {
+			g_printerr("couldn't read the statistics of worker #%u\n", i + 1);
+			g_slice_free(liStatsShmWorker, w);
+			g_slice_free(liStatsShmWorker, totals);
+			return FALSE;
+		}
+
+		if (per_worker) {
+			g_print("# Worker #%u\n", i + 1);
+			stats_print_counters(w);
+			g_print("\n");
+		}
+
+		totals->requests += w->requests;
+		totals->bytes_in += w->bytes_in;
+		totals->bytes_out += w->bytes_out;
+		totals->actions_executed += w->actions_executed;
+		totals->active_connections += w->active_connections;
+		totals->requests_5s_diff += w->requests_5s_diff;
+		totals->bytes_in_5s_diff += w->bytes_in_5s_diff;
+		totals->bytes_out_5s_diff += w->bytes_out_5s_diff;
+		li_histogram_merge(&totals->ttfb, &w->ttfb);
+		li_histogram_merge(&totals->duration, &w->duration);
+		oldest = MIN(oldest, w->updated);
+	}
+
+	g_print("# Totals\n");
+	g_print("pid: %" G_GINT64_FORMAT "\n", header->pid);
+	g_print("uptime: %" G_GINT64_FORMAT "\n", now - header->started);
+	g_print("workers: %u\n", header->worker_count);
+	/* workers update their statistics once a second; a busy or hanging worker falls behind */
+	g_print("max_age: %" G_GINT64_FORMAT "\n", now - oldest);
+	stats_print_counters(totals);
+
+	g_slice_free(liStatsShmWorker, w);
+	g_slice_free(liStatsShmWorker, totals);
+
+	return TRUE;
+}
+
+int main(int argc, char *argv[]) {
+	GError *error = NULL;
+	GOptionContext *context;
+	liStatsShm *shm;
+	gboolean res;
+
+	gchar *path = NULL;
+	gboolean per_worker = FALSE;
+	gint interval = 0;
+
+	GOptionEntry entries[] = {
+		{ "file", 'f', 0, G_OPTION_ARG_FILENAME, &path, "filename of the statistics (setup stats.shm)", "PATH" },
+		{ "workers", 'w', 0, G_OPTION_ARG_NONE, &per_worker, "show each worker", NULL },
+		{ "interval", 'i', 0, G_OPTION_ARG_INT, &interval, "repeat every N seconds", "N" },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL }
+	};
+
+	context = g_option_context_new("- show lighttpd2 statistics");
+	g_option_context_add_main_entries(context, entries, NULL);
+
+	res = g_option_context_parse(context, &argc, &argv, &error);
+
+	g_option_context_free(context);
+
+	if (!res) {
+		g_printerr("failed to parse command line arguments: %s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	if (!path) {
+		g_printerr("no statistics file given, use --file\n");
+		return 1;
+	}
+
+	if (NULL == (shm = li_stats_shm_open(path, &error))) {
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+		g_free(path);
+		return 1;
+	}
+
+	for (;;) {
+		res = stats_dump(shm, per_worker);
+
+		if (!res || interval <= 0) break;
+
+		g_print("\n");
+		sleep(interval);
+	}
+
+	li_stats_shm_free(shm);
+	g_free(path);
+
+	return res ? 0 : 1;
+}
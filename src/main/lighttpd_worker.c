@@ -49,11 +49,15 @@ int main(int argc, char *argv[]) {
 
 #ifdef WITH_PROFILER
 	{
-		/* check for environment variable LIGHTY_PROFILE_MEM */
+		/* check for environment variables LIGHTY_PROFILE_MEM and LIGHTY_PROFILE_MEM_SAMPLE (interval in KiB) */
 		gchar *profile_mem = getenv("LIGHTY_PROFILE_MEM");
+		gchar *profile_mem_sample = getenv("LIGHTY_PROFILE_MEM_SAMPLE");
 		if (profile_mem) {
 			/*g_mem_set_vtable(glib_mem_profiler_table);*/
-			li_profiler_enable(profile_mem);
+			if (profile_mem_sample && atoi(profile_mem_sample) > 0)
+				li_profiler_enable_sampling(profile_mem, atoi(profile_mem_sample));
+			else
+				li_profiler_enable(profile_mem);
 			atexit(li_profiler_finish);
 			/*atexit(li_profiler_dump);*/
 		}
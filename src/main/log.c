@@ -10,12 +10,26 @@
 #include <lighttpd/plugin_core.h>
 
 #include <stdarg.h>
+#include <sys/uio.h>
 
 #define LOG_DEFAULT_TS_FORMAT "%d/%b/%Y %T %Z"
 #define LOG_DEFAULT_TTL 30.0
 
+/* max. number of entries for the same target written with one writev() */
+#if defined(IOV_MAX) && (IOV_MAX < 64)
+# define LOG_WRITEV_MAX IOV_MAX
+#else
+# define LOG_WRITEV_MAX 64
+#endif
+
 static void log_watcher_cb(struct ev_loop *loop, ev_async *w, int revents);
 
+/* log targets are distributed over the writer threads by the hash of their path */
+static liLogShard *log_shard(liServer *srv, GString *path) {
+	if (1 == srv->logs.shard_count) return &srv->logs.shards[0];
+	return &srv->logs.shards[g_string_hash(path) % srv->logs.shard_count];
+}
+
 static void li_log_write_stderr(liServer *srv, const gchar *msg, gboolean newline) {
 	gsize s;
 	struct tm tm;
@@ -35,10 +49,11 @@ static void li_log_write_stderr(liServer *srv, const gchar *msg, gboolean newlin
 	g_printerr(newline ? "%s %s\n" : "%s %s", buf, msg);
 }
 
-static liLogTarget *log_open(liServer *srv, GString *path) {
+static liLogTarget *log_open(liLogShard *shard, GString *path) {
+	liServer *srv = shard->srv;
 	liLogTarget *log;
 
-	log = li_radixtree_lookup_exact(srv->logs.targets, path->str, path->len * 8);
+	log = li_radixtree_lookup_exact(shard->targets, path->str, path->len * 8);
 
 	if (NULL == log) {
 		/* log not open */
@@ -71,18 +86,18 @@ static liLogTarget *log_open(liServer *srv, GString *path) {
 		log->path = g_string_new_len(GSTR_LEN(path));
 		log->fd = fd;
 		log->wqelem.data = log;
-		li_radixtree_insert(srv->logs.targets, log->path->str, log->path->len * 8, log);
+		li_radixtree_insert(shard->targets, log->path->str, log->path->len * 8, log);
 		/*g_print("log_open(\"%s\")\n", log->path->str);*/
 	}
 
-	li_waitqueue_push(&srv->logs.close_queue, &log->wqelem);
+	li_waitqueue_push(&shard->close_queue, &log->wqelem);
 
 	return log;
 }
 
-static void log_close(liServer *srv, liLogTarget *log) {
-	li_radixtree_remove(srv->logs.targets, log->path->str, log->path->len * 8);
-	li_waitqueue_remove(&srv->logs.close_queue, &log->wqelem);
+static void log_close(liLogShard *shard, liLogTarget *log) {
+	li_radixtree_remove(shard->targets, log->path->str, log->path->len * 8);
+	li_waitqueue_remove(&shard->close_queue, &log->wqelem);
 
 	if (log->type == LI_LOG_TYPE_FILE || log->type == LI_LOG_TYPE_PIPE) {
 		if (-1 != log->fd) close(log->fd);
@@ -96,49 +111,178 @@ static void log_close(liServer *srv, liLogTarget *log) {
 
 static void log_close_cb(liWaitQueue *wq, gpointer data) {
 	/* callback for the close queue */
-	liServer *srv = (liServer*) data;
+	liLogShard *shard = (liLogShard*) data;
 	liWaitQueueElem *wqe;
 
 	while ((wqe = li_waitqueue_pop(wq)) != NULL) {
-		log_close(srv, wqe->data);
+		log_close(shard, wqe->data);
 	}
 
 	li_waitqueue_update(wq);
 }
 
+static void log_shards_init(liServer *srv, guint count) {
+	srv->logs.shard_count = count;
+	srv->logs.shards = g_new0(liLogShard, count);
+
+	for (guint i = 0; i < count; i++) {
+		liLogShard *shard = &srv->logs.shards[i];
+
+		shard->srv = srv;
+		shard->ndx = i;
+		shard->loop = ev_loop_new(EVFLAG_AUTO);
+		ev_async_init(&shard->watcher, log_watcher_cb);
+		shard->watcher.data = shard;
+		shard->targets = li_radixtree_new();
+		li_waitqueue_init(&shard->close_queue, shard->loop, log_close_cb, LOG_DEFAULT_TTL, shard);
+		g_queue_init(&shard->write_queue);
+		g_static_mutex_init(&shard->write_queue_mutex);
+		shard->timestamp.cached = g_string_sized_new(255);
+		shard->timestamp.last_ts = 0;
+	}
+}
+
+static void log_shards_free(liServer *srv) {
+	for (guint i = 0; i < srv->logs.shard_count; i++) {
+		liLogShard *shard = &srv->logs.shards[i];
+		GList *link;
+
+		/* entries queued after the thread finished */
+		while (NULL != (link = g_queue_pop_head_link(&shard->write_queue))) {
+			liLogEntry *log_entry = link->data;
+			g_string_free(log_entry->path, TRUE);
+			g_string_free(log_entry->msg, TRUE);
+			g_slice_free(liLogEntry, log_entry);
+		}
+
+		li_radixtree_free(shard->targets, NULL, NULL);
+		g_string_free(shard->timestamp.cached, TRUE);
+		g_static_mutex_free(&shard->write_queue_mutex);
+		ev_loop_destroy(shard->loop);
+	}
+
+	g_free(srv->logs.shards);
+	srv->logs.shards = NULL;
+	srv->logs.shard_count = 0;
+}
+
 void li_log_init(liServer *srv) {
-	srv->logs.loop = ev_loop_new(EVFLAG_AUTO);
-	ev_async_init(&srv->logs.watcher, log_watcher_cb);
-	srv->logs.watcher.data = srv;
-	srv->logs.targets = li_radixtree_new();
-	li_waitqueue_init(&srv->logs.close_queue, srv->logs.loop, log_close_cb, LOG_DEFAULT_TTL, srv);
+	log_shards_init(srv, 1);
+	srv->logs.queue_limit = 0;
 	srv->logs.timestamp.format = g_string_new_len(CONST_STR_LEN(LOG_DEFAULT_TS_FORMAT));
-	srv->logs.timestamp.cached = g_string_sized_new(255);
-	srv->logs.timestamp.last_ts = 0;
 	srv->logs.thread_alive = FALSE;
-	g_queue_init(&srv->logs.write_queue);
-	g_static_mutex_init(&srv->logs.write_queue_mutex);
 	srv->logs.log_context.log_map = li_log_map_new_default();
 }
 
 void li_log_cleanup(liServer *srv) {
-	/* wait for logging thread to exit */
+	/* wait for logging threads to exit */
 	if (g_atomic_int_get(&srv->logs.thread_alive) == TRUE)
 	{
 		li_log_thread_finish(srv);
-		g_thread_join(srv->logs.thread);
+		for (guint i = 0; i < srv->logs.shard_count; i++) {
+			g_thread_join(srv->logs.shards[i].thread);
+		}
 	}
 
-	li_radixtree_free(srv->logs.targets, NULL, NULL);
+	log_shards_free(srv);
 
 	g_string_free(srv->logs.timestamp.format, TRUE);
-	g_string_free(srv->logs.timestamp.cached, TRUE);
-
-	ev_loop_destroy(srv->logs.loop);
 
 	li_log_context_set(&srv->logs.log_context, NULL);
 }
 
+/* pushes the entries onto the queue of the shard; drops them if the shard already has too much queued */
+static void log_shard_push(liServer *srv, liLogShard *shard, GQueue *entries) {
+	gsize bytes = 0, limit = srv->logs.queue_limit;
+	GList *link;
+
+	for (link = g_queue_peek_head_link(entries); link; link = link->next) {
+		bytes += ((liLogEntry*) link->data)->msg->len;
+	}
+
+	g_static_mutex_lock(&shard->write_queue_mutex);
+	if (0 == limit || shard->queued_bytes + bytes <= limit || 0 == shard->queued_bytes) {
+		shard->queued_bytes += bytes;
+		li_g_queue_merge(&shard->write_queue, entries);
+		bytes = 0;
+	} else {
+		shard->dropped += g_queue_get_length(entries);
+		shard->dropped_bytes += bytes;
+	}
+	g_static_mutex_unlock(&shard->write_queue_mutex);
+
+	if (0 != bytes) {
+		/* dropped */
+		while (NULL != (link = g_queue_pop_head_link(entries))) {
+			liLogEntry *log_entry = link->data;
+			g_string_free(log_entry->path, TRUE);
+			g_string_free(log_entry->msg, TRUE);
+			g_slice_free(liLogEntry, log_entry);
+		}
+	}
+
+	ev_async_send(shard->loop, &shard->watcher);
+}
+
+static void log_push_entry(liServer *srv, liLogEntry *log_entry) {
+	GQueue q = G_QUEUE_INIT;
+
+	g_queue_push_tail_link(&q, &log_entry->queue_link);
+	log_shard_push(srv, log_shard(srv, log_entry->path), &q);
+}
+
+gboolean li_log_set_threads(liServer *srv, guint count) {
+	GQueue pending = G_QUEUE_INIT;
+	GList *link;
+
+	if (0 == count) return FALSE;
+	if (g_atomic_int_get(&srv->logs.thread_alive)) return FALSE;
+
+	/* keep entries queued before the threads are started */
+	for (guint i = 0; i < srv->logs.shard_count; i++) {
+		li_g_queue_merge(&pending, &srv->logs.shards[i].write_queue);
+	}
+
+	log_shards_free(srv);
+	log_shards_init(srv, count);
+
+	while (NULL != (link = g_queue_pop_head_link(&pending))) {
+		log_push_entry(srv, link->data);
+	}
+
+	return TRUE;
+}
+
+void li_log_worker_submit(liWorker *wrk) {
+	liServer *srv = wrk->srv;
+	GList *link;
+
+	if (g_queue_is_empty(&wrk->logs.log_queue)) return;
+
+	if (1 == srv->logs.shard_count) {
+		log_shard_push(srv, &srv->logs.shards[0], &wrk->logs.log_queue);
+		return;
+	}
+
+	if (wrk->logs.shard_count != srv->logs.shard_count) {
+		g_free(wrk->logs.shard_queues);
+		wrk->logs.shard_count = srv->logs.shard_count;
+		wrk->logs.shard_queues = g_new0(GQueue, wrk->logs.shard_count);
+	}
+
+	/* split the local queue, so every shard is locked only once */
+	while (NULL != (link = g_queue_pop_head_link(&wrk->logs.log_queue))) {
+		liLogShard *shard = log_shard(srv, ((liLogEntry*) link->data)->path);
+		g_queue_push_tail_link(&wrk->logs.shard_queues[shard->ndx], link);
+	}
+
+	for (guint i = 0; i < wrk->logs.shard_count; i++) {
+		if (!g_queue_is_empty(&wrk->logs.shard_queues[i])) {
+			log_shard_push(srv, &srv->logs.shards[i], &wrk->logs.shard_queues[i]);
+		}
+	}
+}
+
 liLogMap* li_log_map_new(void) {
 	liLogMap *log_map = g_slice_new0(liLogMap);
 
@@ -206,16 +350,102 @@ gboolean li_log_write_direct(liServer *srv, liWorker *wrk, GString *path, GStrin
 		/* push onto local worker log queue */
 		g_queue_push_tail_link(&wrk->logs.log_queue, &log_entry->queue_link);
 	} else {
-		/* no worker context, push directly onto global log queue */
-		g_static_mutex_lock(&srv->logs.write_queue_mutex);
-		g_queue_push_tail_link(&srv->logs.write_queue, &log_entry->queue_link);
-		g_static_mutex_unlock(&srv->logs.write_queue_mutex);
-		ev_async_send(srv->logs.loop, &srv->logs.watcher);
+		/* no worker context, push directly onto the queue of the log thread */
+		log_push_entry(srv, log_entry);
 	}
 
 	return TRUE;
 }
 
+static void log_buffer_free(gpointer data) {
+	liLogBuffer *buf = data;
+
+	g_string_free(buf->path, TRUE);
+	g_string_free(buf->data, TRUE);
+	g_slice_free(liLogBuffer, buf);
+}
+
+/* moves the buffered lines into a log entry on the local worker log queue */
+static void log_buffer_handoff(liWorker *wrk, liLogBuffer *buf) {
+	liLogEntry *log_entry;
+
+	if (0 == buf->data->len) return;
+
+	log_entry = g_slice_new(liLogEntry);
+	log_entry->path = g_string_new_len(GSTR_LEN(buf->path));
+	log_entry->level = 0;
+	log_entry->flags = LOG_FLAG_BLOCK;
+	log_entry->msg = buf->data;
+	log_entry->queue_link.data = log_entry;
+	log_entry->queue_link.next = NULL;
+	log_entry->queue_link.prev = NULL;
+
+	g_queue_push_tail_link(&wrk->logs.log_queue, &log_entry->queue_link);
+
+	buf->data = g_string_sized_new(LI_LOG_BUFFER_BLOCK_SIZE + 1024);
+}
+
+static void log_flush_timer_cb(struct ev_loop *loop, ev_timer *w, int revents) {
+	liWorker *wrk = (liWorker*) w->data;
+	UNUSED(loop);
+	UNUSED(revents);
+
+	li_log_worker_flush(wrk);
+}
+
+void li_log_worker_init(liWorker *wrk) {
+	g_queue_init(&wrk->logs.log_queue);
+	wrk->logs.buffers = g_hash_table_new_full((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal, NULL, log_buffer_free);
+
+	ev_timer_init(&wrk->logs.flush_timer, log_flush_timer_cb, LI_LOG_BUFFER_MAX_LATENCY, LI_LOG_BUFFER_MAX_LATENCY);
+	wrk->logs.flush_timer.data = wrk;
+	ev_timer_start(wrk->loop, &wrk->logs.flush_timer);
+	ev_unref(wrk->loop); /* this watcher shouldn't keep the loop alive */
+}
+
+void li_log_worker_cleanup(liWorker *wrk) {
+	li_ev_safe_ref_and_stop(ev_timer_stop, wrk->loop, &wrk->logs.flush_timer);
+
+	li_log_worker_flush(wrk);
+	g_hash_table_destroy(wrk->logs.buffers);
+	wrk->logs.buffers = NULL;
+
+	li_log_worker_submit(wrk);
+
+	g_free(wrk->logs.shard_queues);
+	wrk->logs.shard_queues = NULL;
+	wrk->logs.shard_count = 0;
+}
+
+void li_log_worker_flush(liWorker *wrk) {
+	GHashTableIter iter;
+	gpointer v;
+
+	g_hash_table_iter_init(&iter, wrk->logs.buffers);
+	while (g_hash_table_iter_next(&iter, NULL, &v)) {
+		log_buffer_handoff(wrk, v);
+	}
+}
+
+liLogBuffer* li_log_buffer_get(liWorker *wrk, GString *path) {
+	liLogBuffer *buf = g_hash_table_lookup(wrk->logs.buffers, path);
+
+	if (NULL == buf) {
+		buf = g_slice_new(liLogBuffer);
+		buf->path = g_string_new_len(GSTR_LEN(path));
+		buf->data = g_string_sized_new(LI_LOG_BUFFER_BLOCK_SIZE + 1024);
+		g_hash_table_insert(wrk->logs.buffers, buf->path, buf);
+	}
+
+	return buf;
+}
+
+void li_log_buffer_commit(liWorker *wrk, liLogBuffer *buf) {
+	if (buf->data->len >= LI_LOG_BUFFER_BLOCK_SIZE) {
+		log_buffer_handoff(wrk, buf);
+	}
+}
+
 gboolean li_log_write(liServer *srv, liWorker *wrk, liLogContext *context, liLogLevel log_level, guint flags, const gchar *fmt, ...) {
 	va_list ap;
 	GString *log_line;
@@ -272,46 +502,97 @@ gboolean li_log_write(liServer *srv, liWorker *wrk, liLogContext *context, liLog
 		/* push onto local worker log queue */
 		g_queue_push_tail_link(&wrk->logs.log_queue, &log_entry->queue_link);
 	} else {
-		/* no worker context, push directly onto global log queue */
-		g_static_mutex_lock(&srv->logs.write_queue_mutex);
-		g_queue_push_tail_link(&srv->logs.write_queue, &log_entry->queue_link);
-		g_static_mutex_unlock(&srv->logs.write_queue_mutex);
-		ev_async_send(srv->logs.loop, &srv->logs.watcher);
+		/* no worker context, push directly onto the queue of the log thread */
+		log_push_entry(srv, log_entry);
 	}
 
 	return TRUE;
 }
 
-static gpointer log_thread(liServer *srv) {
-	ev_loop(srv->logs.loop, 0);
+static gpointer log_thread(liLogShard *shard) {
+	ev_loop(shard->loop, 0);
 	return NULL;
 }
 
-static GString *log_timestamp_format(liServer *srv) {
+static GString *log_timestamp_format(liLogShard *shard) {
 	gsize s;
 	struct tm tm;
-	time_t now = (time_t) ev_now(srv->logs.loop);
+	time_t now = (time_t) ev_now(shard->loop);
+	GString *format = shard->srv->logs.timestamp.format;
 
 	/* cache hit */
-	if (now == srv->logs.timestamp.last_ts) {
-		return srv->logs.timestamp.cached;
+	if (now == shard->timestamp.last_ts) {
+		return shard->timestamp.cached;
 	}
 
 #ifdef HAVE_LOCALTIME_R
-	s = strftime(srv->logs.timestamp.cached->str, srv->logs.timestamp.cached->allocated_len, srv->logs.timestamp.format->str, localtime_r(&now, &tm));
+	s = strftime(shard->timestamp.cached->str, shard->timestamp.cached->allocated_len, format->str, localtime_r(&now, &tm));
 #else
-	s = strftime(srv->logs.timestamp.cached->str, srv->logs.timestamp.cached->allocated_len, srv->logs.timestamp.format->str, localtime(&now));
+	s = strftime(shard->timestamp.cached->str, shard->timestamp.cached->allocated_len, format->str, localtime(&now));
 #endif
 
-	g_string_set_size(srv->logs.timestamp.cached, s);
-	srv->logs.timestamp.last_ts = now;
+	g_string_set_size(shard->timestamp.cached, s);
+	shard->timestamp.last_ts = now;
 
-	return srv->logs.timestamp.cached;
+	return shard->timestamp.cached;
+}
+
+/* add timestamp and newline to a single log line */
+static void log_entry_prepare(liLogShard *shard, liLogEntry *log_entry) {
+	GString *msg = log_entry->msg;
+
+	if (log_entry->flags & LOG_FLAG_BLOCK) return;
+
+	if (log_entry->flags & LOG_FLAG_TIMESTAMP) {
+		GString *ts = log_timestamp_format(shard);
+		g_string_prepend_c(msg, ' ');
+		g_string_prepend_len(msg, GSTR_LEN(ts));
+	}
+
+	g_string_append_len(msg, CONST_STR_LEN("\n"));
+}
+
+static void log_entry_free(liLogEntry *log_entry) {
+	g_string_free(log_entry->path, TRUE);
+	g_string_free(log_entry->msg, TRUE);
+	g_slice_free(liLogEntry, log_entry);
+}
+
+/* write all iovecs, continues after partial writes. returns 0 or the errno of the failed writev() */
+static int log_writev(gint fd, struct iovec *iov, guint iovcnt) {
+	while (iovcnt > 0) {
+		ssize_t r = writev(fd, iov, iovcnt);
+
+		if (-1 == r) {
+			switch (errno) {
+				case EAGAIN:
+				case EINTR:
+					continue;
+			}
+			return errno;
+		}
+
+		while (iovcnt > 0 && (gsize) r >= iov->iov_len) {
+			r -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+
+		if (iovcnt > 0) {
+			iov->iov_base = ((gchar*) iov->iov_base) + r;
+			iov->iov_len -= r;
+		}
+	}
+
+	return 0;
 }
 
 static void log_watcher_cb(struct ev_loop *loop, ev_async *w, int revents) {
-	liServer *srv = (liServer*) w->data;
+	liLogShard *shard = (liLogShard*) w->data;
+	liServer *srv = shard->srv;
 	GList *queue_link, *queue_link_next;
+	gsize queued_bytes;
+	guint64 dropped, dropped_bytes;
 
 	UNUSED(loop);
 	UNUSED(revents);
@@ -319,86 +600,95 @@ static void log_watcher_cb(struct ev_loop *loop, ev_async *w, int revents) {
 	if (g_atomic_int_get(&srv->logs.thread_stop) == TRUE) {
 		liWaitQueueElem *wqe;
 
-		while ((wqe = li_waitqueue_pop_force(&srv->logs.close_queue)) != NULL) {
-			log_close(srv, wqe->data);
+		while ((wqe = li_waitqueue_pop_force(&shard->close_queue)) != NULL) {
+			log_close(shard, wqe->data);
 		}
-		li_waitqueue_stop(&srv->logs.close_queue);
-		ev_async_stop(srv->logs.loop, &srv->logs.watcher);
+		li_waitqueue_stop(&shard->close_queue);
+		ev_async_stop(shard->loop, &shard->watcher);
 		return;
 	}
 
-	/* pop everything from global write queue */
-	g_static_mutex_lock(&srv->logs.write_queue_mutex);
-	queue_link = g_queue_peek_head_link(&srv->logs.write_queue);
-	g_queue_init(&srv->logs.write_queue);
-	g_static_mutex_unlock(&srv->logs.write_queue_mutex);
+	/* pop everything from the write queue of this shard */
+	g_static_mutex_lock(&shard->write_queue_mutex);
+	queue_link = g_queue_peek_head_link(&shard->write_queue);
+	g_queue_init(&shard->write_queue);
+	queued_bytes = shard->queued_bytes;
+	dropped = shard->dropped - shard->dropped_reported;
+	dropped_bytes = shard->dropped_bytes - shard->dropped_bytes_reported;
+	shard->dropped_reported = shard->dropped;
+	shard->dropped_bytes_reported = shard->dropped_bytes;
+	g_static_mutex_unlock(&shard->write_queue_mutex);
+
+	if (0 != dropped) {
+		/* goes through the queue of the shard of the error log target */
+		WARNING(srv, "log thread %u: queue limit reached, dropped %" G_GUINT64_FORMAT " log entries (%" G_GUINT64_FORMAT " bytes)",
+			shard->ndx, dropped, dropped_bytes);
+	}
 
 	while (queue_link) {
 		liLogTarget *log;
 		liLogEntry *log_entry = queue_link->data;
-		GString *msg = log_entry->msg;
-		gssize bytes_written = 0;
-		gssize write_res;
-
-		if (log_entry->flags & LOG_FLAG_TIMESTAMP) {
-			GString *ts = log_timestamp_format(srv);
-			g_string_prepend_c(msg, ' ');
-			g_string_prepend_len(msg, GSTR_LEN(ts));
-		}
+		struct iovec iov[LOG_WRITEV_MAX];
+		guint iovcnt = 0;
+		int err;
 
-		g_string_append_len(msg, CONST_STR_LEN("\n"));
+		log_entry_prepare(shard, log_entry);
 
-		log = log_open(srv, log_entry->path);
+		log = log_open(shard, log_entry->path);
 
 		if (NULL == log || -1 == log->fd) {
-			li_log_write_stderr(srv, msg->str, TRUE);
-			goto next;
+			li_log_write_stderr(srv, log_entry->msg->str, FALSE);
+			queue_link_next = queue_link->next;
+			log_entry_free(log_entry);
+			queue_link = queue_link_next;
+			continue;
 		}
 
-		/* todo: support for other logtargets than files */
-		while (bytes_written < (gssize)msg->len) {
-			write_res = write(log->fd, msg->str + bytes_written, msg->len - bytes_written);
-			/* write_res = msg->len; */
-
-			/* write() failed, check why */
-			if (write_res == -1) {
-				GString *str;
-				int err = errno;
-
-				switch (err) {
-					case EAGAIN:
-					case EINTR:
-						continue;
-				}
-
-				str = g_string_sized_new(63);
-				g_string_printf(str, "could not write to log '%s': %s\n", log_entry->path->str, g_strerror(err));
-				li_log_write_stderr(srv, str->str, TRUE);
-				li_log_write_stderr(srv, msg->str, TRUE);
-				break;
-			}
-			else {
-				bytes_written += write_res;
-				assert(bytes_written <= (gssize) msg->len);
+		/* collect following entries for the same target into one writev() */
+		for (queue_link_next = queue_link; NULL != queue_link_next && iovcnt < LOG_WRITEV_MAX; queue_link_next = queue_link_next->next) {
+			liLogEntry *e = queue_link_next->data;
+
+			if (e != log_entry) {
+				if (!g_string_equal(e->path, log_entry->path)) break;
+				log_entry_prepare(shard, e);
 			}
+
+			iov[iovcnt].iov_base = e->msg->str;
+			iov[iovcnt].iov_len = e->msg->len;
+			iovcnt++;
 		}
 
-next:
-		queue_link_next = queue_link->next;
-		g_string_free(log_entry->path, TRUE);
-		g_string_free(log_entry->msg, TRUE);
-		g_slice_free(liLogEntry, log_entry);
-		queue_link = queue_link_next;
+		/* todo: support for other logtargets than files */
+		if (0 != (err = log_writev(log->fd, iov, iovcnt))) {
+			GString *str = g_string_sized_new(63);
+			g_string_printf(str, "could not write to log '%s': %s", log_entry->path->str, g_strerror(err));
+			li_log_write_stderr(srv, str->str, TRUE);
+			g_string_free(str, TRUE);
+		}
+
+		while (queue_link != queue_link_next) {
+			GList *next = queue_link->next;
+			if (0 != err) {
+				li_log_write_stderr(srv, ((liLogEntry*) queue_link->data)->msg->str, FALSE);
+			}
+			log_entry_free(queue_link->data);
+			queue_link = next;
+		}
 	}
 
+	/* everything popped above is written now */
+	g_static_mutex_lock(&shard->write_queue_mutex);
+	shard->queued_bytes -= queued_bytes;
+	g_static_mutex_unlock(&shard->write_queue_mutex);
+
 	if (g_atomic_int_get(&srv->logs.thread_finish) == TRUE) {
 		liWaitQueueElem *wqe;
 
-		while ((wqe = li_waitqueue_pop_force(&srv->logs.close_queue)) != NULL) {
-			log_close(srv, wqe->data);
+		while ((wqe = li_waitqueue_pop_force(&shard->close_queue)) != NULL) {
+			log_close(shard, wqe->data);
 		}
-		li_waitqueue_stop(&srv->logs.close_queue);
-		ev_async_stop(srv->logs.loop, &srv->logs.watcher);
+		li_waitqueue_stop(&shard->close_queue);
+		ev_async_stop(shard->loop, &shard->watcher);
 		return;
 	}
 
@@ -474,14 +764,18 @@ gchar* li_log_level_str(liLogLevel log_level) {
 void li_log_thread_start(liServer *srv) {
 	GError *err = NULL;
 
-	ev_async_start(srv->logs.loop, &srv->logs.watcher);
+	for (guint i = 0; i < srv->logs.shard_count; i++) {
+		liLogShard *shard = &srv->logs.shards[i];
 
-	srv->logs.thread = g_thread_create((GThreadFunc)log_thread, srv, TRUE, &err);
+		ev_async_start(shard->loop, &shard->watcher);
 
-	if (srv->logs.thread == NULL) {
-		g_printerr("could not create logging thread: %s\n", err->message);
-		g_error_free(err);
-		abort();
+		shard->thread = g_thread_create((GThreadFunc)log_thread, shard, TRUE, &err);
+
+		if (shard->thread == NULL) {
+			g_printerr("could not create logging thread: %s\n", err->message);
+			g_error_free(err);
+			abort();
+		}
 	}
 
 	g_atomic_int_set(&srv->logs.thread_alive, TRUE);
@@ -505,7 +799,9 @@ void li_log_thread_wakeup(liServer *srv) {
 	if (!g_atomic_int_get(&srv->logs.thread_alive))
 		li_log_thread_start(srv);
 
-	ev_async_send(srv->logs.loop, &srv->logs.watcher);
+	for (guint i = 0; i < srv->logs.shard_count; i++) {
+		ev_async_send(srv->logs.shards[i].loop, &srv->logs.shards[i].watcher);
+	}
 }
 
 void li_log_split_lines(liServer *srv, liWorker *wrk, liLogContext *context, liLogLevel log_level, guint flags, gchar *txt, const gchar *prefix) {
@@ -46,6 +46,19 @@ static void li_plugin_free_actions(liServer *srv, liPlugin *p) {
 	}
 }
 
+/* names keep their index if a plugin gets reloaded */
+static guint plugin_action_time_ndx(liServer *srv, const gchar *name) {
+	guint i;
+
+	for (i = 0; i < srv->action_names->len; i++) {
+		if (g_str_equal(g_ptr_array_index(srv->action_names, i), name)) return i + 1;
+	}
+
+	g_ptr_array_add(srv->action_names, g_strdup(name));
+
+	return srv->action_names->len;
+}
+
 static void li_plugin_free_setups(liServer *srv, liPlugin *p) {
 	size_t i;
 	const liPluginSetup *ps;
@@ -228,6 +241,7 @@ liPlugin *li_plugin_register(liServer *srv, const gchar *name, liPluginInitCB in
 			sa->create_action = pa->create_action;
 			sa->p = p;
 			sa->userdata = pa->userdata;
+			sa->time_ndx = plugin_action_time_ndx(srv, pa->name);
 			g_hash_table_insert(srv->actions, (gchar*) pa->name, sa);
 		}
 	}
@@ -420,6 +434,8 @@ liAction* li_create_action(liServer *srv, liWorker *wrk, const gchar *name, liVa
 		return NULL;
 	}
 
+	if (0 == a->time_ndx) a->time_ndx = sa->time_ndx;
+
 	return a;
 }
 
@@ -553,12 +553,122 @@ static liAction* core_index(liServer *srv, liWorker *wrk, liPlugin* p, liValue *
 }
 
 
+static const struct {
+	const gchar *encoding;
+	const gchar *suffix;
+} core_static_precompressed_types[] = {
+	{ "gzip", ".gz" },
+	{ "br", ".br" },
+	{ "bzip2", ".bz2" },
+	{ "zstd", ".zst" },
+	{ NULL, NULL }
+};
+
+static const gchar* core_static_precompressed_suffix(const gchar *encoding) {
+	guint i;
+
+	for (i = 0; NULL != core_static_precompressed_types[i].encoding; i++) {
+		if (0 == strcmp(encoding, core_static_precompressed_types[i].encoding))
+			return core_static_precompressed_types[i].suffix;
+	}
+
+	return NULL;
+}
+
+/* checks whether the client listed the encoding in an Accept-Encoding header, ignoring entries with q=0 */
+static gboolean core_static_accepts_encoding(liVRequest *vr, const gchar *encoding) {
+	GList *hh_entry;
+	gsize len = strlen(encoding);
+
+	for (hh_entry = li_http_header_find_first(vr->request.headers, CONST_STR_LEN("accept-encoding"));
+	     NULL != hh_entry;
+	     hh_entry = li_http_header_find_next(hh_entry, CONST_STR_LEN("accept-encoding"))) {
+		liHttpHeader *hh = (liHttpHeader*) hh_entry->data;
+		const gchar *s = LI_HEADER_VALUE(hh), *p;
+
+		for (p = s; NULL != (p = strstr(p, encoding)); p += len) {
+			const gchar *q = p + len;
+
+			if (p != s && p[-1] != ' ' && p[-1] != ',') continue;
+			if (*q != '\0' && *q != ',' && *q != ';' && *q != ' ') continue;
+
+			while (*q == ' ') q++;
+			if (*q == ';') {
+				q++;
+				while (*q == ' ') q++;
+				if ((q[0] == 'q' || q[0] == 'Q') && q[1] == '=' && 0.0 == g_ascii_strtod(q + 2, NULL)) return FALSE;
+			}
+
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/* looks for "<path><suffix>" siblings of the static file in order of the configured encodings;
+ * replaces fd/st with the first regular sibling accepted by the client that is not older than the original */
+static liHandlerResult core_static_precompressed(liVRequest *vr, GArray *encodings, int *fd, struct stat *st, const gchar **encoding) {
+	GString *path = vr->wrk->tmp_str;
+	guint i;
+
+	for (i = 0; i < encodings->len; i++) {
+		liValue *v = g_array_index(encodings, liValue*, i);
+		const gchar *name = v->data.string->str;
+		const gchar *suffix = core_static_precompressed_suffix(name);
+		liHandlerResult res;
+		struct stat sst;
+		int serr, sfd = -1;
+
+		if (NULL == suffix || !core_static_accepts_encoding(vr, name)) continue;
+
+		g_string_truncate(path, 0);
+		g_string_append_len(path, GSTR_LEN(vr->physical.path));
+		g_string_append(path, suffix);
+
+		res = li_stat_cache_get(vr, path, &sst, &serr, &sfd);
+		if (res == LI_HANDLER_WAIT_FOR_EVENT) {
+			/* the original file is still in the stat cache when we come back */
+			close(*fd);
+			*fd = -1;
+			return res;
+		}
+
+		if (res == LI_HANDLER_ERROR) {
+			if (sfd != -1)
+				close(sfd);
+			continue;
+		}
+
+		if (!S_ISREG(sst.st_mode) || sst.st_mtime < st->st_mtime) {
+			if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+				VR_DEBUG(vr, "ignoring precompressed file '%s': not a regular file or older than the original", path->str);
+			}
+			close(sfd);
+			continue;
+		}
+
+		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+			VR_DEBUG(vr, "serving precompressed file '%s' (%s)", path->str, name);
+		}
+
+		close(*fd);
+		*fd = sfd;
+		*st = sst;
+		*encoding = name;
+		return LI_HANDLER_GO_ON;
+	}
+
+	return LI_HANDLER_GO_ON;
+}
+
 static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpointer *context) {
 	int fd = -1;
 	struct stat st;
 	int err;
 	liHandlerResult res;
 	GArray *exclude_arr = CORE_OPTIONPTR(LI_CORE_OPTION_STATIC_FILE_EXCLUDE_EXTENSIONS).list;
+	GArray *precompressed_arr = CORE_OPTIONPTR(LI_CORE_OPTION_STATIC_PRECOMPRESSED).list;
 	static const gchar boundary[] = "fkj49sn38dcn3";
 	gboolean no_fail = GPOINTER_TO_INT(param);
 
@@ -663,8 +773,16 @@ static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpoint
 		gboolean ranged_response = FALSE;
 		liHttpHeader *hh_range;
 		liChunkFile *cf;
+		const gchar *encoding = NULL;
 		static const GString default_mime_str = { CONST_STR_LEN("application/octet-stream"), 0 };
 
+		/* ranges always refer to the original file */
+		if (precompressed_arr && !li_http_header_lookup(vr->request.headers, CONST_STR_LEN("range"))) {
+			res = core_static_precompressed(vr, precompressed_arr, &fd, &st, &encoding);
+			if (res != LI_HANDLER_GO_ON)
+				return res;
+		}
+
 #ifdef FD_CLOEXEC
 		fcntl(fd, F_SETFD, FD_CLOEXEC);
 #endif
@@ -674,7 +792,35 @@ static liHandlerResult core_handle_static(liVRequest *vr, gpointer param, gpoint
 			return LI_HANDLER_ERROR;
 		}
 
-		li_etag_set_header(vr, &st, &cachable);
+		if (precompressed_arr) {
+			/* announce that we have looked for accept-encoding */
+			li_http_header_append(vr->response.headers, CONST_STR_LEN("Vary"), CONST_STR_LEN("Accept-Encoding"));
+		}
+
+		if (NULL != encoding) {
+			liHttpHeader *hh_etag;
+
+			li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Encoding"), encoding, strlen(encoding));
+
+			/* same etag scheme as mod_deflate: the encoded variant gets its own etag */
+			li_etag_set_header(vr, &st, NULL);
+			hh_etag = li_http_header_lookup(vr->response.headers, CONST_STR_LEN("etag"));
+			if (hh_etag) {
+				GString *s = vr->wrk->tmp_str;
+
+				g_string_truncate(s, 0);
+				g_string_append_len(s, LI_HEADER_VALUE_LEN(hh_etag));
+				g_string_append_len(s, CONST_STR_LEN("-"));
+				g_string_append(s, encoding);
+				li_etag_mutate(s, s);
+				g_string_truncate(hh_etag->data, hh_etag->keylen + 2);
+				g_string_append_len(hh_etag->data, GSTR_LEN(s));
+			}
+			cachable = li_http_response_handle_cachable(vr);
+		} else {
+			li_etag_set_header(vr, &st, &cachable);
+		}
+
 		if (cachable) {
 			vr->response.http_status = 304;
 			close(fd);
@@ -1286,6 +1432,21 @@ static gboolean core_io_timeout(liServer *srv, liPlugin* p, liValue *val, gpoint
 	return TRUE;
 }
 
+static gboolean core_stats_shm(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(p); UNUSED(userdata);
+
+	if (!val || val->type != LI_VALUE_STRING || !val->data.string->len) {
+		ERROR(srv, "%s", "stats.shm expects a filename as parameter");
+		return FALSE;
+	}
+
+	if (srv->stats_shm_path)
+		g_string_free(srv->stats_shm_path, TRUE);
+	srv->stats_shm_path = g_string_new_len(GSTR_LEN(val->data.string));
+
+	return TRUE;
+}
+
 static gboolean core_stat_cache_ttl(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
 	UNUSED(p); UNUSED(userdata);
 
@@ -1441,7 +1602,35 @@ static gboolean core_setup_log_timestamp(liServer *srv, liPlugin* p, liValue *va
 		g_string_free(srv->logs.timestamp.format, TRUE);
 	}
 	srv->logs.timestamp.format = li_value_extract_string(val);
-	srv->logs.timestamp.last_ts = 0;
+
+	return TRUE;
+}
+
+static gboolean core_setup_log_threads(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(p); UNUSED(userdata);
+
+	if (!val || val->type != LI_VALUE_NUMBER || val->data.number < 1 || val->data.number > 64) {
+		ERROR(srv, "%s", "log.threads expects a number between 1 and 64 as parameter");
+		return FALSE;
+	}
+
+	if (!li_log_set_threads(srv, val->data.number)) {
+		ERROR(srv, "%s", "log.threads can't be changed after the log threads were started");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean core_setup_log_queue_limit(liServer *srv, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(p); UNUSED(userdata);
+
+	if (!val || val->type != LI_VALUE_NUMBER || val->data.number < 0) {
+		ERROR(srv, "%s", "log.queue_limit expects a positive number (bytes, 0 = unlimited) as parameter");
+		return FALSE;
+	}
+
+	srv->logs.queue_limit = val->data.number;
 
 	return TRUE;
 }
@@ -1470,6 +1659,33 @@ static gboolean core_option_static_exclude_exts_parse(liServer *srv, liWorker *w
 	return TRUE;
 }
 
+static gboolean core_option_static_precompressed_parse(liServer *srv, liWorker *wrk, liPlugin *p, size_t ndx, liValue *val, gpointer *oval) {
+	GArray *arr;
+	UNUSED(wrk);
+	UNUSED(p);
+	UNUSED(ndx);
+
+	if (!val) return TRUE;
+
+	arr = val->data.list;
+	for (guint i = 0; i < arr->len; i++) {
+		liValue *v = g_array_index(arr, liValue*, i);
+		if (v->type != LI_VALUE_STRING) {
+			ERROR(srv, "static.precompressed option expects a list of strings, entry #%u is of type %s", i, li_value_type_string(v->type));
+			return FALSE;
+		}
+		if (NULL == core_static_precompressed_suffix(v->data.string->str)) {
+			ERROR(srv, "static.precompressed: unknown encoding '%s' (supported: gzip, br, bzip2, zstd)", v->data.string->str);
+			return FALSE;
+		}
+	}
+
+	/* everything ok */
+	*oval = li_value_extract_list(val);
+
+	return TRUE;
+}
+
 
 static gboolean core_option_mime_types_parse(liServer *srv, liWorker *wrk, liPlugin *p, size_t ndx, liValue *val, gpointer *oval) {
 	GArray *arr;
@@ -1751,24 +1967,46 @@ static liHandlerResult core_handle_throttle_pool(liVRequest *vr, gpointer param,
 	return LI_HANDLER_GO_ON;
 }
 
+/* looks up the named parent pool for io.throttle_pool and io.throttle_ip; returns a new reference */
+static liThrottlePool* core_throttle_parent(liServer *srv, const char *action, liValue *val) {
+	liThrottlePool *parent;
+	GString *name;
+
+	if (val->type != LI_VALUE_STRING) {
+		ERROR(srv, "%s: parent pool name has to be a string", action);
+		return NULL;
+	}
+
+	name = g_string_new_len(GSTR_LEN(val->data.string));
+	parent = li_throttle_pool_new(srv, LI_THROTTLE_POOL_NAME, name, 0, NULL);
+
+	if (!parent) {
+		ERROR(srv, "%s: parent pool '%s' hasn't been defined", action, val->data.string->str);
+		g_string_free(name, TRUE);
+		return NULL;
+	}
+
+	return parent;
+}
+
 static liAction* core_throttle_pool(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
 	GString *name;
-	liThrottlePool *pool = NULL;
+	liThrottlePool *pool = NULL, *parent = NULL;
 	gint64 rate;
 
 	UNUSED(wrk); UNUSED(p); UNUSED(userdata);
 
 	if (val->type != LI_VALUE_STRING && val->type != LI_VALUE_LIST) {
-		ERROR(srv, "'io.throttle_pool' action expects a string or a string-number tuple as parameter, %s given", li_value_type_string(val->type));
+		ERROR(srv, "'io.throttle_pool' action expects a string, a string-number tuple or a string-number-string tuple as parameter, %s given", li_value_type_string(val->type));
 		return NULL;
 	}
 
 	if (val->type == LI_VALUE_LIST) {
-		if (val->data.list->len != 2
+		if ((val->data.list->len != 2 && val->data.list->len != 3)
 			|| g_array_index(val->data.list, liValue*, 0)->type != LI_VALUE_STRING
 			|| g_array_index(val->data.list, liValue*, 1)->type != LI_VALUE_NUMBER) {
 
-			ERROR(srv, "%s", "'io.throttle_pool' action expects a string or a string-number tuple as parameter");
+			ERROR(srv, "%s", "'io.throttle_pool' action expects a string, a string-number tuple or a string-number-string tuple as parameter");
 			return NULL;
 		}
 
@@ -1784,63 +2022,110 @@ static liAction* core_throttle_pool(liServer *srv, liWorker *wrk, liPlugin* p, l
 			return NULL;
 		}
 
+		if (val->data.list->len == 3) {
+			parent = core_throttle_parent(srv, "io.throttle_pool", g_array_index(val->data.list, liValue*, 2));
+			if (!parent) return NULL;
+		}
+
 		name = li_value_extract_string(g_array_index(val->data.list, liValue*, 0));
 	} else {
 		name = li_value_extract_string(val);
 		rate = 0;
 	}
 
-	pool = li_throttle_pool_new(srv, LI_THROTTLE_POOL_NAME, name, rate);
+	pool = li_throttle_pool_new(srv, LI_THROTTLE_POOL_NAME, name, rate, parent);
 
 	if (!pool) {
 		ERROR(srv, "io.throttle_pool: rate for pool '%s' hasn't been defined", name->str);
+		g_string_free(name, TRUE);
+		if (parent) li_throttle_pool_free(srv, parent);
 		return NULL;
 	}
 
 	if (rate != pool->rate && rate != 0) {
 		ERROR(srv, "io.throttle_pool: pool '%s' already defined but with different rate (%ukbyte/s)", pool->data.name->str, pool->rate);
+		li_throttle_pool_free(srv, pool);
+		if (parent) li_throttle_pool_free(srv, parent);
 		return NULL;
 	}
 
+	if (parent && pool->parent != parent) {
+		ERROR(srv, "io.throttle_pool: pool '%s' already defined but with a different parent", pool->data.name->str);
+		li_throttle_pool_free(srv, pool);
+		li_throttle_pool_free(srv, parent);
+		return NULL;
+	}
+
+	/* the pool keeps its own reference */
+	if (parent) li_throttle_pool_free(srv, parent);
+
 	return li_action_new_function(core_handle_throttle_pool, NULL, core_throttle_pool_free, pool);
 }
 
+typedef struct core_throttle_ip_param core_throttle_ip_param;
+struct core_throttle_ip_param {
+	gint rate;
+	liThrottlePool *parent;
+};
+
+static void core_throttle_ip_free(liServer *srv, gpointer param) {
+	core_throttle_ip_param *ipp = param;
+
+	if (ipp->parent) li_throttle_pool_free(srv, ipp->parent);
+
+	g_slice_free(core_throttle_ip_param, ipp);
+}
+
 static liHandlerResult core_handle_throttle_ip(liVRequest *vr, gpointer param, gpointer *context) {
 	liThrottlePool *pool;
-	gint rate = GPOINTER_TO_INT(param);
+	core_throttle_ip_param *ipp = param;
 
 	UNUSED(context);
 
-	pool = li_throttle_pool_new(vr->wrk->srv, LI_THROTTLE_POOL_IP, &vr->coninfo->remote_addr, rate);
+	pool = li_throttle_pool_new(vr->wrk->srv, LI_THROTTLE_POOL_IP, &vr->coninfo->remote_addr, ipp->rate, ipp->parent);
 	li_throttle_pool_acquire(vr, pool);
 
 	return LI_HANDLER_GO_ON;
 }
 
 static liAction* core_throttle_ip(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
+	core_throttle_ip_param *ipp;
+	liThrottlePool *parent = NULL;
 	gint64 rate;
 
 	UNUSED(wrk); UNUSED(p); UNUSED(userdata);
 
-	if (val->type != LI_VALUE_NUMBER) {
-		ERROR(srv, "'io.throttle_ip' action expects a positiv integer as parameter, %s given", li_value_type_string(val->type));
+	if (val->type == LI_VALUE_LIST && val->data.list->len == 2
+		&& g_array_index(val->data.list, liValue*, 0)->type == LI_VALUE_NUMBER) {
+		/* (rate, "parent") */
+		rate = g_array_index(val->data.list, liValue*, 0)->data.number;
+		val = g_array_index(val->data.list, liValue*, 1);
+		parent = core_throttle_parent(srv, "io.throttle_ip", val);
+		if (!parent) return NULL;
+	} else if (val->type == LI_VALUE_NUMBER) {
+		rate = val->data.number;
+	} else {
+		ERROR(srv, "'io.throttle_ip' action expects a positiv integer or an integer-string tuple as parameter, %s given", li_value_type_string(val->type));
 		return NULL;
 	}
 
-
-	rate = val->data.number;
-
 	if (rate < 32*1024) {
 		ERROR(srv, "io.throttle_pool: rate %"G_GINT64_FORMAT" is too low (32kbyte/s minimum)", rate);
+		if (parent) li_throttle_pool_free(srv, parent);
 		return NULL;
 	}
 
 	if (rate > 0xFFFFFFFF) {
 		ERROR(srv, "io.throttle_pool: rate %"G_GINT64_FORMAT" is too high (4gbyte/s maximum)", rate);
+		if (parent) li_throttle_pool_free(srv, parent);
 		return NULL;
 	}
 
-	return li_action_new_function(core_handle_throttle_ip, NULL, NULL, GINT_TO_POINTER(rate));
+	ipp = g_slice_new(core_throttle_ip_param);
+	ipp->rate = rate;
+	ipp->parent = parent;
+
+	return li_action_new_function(core_handle_throttle_ip, NULL, core_throttle_ip_free, ipp);
 }
 
 static void core_throttle_connection_free(liServer *srv, gpointer param) {
@@ -1856,6 +2141,7 @@ static liHandlerResult core_handle_throttle_connection(liVRequest *vr, gpointer
 	UNUSED(context);
 
 	vr->throttle.con.rate = throttle_param->rate;
+	vr->throttle.con.last_update = CUR_TS(vr->wrk);
 	vr->throttled = TRUE;
 
 	if (vr->throttle.pool.magazine) {
@@ -2057,6 +2343,7 @@ static void core_suspend(liServer *srv, liPlugin *p, gint32 id, GString *data) {
 
 static const liPluginOption options[] = {
 	{ "debug.log_request_handling", LI_VALUE_BOOLEAN, FALSE, NULL },
+	{ "debug.trace_slow", LI_VALUE_NUMBER, 0, NULL }, /* milliseconds, 0 = disabled */
 
 	{ "static.range_requests", LI_VALUE_BOOLEAN, TRUE, NULL },
 
@@ -2072,12 +2359,15 @@ static const liPluginOption options[] = {
 
 static const liPluginOptionPtr optionptrs[] = {
 	{ "static.exclude_extensions", LI_VALUE_LIST, NULL, core_option_static_exclude_exts_parse, NULL },
+	{ "static.precompressed", LI_VALUE_LIST, NULL, core_option_static_precompressed_parse, NULL },
 
 	{ "server.name", LI_VALUE_STRING, NULL, NULL, NULL },
 	{ "server.tag", LI_VALUE_STRING, PACKAGE_DESC, NULL, NULL },
 
 	{ "mime_types", LI_VALUE_LIST, NULL, core_option_mime_types_parse, core_option_mime_types_free },
 
+	{ "debug.trace_slow_log", LI_VALUE_STRING, NULL, NULL, NULL }, /* log target for debug.trace_slow, default is the error log (info level) */
+
 	{ NULL, 0, NULL, NULL, NULL }
 };
 
@@ -2129,9 +2419,12 @@ static const liPluginSetup setups[] = {
 	{ "module_load", core_module_load, NULL },
 	{ "io.timeout", core_io_timeout, NULL },
 	{ "stat_cache.ttl", core_stat_cache_ttl, NULL },
+	{ "stats.shm", core_stats_shm, NULL },
 	{ "tasklet_pool.threads", core_tasklet_pool_threads, NULL },
 	{ "log", core_setup_log, NULL },
 	{ "log.timestamp", core_setup_log_timestamp, NULL },
+	{ "log.threads", core_setup_log_threads, NULL },
+	{ "log.queue_limit", core_setup_log_queue_limit, NULL },
 
 	{ NULL, NULL, NULL }
 };
@@ -2156,20 +2449,19 @@ static void plugin_core_prepare(liServer *srv, liPlugin *p) {
 		liThrottlePool *pool = g_array_index(srv->throttle_pools, liThrottlePool*, i);
 
 		if (!pool->worker_queues) {
-			guint j;
+			li_throttle_pool_prepare(srv, pool);
+		}
+	}
+	g_mutex_unlock(srv->action_mutex);
 
-			pool->worker_magazine = g_new0(gint, srv->worker_count);
-			pool->worker_last_rearm = g_new0(gint, srv->worker_count);
-			pool->worker_num_cons_queued = g_new0(gint, srv->worker_count);
-			pool->worker_queues = g_new0(GQueue*, srv->worker_count);
+	if (srv->stats_shm_path && !srv->stats_shm) {
+		GError *err = NULL;
 
-			for (j = 0; j < srv->worker_count; j++) {
-				pool->worker_queues[j] = g_queue_new();
-				pool->worker_last_rearm[j] = pool->last_rearm;
-			}
+		if (NULL == (srv->stats_shm = li_stats_shm_create(srv->stats_shm_path->str, srv->worker_count, &err))) {
+			ERROR(srv, "stats.shm: %s", err->message);
+			g_error_free(err);
 		}
 	}
-	g_mutex_unlock(srv->action_mutex);
 }
 
 static void plugin_core_prepare_worker(liServer *srv, liPlugin *p, liWorker *wrk) {
@@ -2,6 +2,10 @@
 #include <lighttpd/base.h>
 #include <lighttpd/plugin_core.h>
 
+#ifdef WITH_PROFILER
+# include <lighttpd/profiler.h>
+#endif
+
 #ifdef HAVE_LUA_H
 # include <lighttpd/core_lua.h>
 # include <lualib.h>
@@ -92,6 +96,19 @@ static void sigpipe_cb(struct ev_loop *loop, struct ev_signal *w, int revents) {
 	UNUSED(loop); UNUSED(w); UNUSED(revents);
 }
 
+#ifdef WITH_PROFILER
+static void sigusr2_cb(struct ev_loop *loop, struct ev_signal *w, int revents) {
+	liServer *srv = (liServer*) w->data;
+	UNUSED(loop);
+	UNUSED(revents);
+
+	if (!li_profiler_enabled) return;
+
+	INFO(srv, "%s", "Got signal USR2, dumping memory profile");
+	li_profiler_dump(10240);
+}
+#endif
+
 liServer* li_server_new(const gchar *module_dir, gboolean module_resident) {
 	liServer* srv = g_slice_new0(liServer);
 
@@ -127,6 +144,7 @@ liServer* li_server_new(const gchar *module_dir, gboolean module_resident) {
 	srv->optionptrs = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, server_optionptr_free);
 	srv->actions = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, server_action_free);
 	srv->setups  = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, server_setup_free);
+	srv->action_names = g_ptr_array_new();
 
 	srv->li_plugins_handle_close = g_array_new(FALSE, TRUE, sizeof(liPlugin*));
 	srv->li_plugins_handle_vrclose = g_array_new(FALSE, TRUE, sizeof(liPlugin*));
@@ -252,6 +270,10 @@ void li_server_free(liServer* srv) {
 		g_array_free(srv->workers, TRUE);
 	}
 
+	li_stats_shm_free(srv->stats_shm);
+	if (srv->stats_shm_path)
+		g_string_free(srv->stats_shm_path, TRUE);
+
 	{
 		guint i; for (i = 0; i < srv->sockets->len; i++) {
 			liServerSocket *sock = g_ptr_array_index(srv->sockets, i);
@@ -286,6 +308,13 @@ void li_server_free(liServer* srv) {
 	li_server_plugins_free(srv);
 	g_array_free(srv->li_plugins_handle_close, TRUE);
 	g_array_free(srv->li_plugins_handle_vrclose, TRUE);
+	{
+		guint i;
+		for (i = 0; i < srv->action_names->len; i++) {
+			g_free(g_ptr_array_index(srv->action_names, i));
+		}
+	}
+	g_ptr_array_free(srv->action_names, TRUE);
 
 	g_mutex_free(srv->action_mutex);
 
@@ -357,6 +386,9 @@ static gboolean li_server_worker_init(liServer *srv) {
 	CATCH_SIGNAL(loop, sigint_cb, INT);
 	CATCH_SIGNAL(loop, sigint_cb, TERM);
 	CATCH_SIGNAL(loop, sigpipe_cb, PIPE);
+#ifdef WITH_PROFILER
+	CATCH_SIGNAL(loop, sigusr2_cb, USR2);
+#endif
 
 	ev_timer_init(&srv->srv_1sec_timer, li_server_1sec_timer, 1.0, 1.0);
 	srv->srv_1sec_timer.data = srv;
@@ -424,7 +456,8 @@ static void li_server_listen_cb(struct ev_loop *loop, ev_io *w, int revents) {
 
 	for ( ;; ) {
 		liWorker *wrk;
-		guint i, min_load, srv_cur_load, srv_max_load;
+		guint i, srv_cur_load, srv_max_load;
+		guint64 min_load, avg_load;
 
 		srv_cur_load = g_atomic_int_get(&srv->connection_load);
 		srv_max_load = g_atomic_int_get(&srv->max_connections);
@@ -448,8 +481,11 @@ static void li_server_listen_cb(struct ev_loop *loop, ev_io *w, int revents) {
 		li_fd_no_block(s); /* we don't fork, don't care about FD_CLOEXEC */
 #endif
 
+		/* pressure (cpu usage and loop lag, see worker.c) counts up to twice the average connections per
+		 * worker (+1), so a worker busy with few heavy connections doesn't get all new ones */
+		avg_load = srv_cur_load / srv->worker_count + 1;
 		wrk = srv->main_worker;
-		min_load = g_atomic_int_get(&wrk->connection_load);
+		min_load = (guint64) g_atomic_int_get(&wrk->connection_load) * 1000 + avg_load * g_atomic_int_get(&wrk->load_pressure);
 
 		if (l <= sizeof(sa)) {
 			remote_addr.addr = g_slice_alloc(l);
@@ -461,7 +497,7 @@ static void li_server_listen_cb(struct ev_loop *loop, ev_io *w, int revents) {
 
 		for (i = 1; i < srv->worker_count; i++) {
 			liWorker *wt = g_array_index(srv->workers, liWorker*, i);
-			guint load = g_atomic_int_get(&wt->connection_load);
+			guint64 load = (guint64) g_atomic_int_get(&wt->connection_load) * 1000 + avg_load * g_atomic_int_get(&wt->load_pressure);
 			if (load < min_load) {
 				wrk = wt;
 				min_load = load;
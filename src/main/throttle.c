@@ -2,13 +2,49 @@
  * Implemented with token bucket algorithm.
  * On average, the rate of bytes/s never exceeds the specified limit
  * but allows small bursts of previously unused bandwidth (max rate*2 for 1 second).
+ *
+ * The magazine of a worker is split among the queued connections and child pools with
+ * deficit round robin: every queued entry gets the same quantum, entries that didn't get
+ * one stay at the head of the queue for the next round, and the rest is kept for later.
+ * A child pool takes at most what its parent granted it, so a parent with one child pool
+ * per client is shared per client instead of per connection. A connection in a child pool
+ * isn't queued in the parent itself, the parent only sees the child pool.
+ *
+ * Throttled connections sleep on a per worker timer wheel with THROTTLE_GRANULARITY ticks,
+ * each one only as long as its rate needs to refill a reasonable chunk; the connection rate
+ * is handed out based on the time since the last refill, so the traffic stays smooth.
  */
 
 #include <lighttpd/base.h>
 
 static void li_throttle_pool_rearm(liWorker *wrk, liThrottlePool *pool);
 
-liThrottlePool *li_throttle_pool_new(liServer *srv, liThrottlePoolType type, gpointer param, guint rate) {
+static liRadixTree* throttle_ip_tree(liServer *srv, liThrottlePool *parent) {
+	if (!parent) return srv->throttle_ip_pools;
+
+	if (!parent->ip_pools) parent->ip_pools = li_radixtree_new();
+	return parent->ip_pools;
+}
+
+void li_throttle_pool_prepare(liServer *srv, liThrottlePool *pool) {
+	guint i;
+
+	pool->worker_magazine = g_new0(gint, srv->worker_count);
+	pool->worker_last_rearm = g_new0(gint, srv->worker_count);
+	pool->worker_num_cons_queued = g_new0(gint, srv->worker_count);
+	pool->worker_queues = g_new0(GQueue*, srv->worker_count);
+	pool->worker_child_queues = g_new0(GQueue*, srv->worker_count);
+	pool->worker_parent_magazine = g_new0(gint, srv->worker_count);
+	pool->worker_parent_lnk = g_new0(GList, srv->worker_count);
+
+	for (i = 0; i < srv->worker_count; i++) {
+		pool->worker_queues[i] = g_queue_new();
+		pool->worker_child_queues[i] = g_queue_new();
+		pool->worker_last_rearm[i] = pool->last_rearm;
+	}
+}
+
+liThrottlePool *li_throttle_pool_new(liServer *srv, liThrottlePoolType type, gpointer param, guint rate, liThrottlePool *parent) {
 	liThrottlePool *pool;
 	guint i;
 
@@ -31,11 +67,12 @@ liThrottlePool *li_throttle_pool_new(liServer *srv, liThrottlePoolType type, gpo
 	} else {
 		/* IP address pool */
 		liSocketAddress *remote_addr = param;
+		liRadixTree *tree = throttle_ip_tree(srv, parent);
 
 		if (remote_addr->addr->plain.sa_family == AF_INET)
-			pool = li_radixtree_lookup_exact(srv->throttle_ip_pools, &remote_addr->addr->ipv4.sin_addr.s_addr, 32);
+			pool = li_radixtree_lookup_exact(tree, &remote_addr->addr->ipv4.sin_addr.s_addr, 32);
 		else
-			pool = li_radixtree_lookup_exact(srv->throttle_ip_pools, &remote_addr->addr->ipv6.sin6_addr.s6_addr, 128);
+			pool = li_radixtree_lookup_exact(tree, &remote_addr->addr->ipv6.sin6_addr.s6_addr, 128);
 
 		if (pool) {
 			g_mutex_unlock(srv->action_mutex);
@@ -53,20 +90,17 @@ liThrottlePool *li_throttle_pool_new(liServer *srv, liThrottlePoolType type, gpo
 	pool->rate = rate;
 	pool->last_rearm = THROTTLE_EVTSTAMP_TO_GINT(ev_time());
 
+	if (parent) {
+		g_atomic_int_inc(&parent->refcount);
+		pool->parent = parent;
+	}
+
 	/*
 	 * We if we are not in LI_SERVER_INIT state, we can initialize the queues directly.
 	 * Otherwise they'll get initialized in the worker prepare callback.
 	 */
 	if (g_atomic_int_get(&srv->state) != LI_SERVER_INIT) {
-		pool->worker_magazine = g_new0(gint, srv->worker_count);
-		pool->worker_last_rearm = g_new0(gint, srv->worker_count);
-		pool->worker_num_cons_queued = g_new0(gint, srv->worker_count);
-		pool->worker_queues = g_new0(GQueue*, srv->worker_count);
-
-		for (i = 0; i < srv->worker_count; i++) {
-			pool->worker_queues[i] = g_queue_new();
-			pool->worker_last_rearm[i] = pool->last_rearm;
-		}
+		li_throttle_pool_prepare(srv, pool);
 	}
 
 	if (type == LI_THROTTLE_POOL_NAME) {
@@ -75,12 +109,13 @@ liThrottlePool *li_throttle_pool_new(liServer *srv, liThrottlePoolType type, gpo
 		g_array_append_val(srv->throttle_pools, pool);
 	} else {
 		liSocketAddress *remote_addr = param;
+		liRadixTree *tree = throttle_ip_tree(srv, parent);
 		pool->data.addr = li_sockaddr_dup(*remote_addr);
 
 		if (remote_addr->addr->plain.sa_family == AF_INET)
-			li_radixtree_insert(srv->throttle_ip_pools, &remote_addr->addr->ipv4.sin_addr.s_addr, 32, pool);
+			li_radixtree_insert(tree, &remote_addr->addr->ipv4.sin_addr.s_addr, 32, pool);
 		else
-			li_radixtree_insert(srv->throttle_ip_pools, &remote_addr->addr->ipv6.sin6_addr.s6_addr, 128, pool);
+			li_radixtree_insert(tree, &remote_addr->addr->ipv6.sin6_addr.s6_addr, 128, pool);
 	}
 
 	g_mutex_unlock(srv->action_mutex);
@@ -106,10 +141,12 @@ void li_throttle_pool_free(liServer *srv, liThrottlePool *pool) {
 
 		g_string_free(pool->data.name, TRUE);
 	} else {
+		liRadixTree *tree = throttle_ip_tree(srv, pool->parent);
+
 		if (pool->data.addr.addr->plain.sa_family == AF_INET)
-			li_radixtree_remove(srv->throttle_ip_pools, &pool->data.addr.addr->ipv4.sin_addr.s_addr, 32);
+			li_radixtree_remove(tree, &pool->data.addr.addr->ipv4.sin_addr.s_addr, 32);
 		else
-			li_radixtree_remove(srv->throttle_ip_pools, &pool->data.addr.addr->ipv6.sin6_addr.s6_addr, 128);
+			li_radixtree_remove(tree, &pool->data.addr.addr->ipv6.sin6_addr.s6_addr, 128);
 		li_sockaddr_clear(&pool->data.addr);
 	}
 	g_mutex_unlock(srv->action_mutex);
@@ -117,22 +154,71 @@ void li_throttle_pool_free(liServer *srv, liThrottlePool *pool) {
 	if (pool->worker_queues) {
 		for (i = 0; i < srv->worker_count; i++) {
 			g_queue_free(pool->worker_queues[i]);
+			g_queue_free(pool->worker_child_queues[i]);
 		}
 
 		g_free(pool->worker_magazine);
 		g_free(pool->worker_last_rearm);
 		g_free(pool->worker_num_cons_queued);
 		g_free(pool->worker_queues);
+		g_free(pool->worker_child_queues);
+		g_free(pool->worker_parent_magazine);
+		g_free(pool->worker_parent_lnk);
 	}
 
+	/* child pools keep a reference, so there are none left */
+	if (pool->ip_pools)
+		li_radixtree_free(pool->ip_pools, NULL, NULL);
+
+	if (pool->parent)
+		li_throttle_pool_free(srv, pool->parent);
+
 	g_slice_free(liThrottlePool, pool);
 }
 
+/* a child pool is queued in its parent as long as it has queued connections or child pools */
+static void throttle_pool_queue_in_parent(liThrottlePool *pool, guint ndx) {
+	for ( ; pool->parent; pool = pool->parent) {
+		GList *lnk = &pool->worker_parent_lnk[ndx];
+
+		if (lnk->data) return; /* already queued, so are the ancestors */
+
+		lnk->data = pool;
+		g_queue_push_tail_link(pool->parent->worker_child_queues[ndx], lnk);
+		g_atomic_int_inc(&pool->parent->worker_num_cons_queued[ndx]);
+	}
+}
+
+static void throttle_pool_unqueue_from_parent(liThrottlePool *pool, guint ndx) {
+	for ( ; pool->parent; pool = pool->parent) {
+		GList *lnk = &pool->worker_parent_lnk[ndx];
+
+		if (pool->worker_queues[ndx]->length || pool->worker_child_queues[ndx]->length) return; /* still busy */
+		if (!lnk->data) return;
+
+		g_queue_unlink(pool->parent->worker_child_queues[ndx], lnk);
+		lnk->data = NULL;
+		g_atomic_int_add(&pool->parent->worker_num_cons_queued[ndx], -1);
+	}
+}
+
+static gboolean throttle_pool_has_ancestor(liThrottlePool *pool, liThrottlePool *ancestor) {
+	for (pool = pool->parent; pool; pool = pool->parent) {
+		if (pool == ancestor) return TRUE;
+	}
+	return FALSE;
+}
+
 void li_throttle_pool_acquire(liVRequest *vr, liThrottlePool *pool) {
 	/* already in this pool */
 	if (vr->throttle.pool.ptr == pool || vr->throttle.ip.ptr == pool)
 		return;
 
+	/* an IP pool below the named pool already charges it for every byte; queueing the vrequest
+	 * in the named pool too would charge it twice */
+	if (pool->type == LI_THROTTLE_POOL_NAME && vr->throttle.ip.ptr && throttle_pool_has_ancestor(vr->throttle.ip.ptr, pool))
+		return;
+
 	g_atomic_int_inc(&pool->refcount);
 
 	if (pool->type == LI_THROTTLE_POOL_NAME) {
@@ -143,6 +229,15 @@ void li_throttle_pool_acquire(liVRequest *vr, liThrottlePool *pool) {
 
 		vr->throttle.pool.ptr = pool;
 	} else {
+		if (vr->throttle.ip.ptr != NULL) {
+			/* already in a different IP pool */
+			li_throttle_pool_release(vr, vr->throttle.ip.ptr);
+		}
+		if (vr->throttle.pool.ptr != NULL && throttle_pool_has_ancestor(pool, vr->throttle.pool.ptr)) {
+			/* the named pool is charged through the IP pool from now on */
+			li_throttle_pool_release(vr, vr->throttle.pool.ptr);
+		}
+
 		vr->throttle.ip.ptr = pool;
 	}
 
@@ -159,6 +254,8 @@ void li_throttle_pool_release(liVRequest *vr, liThrottlePool *pool) {
 			g_queue_unlink(vr->throttle.pool.queue, &vr->throttle.pool.lnk);
 			vr->throttle.pool.queue = NULL;
 		}
+		/* the pool may still be queued in its parent even if the vrequest isn't queued anymore */
+		throttle_pool_unqueue_from_parent(pool, vr->wrk->ndx);
 
 		vr->throttle.pool.magazine = 0;
 		vr->throttle.pool.ptr = NULL;
@@ -168,6 +265,7 @@ void li_throttle_pool_release(liVRequest *vr, liThrottlePool *pool) {
 			g_queue_unlink(vr->throttle.ip.queue, &vr->throttle.ip.lnk);
 			vr->throttle.ip.queue = NULL;
 		}
+		throttle_pool_unqueue_from_parent(pool, vr->wrk->ndx);
 
 		vr->throttle.ip.magazine = 0;
 		vr->throttle.ip.ptr = NULL;
@@ -176,11 +274,58 @@ void li_throttle_pool_release(liVRequest *vr, liThrottlePool *pool) {
 	li_throttle_pool_free(vr->wrk->srv, pool);
 }
 
+/* deficit round robin over the queued connections and child pools; returns the amount handed out */
+static gint throttle_pool_distribute(liThrottlePool *pool, guint ndx, gint magazine) {
+	GQueue *cons = pool->worker_queues[ndx], *children = pool->worker_child_queues[ndx];
+	gint quantum, used = 0;
+	gboolean child_turn = FALSE;
+
+	if (magazine <= 0) return 0;
+
+	quantum = magazine / (cons->length + children->length);
+	if (quantum < THROTTLE_QUANTUM_MIN) quantum = MIN(magazine, THROTTLE_QUANTUM_MIN);
+
+	while (magazine - used >= quantum && (cons->length || children->length)) {
+		GList *lnk;
+
+		/* alternate between connections and child pools */
+		child_turn = !child_turn;
+		if (child_turn && !children->length) child_turn = FALSE;
+		if (!child_turn && !cons->length) child_turn = TRUE;
+
+		if (child_turn) {
+			liThrottlePool *child;
+
+			lnk = g_queue_pop_head_link(children);
+			child = lnk->data;
+			lnk->data = NULL;
+			child->worker_parent_magazine[ndx] += quantum;
+		} else {
+			liVRequest *vr;
+
+			lnk = g_queue_pop_head_link(cons);
+			vr = lnk->data;
+			if (pool->type == LI_THROTTLE_POOL_NAME) {
+				vr->throttle.pool.magazine += quantum;
+				vr->throttle.pool.queue = NULL;
+			} else {
+				vr->throttle.ip.magazine += quantum;
+				vr->throttle.ip.queue = NULL;
+			}
+		}
+
+		lnk->next = NULL;
+		lnk->prev = NULL;
+		g_atomic_int_add(&pool->worker_num_cons_queued[ndx], -1);
+		used += quantum;
+	}
+
+	return used;
+}
+
 static void li_throttle_pool_rearm(liWorker *wrk, liThrottlePool *pool) {
 	gint time_diff, supply, num_cons, magazine;
 	guint i;
-	GQueue *queue;
-	GList *lnk, *lnk_next;
 	guint now = THROTTLE_EVTSTAMP_TO_GINT(CUR_TS(wrk));
 
 	time_diff = now - pool->worker_last_rearm[wrk->ndx];
@@ -210,13 +355,14 @@ static void li_throttle_pool_rearm(liWorker *wrk, liThrottlePool *pool) {
 			}
 
 			if (num_cons) {
-				/* rearm the worker magazines */
-				supply = ((pool->rate / 1000) * MIN(time_diff, 1000)) / num_cons;
+				/* rearm the worker magazines; each worker gets its share of the rate in one division,
+				 * so rounding doesn't lose bytes per connection on every (short) rearm interval */
 				for (i = 0; i < wrk->srv->worker_count; i++) {
 					if (worker_num_cons[i] == 0)
 						continue;
 
-					g_atomic_int_add(&pool->worker_magazine[i], supply * worker_num_cons[i]);
+					supply = (gint) (((guint64) pool->rate * MIN(time_diff, 1000) * worker_num_cons[i]) / (1000 * (guint64) num_cons));
+					g_atomic_int_add(&pool->worker_magazine[i], supply);
 				}
 			}
 
@@ -229,32 +375,34 @@ static void li_throttle_pool_rearm(liWorker *wrk, liThrottlePool *pool) {
 	}
 
 
-	/* select current queue */
-	queue = pool->worker_queues[wrk->ndx];
+	if (pool->parent) {
+		li_throttle_pool_rearm(wrk, pool->parent);
+	}
 
-	if (queue->length) {
-		g_atomic_int_set(&pool->worker_num_cons_queued[wrk->ndx], 0);
+	num_cons = pool->worker_queues[wrk->ndx]->length + pool->worker_child_queues[wrk->ndx]->length;
 
+	if (num_cons) {
 		magazine = g_atomic_int_get(&pool->worker_magazine[wrk->ndx]);
-		g_atomic_int_add(&pool->worker_magazine[wrk->ndx], -magazine);
-		supply = magazine / queue->length;
+		if (pool->parent) {
+			magazine = MIN(magazine, pool->worker_parent_magazine[wrk->ndx]);
+		}
 
-		/* rearm connections */
-		for (lnk = g_queue_peek_head_link(queue); lnk != NULL; lnk = lnk_next) {
-			if (pool->type == LI_THROTTLE_POOL_NAME) {
-				((liVRequest*)lnk->data)->throttle.pool.magazine += supply;
-				((liVRequest*)lnk->data)->throttle.pool.queue = NULL;
-			} else {
-				((liVRequest*)lnk->data)->throttle.ip.magazine += supply;
-				((liVRequest*)lnk->data)->throttle.ip.queue = NULL;
-			}
-			lnk_next = lnk->next;
-			lnk->next = NULL;
-			lnk->prev = NULL;
+		supply = throttle_pool_distribute(pool, wrk->ndx, magazine);
+
+		g_atomic_int_add(&pool->worker_magazine[wrk->ndx], -supply);
+		if (pool->parent) {
+			pool->worker_parent_magazine[wrk->ndx] -= supply;
 		}
+	}
 
-		/* clear current connection queue */
-		g_queue_init(queue);
+	if (pool->parent) {
+		if (pool->worker_queues[wrk->ndx]->length || pool->worker_child_queues[wrk->ndx]->length) {
+			/* wait for the parent */
+			throttle_pool_queue_in_parent(pool, wrk->ndx);
+		} else {
+			/* served from what the parent granted before; don't keep taking its quantum while idle */
+			throttle_pool_unqueue_from_parent(pool, wrk->ndx);
+		}
 	}
 
 	pool->worker_last_rearm[wrk->ndx] = now;
@@ -264,8 +412,8 @@ void li_throttle_reset(liVRequest *vr) {
 	if (!vr->throttled)
 		return;
 
-	/* remove from throttle queue */
-	li_waitqueue_remove(&vr->wrk->throttle_queue, &vr->throttle.wqueue_elem);
+	/* remove from throttle wheel */
+	li_timerwheel_remove(&vr->wrk->throttle_wheel, &vr->throttle.timer_elem);
 
 	if (vr->throttle.pool.ptr)
 		li_throttle_pool_release(vr, vr->throttle.pool.ptr);
@@ -275,74 +423,97 @@ void li_throttle_reset(liVRequest *vr) {
 	vr->throttle.pool.magazine = 0;
 	vr->throttle.ip.magazine = 0;
 	vr->throttle.con.rate = 0;
+	vr->throttle.con.last_update = 0;
 	vr->throttle.magazine = 0;
 	vr->throttled = FALSE;
 }
 
-void li_throttle_cb(liWaitQueue *wq, gpointer data) {
-	liWaitQueueElem *wqe;
-	liVRequest *vr;
-	liWorker *wrk;
+/* hands out at most <max> bytes of what the connection rate allows since the last update (max one second) */
+static gint throttle_con_supply(liVRequest *vr, gint max) {
+	ev_tstamp now = CUR_TS(vr->wrk);
+	gdouble allowed;
 	gint supply;
 
-	wrk = data;
+	if (max <= 0)
+		return 0;
 
-	while (NULL != (wqe = li_waitqueue_pop(wq))) {
-		vr = wqe->data;
+	if (now - vr->throttle.con.last_update > 1.0)
+		vr->throttle.con.last_update = now - 1.0;
 
-		if (vr->throttle.pool.ptr) {
-			/* throttled by pool */
-			li_throttle_pool_rearm(wrk, vr->throttle.pool.ptr);
+	allowed = (now - vr->throttle.con.last_update) * vr->throttle.con.rate;
+	if (allowed <= 0)
+		return 0;
 
-			if (vr->throttle.ip.ptr) {
-				/* throttled by pool+IP */
+	supply = (allowed < max) ? (gint) allowed : max;
+	vr->throttle.con.last_update += ((gdouble) supply) / vr->throttle.con.rate;
 
-				li_throttle_pool_rearm(wrk, vr->throttle.ip.ptr);
+	return supply;
+}
 
-				supply = MIN(vr->throttle.pool.magazine, vr->throttle.ip.magazine);
+/* estimated time until a connection waiting in the pool gets its next share */
+static gdouble throttle_pool_delay(liThrottlePool *pool, guint ndx) {
+	gint queued = MAX(1, g_atomic_int_get(&pool->worker_num_cons_queued[ndx]));
 
-				if (vr->throttle.con.rate) {
-					/* throttled by pool+IP+con */
-					supply = MIN(supply, vr->throttle.con.rate / 1000 * THROTTLE_GRANULARITY);
-				}
+	return ((gdouble) queued * THROTTLE_QUANTUM_MIN) / pool->rate;
+}
+
+void li_throttle_cb(liTimerWheel *tw, liTimerWheelElem *elem, gpointer data) {
+	liVRequest *vr = elem->data;
+	liWorker *wrk = data;
+	gint supply;
+
+	UNUSED(tw);
+
+	if (vr->throttle.pool.ptr) {
+		/* throttled by pool */
+		li_throttle_pool_rearm(wrk, vr->throttle.pool.ptr);
+
+		if (vr->throttle.ip.ptr) {
+			/* throttled by pool+IP */
 
-				vr->throttle.pool.magazine -= supply;
-				vr->throttle.ip.magazine -= supply;
-				vr->throttle.magazine += supply;
-			} else if (vr->throttle.con.rate) {
-				/* throttled by pool+con */
-				supply = MIN(vr->throttle.pool.magazine, vr->throttle.con.rate / 1000 * THROTTLE_GRANULARITY);
-				vr->throttle.magazine += supply;
-				vr->throttle.pool.magazine -= supply;
-			} else {
-				vr->throttle.magazine += vr->throttle.pool.magazine;
-				vr->throttle.pool.magazine = 0;
-			}
-		} else if (vr->throttle.ip.ptr) {
-			/* throttled by IP */
 			li_throttle_pool_rearm(wrk, vr->throttle.ip.ptr);
 
+			supply = MIN(vr->throttle.pool.magazine, vr->throttle.ip.magazine);
+
 			if (vr->throttle.con.rate) {
-				/* throttled by IP+con */
-				supply = MIN(vr->throttle.ip.magazine, vr->throttle.con.rate / 1000 * THROTTLE_GRANULARITY);
-				vr->throttle.magazine += supply;
-				vr->throttle.ip.magazine -= supply;
-			} else {
-				vr->throttle.magazine += vr->throttle.ip.magazine;
-				vr->throttle.ip.magazine = 0;
+				/* throttled by pool+IP+con */
+				supply = throttle_con_supply(vr, supply);
 			}
+
+			vr->throttle.pool.magazine -= supply;
+			vr->throttle.ip.magazine -= supply;
+			vr->throttle.magazine += supply;
+		} else if (vr->throttle.con.rate) {
+			/* throttled by pool+con */
+			supply = throttle_con_supply(vr, vr->throttle.pool.magazine);
+			vr->throttle.magazine += supply;
+			vr->throttle.pool.magazine -= supply;
 		} else {
-			/* throttled by connection */
-			if (vr->throttle.magazine <= vr->throttle.con.rate)
-				vr->throttle.magazine += vr->throttle.con.rate / 1000 * THROTTLE_GRANULARITY;
+			vr->throttle.magazine += vr->throttle.pool.magazine;
+			vr->throttle.pool.magazine = 0;
 		}
+	} else if (vr->throttle.ip.ptr) {
+		/* throttled by IP */
+		li_throttle_pool_rearm(wrk, vr->throttle.ip.ptr);
+
+		if (vr->throttle.con.rate) {
+			/* throttled by IP+con */
+			supply = throttle_con_supply(vr, vr->throttle.ip.magazine);
+			vr->throttle.magazine += supply;
+			vr->throttle.ip.magazine -= supply;
+		} else {
+			vr->throttle.magazine += vr->throttle.ip.magazine;
+			vr->throttle.ip.magazine = 0;
+		}
+	} else {
+		/* throttled by connection */
+		vr->throttle.magazine += throttle_con_supply(vr, vr->throttle.con.rate - vr->throttle.magazine);
+	}
 
-		if (!vr->coninfo->callbacks->handle_check_io(vr)) continue; /* vr got reset */
+	if (!vr->coninfo->callbacks->handle_check_io(vr)) return; /* vr got reset */
 
-		if (vr->throttle.magazine <= 0)
-			li_throttle_update(vr, 0, 0);
-	}
-	li_waitqueue_update(wq);
+	if (vr->throttle.magazine <= 0)
+		li_throttle_update(vr, 0, 0);
 }
 
 void li_throttle_update(liVRequest *vr, goffset transferred, goffset write_max) {
@@ -350,8 +521,21 @@ void li_throttle_update(liVRequest *vr, goffset transferred, goffset write_max)
 
 	vr->throttle.magazine -= transferred;
 
-	if (vr->throttle.magazine <= 0) {
-		li_waitqueue_push(&vr->wrk->throttle_queue, &vr->throttle.wqueue_elem);
+	if (vr->throttle.magazine <= 0 && !vr->throttle.timer_elem.slot) {
+		/* sleep until we can expect enough bandwidth for a reasonable chunk, but at least one tick */
+		gdouble delay = ((gdouble) THROTTLE_GRANULARITY) / 1000;
+		guint ndx = vr->wrk->ndx;
+
+		if (vr->throttle.con.rate) {
+			gint chunk = MAX(THROTTLE_QUANTUM_MIN, vr->throttle.con.rate / 1000 * THROTTLE_GRANULARITY);
+			delay = MAX(delay, ((gdouble) chunk - vr->throttle.magazine) / vr->throttle.con.rate);
+		}
+		if (vr->throttle.pool.ptr && vr->throttle.pool.magazine <= 0)
+			delay = MAX(delay, throttle_pool_delay(vr->throttle.pool.ptr, ndx));
+		if (vr->throttle.ip.ptr && vr->throttle.ip.magazine <= 0)
+			delay = MAX(delay, throttle_pool_delay(vr->throttle.ip.ptr, ndx));
+
+		li_timerwheel_add(&vr->wrk->throttle_wheel, &vr->throttle.timer_elem, MIN(delay, 1.0));
 	}
 
 	/* queue in pool if necessary */
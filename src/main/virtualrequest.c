@@ -190,7 +190,7 @@ liVRequest* li_vrequest_new(liWorker *wrk, liConInfo *coninfo) {
 
 	li_action_stack_init(&vr->action_stack);
 
-	vr->throttle.wqueue_elem.data = vr;
+	vr->throttle.timer_elem.data = vr;
 	vr->throttle.pool.lnk.data = vr;
 	vr->throttle.ip.lnk.data = vr;
 
@@ -255,6 +255,8 @@ void li_vrequest_reset(liVRequest *vr, gboolean keepalive) {
 
 	vr->backend = NULL;
 
+	memset(&vr->trace, 0, sizeof(vr->trace));
+
 	/* don't reset request for keep-alive tracking */
 	if (!keepalive) li_request_reset(&vr->request);
 	li_physical_reset(&vr->physical);
@@ -333,6 +335,7 @@ void li_vrequest_start(liVRequest *vr) {
 void li_vrequest_handle_request_headers(liVRequest *vr) {
 	if (LI_VRS_CLEAN == vr->state) {
 		vr->state = LI_VRS_HANDLE_REQUEST_HEADERS;
+		vr->trace.headers_parsed = CUR_TS(vr->wrk);
 	}
 	li_vrequest_joblist_append(vr);
 }
@@ -348,6 +351,7 @@ void li_vrequest_handle_request_body(liVRequest *vr) {
 void li_vrequest_handle_response_headers(liVRequest *vr) {
 	if (LI_VRS_HANDLE_RESPONSE_HEADERS > vr->state) {
 		vr->state = LI_VRS_HANDLE_RESPONSE_HEADERS;
+		vr->trace.backend = CUR_TS(vr->wrk);
 	}
 	li_vrequest_joblist_append(vr);
 }
@@ -522,6 +526,8 @@ void li_vrequest_state_machine(liVRequest *vr) {
 				li_vrequest_handle_direct(vr);
 			}
 
+			vr->trace.actions_done = CUR_TS(vr->wrk);
+
 			if (!vr->coninfo->callbacks->handle_request_headers(vr)) return;
 			break;
 
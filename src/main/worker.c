@@ -9,6 +9,10 @@
 # include <lauxlib.h>
 #endif
 
+#ifdef HAVE_SYS_RESOURCE_H
+# include <sys/resource.h>
+#endif
+
 static liConnection* worker_con_get(liWorker *wrk);
 
 /* closing sockets - wait for proper shutdown */
@@ -204,24 +208,34 @@ GString *li_worker_current_timestamp(liWorker *wrk, liTimeFunc timefunc, guint f
 	return wts->str;
 }
 
+/* runs after the job queue (lowest priority), right before the loop waits for new events */
 static void li_worker_prepare_cb(struct ev_loop *loop, ev_prepare *w, int revents) {
 	liWorker *wrk = (liWorker*) w->data;
-	liServer *srv = wrk->srv;
 	UNUSED(loop);
 	UNUSED(revents);
 
-	/* are there pending log entries? */
-	if (g_queue_get_length(&wrk->logs.log_queue)) {
-		/* take log entries from local queue, insert into global queue and notify log thread */
-		g_static_mutex_lock(&srv->logs.write_queue_mutex);
+	/* take pending log entries from local queue, insert into the log thread queues and notify them */
+	li_log_worker_submit(wrk);
 
-		li_g_queue_merge(&srv->logs.write_queue, &wrk->logs.log_queue);
+	if (wrk->loop_check_ts > 0) {
+		ev_tstamp busy = ev_time() - wrk->loop_check_ts;
+		guint64 busy_usec = busy > 0 ? (guint64) (busy * 1000000) : 0;
 
-		g_static_mutex_unlock(&srv->logs.write_queue_mutex);
-		ev_async_send(srv->logs.loop, &srv->logs.watcher);
+		li_histogram_record(&wrk->stats.loop_busy, busy_usec);
+		wrk->stats.loop_busy_max_1s = MAX(wrk->stats.loop_busy_max_1s, busy_usec);
+		wrk->loop_check_ts = 0;
 	}
 }
 
+/* runs first (highest priority) after the loop got new events */
+static void li_worker_check_cb(struct ev_loop *loop, ev_check *w, int revents) {
+	liWorker *wrk = (liWorker*) w->data;
+	UNUSED(loop);
+	UNUSED(revents);
+
+	wrk->loop_check_ts = ev_time();
+}
+
 /* stop worker watcher */
 static void li_worker_stop_cb(struct ev_loop *loop, ev_async *w, int revents) {
 	liWorker *wrk = (liWorker*) w->data;
@@ -293,7 +307,67 @@ static void li_worker_new_con_cb(struct ev_loop *loop, ev_async *w, int revents)
 	}
 }
 
+/* copy the stats to the shared memory segment */
+static void worker_stats_publish(liWorker *wrk) {
+	liStatsShmWorker *slot = li_stats_shm_worker(wrk->srv->stats_shm, wrk->ndx);
+
+	if (!slot) return;
+
+	li_stats_shm_write_begin(slot);
+
+	slot->updated = (gint64) ev_now(wrk->loop);
+	slot->requests = wrk->stats.requests;
+	slot->bytes_in = wrk->stats.bytes_in;
+	slot->bytes_out = wrk->stats.bytes_out;
+	slot->actions_executed = wrk->stats.actions_executed;
+	slot->active_connections = wrk->connections_active;
+	slot->requests_5s_diff = wrk->stats.requests_5s_diff;
+	slot->bytes_in_5s_diff = wrk->stats.bytes_in_5s_diff;
+	slot->bytes_out_5s_diff = wrk->stats.bytes_out_5s_diff;
+	slot->ttfb = wrk->stats.ttfb;
+	slot->duration = wrk->stats.duration;
+
+	li_stats_shm_write_end(slot);
+}
+
 /* stats watcher */
+/* cpu time of the calling thread in microseconds, 0 if not available */
+static guint64 worker_thread_cpu_usec(void) {
+#ifdef RUSAGE_THREAD /* only defined if sys/resource.h was included */
+	struct rusage ru;
+
+	if (0 != getrusage(RUSAGE_THREAD, &ru)) return 0;
+
+	return (guint64) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+#else
+	return 0;
+#endif
+}
+
+/* the load of a worker isn't only its number of connections: a few connections with heavy
+ * (tls, compression, ...) traffic can keep it busier than many idle keep-alive connections.
+ * the pressure is the share of the last interval the worker spent on the cpu (or busy
+ * handling events, if the cpu time isn't available) plus the longest loop iteration
+ * (100ms and more count as 1000), i.e. what a new connection would have to wait for.
+ */
+static void worker_stats_update_pressure(liWorker *wrk, ev_tstamp interval) {
+	guint64 interval_usec = (guint64) (interval * 1000000), cpu_usec, busy_usec, cpu, lag;
+
+	cpu_usec = worker_thread_cpu_usec();
+	busy_usec = wrk->stats.loop_busy.sum - wrk->stats.last_loop_busy;
+
+	if (0 != cpu_usec && 0 != wrk->stats.last_cpu_usec) {
+		busy_usec = cpu_usec - wrk->stats.last_cpu_usec;
+	}
+
+	cpu = interval_usec > 0 ? MIN(busy_usec * 1000 / interval_usec, 1000) : 0;
+	lag = MIN(wrk->stats.loop_busy_max_1s / 100, 1000);
+
+	g_atomic_int_set((gint*) &wrk->load_pressure, (gint) (cpu + lag));
+
+	wrk->stats.last_cpu_usec = cpu_usec;
+}
+
 static void worker_stats_watcher_cb(struct ev_loop *loop, ev_timer *w, int revents) {
 	liWorker *wrk = (liWorker*) w->data;
 	ev_tstamp now = ev_now(wrk->loop);
@@ -307,6 +381,7 @@ static void worker_stats_watcher_cb(struct ev_loop *loop, ev_timer *w, int reven
 			if (wrk->stats.requests_per_sec > 0)
 			DEBUG(wrk->srv, "worker %u: %.2f requests per second", wrk->ndx, wrk->stats.requests_per_sec);
 #endif
+		worker_stats_update_pressure(wrk, now - wrk->stats.last_update);
 	}
 
 	/* 5s averages and peak values */
@@ -336,7 +411,12 @@ static void worker_stats_watcher_cb(struct ev_loop *loop, ev_timer *w, int reven
 	wrk->stats.active_cons_cum += wrk->connections_active;
 
 	wrk->stats.last_requests = wrk->stats.requests;
+	wrk->stats.last_loop_busy = wrk->stats.loop_busy.sum;
+	wrk->stats.loop_busy_max_1s = 0;
 	wrk->stats.last_update = now;
+
+	if (wrk->srv->stats_shm)
+		worker_stats_publish(wrk);
 }
 
 /* init */
@@ -361,6 +441,8 @@ liWorker* li_worker_new(liServer *srv, struct ev_loop *loop) {
 	wrk->connections_active = 0;
 	wrk->connections = g_array_new(FALSE, TRUE, sizeof(liConnection*));
 
+	wrk->action_times = g_array_new(FALSE, TRUE, sizeof(liActionTime));
+
 	wrk->tmp_str = g_string_sized_new(255);
 
 	wrk->timestamps_gmt = g_array_sized_new(FALSE, TRUE, sizeof(liWorkerTS), srv->ts_formats->len);
@@ -380,9 +462,16 @@ liWorker* li_worker_new(liServer *srv, struct ev_loop *loop) {
 
 	ev_init(&wrk->loop_prepare, li_worker_prepare_cb);
 	wrk->loop_prepare.data = wrk;
+	ev_set_priority(&wrk->loop_prepare, EV_MINPRI);
 	ev_prepare_start(wrk->loop, &wrk->loop_prepare);
 	ev_unref(wrk->loop); /* this watcher shouldn't keep the loop alive */
 
+	ev_init(&wrk->loop_check, li_worker_check_cb);
+	wrk->loop_check.data = wrk;
+	ev_set_priority(&wrk->loop_check, EV_MAXPRI);
+	ev_check_start(wrk->loop, &wrk->loop_check);
+	ev_unref(wrk->loop); /* this watcher shouldn't keep the loop alive */
+
 	ev_init(&wrk->worker_exit_watcher, li_worker_exit_cb);
 	wrk->worker_exit_watcher.data = wrk;
 	ev_async_start(wrk->loop, &wrk->worker_exit_watcher);
@@ -410,6 +499,8 @@ liWorker* li_worker_new(liServer *srv, struct ev_loop *loop) {
 	ev_timer_start(wrk->loop, &wrk->stats_watcher);
 	ev_unref(wrk->loop); /* this watcher shouldn't keep the loop alive */
 
+	li_log_worker_init(wrk);
+
 	ev_init(&wrk->collect_watcher, li_collect_watcher_cb);
 	wrk->collect_watcher.data = wrk;
 	ev_async_start(wrk->loop, &wrk->collect_watcher);
@@ -420,7 +511,7 @@ liWorker* li_worker_new(liServer *srv, struct ev_loop *loop) {
 	li_waitqueue_init(&wrk->io_timeout_queue, wrk->loop, worker_io_timeout_cb, srv->io_timeout, wrk);
 
 	/* throttling */
-	li_waitqueue_init(&wrk->throttle_queue, wrk->loop, li_throttle_cb, ((gdouble)THROTTLE_GRANULARITY) / 1000, wrk);
+	li_timerwheel_init(&wrk->throttle_wheel, wrk->loop, li_throttle_cb, ((gdouble)THROTTLE_GRANULARITY) / 1000, wrk);
 
 	li_job_queue_init(&wrk->jobqueue, wrk->loop);
 
@@ -479,7 +570,13 @@ void li_worker_free(liWorker *wrk) {
 	li_collect_watcher_cb(wrk->loop, &wrk->collect_watcher, 0);
 	g_async_queue_unref(wrk->collect_queue);
 
+	/* hand remaining log lines (including the ones from the closed connections) to the log thread */
+	li_log_worker_cleanup(wrk);
+
 	li_ev_safe_ref_and_stop(ev_prepare_stop, wrk->loop, &wrk->loop_prepare);
+	li_ev_safe_ref_and_stop(ev_check_stop, wrk->loop, &wrk->loop_check);
+
+	g_array_free(wrk->action_times, TRUE);
 
 	g_string_free(wrk->tmp_str, TRUE);
 
@@ -533,7 +630,7 @@ void li_worker_stop(liWorker *context, liWorker *wrk) {
 		ev_async_stop(wrk->loop, &wrk->worker_suspend_watcher);
 		ev_async_stop(wrk->loop, &wrk->new_con_watcher);
 		li_waitqueue_stop(&wrk->io_timeout_queue);
-		li_waitqueue_stop(&wrk->throttle_queue);
+		li_timerwheel_stop(&wrk->throttle_wheel);
 		if (wrk->stat_cache)
 			li_waitqueue_stop(&wrk->stat_cache->delete_queue);
 		li_worker_new_con_cb(wrk->loop, &wrk->new_con_watcher, 0); /* handle remaining new connections */
@@ -3,7 +3,10 @@
  *
  * Description:
  *     mod_accesslog can log requests handled by lighttpd to files, pipes or syslog
- *     the format of the logs can be customized by using printf-style placeholders
+ *     the format of the logs can be customized by using printf-style placeholders,
+ *     which are compiled once into a list of instructions
+ *     log lines are collected in per-worker buffers and handed to the log thread in blocks;
+ *     a line may be delayed up to one second before it is written.
  *
  * Setups:
  *     none
@@ -14,6 +17,16 @@
  *     accesslog.format = <format>;  - log format
  *         type: string
  *         default: "%h %V %u %t \"%r\" %>s %b \"%{Referer}i\" \"%{User-Agent}i\""
+ *         %t takes an optional strftime format (%{%Y-%m-%dT%H:%M:%S}t) or one of
+ *         %{sec}t, %{msec}t, %{usec}t for the time since the epoch; %{name}C logs the value of cookie "name"
+ *         strftime formats have to be known when the server starts, they can't be added by lua actions later
+ *     accesslog.type = <type>;      - record type: "text", "json" or "binary"
+ *         type: string
+ *         default: "text"
+ *         json writes one object per line with the fields of the format (literal text is ignored);
+ *         numbers (byte counts, durations, status, plain %t as unix timestamp) are written as integers,
+ *         missing values as null. keys are taken from al_format_mapping (plus ".<key>" for %{key}x), a field
+ *         repeated in the format is written once. binary writes length-prefixed records, see al_format_binary().
  * Actions:
  *     none
  *
@@ -22,8 +35,7 @@
  *     accesslog.format = "%h %V %u %t \"%r\" %>s %b \"%{Referer}i\" \"%{User-Agent}i\"";
  *
  * Todo:
- *     - implement format key for %t: %{format}t
- *     - implement missing format identifiers
+ *     - %H (request protocol) has no format identifier yet, %h doesn't resolve hostnames
  *
  * Author:
  *     Copyright (c) 2009 Thomas Porzelt
@@ -46,85 +58,125 @@ struct al_data {
 };
 typedef struct al_data al_data;
 
+enum {
+	AL_OPTION_ACCESSLOG_TYPE = 0
+};
+
 enum {
 	AL_OPTION_ACCESSLOG = 0,
 	AL_OPTION_ACCESSLOG_FORMAT
 };
 
+/* accesslog.type */
+enum {
+	AL_TYPE_TEXT = 0,
+	AL_TYPE_JSON,
+	AL_TYPE_BINARY
+};
+
+typedef enum {
+	AL_FORMAT_UNSUPPORTED,
+	AL_FORMAT_LITERAL,               /* run of literal text, including %% */
+	AL_FORMAT_PERCENT,
+	AL_FORMAT_REMOTE_ADDR,
+	AL_FORMAT_LOCAL_ADDR,
+	AL_FORMAT_BYTES_RESPONSE,        /* without headers */
+	AL_FORMAT_BYTES_RESPONSE_CLF,    /* same as above but - instead of 0 */
+	AL_FORMAT_COOKIE,
+	AL_FORMAT_DURATION_MICROSECONDS, /* duration of request in microseconds */
+	AL_FORMAT_ENV,                   /* environment var */
+	AL_FORMAT_FILENAME,
+	AL_FORMAT_REMOTE_HOST,
+	AL_FORMAT_PROTOCOL,
+	AL_FORMAT_REQUEST_HEADER,
+	AL_FORMAT_METHOD,
+	AL_FORMAT_RESPONSE_HEADER,
+	AL_FORMAT_LOCAL_PORT,
+	AL_FORMAT_QUERY_STRING,
+	AL_FORMAT_FIRST_LINE,            /* GET /foo?bar HTTP/1.1 */
+	AL_FORMAT_STATUS_CODE,
+	AL_FORMAT_TIME,                  /* standard english format or %{strftime format}t */
+	AL_FORMAT_TIME_SEC,              /* %{sec}t: seconds since the epoch */
+	AL_FORMAT_TIME_MSEC,             /* %{msec}t */
+	AL_FORMAT_TIME_USEC,             /* %{usec}t */
+	AL_FORMAT_DURATION_SECONDS,
+	AL_FORMAT_AUTHED_USER,
+	AL_FORMAT_PATH,
+	AL_FORMAT_SERVER_NAME,
+	AL_FORMAT_HOSTNAME,
+	AL_FORMAT_CONNECTION_STATUS,     /* X = not complete, + = keep alive, - = no keep alive */
+	AL_FORMAT_BYTES_IN,
+	AL_FORMAT_BYTES_OUT
+} al_format_type;
+
 typedef struct {
 	gchar character;
 	gboolean need_key;
-	enum {
-		AL_FORMAT_UNSUPPORTED,
-		AL_FORMAT_PERCENT,
-		AL_FORMAT_REMOTE_ADDR,
-		AL_FORMAT_LOCAL_ADDR,
-		AL_FORMAT_BYTES_RESPONSE,        /* without headers */
-		AL_FORMAT_BYTES_RESPONSE_CLF,    /* same as above but - instead of 0 */
-		AL_FORMAT_COOKIE,
-		AL_FORMAT_DURATION_MICROSECONDS, /* duration of request in microseconds */
-		AL_FORMAT_ENV,                   /* environment var */
-		AL_FORMAT_FILENAME,
-		AL_FORMAT_REMOTE_HOST,
-		AL_FORMAT_PROTOCOL,
-		AL_FORMAT_REQUEST_HEADER,
-		AL_FORMAT_METHOD,
-		AL_FORMAT_RESPONSE_HEADER,
-		AL_FORMAT_LOCAL_PORT,
-		AL_FORMAT_QUERY_STRING,
-		AL_FORMAT_FIRST_LINE,            /* GET /foo?bar HTTP/1.1 */
-		AL_FORMAT_STATUS_CODE,
-		AL_FORMAT_TIME,                  /* standard english format */
-		AL_FORMAT_DURATION_SECONDS,
-		AL_FORMAT_AUTHED_USER,
-		AL_FORMAT_PATH,
-		AL_FORMAT_SERVER_NAME,
-		AL_FORMAT_HOSTNAME,
-		AL_FORMAT_CONNECTION_STATUS,     /* X = not complete, + = keep alive, - = no keep alive */
-		AL_FORMAT_BYTES_IN,
-		AL_FORMAT_BYTES_OUT
-	} type;
+	al_format_type type;
+	guint size;                      /* estimated output size; an upper bound for fixed size fields */
+	const gchar *name;               /* field name for json output; keyed fields append ".key" */
 } al_format;
 
+/* the format string is compiled into a flat list of instructions; consecutive literal text
+ * is merged into one run, all runs are stored in one string (literals) */
 typedef struct {
-	al_format format;
+	al_format_type type;
+	gchar character;
+	guint offset, len;               /* AL_FORMAT_LITERAL: run in literals */
+	guint name_offset, name_len;     /* "name": in names */
 	GString *key;
-	enum { AL_ENTRY_FORMAT, AL_ENTRY_STRING } type;
-} al_format_entry;
+	guint ts_ndx;                    /* AL_FORMAT_TIME */
+} al_instruction;
+
+typedef struct {
+	al_instruction *code;
+	guint len;
+	GString *literals;
+	GString *names;                  /* json field names, already quoted and followed by ':' */
+	gsize size_estimate;             /* buffer space reserved before rendering a record */
+} al_compiled_format;
+
+/* typed value of a field, used by all output types */
+typedef struct {
+	enum { AL_VALUE_NONE = 0, AL_VALUE_INT, AL_VALUE_STRING } type;
+	gint64 i;
+	const gchar *str;
+	gsize len;
+	gboolean escape;                 /* text output: string may contain unsafe characters */
+} al_value;
 
 static const al_format al_format_mapping[] = {
-	{ '%', FALSE, AL_FORMAT_PERCENT },
-	{ 'a', FALSE, AL_FORMAT_REMOTE_ADDR },
-	{ 'A', FALSE, AL_FORMAT_LOCAL_ADDR },
-	{ 'b', FALSE, AL_FORMAT_BYTES_RESPONSE },
-	{ 'B', FALSE, AL_FORMAT_BYTES_RESPONSE_CLF },
-	{ 'C', FALSE, AL_FORMAT_COOKIE },
-	{ 'D', FALSE, AL_FORMAT_DURATION_MICROSECONDS },
-	{ 'e', TRUE, AL_FORMAT_ENV },
-	{ 'f', FALSE, AL_FORMAT_FILENAME },
-	{ 'h', FALSE, AL_FORMAT_REMOTE_ADDR },
-	{ 'i', TRUE, AL_FORMAT_REQUEST_HEADER },
-	{ 'm', FALSE, AL_FORMAT_METHOD },
-	{ 'o', TRUE, AL_FORMAT_RESPONSE_HEADER },
-	{ 'p', FALSE, AL_FORMAT_LOCAL_PORT },
-	{ 'q', FALSE, AL_FORMAT_QUERY_STRING },
-	{ 'r', FALSE, AL_FORMAT_FIRST_LINE },
-	{ 's', FALSE, AL_FORMAT_STATUS_CODE },
-	{ 't', FALSE, AL_FORMAT_TIME },
-	{ 'T', FALSE, AL_FORMAT_DURATION_SECONDS },
-	{ 'u', FALSE, AL_FORMAT_AUTHED_USER },
-	{ 'U', FALSE, AL_FORMAT_PATH },
-	{ 'v', FALSE, AL_FORMAT_SERVER_NAME },
-	{ 'V', FALSE, AL_FORMAT_HOSTNAME },
-	{ 'X', FALSE, AL_FORMAT_CONNECTION_STATUS },
-	{ 'I', FALSE, AL_FORMAT_BYTES_IN },
-	{ 'O', FALSE, AL_FORMAT_BYTES_OUT },
-
-	{ '\0', FALSE, AL_FORMAT_UNSUPPORTED }
+	{ '%', FALSE, AL_FORMAT_PERCENT, 1, NULL },
+	{ 'a', FALSE, AL_FORMAT_REMOTE_ADDR, 46, "remote_addr" },
+	{ 'A', FALSE, AL_FORMAT_LOCAL_ADDR, 46, "local_addr" },
+	{ 'b', FALSE, AL_FORMAT_BYTES_RESPONSE, 20, "bytes_response" },
+	{ 'B', FALSE, AL_FORMAT_BYTES_RESPONSE_CLF, 20, "bytes_response_clf" },
+	{ 'C', TRUE, AL_FORMAT_COOKIE, 64, "cookie" },
+	{ 'D', FALSE, AL_FORMAT_DURATION_MICROSECONDS, 20, "duration_usec" },
+	{ 'e', TRUE, AL_FORMAT_ENV, 64, "env" },
+	{ 'f', FALSE, AL_FORMAT_FILENAME, 128, "filename" },
+	{ 'h', FALSE, AL_FORMAT_REMOTE_ADDR, 46, "remote_host" },
+	{ 'i', TRUE, AL_FORMAT_REQUEST_HEADER, 128, "request_header" },
+	{ 'm', FALSE, AL_FORMAT_METHOD, 16, "method" },
+	{ 'o', TRUE, AL_FORMAT_RESPONSE_HEADER, 64, "response_header" },
+	{ 'p', FALSE, AL_FORMAT_LOCAL_PORT, 5, "local_port" },
+	{ 'q', FALSE, AL_FORMAT_QUERY_STRING, 64, "query_string" },
+	{ 'r', FALSE, AL_FORMAT_FIRST_LINE, 160, "request_line" },
+	{ 's', FALSE, AL_FORMAT_STATUS_CODE, 3, "status" },
+	{ 't', FALSE, AL_FORMAT_TIME, 28, "time" },
+	{ 'T', FALSE, AL_FORMAT_DURATION_SECONDS, 20, "duration_sec" },
+	{ 'u', FALSE, AL_FORMAT_AUTHED_USER, 32, "user" },
+	{ 'U', FALSE, AL_FORMAT_PATH, 128, "path" },
+	{ 'v', FALSE, AL_FORMAT_SERVER_NAME, 64, "server_name" },
+	{ 'V', FALSE, AL_FORMAT_HOSTNAME, 64, "host" },
+	{ 'X', FALSE, AL_FORMAT_CONNECTION_STATUS, 1, "connection_status" },
+	{ 'I', FALSE, AL_FORMAT_BYTES_IN, 20, "bytes_in" },
+	{ 'O', FALSE, AL_FORMAT_BYTES_OUT, 20, "bytes_out" },
+
+	{ '\0', FALSE, AL_FORMAT_UNSUPPORTED, 0, NULL }
 };
 
 
-
 static void al_append_escaped(GString *log, GString *str) {
 	/* replaces non-printable chars with \xHH where HH is the hex representation of the byte */
 	/* exceptions: " => \", \ => \\, whitespace chars => \n \t etc. */
@@ -156,6 +208,36 @@ static void al_append_escaped(GString *log, GString *str) {
 }
 
 
+static void al_append_json_string(GString *str, const gchar *s, gsize len) {
+	/* invalid utf-8 can't be passed through; escape all non-ascii bytes as \u00HH in that case */
+	gboolean utf8 = g_utf8_validate(s, len, NULL);
+	static const gchar hex[] = "0123456789abcdef";
+
+	g_string_append_c(str, '"');
+	for (gsize i = 0; i < len; i++) {
+		guchar c = s[i];
+		switch (c) {
+		case '"': g_string_append_len(str, CONST_STR_LEN("\\\"")); break;
+		case '\\': g_string_append_len(str, CONST_STR_LEN("\\\\")); break;
+		case '\b': g_string_append_len(str, CONST_STR_LEN("\\b")); break;
+		case '\f': g_string_append_len(str, CONST_STR_LEN("\\f")); break;
+		case '\n': g_string_append_len(str, CONST_STR_LEN("\\n")); break;
+		case '\r': g_string_append_len(str, CONST_STR_LEN("\\r")); break;
+		case '\t': g_string_append_len(str, CONST_STR_LEN("\\t")); break;
+		default:
+			if (c < 0x20 || (c >= 0x80 && !utf8)) {
+				gchar u[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+				g_string_append_len(str, u, 6);
+			} else {
+				g_string_append_c(str, c);
+			}
+			break;
+		}
+	}
+	g_string_append_c(str, '"');
+}
+
+
 static al_format al_get_format(gchar c) {
 	guint i;
 	for (i = 0; al_format_mapping[i].type != AL_FORMAT_UNSUPPORTED; i++) {
@@ -167,239 +249,505 @@ static al_format al_get_format(gchar c) {
 }
 
 
-#define AL_PARSE_ERROR() \
-	do { \
-		if (e.key) \
-			g_string_free(e.key, TRUE); \
-		for (guint i = 0; i < arr->len; i++) \
-			if (g_array_index(arr, al_format_entry, i).key) \
-				g_string_free(g_array_index(arr, al_format_entry, i).key, TRUE); \
-		g_array_free(arr, TRUE); \
-		return NULL; \
-	} while (0)
-
-static GArray *al_parse_format(liServer *srv, const gchar *formatstr) {
-	GArray *arr = g_array_new(FALSE, TRUE, sizeof(al_format_entry));
-	al_format_entry e;
+static void al_compiled_format_free(al_compiled_format *fmt) {
+	for (guint i = 0; i < fmt->len; i++) {
+		if (fmt->code[i].key)
+			g_string_free(fmt->code[i].key, TRUE);
+	}
+
+	g_free(fmt->code);
+	g_string_free(fmt->literals, TRUE);
+	g_string_free(fmt->names, TRUE);
+	g_slice_free(al_compiled_format, fmt);
+}
+
+static void al_emit_literal(GArray *code, GString *literals, const gchar *str, gsize len) {
+	al_instruction ins;
+
+	if (code->len && g_array_index(code, al_instruction, code->len - 1).type == AL_FORMAT_LITERAL) {
+		/* runs are appended in order, so the previous run ends at the end of literals */
+		g_array_index(code, al_instruction, code->len - 1).len += len;
+	} else {
+		memset(&ins, 0, sizeof(ins));
+		ins.type = AL_FORMAT_LITERAL;
+		ins.offset = literals->len;
+		ins.len = len;
+		g_array_append_val(code, ins);
+	}
+
+	g_string_append_len(literals, str, len);
+}
+
+static gboolean al_ts_format_add(liServer *srv, GString *key, guint *ndx) {
+	GString *tsfmt = g_string_new_len(GSTR_LEN(key));
+
+	*ndx = li_server_ts_format_add(srv, tsfmt);
+
+	/* format was already registered */
+	if (g_array_index(srv->ts_formats, GString*, *ndx) != tsfmt)
+		g_string_free(tsfmt, TRUE);
+
+	/* the worker timestamp caches are sized when the workers start (see li_worker_run()) */
+	if (LI_SERVER_INIT != g_atomic_int_get(&srv->state) && *ndx >= srv->main_worker->timestamps_local->len) {
+		ERROR(srv, "accesslog.format: timestamp format \"%s\" wasn't registered before the server started, use it in the main config", key->str);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean al_name_used(GString *names, al_instruction *code, guint len, const gchar *name, gsize name_len) {
+	for (guint i = 0; i < len; i++) {
+		if (code[i].name_len == name_len && 0 == memcmp(names->str + code[i].name_offset, name, name_len))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+static al_compiled_format *al_parse_format(liServer *srv, al_data *ald, const gchar *formatstr) {
+	GArray *code = g_array_new(FALSE, TRUE, sizeof(al_instruction));
+	GString *literals = g_string_sized_new(0);
+	GString *names = g_string_sized_new(0);
+	GString *name = g_string_sized_new(0);
+	al_compiled_format *fmt;
+	gsize size_estimate = 0;
+	GString *key = NULL;
 	const gchar *c, *k;
 
 	for (c = formatstr; *c != '\0';) {
+		al_instruction ins;
+		al_format f;
 
-		if (*c == '%') {
-			c++;
-			e.type = AL_ENTRY_FORMAT;
-			e.key = NULL;
-			if (*c == '\0')
-				AL_PARSE_ERROR();
-			if (*c == '<' || *c == '>')
-				/* we ignore < and > */
-				c++;
-			if (*c == '{') {
-				/* %{key} */
-				c++;
-				for (k = c; *k != '}'; k++) /* skip to next } */
-					if (*k == '\0')
-						AL_PARSE_ERROR();
-				e.key = g_string_new_len(c, k - c);
-				c = k+1;
-			}
-			e.format = al_get_format(*c);
-			if (e.format.type == AL_FORMAT_UNSUPPORTED) {
-				ERROR(srv, "unknown format identifier: %c", *c);
-				AL_PARSE_ERROR();
-			}
-			if (!e.key && e.format.need_key) {
-				ERROR(srv, "format identifier \"%c\" needs a key", e.format.character);
-				AL_PARSE_ERROR();
-			}
-			c++;
-		} else {
+		if (*c != '%') {
 			/* normal string */
-			e.type = AL_ENTRY_STRING;
 			for (k = (c+1); *k != '\0' && *k != '%'; k++); /* skip to next % */
-			e.key = g_string_new_len(c, k - c);
+			al_emit_literal(code, literals, c, k - c);
 			c = k;
+			continue;
+		}
+
+		c++;
+		if (*c == '\0')
+			goto error;
+		if (*c == '<' || *c == '>')
+			/* we ignore < and > */
+			c++;
+		if (*c == '{') {
+			/* %{key} */
+			c++;
+			for (k = c; *k != '}'; k++) /* skip to next } */
+				if (*k == '\0')
+					goto error;
+			key = g_string_new_len(c, k - c);
+			c = k+1;
+		}
+		f = al_get_format(*c);
+		if (f.type == AL_FORMAT_UNSUPPORTED) {
+			ERROR(srv, "unknown format identifier: %c", *c);
+			goto error;
+		}
+		if (!key && f.need_key) {
+			ERROR(srv, "format identifier \"%c\" needs a key", f.character);
+			goto error;
+		}
+		c++;
+
+		if (f.type == AL_FORMAT_PERCENT) {
+			al_emit_literal(code, literals, CONST_STR_LEN("%"));
+			if (key) {
+				g_string_free(key, TRUE);
+				key = NULL;
+			}
+			continue;
 		}
 
-		g_array_append_val(arr, e);
+		memset(&ins, 0, sizeof(ins));
+		ins.type = f.type;
+		ins.character = f.character;
+		ins.key = key;
+		key = NULL;
+		size_estimate += f.size;
+
+		g_string_assign(name, f.name);
+
+		if (f.type == AL_FORMAT_TIME) {
+			if (!ins.key) {
+				ins.ts_ndx = ald->ts_ndx;
+			} else if (g_str_equal(ins.key->str, "sec")) {
+				ins.type = AL_FORMAT_TIME_SEC;
+				g_string_append_len(name, CONST_STR_LEN("_sec"));
+			} else if (g_str_equal(ins.key->str, "msec")) {
+				ins.type = AL_FORMAT_TIME_MSEC;
+				g_string_append_len(name, CONST_STR_LEN("_msec"));
+			} else if (g_str_equal(ins.key->str, "usec")) {
+				ins.type = AL_FORMAT_TIME_USEC;
+				g_string_append_len(name, CONST_STR_LEN("_usec"));
+			} else {
+				/* strftime format */
+				if (!al_ts_format_add(srv, ins.key, &ins.ts_ndx)) {
+					g_string_free(ins.key, TRUE);
+					goto error;
+				}
+				size_estimate += 2 * ins.key->len;
+				g_string_append_c(name, '.');
+				g_string_append_len(name, GSTR_LEN(ins.key));
+			}
+		} else if (ins.key) {
+			g_string_append_c(name, '.');
+			g_string_append_len(name, GSTR_LEN(ins.key));
+		}
+
+		ins.name_offset = names->len;
+		al_append_json_string(names, GSTR_LEN(name));
+		g_string_append_c(names, ':');
+		ins.name_len = names->len - ins.name_offset;
+
+		/* repeated fields (like "%s %>s") have the same value: json writes each key only once */
+		if (al_name_used(names, (al_instruction*) code->data, code->len, names->str + ins.name_offset, ins.name_len)) {
+			g_string_truncate(names, ins.name_offset);
+			ins.name_len = 0;
+		}
+
+		/* binary: field header and length */
+		size_estimate += 6;
+
+		g_array_append_val(code, ins);
 	}
 
-	return arr;
+	fmt = g_slice_new(al_compiled_format);
+	fmt->literals = literals;
+	fmt->names = names;
+	/* enough for text (literals), json (names) and binary records; + newline / braces / length */
+	fmt->size_estimate = size_estimate + MAX(literals->len, names->len + code->len) + 4;
+	fmt->len = code->len;
+	fmt->code = (al_instruction*) g_array_free(code, FALSE);
+	g_string_free(name, TRUE);
+
+	return fmt;
+
+error:
+	if (key)
+		g_string_free(key, TRUE);
+	g_string_free(name, TRUE);
+	g_string_free(names, TRUE);
+	for (guint i = 0; i < code->len; i++)
+		if (g_array_index(code, al_instruction, i).key)
+			g_string_free(g_array_index(code, al_instruction, i).key, TRUE);
+	g_array_free(code, TRUE);
+	g_string_free(literals, TRUE);
+
+	return NULL;
 }
 
-static GString *al_format_log(liVRequest *vr, al_data *ald, GArray *format) {
-	GString *str = g_string_sized_new(255);
+#define AL_VALUE_INT(val) do { v->type = AL_VALUE_INT; v->i = (val); } while (0)
+#define AL_VALUE_STR(s, l, esc) do { v->type = AL_VALUE_STRING; v->str = (s); v->len = (l); v->escape = (esc); } while (0)
+#define AL_VALUE_GSTR(gs, esc) AL_VALUE_STR((gs)->str, (gs)->len, esc)
+
+/* extracts the typed value of a field; strings may point to vr->wrk->tmp_str */
+static void al_get_value(liVRequest *vr, al_instruction *ins, gboolean structured, al_value *v) {
 	liResponse *resp = &vr->response;
 	liRequest *req = &vr->request;
 	liPhysical *phys = &vr->physical;
+	GString *tmp_gstr2 = NULL;
+	gchar *tmp_str = NULL;
+	guint len = 0;
+
+	v->type = AL_VALUE_NONE;
+
+	switch (ins->type) {
+	case AL_FORMAT_REMOTE_ADDR:
+		AL_VALUE_GSTR(vr->coninfo->remote_addr_str, FALSE);
+		break;
+	case AL_FORMAT_LOCAL_ADDR:
+		AL_VALUE_GSTR(vr->coninfo->local_addr_str, FALSE);
+		break;
+	case AL_FORMAT_BYTES_RESPONSE:
+	case AL_FORMAT_BYTES_RESPONSE_CLF:
+		AL_VALUE_INT(vr->vr_out->bytes_out);
+		break;
+	case AL_FORMAT_COOKIE: {
+			const gchar *value;
+			gsize value_len;
+			li_http_header_get_all(vr->wrk->tmp_str, req->headers, CONST_STR_LEN("Cookie"));
+			if (li_cookie_find(GSTR_LEN(vr->wrk->tmp_str), GSTR_LEN(ins->key), &value, &value_len))
+				AL_VALUE_STR(value, value_len, TRUE);
+		}
+		break;
+	case AL_FORMAT_DURATION_MICROSECONDS:
+		AL_VALUE_INT((CUR_TS(vr->wrk) - vr->ts_started) * 1000 * 1000);
+		break;
+	case AL_FORMAT_ENV:
+		tmp_gstr2 = li_environment_get(&vr->env, GSTR_LEN(ins->key));
+		if (tmp_gstr2)
+			AL_VALUE_GSTR(tmp_gstr2, TRUE);
+		break;
+	case AL_FORMAT_FILENAME:
+		if (phys->path->len)
+			AL_VALUE_GSTR(phys->path, FALSE);
+		break;
+	case AL_FORMAT_REQUEST_HEADER:
+		li_http_header_get_all(vr->wrk->tmp_str, req->headers, GSTR_LEN(ins->key));
+		if (vr->wrk->tmp_str->len)
+			AL_VALUE_GSTR(vr->wrk->tmp_str, TRUE);
+		break;
+	case AL_FORMAT_METHOD:
+		AL_VALUE_GSTR(req->http_method_str, FALSE);
+		break;
+	case AL_FORMAT_RESPONSE_HEADER:
+		li_http_header_get_all(vr->wrk->tmp_str, resp->headers, GSTR_LEN(ins->key));
+		if (vr->wrk->tmp_str->len)
+			AL_VALUE_GSTR(vr->wrk->tmp_str, TRUE);
+		break;
+	case AL_FORMAT_LOCAL_PORT:
+		switch (vr->coninfo->local_addr.addr->plain.sa_family) {
+		case AF_INET: AL_VALUE_INT(ntohs(vr->coninfo->local_addr.addr->ipv4.sin_port)); break;
+		#ifdef HAVE_IPV6
+		case AF_INET6: AL_VALUE_INT(ntohs(vr->coninfo->local_addr.addr->ipv6.sin6_port)); break;
+		#endif
+		default: break;
+		}
+		break;
+	case AL_FORMAT_QUERY_STRING:
+		if (req->uri.query->len)
+			AL_VALUE_GSTR(req->uri.query, TRUE);
+		break;
+	case AL_FORMAT_FIRST_LINE:
+		/* method and version never need escaping, so the whole line can be escaped */
+		g_string_truncate(vr->wrk->tmp_str, 0);
+		g_string_append_len(vr->wrk->tmp_str, GSTR_LEN(req->http_method_str));
+		g_string_append_c(vr->wrk->tmp_str, ' ');
+		g_string_append_len(vr->wrk->tmp_str, GSTR_LEN(req->uri.raw_orig_path));
+		g_string_append_c(vr->wrk->tmp_str, ' ');
+		tmp_str = li_http_version_string(req->http_version, &len);
+		g_string_append_len(vr->wrk->tmp_str, tmp_str, len);
+		AL_VALUE_GSTR(vr->wrk->tmp_str, TRUE);
+		break;
+	case AL_FORMAT_STATUS_CODE:
+		AL_VALUE_INT(resp->http_status);
+		break;
+	case AL_FORMAT_TIME:
+		if (structured && !ins->key) {
+			/* typed output: plain %t is the unix timestamp */
+			AL_VALUE_INT((gint64) CUR_TS(vr->wrk));
+		} else if (ins->ts_ndx < vr->wrk->timestamps_local->len) {
+			/* al_ts_format_add() rejects formats without cache slot, just being careful */
+			tmp_gstr2 = li_worker_current_timestamp(vr->wrk, LI_LOCALTIME, ins->ts_ndx);
+			if (tmp_gstr2)
+				AL_VALUE_GSTR(tmp_gstr2, FALSE);
+		}
+		break;
+	case AL_FORMAT_TIME_SEC:
+		AL_VALUE_INT((gint64) CUR_TS(vr->wrk));
+		break;
+	case AL_FORMAT_TIME_MSEC:
+		AL_VALUE_INT((gint64) (CUR_TS(vr->wrk) * 1000));
+		break;
+	case AL_FORMAT_TIME_USEC:
+		AL_VALUE_INT((gint64) (CUR_TS(vr->wrk) * 1000 * 1000));
+		break;
+	case AL_FORMAT_DURATION_SECONDS:
+		AL_VALUE_INT(CUR_TS(vr->wrk) - vr->ts_started);
+		break;
+	case AL_FORMAT_AUTHED_USER:
+		tmp_gstr2 = li_environment_get(&vr->env, CONST_STR_LEN("REMOTE_USER"));
+		if (tmp_gstr2)
+			AL_VALUE_GSTR(tmp_gstr2, FALSE);
+		break;
+	case AL_FORMAT_PATH:
+		AL_VALUE_GSTR(req->uri.path, FALSE);
+		break;
+	case AL_FORMAT_SERVER_NAME:
+		if (CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_NAME).string)
+			AL_VALUE_GSTR(CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_NAME).string, FALSE);
+		else
+			AL_VALUE_GSTR(req->uri.host, FALSE);
+		break;
+	case AL_FORMAT_HOSTNAME:
+		if (req->uri.host->len)
+			AL_VALUE_GSTR(req->uri.host, FALSE);
+		break;
+	case AL_FORMAT_CONNECTION_STATUS: {
+			/* was request completed? */
+			liConnection *con = li_connection_from_vrequest(vr); /* try to get a connection object */
+
+			if (con && (con->in->is_closed && con->raw_out->is_closed && 0 == con->raw_out->length)) {
+				AL_VALUE_STR("X", 1, FALSE);
+			} else {
+				AL_VALUE_STR(vr->coninfo->keep_alive ? "+" : "-", 1, FALSE);
+			}
+		}
+		break;
+	case AL_FORMAT_BYTES_IN:
+		AL_VALUE_INT(vr->coninfo->stats.bytes_in);
+		break;
+	case AL_FORMAT_BYTES_OUT:
+		AL_VALUE_INT(vr->coninfo->stats.bytes_out);
+		break;
+	default:
+		AL_VALUE_STR("?", 1, FALSE);
+		break;
+	}
+}
 
-	for (guint i = 0; i < format->len; i++) {
-		GString *tmp_gstr2 = NULL;
-		gchar *tmp_str = NULL;
-		guint len = 0;
-
-		al_format_entry *e = &g_array_index(format, al_format_entry, i);
-		if (e->type == AL_ENTRY_FORMAT) {
-			switch (e->format.type) {
-			case AL_FORMAT_PERCENT:
-				g_string_append_c(str, '%');
-				break;
-			case AL_FORMAT_REMOTE_ADDR:
-				g_string_append_len(str, GSTR_LEN(vr->coninfo->remote_addr_str));
-				break;
-			case AL_FORMAT_LOCAL_ADDR:
-				g_string_append_len(str, GSTR_LEN(vr->coninfo->local_addr_str));
-				break;
-			case AL_FORMAT_BYTES_RESPONSE:
-				li_string_append_int(str, vr->vr_out->bytes_out);
-				break;
-			case AL_FORMAT_BYTES_RESPONSE_CLF:
-				if (vr->vr_out->bytes_out)
-					li_string_append_int(str, vr->vr_out->bytes_out);
-				else
-					g_string_append_c(str, '-');
-				break;
-			case AL_FORMAT_DURATION_MICROSECONDS:
-				li_string_append_int(str, (CUR_TS(vr->wrk) - vr->ts_started) * 1000 * 1000);
-				break;
-			case AL_FORMAT_ENV:
-				tmp_gstr2 = li_environment_get(&vr->env, GSTR_LEN(e->key));
-				if (tmp_gstr2)
-					al_append_escaped(str, tmp_gstr2);
-				else
-					g_string_append_c(str, '-');
-				break;
-			case AL_FORMAT_FILENAME:
-				if (phys->path->len)
-					g_string_append_len(str, GSTR_LEN(phys->path));
-				else
-					g_string_append_c(str, '-');
-				break;
-			case AL_FORMAT_REQUEST_HEADER:
-				li_http_header_get_all(vr->wrk->tmp_str, req->headers, GSTR_LEN(e->key));
-				if (vr->wrk->tmp_str->len)
-					al_append_escaped(str, vr->wrk->tmp_str);
-				else
-					g_string_append_c(str, '-');
-				break;
-			case AL_FORMAT_METHOD:
-				g_string_append_len(str, GSTR_LEN(req->http_method_str));
-				break;
-			case AL_FORMAT_RESPONSE_HEADER:
-				li_http_header_get_all(vr->wrk->tmp_str, resp->headers, GSTR_LEN(e->key));
-				if (vr->wrk->tmp_str->len)
-					al_append_escaped(str, vr->wrk->tmp_str);
-				else
-					g_string_append_c(str, '-');
-				break;
-			case AL_FORMAT_LOCAL_PORT:
-				switch (vr->coninfo->local_addr.addr->plain.sa_family) {
-				case AF_INET: li_string_append_int(str, ntohs(vr->coninfo->local_addr.addr->ipv4.sin_port)); break;
-				#ifdef HAVE_IPV6
-				case AF_INET6: li_string_append_int(str, ntohs(vr->coninfo->local_addr.addr->ipv6.sin6_port)); break;
-				#endif
-				default: g_string_append_c(str, '-'); break;
-				}
-				break;
-			case AL_FORMAT_QUERY_STRING:
-				if (req->uri.query->len)
-					al_append_escaped(str, req->uri.query);
-				else
-					g_string_append_c(str, '-');
-				break;
-			case AL_FORMAT_FIRST_LINE:
-				g_string_append_len(str, GSTR_LEN(req->http_method_str));
-				g_string_append_c(str, ' ');
-				al_append_escaped(str, req->uri.raw_orig_path);
-				g_string_append_c(str, ' ');
-				tmp_str = li_http_version_string(req->http_version, &len);
-				g_string_append_len(str, tmp_str, len);
-				break;
-			case AL_FORMAT_STATUS_CODE:
-				li_string_append_int(str, resp->http_status);
-				break;
-			case AL_FORMAT_TIME:
-				/* todo: implement format string */
-				tmp_gstr2 = li_worker_current_timestamp(vr->wrk, LI_LOCALTIME, ald->ts_ndx);
-				g_string_append_len(str, GSTR_LEN(tmp_gstr2));
-				break;
-			case AL_FORMAT_DURATION_SECONDS:
-				li_string_append_int(str, CUR_TS(vr->wrk) - vr->ts_started);
-				break;
-			case AL_FORMAT_AUTHED_USER:
-				tmp_gstr2 = li_environment_get(&vr->env, CONST_STR_LEN("REMOTE_USER"));
-				if (tmp_gstr2)
-					g_string_append_len(str, GSTR_LEN(tmp_gstr2));
-				else
-					g_string_append_c(str, '-');
-				break;
-			case AL_FORMAT_PATH:
-				g_string_append_len(str, GSTR_LEN(req->uri.path));
-				break;
-			case AL_FORMAT_SERVER_NAME:
-				if (CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_NAME).string)
-					g_string_append_len(str, GSTR_LEN(CORE_OPTIONPTR(LI_CORE_OPTION_SERVER_NAME).string));
-				else
-					g_string_append_len(str, GSTR_LEN(req->uri.host));
-				break;
-			case AL_FORMAT_HOSTNAME:
-				if (req->uri.host->len)
-					g_string_append_len(str, GSTR_LEN(req->uri.host));
-				else
-					g_string_append_c(str, '-');
-				break;
-			case AL_FORMAT_CONNECTION_STATUS: {
-					/* was request completed? */
-					liConnection *con = li_connection_from_vrequest(vr); /* try to get a connection object */
-
-					if (con && (con->in->is_closed && con->raw_out->is_closed && 0 == con->raw_out->length)) {
-						g_string_append_c(str, 'X');
-					} else {
-						g_string_append_c(str, vr->coninfo->keep_alive ? '+' : '-');
-					}
-				}
-				break;
-			case AL_FORMAT_BYTES_IN:
-				li_string_append_int(str, vr->coninfo->stats.bytes_in);
-				break;
-			case AL_FORMAT_BYTES_OUT:
-				li_string_append_int(str, vr->coninfo->stats.bytes_out);
-				break;
-			default:
-				/* not implemented:
-				{ 'C', FALSE, AL_FORMAT_COOKIE }
-				{ 't', FALSE, AL_FORMAT_TIME }, (partially implemented)
-				*/
-				g_string_append_c(str, '?');
-				break;
+#undef AL_VALUE_INT
+#undef AL_VALUE_STR
+#undef AL_VALUE_GSTR
+
+static void al_reserve(GString *str, gsize size) {
+	/* reserve space for the estimated record length, so appending rarely reallocates */
+	if (str->len + size >= str->allocated_len) {
+		gsize len = str->len;
+		g_string_set_size(str, len + size);
+		g_string_truncate(str, len);
+	}
+}
+
+static void al_format_text(liVRequest *vr, al_compiled_format *fmt, GString *str) {
+	al_value v;
+
+	for (guint i = 0; i < fmt->len; i++) {
+		al_instruction *ins = &fmt->code[i];
+
+		if (ins->type == AL_FORMAT_LITERAL) {
+			g_string_append_len(str, fmt->literals->str + ins->offset, ins->len);
+			continue;
+		}
+
+		al_get_value(vr, ins, FALSE, &v);
+
+		switch (v.type) {
+		case AL_VALUE_NONE:
+			g_string_append_c(str, '-');
+			break;
+		case AL_VALUE_INT:
+			if (0 == v.i && ins->type == AL_FORMAT_BYTES_RESPONSE_CLF)
+				g_string_append_c(str, '-');
+			else
+				li_string_append_int(str, v.i);
+			break;
+		case AL_VALUE_STRING:
+			if (v.escape) {
+				GString s = li_const_gstring(v.str, v.len);
+				al_append_escaped(str, &s);
+			} else {
+				g_string_append_len(str, v.str, v.len);
 			}
-		} else {
-			/* append normal string */
-			g_string_append_len(str, GSTR_LEN(e->key));
+			break;
+		}
+	}
+
+	g_string_append_c(str, '\n');
+}
+
+/* {"name":value,...}\n - ints are numbers, missing values are null */
+static void al_format_json(liVRequest *vr, al_compiled_format *fmt, GString *str) {
+	gboolean first = TRUE;
+	al_value v;
+
+	g_string_append_c(str, '{');
+
+	for (guint i = 0; i < fmt->len; i++) {
+		al_instruction *ins = &fmt->code[i];
+
+		if (ins->type == AL_FORMAT_LITERAL || 0 == ins->name_len) continue;
+
+		if (!first) g_string_append_c(str, ',');
+		first = FALSE;
+
+		g_string_append_len(str, fmt->names->str + ins->name_offset, ins->name_len);
+
+		al_get_value(vr, ins, TRUE, &v);
+
+		switch (v.type) {
+		case AL_VALUE_NONE:
+			g_string_append_len(str, CONST_STR_LEN("null"));
+			break;
+		case AL_VALUE_INT:
+			li_string_append_int(str, v.i);
+			break;
+		case AL_VALUE_STRING:
+			al_append_json_string(str, v.str, v.len);
+			break;
+		}
+	}
+
+	g_string_append_len(str, CONST_STR_LEN("}\n"));
+}
+
+/* record: u32 length of the following fields; each field: u8 format character, u8 value type,
+ *   then a i64 (AL_VALUE_INT) or u32 length + bytes (AL_VALUE_STRING). all integers are big endian.
+ *   fields appear in the order of the format string, literal text is not written.
+ */
+static void al_format_binary(liVRequest *vr, al_compiled_format *fmt, GString *str) {
+	gsize start = str->len;
+	guint32 u32;
+	guint64 u64;
+	al_value v;
+
+	g_string_append_len(str, "\0\0\0\0", 4);
+
+	for (guint i = 0; i < fmt->len; i++) {
+		al_instruction *ins = &fmt->code[i];
+		gchar hdr[2];
+
+		if (ins->type == AL_FORMAT_LITERAL) continue;
+
+		al_get_value(vr, ins, TRUE, &v);
+
+		hdr[0] = ins->character;
+		hdr[1] = v.type;
+		g_string_append_len(str, hdr, 2);
+
+		switch (v.type) {
+		case AL_VALUE_NONE:
+			break;
+		case AL_VALUE_INT:
+			u64 = GUINT64_TO_BE((guint64) v.i);
+			g_string_append_len(str, (const gchar*) &u64, 8);
+			break;
+		case AL_VALUE_STRING:
+			u32 = GUINT32_TO_BE((guint32) v.len);
+			g_string_append_len(str, (const gchar*) &u32, 4);
+			g_string_append_len(str, v.str, v.len);
+			break;
 		}
 	}
 
-	return str;
+	u32 = GUINT32_TO_BE((guint32) (str->len - start - 4));
+	memcpy(str->str + start, &u32, 4);
 }
 
 static void al_handle_vrclose(liVRequest *vr, liPlugin *p) {
 	/* VRequest closed, log it */
-	GString *msg;
+	liLogBuffer *buf;
 	liResponse *resp = &vr->response;
 	GString *log_path = OPTIONPTR(AL_OPTION_ACCESSLOG).ptr;
-	GArray *format = OPTIONPTR(AL_OPTION_ACCESSLOG_FORMAT).list;
+	al_compiled_format *format = OPTIONPTR(AL_OPTION_ACCESSLOG_FORMAT).ptr;
 
 	if (LI_VRS_CLEAN == vr->state || resp->http_status == 0 || !log_path || !format)
 		/* if status code is zero, it means the connection was closed while in keep alive state or similar and no logging is needed */
 		return;
 
-	msg = al_format_log(vr, p->data, format);
+	/* format directly into the per-worker buffer of the log target */
+	buf = li_log_buffer_get(vr->wrk, log_path);
+	al_reserve(buf->data, format->size_estimate);
+
+	switch (OPTION(AL_OPTION_ACCESSLOG_TYPE).number) {
+	case AL_TYPE_JSON:
+		al_format_json(vr, format, buf->data);
+		break;
+	case AL_TYPE_BINARY:
+		al_format_binary(vr, format, buf->data);
+		break;
+	default:
+		al_format_text(vr, format, buf->data);
+		break;
+	}
 
-	li_log_write_direct(vr->wrk->srv, vr->wrk, log_path, msg);
+	li_log_buffer_commit(vr->wrk, buf);
 }
 
 
-
 static void al_option_accesslog_free(liServer *srv, liPlugin *p, size_t ndx, gpointer oval) {
 	UNUSED(srv);
 	UNUSED(p);
@@ -431,54 +779,80 @@ static gboolean al_option_accesslog_parse(liServer *srv, liWorker *wrk, liPlugin
 }
 
 static void al_option_accesslog_format_free(liServer *srv, liPlugin *p, size_t ndx, gpointer oval) {
-	GArray *arr;
-	guint i;
-
 	UNUSED(srv);
 	UNUSED(p);
 	UNUSED(ndx);
 
 	if (!oval) return;
 
-	arr = oval;
-
-	for (i = 0; i < arr->len; i++) {
-		al_format_entry *afe = &g_array_index(arr, al_format_entry, i);
-		if (afe->key)
-			g_string_free(afe->key, TRUE);
-	}
-
-	g_array_free(arr, TRUE);
+	al_compiled_format_free(oval);
 }
 
 static gboolean al_option_accesslog_format_parse(liServer *srv, liWorker *wrk, liPlugin *p, size_t ndx, liValue *val, gpointer *oval) {
-	GArray *arr;
+	al_compiled_format *fmt;
 
 	UNUSED(wrk);
-	UNUSED(p);
 	UNUSED(ndx);
 
 	if (!val) {
 		/* default */
-		arr = al_parse_format(srv, AL_DEFAULT_FORMAT);
+		fmt = al_parse_format(srv, p->data, AL_DEFAULT_FORMAT);
 	} else if (val->type != LI_VALUE_STRING) {
 		ERROR(srv, "accesslog.format option expects a string as parameter, %s given", li_value_type_string(val->type));
 		return FALSE;
 	} else {
-		arr = al_parse_format(srv, val->data.string->str);
+		fmt = al_parse_format(srv, p->data, val->data.string->str);
 	}
 
-	if (!arr) {
+	if (!fmt) {
 		ERROR(srv, "%s", "failed to parse accesslog format");
 		return FALSE;
 	}
 
-	*oval = arr;
+	*oval = fmt;
+
+	return TRUE;
+}
+
+
+static gboolean al_option_accesslog_type_parse(liServer *srv, liWorker *wrk, liPlugin *p, size_t ndx, liValue *val, liOptionValue *oval) {
+	UNUSED(wrk);
+	UNUSED(p);
+	UNUSED(ndx);
+
+	if (!val) {
+		/* default */
+		oval->number = AL_TYPE_TEXT;
+		return TRUE;
+	}
+
+	/* Need manual type check, as resulting option type is number */
+	if (val->type != LI_VALUE_STRING) {
+		ERROR(srv, "accesslog.type option expects a string as parameter, %s given", li_value_type_string(val->type));
+		return FALSE;
+	}
+
+	if (g_str_equal(val->data.string->str, "text")) {
+		oval->number = AL_TYPE_TEXT;
+	} else if (g_str_equal(val->data.string->str, "json")) {
+		oval->number = AL_TYPE_JSON;
+	} else if (g_str_equal(val->data.string->str, "binary")) {
+		oval->number = AL_TYPE_BINARY;
+	} else {
+		ERROR(srv, "unknown accesslog.type: %s", val->data.string->str);
+		return FALSE;
+	}
 
 	return TRUE;
 }
 
 
+static const liPluginOption options[] = {
+	{ "accesslog.type", LI_VALUE_NONE, AL_TYPE_TEXT, al_option_accesslog_type_parse }, /* type in config is string, internal type is number */
+
+	{ NULL, 0, 0, NULL }
+};
+
 static const liPluginOptionPtr optionptrs[] = {
 	{ "accesslog", LI_VALUE_NONE, NULL, al_option_accesslog_parse, al_option_accesslog_free },
 	{ "accesslog.format", LI_VALUE_STRING, NULL, al_option_accesslog_format_parse, al_option_accesslog_format_free },
@@ -507,6 +881,7 @@ static void plugin_accesslog_init(liServer *srv, liPlugin *p, gpointer userdata)
 	UNUSED(srv); UNUSED(userdata);
 
 	p->free = plugin_accesslog_free;
+	p->options = options;
 	p->optionptrs = optionptrs;
 	p->actions = actions;
 	p->setups = setups;
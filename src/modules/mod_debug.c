@@ -15,6 +15,8 @@
  *           one can request additional debug output for specific connections
  *     debug.profiler_dump;
  *         - dumps all allocated memory to the profiler output file if profiling enabled (LIGHTY_PROFILE_MEM=profiler.log)
+ *         - with LIGHTY_PROFILE_MEM_SAMPLE=<KiB> the profiler only samples about one allocation per interval and
+ *           dumps the estimated live bytes per allocating callsite; cheap enough for production. SIGUSR2 dumps too.
  *
  * Example config:
  *     if req.path == "/debug/connections" { debug.show_connections; }
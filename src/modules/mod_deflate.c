@@ -10,14 +10,25 @@
  *      - if more than one etag response header is sent
  *      - if no common encoding is found
  *
- *     Supported encodings
- *      - gzip, deflate (needs zlib)
+ *     Supported encodings (in order of preference)
+ *      - br (needs brotli)
+ *      - zstd (needs zstd)
  *      - bzip2 (needs bzip2)
+ *      - gzip, deflate (needs zlib)
  *
  *     + Modifies etag response header (if present)
  *     + Adds "Vary: Accept-Encoding" response header
  *     + Resets Content-Length header
  *
+ *     Compressed variants of 200 responses with an etag can be cached (shared by all workers),
+ *     keyed by encoding, compression level, host, uri and etag; small variants are kept in memory,
+ *     bigger ones in the (optional) disk directory. Both are bounded and evicted in LRU order.
+ *     Responses with "Cache-Control: no-store" or "private" are not cached.
+ *     Each deflate action has its own cache (and limits); on disk it uses a private
+ *     "deflate-<pid>-XXXXXX" subdirectory of the cache directory, so several actions and
+ *     instances (graceful restart) can share a directory. Subdirectories of dead processes
+ *     are removed on startup.
+ *
  * Setups:
  *     none
  *
@@ -25,8 +36,17 @@
  *     deflate.debug <boolean>
  *
  * Actions:
- *     deflate [ "encodings": "deflate,gzip,bzip2", "blocksize": 4096, "output-buffer": 4096, "compression-level": 1 ];
+ *     deflate [ "encodings": "deflate,gzip,bzip2,br,zstd", "blocksize": 4096, "output-buffer": 4096, "compression-level": 1 ];
  *       - options are all optional, default values shown in line above :)
+ *       - "compression-level" (1-9) is used for zlib and bzip2; brotli and zstd have their own settings:
+ *         "brotli-quality": 4 (0-11), "brotli-window": 22 (log2 of the window size, 10-24),
+ *         "zstd-level": 3 (1-19), "zstd-window": 0 (log2 of the window size, 10-27; 0: derived from level)
+ *       - "offload": 0 (bytes); compress responses bigger than this in the tasklet pool of the worker
+ *         (see "tasklet_pool.threads") instead of the event loop; 0 disables offloading
+ *         "offload-blocks": 4; maximum number of input blocks ("blocksize") handed to one tasklet
+ *       - cache options (cache is disabled by default), limits are per action:
+ *         "cache-memory": 0 (bytes of memory for cached variants), "cache-memory-entry": 65536 (max size of a memory entry),
+ *         "cache-disk": "/var/cache/lighttpd/deflate" (directory for bigger variants), "cache-disk-size": 67108864
  *
  * Example config:
  *     deflate;
@@ -39,6 +59,9 @@
 #include <lighttpd/base.h>
 #include <lighttpd/plugin_core.h>
 
+#include <fcntl.h>
+#include <signal.h>
+
 LI_API gboolean mod_deflate_init(liModules *mods, liModule *mod);
 LI_API gboolean mod_deflate_free(liModules *mods, liModule *mod);
 
@@ -50,9 +73,14 @@ LI_API gboolean mod_deflate_free(liModules *mods, liModule *mod);
 #define ENCODING_NAME_COMPRESS   "compress"
 #define ENCODING_NAME_BZIP2      "bzip2"
 #define ENCODING_NAME_X_BZIP2    "x-bzip2"
+#define ENCODING_NAME_BROTLI     "br"
+#define ENCODING_NAME_ZSTD       "zstd"
 
+/* order defines preference */
 typedef enum {
 	ENCODING_IDENTITY,
+	ENCODING_BROTLI,
+	ENCODING_ZSTD,
 	ENCODING_BZIP2,
 	ENCODING_X_BZIP2,
 	ENCODING_GZIP,
@@ -63,6 +91,8 @@ typedef enum {
 
 static const char* encoding_names[] = {
 	"identity",
+	"br",
+	"zstd",
 	"bzip2",
 	"x-bzip2",
 	"gzip",
@@ -79,17 +109,44 @@ static const guint encoding_available_mask = 0
 #ifdef HAVE_ZLIB
 	| (1 << ENCODING_GZIP) | (1 << ENCODING_X_GZIP) | (1 << ENCODING_DEFLATE)
 #endif
+#ifdef HAVE_BROTLI
+	| (1 << ENCODING_BROTLI)
+#endif
+#ifdef HAVE_ZSTD
+	| (1 << ENCODING_ZSTD)
+#endif
 ;
 
+typedef struct deflate_cache deflate_cache;
+
 typedef struct deflate_config deflate_config;
 struct deflate_config {
 	liPlugin *p;
 	guint allowed_encodings;
 	guint blocksize, output_buffer, compression_level;
+	guint brotli_quality, brotli_window;
+	guint zstd_level, zstd_window;
+	goffset offload;
+	guint offload_blocks;
+	deflate_cache *cache;
 };
 
 /**********************************************************************************/
 
+/* DEFLATE_OP_PROCESS may keep output in the encoder; DEFLATE_OP_FLUSH and DEFLATE_OP_FINISH
+ * have to append all pending output to the chunkqueue */
+typedef enum {
+	DEFLATE_OP_PROCESS,
+	DEFLATE_OP_FLUSH,
+	DEFLATE_OP_FINISH
+} deflate_op;
+
+/* compress callbacks must not touch the vrequest: they may run in a tasklet thread */
+typedef gboolean (*deflate_compress_cb)(gpointer ctx, liChunkQueue *out, deflate_op op, const char *data, gsize len, const gchar **errmsg);
+typedef void (*deflate_context_free_cb)(gpointer ctx);
+
+/**********************************************************************************/
+
 #ifdef HAVE_ZLIB
 
 # include <zlib.h>
@@ -109,15 +166,14 @@ static const unsigned char gzip_header[] = {
 
 typedef struct deflate_context_zlib deflate_context_zlib;
 struct deflate_context_zlib {
-	deflate_config conf;
-
 	z_stream z;
 	GByteArray *buf;
 	gboolean is_gzip, gzip_header;
 	unsigned long crc;
 };
 
-static void deflate_context_zlib_free(deflate_context_zlib *ctx) {
+static void deflate_context_zlib_free(gpointer param) {
+	deflate_context_zlib *ctx = (deflate_context_zlib*) param;
 	z_stream *z;
 	if (!ctx) return;
 
@@ -136,8 +192,6 @@ static deflate_context_zlib* deflate_context_zlib_create(liVRequest *vr, deflate
 	guint window_size = -MAX_WBITS; /* supress zlib-header */
 	guint mem_level = 8;
 
-	ctx->conf = *conf;
-
 	z->zalloc = Z_NULL;
 	z->zfree = Z_NULL;
 	z->opaque = Z_NULL;
@@ -168,46 +222,28 @@ static deflate_context_zlib* deflate_context_zlib_create(liVRequest *vr, deflate
 	return ctx;
 }
 
-static void deflate_filter_zlib_free(liVRequest *vr, liFilter *f) {
-	deflate_context_zlib *ctx = (deflate_context_zlib*) f->param;
-	UNUSED(vr);
+static void deflate_zlib_flush_buf(deflate_context_zlib *ctx, liChunkQueue *out) {
+	z_stream *z = &ctx->z;
 
-	deflate_context_zlib_free(ctx);
+	if (0 < ctx->buf->len - z->avail_out) {
+		li_chunkqueue_append_mem(out, ctx->buf->data, ctx->buf->len - z->avail_out);
+		z->next_out = ctx->buf->data;
+		z->avail_out = ctx->buf->len;
+	}
 }
 
-static liHandlerResult deflate_filter_zlib(liVRequest *vr, liFilter *f) {
-	deflate_context_zlib *ctx = (deflate_context_zlib*) f->param;
-	const off_t blocksize = ctx->conf.blocksize;
-	const off_t max_compress = 4 * blocksize;
-	gboolean debug = _OPTION(vr, ctx->conf.p, 0).boolean;
+static gboolean deflate_zlib_compress(gpointer param, liChunkQueue *out, deflate_op op, const char *data, gsize len, const gchar **errmsg) {
+	deflate_context_zlib *ctx = (deflate_context_zlib*) param;
 	z_stream *z = &ctx->z;
-	off_t l = 0;
-	liHandlerResult res;
 	int rc;
-	UNUSED(vr);
-
-	if (f->in->is_closed && 0 == f->in->length && f->out->is_closed) {
-		/* nothing to do anymore */
-		return LI_HANDLER_GO_ON;
-	}
-
-	if (f->out->is_closed) {
-		li_chunkqueue_skip_all(f->in);
-		f->in->is_closed = TRUE;
-		if (debug) {
-			VR_DEBUG(vr, "deflate out stream closed: in: %i, out : %i", (int) z->total_in, (int) z->total_out);
-		}
-		return LI_HANDLER_GO_ON;
-	}
 
 	if (ctx->is_gzip && !ctx->gzip_header) {
 		ctx->gzip_header = TRUE;
 
 		/* as the buffer is unused it really should be big enough */
 		if (z->avail_out < sizeof(gzip_header)) {
-			f->out->is_closed = TRUE;
-			VR_ERROR(vr, "deflate error: %s", z->msg);
-			return LI_HANDLER_ERROR;
+			*errmsg = "output buffer too small for gzip header";
+			return FALSE;
 		}
 
 		/* copy gzip header into output buffer */
@@ -219,26 +255,9 @@ static liHandlerResult deflate_filter_zlib(liVRequest *vr, liFilter *f) {
 		z->avail_out -= sizeof(gzip_header);
 	}
 
-	while (l < max_compress) {
-		char *data;
-		off_t len;
-		liChunkIter ci;
-		GError *err = NULL;
-
-		if (0 == f->in->length) break;
-
-		ci = li_chunkqueue_iter(f->in);
-
-		if (LI_HANDLER_GO_ON != (res = li_chunkiter_read(ci, 0, blocksize, &data, &len, &err))) {
-			if (NULL != err) {
-				VR_ERROR(vr, "Couldn't read data from chunkqueue: %s", err->message);
-				g_error_free(err);
-			}
-			return res;
-		}
-
+	if (len > 0) {
 		if (ctx->is_gzip) {
-			ctx->crc = crc32(ctx->crc, (unsigned char*) data, len);
+			ctx->crc = crc32(ctx->crc, (const unsigned char*) data, len);
 		}
 
 		z->next_in = (unsigned char*) data;
@@ -246,37 +265,42 @@ static liHandlerResult deflate_filter_zlib(liVRequest *vr, liFilter *f) {
 
 		do {
 			if (Z_OK != deflate(z, Z_NO_FLUSH)) {
-				f->out->is_closed = TRUE;
-				VR_ERROR(vr, "deflate error: %s", z->msg);
-				return LI_HANDLER_ERROR;
+				*errmsg = z->msg;
+				return FALSE;
 			}
 
 			if(z->avail_out == 0 || z->avail_in > 0) {
-				li_chunkqueue_append_mem(f->out, ctx->buf->data, ctx->buf->len - z->avail_out);
-				z->next_out = ctx->buf->data;
-				z->avail_out = ctx->buf->len;
+				deflate_zlib_flush_buf(ctx, out);
 			}
 		} while (z->avail_in > 0);
-
-		li_chunkqueue_skip(f->in, len);
-		l += len;
 	}
 
-	if (0 == f->in->length && f->in->is_closed) {
+	switch (op) {
+	case DEFLATE_OP_PROCESS:
+		break;
+	case DEFLATE_OP_FLUSH:
+		do {
+			rc = deflate(z, Z_SYNC_FLUSH);
+			if (rc == Z_BUF_ERROR) break; /* nothing left to flush */
+			if (rc != Z_OK && rc != Z_STREAM_END) {
+				*errmsg = z->msg;
+				return FALSE;
+			}
+			if (z->avail_out > 0) break;
+			deflate_zlib_flush_buf(ctx, out);
+		} while (TRUE);
+		deflate_zlib_flush_buf(ctx, out);
+		break;
+	case DEFLATE_OP_FINISH:
 		do {
 			rc = deflate(z, Z_FINISH);
 			if (rc != Z_OK && rc != Z_STREAM_END) {
-				f->out->is_closed = TRUE;
-				VR_ERROR(vr, "deflate error: %s", z->msg);
-				return LI_HANDLER_ERROR;
+				*errmsg = z->msg;
+				return FALSE;
 			}
 
 			/* flush every time until done */
-			if (0 < ctx->buf->len - z->avail_out) {
-				li_chunkqueue_append_mem(f->out, ctx->buf->data, ctx->buf->len - z->avail_out);
-				z->next_out = ctx->buf->data;
-				z->avail_out = ctx->buf->len;
-			}
+			deflate_zlib_flush_buf(ctx, out);
 		} while (rc != Z_STREAM_END);
 
 		if (ctx->is_gzip) {
@@ -293,33 +317,12 @@ static liHandlerResult deflate_filter_zlib(liVRequest *vr, liFilter *f) {
 			c[7] = (z->total_in >> 24) & 0xff;
 
 			/* append footer to write_queue */
-			li_chunkqueue_append_mem(f->out, c, 8);
-		}
-
-		if (debug) {
-			VR_DEBUG(vr, "deflate finished: in: %i, out : %i", (int) z->total_in, (int) z->total_out);
-		}
-
-		f->out->is_closed = TRUE;
-	}
-
-	if (l > 0 && 0 == f->in->length && !f->in->is_closed) { /* flush z_stream */
-		rc = deflate(z, Z_SYNC_FLUSH);
-		if (rc != Z_OK && rc != Z_STREAM_END) {
-			f->out->is_closed = TRUE;
-			VR_ERROR(vr, "deflate error: %s", z->msg);
-			return LI_HANDLER_ERROR;
+			li_chunkqueue_append_mem(out, c, 8);
 		}
+		break;
 	}
 
-	/* flush output buffer if there is no more data pending */
-	if (0 == f->in->length && 0 < ctx->buf->len - z->avail_out) {
-		li_chunkqueue_append_mem(f->out, ctx->buf->data, ctx->buf->len - z->avail_out);
-		z->next_out = ctx->buf->data;
-		z->avail_out = ctx->buf->len;
-	}
-
-	return 0 == f->in->length ? LI_HANDLER_GO_ON : LI_HANDLER_COMEBACK;
+	return TRUE;
 }
 #endif /* HAVE_ZLIB */
 
@@ -334,13 +337,12 @@ static liHandlerResult deflate_filter_zlib(liVRequest *vr, liFilter *f) {
 
 typedef struct deflate_context_bzip2 deflate_context_bzip2;
 struct deflate_context_bzip2 {
-	deflate_config conf;
-
 	bz_stream bz;
 	GByteArray *buf;
 };
 
-static void deflate_context_bzip2_free(deflate_context_bzip2 *ctx) {
+static void deflate_context_bzip2_free(gpointer param) {
+	deflate_context_bzip2 *ctx = (deflate_context_bzip2*) param;
 	bz_stream *bz;
 	if (!ctx) return;
 
@@ -357,8 +359,6 @@ static deflate_context_bzip2* deflate_context_bzip2_create(liVRequest *vr, defla
 	bz_stream *bz = &ctx->bz;
 	guint compression_level = conf->compression_level;
 
-	ctx->conf = *conf;
-
 	bz->bzalloc = NULL;
 	bz->bzfree = NULL;
 	bz->opaque = NULL;
@@ -382,283 +382,1130 @@ static deflate_context_bzip2* deflate_context_bzip2_create(liVRequest *vr, defla
 	return ctx;
 }
 
-static void deflate_filter_bzip2_free(liVRequest *vr, liFilter *f) {
-	deflate_context_bzip2 *ctx = (deflate_context_bzip2*) f->param;
-	UNUSED(vr);
+static void deflate_bzip2_flush_buf(deflate_context_bzip2 *ctx, liChunkQueue *out) {
+	bz_stream *bz = &ctx->bz;
 
-	deflate_context_bzip2_free(ctx);
+	if (0 < ctx->buf->len - bz->avail_out) {
+		li_chunkqueue_append_mem(out, ctx->buf->data, ctx->buf->len - bz->avail_out);
+		bz->next_out = (char*) ctx->buf->data;
+		bz->avail_out = ctx->buf->len;
+	}
 }
 
-static liHandlerResult deflate_filter_bzip2(liVRequest *vr, liFilter *f) {
-	deflate_context_bzip2 *ctx = (deflate_context_bzip2*) f->param;
-	const off_t blocksize = ctx->conf.blocksize;
-	const off_t max_compress = 4 * blocksize;
-	gboolean debug = _OPTION(vr, ctx->conf.p, 0).boolean;
+static gboolean deflate_bzip2_compress(gpointer param, liChunkQueue *out, deflate_op op, const char *data, gsize len, const gchar **errmsg) {
+	deflate_context_bzip2 *ctx = (deflate_context_bzip2*) param;
 	bz_stream *bz = &ctx->bz;
-	off_t l = 0;
-	liHandlerResult res;
 	int rc;
-	UNUSED(vr);
-
-	if (f->in->is_closed && 0 == f->in->length && f->out->is_closed) {
-		/* nothing to do anymore */
-		return LI_HANDLER_GO_ON;
-	}
-
-	if (f->out->is_closed) {
-		li_chunkqueue_skip_all(f->in);
-		f->in->is_closed = TRUE;
-		if (debug) {
-			VR_DEBUG(vr, "deflate out stream closed: in: %i, out : %i", (int) bz->total_in_lo32, (int) bz->total_out_lo32);
-		}
-		return LI_HANDLER_GO_ON;
-	}
-
-	while (l < max_compress) {
-		char *data;
-		off_t len;
-		liChunkIter ci;
-		GError *err = NULL;
 
-		if (0 == f->in->length) break;
-
-		ci = li_chunkqueue_iter(f->in);
-
-		if (LI_HANDLER_GO_ON != (res = li_chunkiter_read(ci, 0, blocksize, &data, &len, &err))) {
-			if (NULL != err) {
-				VR_ERROR(vr, "Couldn't read data from chunkqueue: %s", err->message);
-				g_error_free(err);
-			}
-			return res;
-		}
-
-		bz->next_in = data;
+	if (len > 0) {
+		bz->next_in = (char*) data;
 		bz->avail_in = len;
 
 		do {
 			rc = BZ2_bzCompress(bz, BZ_RUN);
 			if (rc != BZ_RUN_OK) {
-				f->out->is_closed = TRUE;
-				VR_ERROR(vr, "BZ2_bzCompress error: rc = %i", rc);
-				return LI_HANDLER_ERROR;
+				*errmsg = "BZ2_bzCompress failed";
+				return FALSE;
 			}
 
 			if(bz->avail_out == 0 || bz->avail_in > 0) {
-				li_chunkqueue_append_mem(f->out, ctx->buf->data, ctx->buf->len - bz->avail_out);
-				bz->next_out = (char*) ctx->buf->data;
-				bz->avail_out = ctx->buf->len;
+				deflate_bzip2_flush_buf(ctx, out);
 			}
 		} while (bz->avail_in > 0);
-
-		li_chunkqueue_skip(f->in, len);
-		l += len;
 	}
 
-	if (0 == f->in->length && f->in->is_closed) {
+	switch (op) {
+	case DEFLATE_OP_PROCESS:
+		break;
+	case DEFLATE_OP_FLUSH:
+		/* BZ_FLUSH would end the current block and hurt the compression ratio; only pass on what we have */
+		deflate_bzip2_flush_buf(ctx, out);
+		break;
+	case DEFLATE_OP_FINISH:
 		do {
 			rc = BZ2_bzCompress(bz, BZ_FINISH);
 			if (rc != BZ_RUN_OK && rc != BZ_STREAM_END && rc != BZ_FINISH_OK) {
-				f->out->is_closed = TRUE;
-				VR_ERROR(vr, "BZ2_bzCompress error: rc = %i", rc);
-				return LI_HANDLER_ERROR;
+				*errmsg = "BZ2_bzCompress failed";
+				return FALSE;
 			}
 
 			/* flush every time until done */
-			if (0 < ctx->buf->len - bz->avail_out) {
-				li_chunkqueue_append_mem(f->out, ctx->buf->data, ctx->buf->len - bz->avail_out);
-				bz->next_out = (char*) ctx->buf->data;
-				bz->avail_out = ctx->buf->len;
-			}
+			deflate_bzip2_flush_buf(ctx, out);
 		} while (rc == BZ_RUN_OK || rc == BZ_FINISH_OK);
-
-		if (debug) {
-			VR_DEBUG(vr, "deflate finished: in: %i, out : %i", (int) bz->total_in_lo32, (int) bz->total_out_lo32);
-		}
-
-
-		f->out->is_closed = TRUE;
-	}
-
-	/* flush output buffer if there is no more data pending */
-	if (0 == f->in->length && 0 < ctx->buf->len - bz->avail_out) {
-		li_chunkqueue_append_mem(f->out, ctx->buf->data, ctx->buf->len - bz->avail_out);
-		bz->next_out = (char*) ctx->buf->data;
-		bz->avail_out = ctx->buf->len;
+		break;
 	}
 
-	return 0 == f->in->length ? LI_HANDLER_GO_ON : LI_HANDLER_COMEBACK;
+	return TRUE;
 }
 #endif /* HAVE_BZIP */
 
-static liHandlerResult deflate_filter_null(liVRequest *vr, liFilter *f) {
-	UNUSED(vr);
-	li_chunkqueue_skip_all(f->in);
-	f->out->is_closed = f->in->is_closed = TRUE;
-	return LI_HANDLER_GO_ON;
-}
-
 /**********************************************************************************/
 
-/* returns TRUE if handled with 304, FALSE otherwise */
-static gboolean cached_handle_etag(liVRequest *vr, gboolean debug, liHttpHeader *hh_etag, const char* enc_name) {
-	GString *s = vr->wrk->tmp_str;
+#ifdef HAVE_BROTLI
 
-	if (!hh_etag) return FALSE;
+# include <brotli/encode.h>
 
-	g_string_truncate(s, 0);
-	g_string_append_len(s, LI_HEADER_VALUE_LEN(hh_etag));
-	g_string_append_len(s, CONST_STR_LEN("-"));
-	g_string_append_len(s, enc_name, strlen(enc_name));
-	li_etag_mutate(s, s);
-	g_string_truncate(hh_etag->data, hh_etag->keylen + 2);
-	g_string_append_len(hh_etag->data, GSTR_LEN(s));
+typedef struct deflate_context_brotli deflate_context_brotli;
+struct deflate_context_brotli {
+	BrotliEncoderState *state;
+	GByteArray *buf;
+	size_t avail_out;
+	guint8 *next_out;
+};
 
-	if (200 == vr->response.http_status && li_http_response_handle_cachable(vr)) {
-		if (debug || CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
-			VR_DEBUG(vr, "%s", "deflate: etag handling => 304 Not Modified");
-		}
-		vr->response.http_status = 304;
-		return TRUE;
-	}
-	return FALSE;
+static void deflate_context_brotli_free(gpointer param) {
+	deflate_context_brotli *ctx = (deflate_context_brotli*) param;
+	if (!ctx) return;
+
+	BrotliEncoderDestroyInstance(ctx->state);
+
+	g_byte_array_free(ctx->buf, TRUE);
+
+	g_slice_free(deflate_context_brotli, ctx);
 }
 
-static guint header_to_endocing_mask(const gchar *s) {
-	guint encoding_mask = 0, i;
+static deflate_context_brotli* deflate_context_brotli_create(liVRequest *vr, deflate_config *conf) {
+	deflate_context_brotli *ctx = g_slice_new0(deflate_context_brotli);
 
-	for (i = 1; encoding_names[i]; i++) {
-		const gchar *p = strstr(s, encoding_names[i]);
-		if (NULL != p && (p == s || p[-1] == ' ' || p[-1] == ',')) {
-			encoding_mask |= 1 << i;
-		}
+	if (NULL == (ctx->state = BrotliEncoderCreateInstance(NULL, NULL, NULL))
+	    || !BrotliEncoderSetParameter(ctx->state, BROTLI_PARAM_QUALITY, conf->brotli_quality)
+	    || !BrotliEncoderSetParameter(ctx->state, BROTLI_PARAM_LGWIN, conf->brotli_window)) {
+		if (NULL != ctx->state) BrotliEncoderDestroyInstance(ctx->state);
+		g_slice_free(deflate_context_brotli, ctx);
+		VR_ERROR(vr, "%s", "Couldn't init brotli encoder");
+		return NULL;
 	}
 
-	return encoding_mask;
-}
+	ctx->buf = g_byte_array_new();
+	g_byte_array_set_size(ctx->buf, conf->output_buffer);
 
-static liHandlerResult deflate_handle(liVRequest *vr, gpointer param, gpointer *context) {
-	deflate_config *config = (deflate_config*) param;
-	GList *hh_encoding_entry, *hh_etag_entry;
-	liHttpHeader *hh_encoding, *hh_etag = NULL;
-	guint encoding_mask = 0, i;
-	gboolean debug = _OPTION(vr, config->p, 0).boolean;
-	gboolean is_head_request = (vr->request.http_method == LI_HTTP_METHOD_HEAD);
+	ctx->next_out = ctx->buf->data;
+	ctx->avail_out = ctx->buf->len;
 
-	UNUSED(context);
+	return ctx;
+}
 
-	VREQUEST_WAIT_FOR_RESPONSE_HEADERS(vr);
+static void deflate_brotli_flush_buf(deflate_context_brotli *ctx, liChunkQueue *out) {
+	if (0 < ctx->buf->len - ctx->avail_out) {
+		li_chunkqueue_append_mem(out, ctx->buf->data, ctx->buf->len - ctx->avail_out);
+		ctx->next_out = ctx->buf->data;
+		ctx->avail_out = ctx->buf->len;
+	}
+}
 
-	/* disable compression for some http status types. */
-	switch(vr->response.http_status) {
-	case 100:
-	case 101:
-	case 204:
-	case 205:
-	case 206:
-	case 304:
-		/* disable compression as we have no response entity */
-		return LI_HANDLER_GO_ON;
-	default:
-		break;
+static gboolean deflate_brotli_compress(gpointer param, liChunkQueue *out, deflate_op op, const char *data, gsize len, const gchar **errmsg) {
+	deflate_context_brotli *ctx = (deflate_context_brotli*) param;
+	BrotliEncoderOperation bop;
+	size_t avail_in = len;
+	const guint8 *next_in = (const guint8*) data;
+
+	switch (op) {
+	case DEFLATE_OP_FLUSH: bop = BROTLI_OPERATION_FLUSH; break;
+	case DEFLATE_OP_FINISH: bop = BROTLI_OPERATION_FINISH; break;
+	default: bop = BROTLI_OPERATION_PROCESS; break;
 	}
 
-	/* response already encoded */
-	if (li_http_header_find_first(vr->response.headers, CONST_STR_LEN("content-encoding"))) {
-		if (debug) {
-			VR_DEBUG(vr, "%s", "deflate: Content-Encoding already set => not compressing");
+	/* loop until all input is consumed and (for flush/finish) all output is produced */
+	do {
+		if (!BrotliEncoderCompressStream(ctx->state, bop, &avail_in, &next_in, &ctx->avail_out, &ctx->next_out, NULL)) {
+			*errmsg = "BrotliEncoderCompressStream failed";
+			return FALSE;
 		}
-		return LI_HANDLER_GO_ON;
-	}
 
-	/* don't mess with content after transfer-encoding */
-	if (li_http_header_find_first(vr->response.headers, CONST_STR_LEN("transfer-encoding"))) {
-		if (debug) {
-			VR_DEBUG(vr, "%s", "deflate: Transfer-Encoding set => not compressing");
+		if (0 == ctx->avail_out || avail_in > 0 || BrotliEncoderHasMoreOutput(ctx->state)) {
+			deflate_brotli_flush_buf(ctx, out);
 		}
-		return LI_HANDLER_GO_ON;
-	}
+	} while (avail_in > 0 || BrotliEncoderHasMoreOutput(ctx->state)
+		|| (BROTLI_OPERATION_FINISH == bop && !BrotliEncoderIsFinished(ctx->state)));
 
-	/* announce that we have looked for accept-encoding */
-	li_http_header_append(vr->response.headers, CONST_STR_LEN("Vary"), CONST_STR_LEN("Accept-Encoding"));
+	if (DEFLATE_OP_PROCESS != op) deflate_brotli_flush_buf(ctx, out);
 
-	hh_encoding_entry = li_http_header_find_first(vr->request.headers, CONST_STR_LEN("accept-encoding"));
-	while (hh_encoding_entry) {
-		hh_encoding = (liHttpHeader*) hh_encoding_entry->data;
-		encoding_mask |= header_to_endocing_mask(LI_HEADER_VALUE(hh_encoding));
-		hh_encoding_entry = li_http_header_find_next(hh_encoding_entry, CONST_STR_LEN("accept-encoding"));
-	}
+	return TRUE;
+}
+#endif /* HAVE_BROTLI */
 
-	if (0 == encoding_mask)
-		return LI_HANDLER_GO_ON; /* no known encoding found */
+/**********************************************************************************/
 
-	encoding_mask &= encoding_available_mask & config->allowed_encodings;
-	if (0 == encoding_mask) {
-		if (debug) {
-			VR_DEBUG(vr, "%s", "no common encoding found => not compressing");
-		}
-		return LI_HANDLER_GO_ON; /* no common encoding found */
-	}
+#ifdef HAVE_ZSTD
 
-	/* find best encoding (first in list) */
-	for (i = 1; 0 == (encoding_mask & (1 << i)) ; i++) ;
+# include <zstd.h>
 
-	hh_etag_entry = li_http_header_find_first(vr->response.headers, CONST_STR_LEN("etag"));
-	if (hh_etag_entry) {
-		if (li_http_header_find_next(hh_etag_entry, CONST_STR_LEN("etag"))) {
-			if (debug || CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
-				VR_DEBUG(vr, "%s", "duplicate etag header in response, will not deflate it");
-			}
-			return LI_HANDLER_GO_ON;
+typedef struct deflate_context_zstd deflate_context_zstd;
+struct deflate_context_zstd {
+	ZSTD_CCtx *cctx;
+	GByteArray *buf;
+	ZSTD_outBuffer out;
+};
+
+static void deflate_context_zstd_free(gpointer param) {
+	deflate_context_zstd *ctx = (deflate_context_zstd*) param;
+	if (!ctx) return;
+
+	ZSTD_freeCCtx(ctx->cctx);
+
+	g_byte_array_free(ctx->buf, TRUE);
+
+	g_slice_free(deflate_context_zstd, ctx);
+}
+
+static deflate_context_zstd* deflate_context_zstd_create(liVRequest *vr, deflate_config *conf) {
+	deflate_context_zstd *ctx = g_slice_new0(deflate_context_zstd);
+
+	if (NULL == (ctx->cctx = ZSTD_createCCtx())
+	    || ZSTD_isError(ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_compressionLevel, conf->zstd_level))
+	    || ZSTD_isError(ZSTD_CCtx_setParameter(ctx->cctx, ZSTD_c_windowLog, conf->zstd_window))) {
+		if (NULL != ctx->cctx) ZSTD_freeCCtx(ctx->cctx);
+		g_slice_free(deflate_context_zstd, ctx);
+		VR_ERROR(vr, "%s", "Couldn't init zstd context");
+		return NULL;
+	}
+
+	ctx->buf = g_byte_array_new();
+	g_byte_array_set_size(ctx->buf, conf->output_buffer);
+
+	ctx->out.dst = ctx->buf->data;
+	ctx->out.size = ctx->buf->len;
+	ctx->out.pos = 0;
+
+	return ctx;
+}
+
+static void deflate_zstd_flush_buf(deflate_context_zstd *ctx, liChunkQueue *out) {
+	if (0 < ctx->out.pos) {
+		li_chunkqueue_append_mem(out, ctx->buf->data, ctx->out.pos);
+		ctx->out.pos = 0;
+	}
+}
+
+static gboolean deflate_zstd_compress(gpointer param, liChunkQueue *out, deflate_op op, const char *data, gsize len, const gchar **errmsg) {
+	deflate_context_zstd *ctx = (deflate_context_zstd*) param;
+	ZSTD_inBuffer in = { data, len, 0 };
+	ZSTD_EndDirective zop;
+	size_t rc;
+
+	switch (op) {
+	case DEFLATE_OP_FLUSH: zop = ZSTD_e_flush; break;
+	case DEFLATE_OP_FINISH: zop = ZSTD_e_end; break;
+	default: zop = ZSTD_e_continue; break;
+	}
+
+	/* loop until all input is consumed and (for flush/end) all output is produced */
+	do {
+		rc = ZSTD_compressStream2(ctx->cctx, &ctx->out, &in, zop);
+		if (ZSTD_isError(rc)) {
+			*errmsg = ZSTD_getErrorName(rc);
+			return FALSE;
 		}
-		hh_etag = (liHttpHeader*) hh_etag_entry->data;
+
+		if (ctx->out.pos == ctx->out.size || in.pos < in.size || (ZSTD_e_continue != zop && 0 != rc)) {
+			deflate_zstd_flush_buf(ctx, out);
+		}
+	} while (in.pos < in.size || (ZSTD_e_continue != zop && 0 != rc));
+
+	if (DEFLATE_OP_PROCESS != op) deflate_zstd_flush_buf(ctx, out);
+
+	return TRUE;
+}
+#endif /* HAVE_ZSTD */
+
+/**********************************************************************************/
+
+/* one compressed response: encoder context + input/output handling, optionally offloaded to the
+ * tasklet pool of the worker. while a tasklet is running only that thread touches the encoder
+ * context and job_in/job_out; if the filter gets freed meanwhile the stream is only marked detached
+ * and freed when the tasklet is finished (tasklets can't be cancelled). */
+typedef struct deflate_stream deflate_stream;
+struct deflate_stream {
+	deflate_config conf;
+
+	gpointer ctx;
+	deflate_compress_cb compress;
+	deflate_context_free_cb ctx_free;
+	guint64 total_in;
+
+	/* offloading */
+	liJobRef *vr_ref;
+	gboolean running, job_done, detached;
+	GByteArray *job_in;
+	liChunkQueue *job_out;
+	deflate_op job_op;
+	gboolean job_failed;
+	const gchar *job_errmsg;
+};
+
+static deflate_stream* deflate_stream_new(deflate_config *conf, gpointer ctx, deflate_compress_cb compress_cb, deflate_context_free_cb ctx_free) {
+	deflate_stream *stream = g_slice_new0(deflate_stream);
+
+	stream->conf = *conf;
+	stream->ctx = ctx;
+	stream->compress = compress_cb;
+	stream->ctx_free = ctx_free;
+
+	return stream;
+}
+
+static void deflate_stream_free(deflate_stream *stream) {
+	stream->ctx_free(stream->ctx);
+
+	if (NULL != stream->vr_ref) li_job_ref_release(stream->vr_ref);
+	if (NULL != stream->job_in) g_byte_array_free(stream->job_in, TRUE);
+	if (NULL != stream->job_out) li_chunkqueue_free(stream->job_out);
+
+	g_slice_free(deflate_stream, stream);
+}
+
+/* tasklet thread */
+static void deflate_stream_run(gpointer data) {
+	deflate_stream *stream = (deflate_stream*) data;
+
+	stream->job_failed = !stream->compress(stream->ctx, stream->job_out, stream->job_op,
+		(const char*) stream->job_in->data, stream->job_in->len, &stream->job_errmsg);
+}
+
+/* worker thread */
+static void deflate_stream_finished(gpointer data) {
+	deflate_stream *stream = (deflate_stream*) data;
+
+	stream->running = FALSE;
+
+	if (stream->detached) {
+		deflate_stream_free(stream);
+		return;
 	}
 
-	if (debug || CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
-		VR_DEBUG(vr, "deflate: compressing using %s encoding", encoding_names[i]);
+	stream->job_done = TRUE;
+	li_job_later_ref(stream->vr_ref);
+}
+
+static void deflate_filter_free(liVRequest *vr, liFilter *f) {
+	deflate_stream *stream = (deflate_stream*) f->param;
+	UNUSED(vr);
+
+	if (stream->running) {
+		stream->detached = TRUE;
+	} else {
+		deflate_stream_free(stream);
 	}
+}
 
-	switch ((encodings) i) {
-	case ENCODING_IDENTITY:
+static liHandlerResult deflate_filter(liVRequest *vr, liFilter *f) {
+	deflate_stream *stream = (deflate_stream*) f->param;
+	const off_t blocksize = stream->conf.blocksize;
+	gboolean debug = _OPTION(vr, stream->conf.p, 0).boolean;
+	gboolean offload;
+	off_t max_compress, l = 0;
+	const gchar *errmsg = NULL;
+	liHandlerResult res;
+	deflate_op op;
+
+	if (stream->running) return LI_HANDLER_WAIT_FOR_EVENT;
+
+	if (stream->job_done) {
+		stream->job_done = FALSE;
+		g_byte_array_set_size(stream->job_in, 0);
+
+		if (stream->job_failed) {
+			li_chunkqueue_skip_all(stream->job_out);
+			f->out->is_closed = TRUE;
+			VR_ERROR(vr, "deflate error: %s", stream->job_errmsg ? stream->job_errmsg : "unknown error");
+			return LI_HANDLER_ERROR;
+		}
+
+		if (f->out->is_closed) {
+			li_chunkqueue_skip_all(stream->job_out);
+		} else {
+			li_chunkqueue_steal_all(f->out, stream->job_out);
+
+			if (DEFLATE_OP_FINISH == stream->job_op) {
+				if (debug) {
+					VR_DEBUG(vr, "deflate finished: in: %"G_GUINT64_FORMAT", out : %"L_GOFFSET_FORMAT, stream->total_in, f->out->bytes_in);
+				}
+				f->out->is_closed = TRUE;
+			}
+		}
+	}
+
+	if (f->in->is_closed && 0 == f->in->length && f->out->is_closed) {
+		/* nothing to do anymore */
 		return LI_HANDLER_GO_ON;
-	case ENCODING_BZIP2:
-	case ENCODING_X_BZIP2:
-#ifdef HAVE_BZIP
-		if (cached_handle_etag(vr, debug, hh_etag, encoding_names[i])) return LI_HANDLER_GO_ON;
-		if (!is_head_request) {
-			deflate_context_bzip2 *ctx;
-			ctx = deflate_context_bzip2_create(vr, config);
-			if (!ctx) return LI_HANDLER_GO_ON;
-			li_vrequest_add_filter_out(vr, deflate_filter_bzip2, deflate_filter_bzip2_free, ctx);
+	}
+
+	if (f->out->is_closed) {
+		li_chunkqueue_skip_all(f->in);
+		f->in->is_closed = TRUE;
+		if (debug) {
+			VR_DEBUG(vr, "deflate out stream closed: in: %"G_GUINT64_FORMAT", out : %"L_GOFFSET_FORMAT, stream->total_in, f->out->bytes_in);
+		}
+		return LI_HANDLER_GO_ON;
+	}
+
+	/* offload big responses: everything after the first "offload" bytes */
+	offload = stream->conf.offload > 0 && stream->total_in + f->in->length >= stream->conf.offload;
+	max_compress = offload ? stream->conf.offload_blocks * blocksize : 4 * blocksize;
+
+	if (offload && NULL == stream->job_in) {
+		stream->job_in = g_byte_array_sized_new(max_compress);
+		stream->job_out = li_chunkqueue_new();
+		stream->vr_ref = li_vrequest_get_ref(vr);
+	}
+
+	while (l < max_compress) {
+		char *data;
+		off_t len;
+		liChunkIter ci;
+		GError *err = NULL;
+
+		if (0 == f->in->length) break;
+
+		ci = li_chunkqueue_iter(f->in);
+
+		if (LI_HANDLER_GO_ON != (res = li_chunkiter_read(ci, 0, MIN(blocksize, max_compress - l), &data, &len, &err))) {
+			if (NULL != err) {
+				VR_ERROR(vr, "Couldn't read data from chunkqueue: %s", err->message);
+				g_error_free(err);
+			}
+			return res;
 		}
+
+		if (offload) {
+			/* copy the block, the tasklet must not touch the chunkqueue */
+			g_byte_array_append(stream->job_in, (const guint8*) data, len);
+		} else if (!stream->compress(stream->ctx, f->out, DEFLATE_OP_PROCESS, data, len, &errmsg)) {
+			f->out->is_closed = TRUE;
+			VR_ERROR(vr, "deflate error: %s", errmsg ? errmsg : "unknown error");
+			return LI_HANDLER_ERROR;
+		}
+
+		li_chunkqueue_skip(f->in, len);
+		l += len;
+	}
+
+	stream->total_in += l;
+
+	if (0 == f->in->length && f->in->is_closed) {
+		op = DEFLATE_OP_FINISH;
+	} else if (l > 0 && 0 == f->in->length) {
+		op = DEFLATE_OP_FLUSH;
+	} else {
+		op = DEFLATE_OP_PROCESS;
+	}
+
+	if (offload) {
+		if (0 == l && DEFLATE_OP_FINISH != op) return LI_HANDLER_GO_ON;
+
+		stream->job_op = op;
+		stream->running = TRUE;
+		li_tasklet_push(vr->wrk->tasklets, deflate_stream_run, deflate_stream_finished, stream);
+		return LI_HANDLER_WAIT_FOR_EVENT;
+	}
+
+	if (DEFLATE_OP_PROCESS != op) {
+		if (!stream->compress(stream->ctx, f->out, op, NULL, 0, &errmsg)) {
+			f->out->is_closed = TRUE;
+			VR_ERROR(vr, "deflate error: %s", errmsg ? errmsg : "unknown error");
+			return LI_HANDLER_ERROR;
+		}
+	}
+
+	if (DEFLATE_OP_FINISH == op) {
+		if (debug) {
+			VR_DEBUG(vr, "deflate finished: in: %"G_GUINT64_FORMAT", out : %"L_GOFFSET_FORMAT, stream->total_in, f->out->bytes_in);
+		}
+
+		f->out->is_closed = TRUE;
+	}
+
+	return 0 == f->in->length ? LI_HANDLER_GO_ON : LI_HANDLER_COMEBACK;
+}
+
+static liHandlerResult deflate_filter_null(liVRequest *vr, liFilter *f) {
+	UNUSED(vr);
+	li_chunkqueue_skip_all(f->in);
+	f->out->is_closed = f->in->is_closed = TRUE;
+	return LI_HANDLER_GO_ON;
+}
+
+/**********************************************************************************/
+
+/* cache of compressed variants, shared by all workers; keyed by encoding, level, host, uri and etag.
+ * small variants are kept in memory, bigger ones (or all of them if no memory is configured) on disk.
+ * each tier has its own byte limit and LRU list.
+ * every cache (i.e. deflate action) writes its files into its own subdirectory
+ * "deflate-<pid>-XXXXXX", lookups reopen entries by filename.
+ */
+
+typedef struct deflate_cache_entry deflate_cache_entry;
+struct deflate_cache_entry {
+	GString *key;
+	GList lru_link;  /* in mem_lru or disk_lru, data points to entry */
+
+	goffset size;
+	liBuffer *data;    /* memory entry */
+	GString *filename; /* disk entry */
+};
+
+struct deflate_cache {
+	GMutex *mutex;
+	GHashTable *entries; /* GString* key -> deflate_cache_entry* */
+
+	GQueue mem_lru, disk_lru; /* most recently used at head */
+	goffset mem_size, disk_size;
+
+	/* settings */
+	goffset mem_limit, mem_entry_limit, disk_limit;
+	GString *disk_path; /* private subdirectory, NULL: no disk cache */
+};
+
+typedef struct deflate_cache_store deflate_cache_store;
+struct deflate_cache_store {
+	deflate_cache *cache;
+	GString *key;
+
+	goffset size;
+	GByteArray *mem;
+	int fd;
+	GString *filename;
+};
+
+typedef struct deflate_cache_hit deflate_cache_hit;
+struct deflate_cache_hit {
+	goffset size;
+	liBuffer *data;
+	int fd;
+};
+
+static void deflate_cache_entry_free(deflate_cache_entry *entry) {
+	if (NULL != entry->data) {
+		li_buffer_release(entry->data);
+	}
+	if (NULL != entry->filename) {
+		unlink(entry->filename->str);
+		g_string_free(entry->filename, TRUE);
+	}
+	g_string_free(entry->key, TRUE);
+	g_slice_free(deflate_cache_entry, entry);
+}
+
+/* removes a cache subdirectory with all its files */
+static void deflate_cache_remove_dir(liServer *srv, const gchar *path) {
+	GDir *dir;
+	GError *err = NULL;
+	const gchar *name;
+	GString *filename;
+
+	if (NULL == (dir = g_dir_open(path, 0, &err))) {
+		WARNING(srv, "deflate: couldn't open cache directory '%s': %s", path, err->message);
+		g_error_free(err);
+		return;
+	}
+
+	filename = g_string_sized_new(strlen(path) + 32);
+	while (NULL != (name = g_dir_read_name(dir))) {
+		g_string_assign(filename, path);
+		g_string_append_c(filename, G_DIR_SEPARATOR);
+		g_string_append(filename, name);
+		unlink(filename->str);
+	}
+	g_string_free(filename, TRUE);
+
+	g_dir_close(dir);
+
+	if (-1 == rmdir(path)) {
+		WARNING(srv, "deflate: couldn't remove cache directory '%s': %s", path, g_strerror(errno));
+	}
+}
+
+/* removes the subdirectories of processes that didn't clean up (crashed);
+ * directories of running processes (other actions, graceful restart) are kept */
+static void deflate_cache_clean_dir(liServer *srv, GString *path) {
+	GDir *dir;
+	GError *err = NULL;
+	const gchar *name;
+	GString *filename;
+
+	if (NULL == (dir = g_dir_open(path->str, 0, &err))) {
+		WARNING(srv, "deflate: couldn't open cache directory '%s': %s", path->str, err->message);
+		g_error_free(err);
+		return;
+	}
+
+	filename = g_string_sized_new(path->len + 32);
+	while (NULL != (name = g_dir_read_name(dir))) {
+		gchar *end;
+		glong pid;
+
+		if (!g_str_has_prefix(name, "deflate-")) continue;
+
+		pid = strtol(name + sizeof("deflate-") - 1, &end, 10);
+		if (pid <= 0 || '-' != *end) continue;
+		if (pid == (glong) getpid() || 0 == kill((pid_t) pid, 0) || ESRCH != errno) continue;
+
+		g_string_truncate(filename, 0);
+		g_string_append_len(filename, GSTR_LEN(path));
+		g_string_append_c(filename, G_DIR_SEPARATOR);
+		g_string_append(filename, name);
+		deflate_cache_remove_dir(srv, filename->str);
+	}
+	g_string_free(filename, TRUE);
+
+	g_dir_close(dir);
+}
+
+static deflate_cache* deflate_cache_new(liServer *srv, goffset mem_limit, goffset mem_entry_limit, GString *disk_path, goffset disk_limit) {
+	deflate_cache *cache = g_slice_new0(deflate_cache);
+
+	cache->mutex = g_mutex_new();
+	cache->entries = g_hash_table_new((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal);
+	g_queue_init(&cache->mem_lru);
+	g_queue_init(&cache->disk_lru);
+
+	cache->mem_limit = mem_limit;
+	cache->mem_entry_limit = MIN(mem_entry_limit, mem_limit);
+	cache->disk_limit = disk_limit;
+
+	if (NULL != disk_path) {
+		GString *subdir = g_string_sized_new(disk_path->len + 32);
+
+		deflate_cache_clean_dir(srv, disk_path);
+
+		g_string_printf(subdir, "%s%cdeflate-%i-XXXXXX", disk_path->str, G_DIR_SEPARATOR, (int) getpid());
+		if (NULL == mkdtemp(subdir->str)) {
+			WARNING(srv, "deflate: couldn't create cache directory in '%s', disk cache disabled: %s", disk_path->str, g_strerror(errno));
+			g_string_free(subdir, TRUE);
+		} else {
+			cache->disk_path = subdir;
+		}
+
+		g_string_free(disk_path, TRUE);
+	}
+
+	return cache;
+}
+
+static void deflate_cache_free(liServer *srv, deflate_cache *cache) {
+	GList *link;
+
+	if (!cache) return;
+
+	while (NULL != (link = g_queue_pop_head_link(&cache->mem_lru))) {
+		deflate_cache_entry_free(link->data);
+	}
+	while (NULL != (link = g_queue_pop_head_link(&cache->disk_lru))) {
+		deflate_cache_entry_free(link->data);
+	}
+	g_hash_table_destroy(cache->entries);
+	g_mutex_free(cache->mutex);
+
+	if (NULL != cache->disk_path) {
+		/* the entries removed their files already */
+		deflate_cache_remove_dir(srv, cache->disk_path->str);
+		g_string_free(cache->disk_path, TRUE);
+	}
+
+	g_slice_free(deflate_cache, cache);
+}
+
+/* whether a Cache-Control value contains the directive token (case-insensitive) */
+static gboolean deflate_cache_control_has(const gchar *s, const gchar *token, gsize len) {
+	for (;;) {
+		while (' ' == *s || '\t' == *s || ',' == *s) s++;
+		if ('\0' == *s) return FALSE;
+
+		if (0 == g_ascii_strncasecmp(s, token, len) && NULL != strchr(" \t,=", s[len])) return TRUE;
+
+		while ('\0' != *s && ',' != *s) s++;
+	}
+}
+
+/* responses for a single user or which must not be stored aren't shared through the cache */
+static gboolean deflate_cache_allowed(liVRequest *vr) {
+	GList *l;
+
+	for (l = li_http_header_find_first(vr->response.headers, CONST_STR_LEN("cache-control")); l; l = li_http_header_find_next(l, CONST_STR_LEN("cache-control"))) {
+		liHttpHeader *hh = (liHttpHeader*) l->data;
+		const gchar *value = LI_HEADER_VALUE(hh);
+
+		if (deflate_cache_control_has(value, CONST_STR_LEN("no-store")) || deflate_cache_control_has(value, CONST_STR_LEN("private"))) return FALSE;
+	}
+
+	return TRUE;
+}
+
+static GString* deflate_cache_key(liVRequest *vr, deflate_config *conf, liHttpHeader *hh_etag, encodings encoding) {
+	GString *key = g_string_sized_new(127);
+
+	g_string_append(key, encoding_names[encoding]);
+	g_string_append_c(key, '-');
+	switch (encoding) {
+	case ENCODING_BROTLI:
+		li_string_append_int(key, conf->brotli_quality);
+		g_string_append_c(key, '-');
+		li_string_append_int(key, conf->brotli_window);
+		break;
+	case ENCODING_ZSTD:
+		li_string_append_int(key, conf->zstd_level);
+		g_string_append_c(key, '-');
+		li_string_append_int(key, conf->zstd_window);
+		break;
+	default:
+		li_string_append_int(key, conf->compression_level);
 		break;
+	}
+	g_string_append_c(key, ' ');
+	g_string_append_len(key, GSTR_LEN(vr->request.uri.host));
+	g_string_append_len(key, GSTR_LEN(vr->request.uri.raw_path));
+	g_string_append_c(key, ' ');
+	g_string_append_len(key, LI_HEADER_VALUE_LEN(hh_etag));
+
+	return key;
+}
+
+/* needs cache->mutex */
+static void deflate_cache_evict(deflate_cache *cache) {
+	GList *link;
+
+	while (cache->mem_size > cache->mem_limit && NULL != (link = g_queue_pop_tail_link(&cache->mem_lru))) {
+		deflate_cache_entry *entry = link->data;
+		cache->mem_size -= entry->size;
+		g_hash_table_remove(cache->entries, entry->key);
+		deflate_cache_entry_free(entry);
+	}
+
+	while (cache->disk_size > cache->disk_limit && NULL != (link = g_queue_pop_tail_link(&cache->disk_lru))) {
+		deflate_cache_entry *entry = link->data;
+		cache->disk_size -= entry->size;
+		g_hash_table_remove(cache->entries, entry->key);
+		deflate_cache_entry_free(entry);
+	}
+}
+
+static gboolean deflate_cache_lookup(liVRequest *vr, deflate_cache *cache, GString *key, deflate_cache_hit *hit) {
+	deflate_cache_entry *entry;
+	gboolean found = FALSE;
+
+	g_mutex_lock(cache->mutex);
+
+	entry = g_hash_table_lookup(cache->entries, key);
+	if (NULL != entry) {
+		GQueue *lru = (NULL != entry->data) ? &cache->mem_lru : &cache->disk_lru;
+
+		g_queue_unlink(lru, &entry->lru_link);
+		g_queue_push_head_link(lru, &entry->lru_link);
+
+		hit->size = entry->size;
+		if (NULL != entry->data) {
+			li_buffer_acquire(entry->data);
+			hit->data = entry->data;
+			found = TRUE;
+		} else if (-1 != (hit->fd = open(entry->filename->str, O_RDONLY))) {
+			/* open while locked so the file can't get replaced in between */
+#ifdef FD_CLOEXEC
+			fcntl(hit->fd, F_SETFD, FD_CLOEXEC);
+#endif
+			found = TRUE;
+		} else {
+			VR_ERROR(vr, "deflate: couldn't open cache file '%s': %s", entry->filename->str, g_strerror(errno));
+			g_hash_table_remove(cache->entries, entry->key);
+			g_queue_unlink(lru, &entry->lru_link);
+			cache->disk_size -= entry->size;
+			deflate_cache_entry_free(entry);
+		}
+	}
+
+	g_mutex_unlock(cache->mutex);
+
+	return found;
+}
+
+static void deflate_cache_store_free(deflate_cache_store *store) {
+	if (!store) return;
+
+	if (-1 != store->fd) {
+		close(store->fd);
+		unlink(store->filename->str);
+	}
+	if (NULL != store->filename) g_string_free(store->filename, TRUE);
+	if (NULL != store->mem) g_byte_array_free(store->mem, TRUE);
+	if (NULL != store->key) g_string_free(store->key, TRUE);
+
+	g_slice_free(deflate_cache_store, store);
+}
+
+static deflate_cache_store* deflate_cache_store_new(deflate_cache *cache, GString *key) {
+	deflate_cache_store *store = g_slice_new0(deflate_cache_store);
+
+	store->cache = cache;
+	store->key = key;
+	store->mem = g_byte_array_new();
+	store->fd = -1;
+
+	return store;
+}
+
+static gboolean deflate_cache_store_write(liVRequest *vr, deflate_cache_store *store, const guint8 *data, gsize len) {
+	while (len > 0) {
+		ssize_t r = write(store->fd, data, len);
+		if (r < 0) {
+			if (errno == EINTR) continue;
+			VR_ERROR(vr, "deflate: couldn't write cache file '%s': %s", store->filename->str, g_strerror(errno));
+			return FALSE;
+		}
+		data += r;
+		len -= r;
+	}
+
+	return TRUE;
+}
+
+/* returns FALSE if the variant can't be cached */
+static gboolean deflate_cache_store_append(liVRequest *vr, deflate_cache_store *store, const gchar *data, gsize len) {
+	deflate_cache *cache = store->cache;
+
+	store->size += len;
+
+	if (NULL != store->mem && store->size <= cache->mem_entry_limit) {
+		g_byte_array_append(store->mem, (const guint8*) data, len);
+		return TRUE;
+	}
+
+	if (NULL == cache->disk_path || store->size > cache->disk_limit) return FALSE;
+
+	if (-1 == store->fd) {
+		/* too big for memory, move to disk */
+		store->filename = g_string_sized_new(cache->disk_path->len + 16);
+		g_string_append_len(store->filename, GSTR_LEN(cache->disk_path));
+		g_string_append_c(store->filename, G_DIR_SEPARATOR);
+		g_string_append_len(store->filename, CONST_STR_LEN("deflate-XXXXXX"));
+
+		errno = 0; /* posix doesn't define any errors */
+		if (-1 == (store->fd = mkstemp(store->filename->str))) {
+			VR_ERROR(vr, "deflate: couldn't create cache file '%s': %s", store->filename->str, g_strerror(errno));
+			return FALSE;
+		}
+#ifdef FD_CLOEXEC
+		fcntl(store->fd, F_SETFD, FD_CLOEXEC);
 #endif
+
+		if (!deflate_cache_store_write(vr, store, store->mem->data, store->mem->len)) return FALSE;
+		g_byte_array_free(store->mem, TRUE);
+		store->mem = NULL;
+	}
+
+	return deflate_cache_store_write(vr, store, (const guint8*) data, len);
+}
+
+static void deflate_cache_store_finish(deflate_cache_store *store) {
+	deflate_cache *cache = store->cache;
+	deflate_cache_entry *entry;
+
+	g_mutex_lock(cache->mutex);
+
+	if (NULL != g_hash_table_lookup(cache->entries, store->key)) {
+		/* another request was faster */
+		g_mutex_unlock(cache->mutex);
+		deflate_cache_store_free(store);
+		return;
+	}
+
+	entry = g_slice_new0(deflate_cache_entry);
+	entry->key = store->key;
+	entry->size = store->size;
+	entry->lru_link.data = entry;
+	store->key = NULL;
+
+	if (-1 != store->fd) {
+		close(store->fd);
+		store->fd = -1;
+		entry->filename = store->filename;
+		store->filename = NULL;
+
+		g_queue_push_head_link(&cache->disk_lru, &entry->lru_link);
+		cache->disk_size += entry->size;
+	} else {
+		entry->data = li_buffer_new_slice(MAX(store->mem->len, 1));
+		memcpy(entry->data->addr, store->mem->data, store->mem->len);
+		entry->data->used = store->mem->len;
+
+		g_queue_push_head_link(&cache->mem_lru, &entry->lru_link);
+		cache->mem_size += entry->size;
+	}
+
+	g_hash_table_insert(cache->entries, entry->key, entry);
+	deflate_cache_evict(cache);
+
+	g_mutex_unlock(cache->mutex);
+
+	deflate_cache_store_free(store);
+}
+
+static void deflate_filter_cache_store_free(liVRequest *vr, liFilter *f) {
+	UNUSED(vr);
+
+	deflate_cache_store_free((deflate_cache_store*) f->param);
+}
+
+/* copies the compressed stream into the cache while passing it through */
+static liHandlerResult deflate_filter_cache_store(liVRequest *vr, liFilter *f) {
+	deflate_cache_store *store = (deflate_cache_store*) f->param;
+
+	if (f->out->is_closed) {
+		li_chunkqueue_skip_all(f->in);
+		f->in->is_closed = TRUE;
+		deflate_cache_store_free(store);
+		f->param = NULL;
 		return LI_HANDLER_GO_ON;
+	}
+
+	while (NULL != store && 0 < f->in->length) {
+		char *data;
+		off_t len;
+		GError *err = NULL;
+
+		if (LI_HANDLER_GO_ON != li_chunkiter_read(li_chunkqueue_iter(f->in), 0, 64*1024, &data, &len, &err)) {
+			if (NULL != err) {
+				VR_ERROR(vr, "Couldn't read data from chunkqueue: %s", err->message);
+				g_error_free(err);
+			}
+			deflate_cache_store_free(store);
+			f->param = store = NULL;
+			break;
+		}
+
+		if (!deflate_cache_store_append(vr, store, data, len)) {
+			deflate_cache_store_free(store);
+			f->param = store = NULL;
+		}
+
+		li_chunkqueue_steal_len(f->out, f->in, len);
+	}
+
+	/* not caching (anymore) */
+	if (NULL == store) li_chunkqueue_steal_all(f->out, f->in);
+
+	if (f->in->is_closed) {
+		f->out->is_closed = TRUE;
+		if (NULL != store) {
+			deflate_cache_store_finish(store);
+			f->param = NULL;
+		}
+	}
+
+	return LI_HANDLER_GO_ON;
+}
+
+static void deflate_filter_cache_hit_free(liVRequest *vr, liFilter *f) {
+	deflate_cache_hit *hit = (deflate_cache_hit*) f->param;
+	UNUSED(vr);
+
+	if (NULL != hit->data) li_buffer_release(hit->data);
+	if (-1 != hit->fd) close(hit->fd);
+	g_slice_free(deflate_cache_hit, hit);
+}
+
+/* replaces the response body with the cached variant */
+static liHandlerResult deflate_filter_cache_hit(liVRequest *vr, liFilter *f) {
+	deflate_cache_hit *hit = (deflate_cache_hit*) f->param;
+	UNUSED(vr);
+
+	li_chunkqueue_skip_all(f->in);
+	f->in->is_closed = TRUE;
+
+	if (NULL == hit) return LI_HANDLER_GO_ON;
+
+	if (!f->out->is_closed) {
+		if (NULL != hit->data) {
+			li_chunkqueue_append_buffer(f->out, hit->data);
+			hit->data = NULL;
+		} else {
+			li_chunkqueue_append_file_fd(f->out, NULL, 0, hit->size, hit->fd);
+			hit->fd = -1;
+		}
+	}
+	deflate_filter_cache_hit_free(vr, f);
+	f->param = NULL;
+
+	f->out->is_closed = TRUE;
+
+	return LI_HANDLER_GO_ON;
+}
+
+/**********************************************************************************/
+
+/* returns TRUE if handled with 304, FALSE otherwise */
+static gboolean cached_handle_etag(liVRequest *vr, gboolean debug, liHttpHeader *hh_etag, const char* enc_name) {
+	GString *s = vr->wrk->tmp_str;
+
+	if (!hh_etag) return FALSE;
+
+	g_string_truncate(s, 0);
+	g_string_append_len(s, LI_HEADER_VALUE_LEN(hh_etag));
+	g_string_append_len(s, CONST_STR_LEN("-"));
+	g_string_append_len(s, enc_name, strlen(enc_name));
+	li_etag_mutate(s, s);
+	g_string_truncate(hh_etag->data, hh_etag->keylen + 2);
+	g_string_append_len(hh_etag->data, GSTR_LEN(s));
+
+	if (200 == vr->response.http_status && li_http_response_handle_cachable(vr)) {
+		if (debug || CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+			VR_DEBUG(vr, "%s", "deflate: etag handling => 304 Not Modified");
+		}
+		vr->response.http_status = 304;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+static guint header_to_endocing_mask(const gchar *s) {
+	guint encoding_mask = 0, i;
+
+	for (i = 1; encoding_names[i]; i++) {
+		const gchar *p = strstr(s, encoding_names[i]);
+		if (NULL != p && (p == s || p[-1] == ' ' || p[-1] == ',')) {
+			encoding_mask |= 1 << i;
+		}
+	}
+
+	return encoding_mask;
+}
+
+static gboolean deflate_add_filter(liVRequest *vr, deflate_config *config, encodings encoding) {
+	deflate_stream *stream;
+
+	switch (encoding) {
+#ifdef HAVE_BZIP
+	case ENCODING_BZIP2:
+	case ENCODING_X_BZIP2: {
+			deflate_context_bzip2 *ctx = deflate_context_bzip2_create(vr, config);
+			if (!ctx) return FALSE;
+			stream = deflate_stream_new(config, ctx, deflate_bzip2_compress, deflate_context_bzip2_free);
+		}
+		break;
+#endif
+#ifdef HAVE_ZLIB
 	case ENCODING_GZIP:
 	case ENCODING_X_GZIP:
-#ifdef HAVE_ZLIB
-		if (cached_handle_etag(vr, debug, hh_etag, encoding_names[i])) return LI_HANDLER_GO_ON;
-		if (!is_head_request) {
-			deflate_context_zlib *ctx;
-			ctx = deflate_context_zlib_create(vr, config, TRUE);
-			if (!ctx) return LI_HANDLER_GO_ON;
-			li_vrequest_add_filter_out(vr, deflate_filter_zlib, deflate_filter_zlib_free, ctx);
+	case ENCODING_DEFLATE: {
+			deflate_context_zlib *ctx = deflate_context_zlib_create(vr, config, ENCODING_DEFLATE != encoding);
+			if (!ctx) return FALSE;
+			stream = deflate_stream_new(config, ctx, deflate_zlib_compress, deflate_context_zlib_free);
 		}
 		break;
 #endif
-		return LI_HANDLER_GO_ON;
-	case ENCODING_DEFLATE:
-#ifdef HAVE_ZLIB
-		if (cached_handle_etag(vr, debug, hh_etag, encoding_names[i])) return LI_HANDLER_GO_ON;
-		if (!is_head_request) {
-			deflate_context_zlib *ctx;
-			ctx = deflate_context_zlib_create(vr, config, FALSE);
-			if (!ctx) return LI_HANDLER_GO_ON;
-			li_vrequest_add_filter_out(vr, deflate_filter_zlib, deflate_filter_zlib_free, ctx);
+#ifdef HAVE_BROTLI
+	case ENCODING_BROTLI: {
+			deflate_context_brotli *ctx = deflate_context_brotli_create(vr, config);
+			if (!ctx) return FALSE;
+			stream = deflate_stream_new(config, ctx, deflate_brotli_compress, deflate_context_brotli_free);
+		}
+		break;
+#endif
+#ifdef HAVE_ZSTD
+	case ENCODING_ZSTD: {
+			deflate_context_zstd *ctx = deflate_context_zstd_create(vr, config);
+			if (!ctx) return FALSE;
+			stream = deflate_stream_new(config, ctx, deflate_zstd_compress, deflate_context_zstd_free);
 		}
 		break;
 #endif
+	default:
+		return FALSE;
+	}
+
+	li_vrequest_add_filter_out(vr, deflate_filter, deflate_filter_free, stream);
+	return TRUE;
+}
+
+static liHandlerResult deflate_handle(liVRequest *vr, gpointer param, gpointer *context) {
+	deflate_config *config = (deflate_config*) param;
+	GList *hh_encoding_entry, *hh_etag_entry;
+	liHttpHeader *hh_encoding, *hh_etag = NULL;
+	guint encoding_mask = 0, i;
+	gboolean debug = _OPTION(vr, config->p, 0).boolean;
+	gboolean is_head_request = (vr->request.http_method == LI_HTTP_METHOD_HEAD);
+	GString *cache_key = NULL;
+	deflate_cache_hit hit = { 0, NULL, -1 };
+	gboolean cache_hit = FALSE;
+
+	UNUSED(context);
+
+	VREQUEST_WAIT_FOR_RESPONSE_HEADERS(vr);
+
+	/* disable compression for some http status types. */
+	switch(vr->response.http_status) {
+	case 100:
+	case 101:
+	case 204:
+	case 205:
+	case 206:
+	case 304:
+		/* disable compression as we have no response entity */
 		return LI_HANDLER_GO_ON;
-	case ENCODING_COMPRESS:
+	default:
+		break;
+	}
+
+	/* response already encoded */
+	if (li_http_header_find_first(vr->response.headers, CONST_STR_LEN("content-encoding"))) {
+		if (debug) {
+			VR_DEBUG(vr, "%s", "deflate: Content-Encoding already set => not compressing");
+		}
+		return LI_HANDLER_GO_ON;
+	}
+
+	/* don't mess with content after transfer-encoding */
+	if (li_http_header_find_first(vr->response.headers, CONST_STR_LEN("transfer-encoding"))) {
+		if (debug) {
+			VR_DEBUG(vr, "%s", "deflate: Transfer-Encoding set => not compressing");
+		}
+		return LI_HANDLER_GO_ON;
+	}
+
+	/* announce that we have looked for accept-encoding */
+	li_http_header_append(vr->response.headers, CONST_STR_LEN("Vary"), CONST_STR_LEN("Accept-Encoding"));
+
+	hh_encoding_entry = li_http_header_find_first(vr->request.headers, CONST_STR_LEN("accept-encoding"));
+	while (hh_encoding_entry) {
+		hh_encoding = (liHttpHeader*) hh_encoding_entry->data;
+		encoding_mask |= header_to_endocing_mask(LI_HEADER_VALUE(hh_encoding));
+		hh_encoding_entry = li_http_header_find_next(hh_encoding_entry, CONST_STR_LEN("accept-encoding"));
+	}
+
+	if (0 == encoding_mask)
+		return LI_HANDLER_GO_ON; /* no known encoding found */
+
+	encoding_mask &= encoding_available_mask & config->allowed_encodings;
+	if (0 == encoding_mask) {
+		if (debug) {
+			VR_DEBUG(vr, "%s", "no common encoding found => not compressing");
+		}
+		return LI_HANDLER_GO_ON; /* no common encoding found */
+	}
+
+	/* find best encoding (first in list) */
+	for (i = 1; 0 == (encoding_mask & (1 << i)) ; i++) ;
+
+	hh_etag_entry = li_http_header_find_first(vr->response.headers, CONST_STR_LEN("etag"));
+	if (hh_etag_entry) {
+		if (li_http_header_find_next(hh_etag_entry, CONST_STR_LEN("etag"))) {
+			if (debug || CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+				VR_DEBUG(vr, "%s", "duplicate etag header in response, will not deflate it");
+			}
+			return LI_HANDLER_GO_ON;
+		}
+		hh_etag = (liHttpHeader*) hh_etag_entry->data;
+	}
+
+	if (debug || CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+		VR_DEBUG(vr, "deflate: compressing using %s encoding", encoding_names[i]);
+	}
+
+	if (NULL != config->cache && NULL != hh_etag && !is_head_request && 200 == vr->response.http_status && deflate_cache_allowed(vr)) {
+		/* key uses the original etag, build it before it gets mutated */
+		cache_key = deflate_cache_key(vr, config, hh_etag, (encodings) i);
+	}
+
+	if (cached_handle_etag(vr, debug, hh_etag, encoding_names[i])) {
+		if (NULL != cache_key) g_string_free(cache_key, TRUE);
 		return LI_HANDLER_GO_ON;
 	}
 
@@ -666,18 +1513,40 @@ static liHandlerResult deflate_handle(liVRequest *vr, gpointer param, gpointer *
 		/* kill content so response.c doesn't send wrong content-length */
 		liFilter *f = li_vrequest_add_filter_out(vr, deflate_filter_null, NULL, NULL);
 		f->out->is_closed = f->in->is_closed = TRUE;
+	} else if (NULL != cache_key && deflate_cache_lookup(vr, config->cache, cache_key, &hit)) {
+		if (debug || CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
+			VR_DEBUG(vr, "deflate: cache hit for '%s'", cache_key->str);
+		}
+		g_string_free(cache_key, TRUE);
+		li_vrequest_add_filter_out(vr, deflate_filter_cache_hit, deflate_filter_cache_hit_free, g_slice_dup(deflate_cache_hit, &hit));
+		cache_hit = TRUE;
+	} else {
+		if (!deflate_add_filter(vr, config, (encodings) i)) {
+			if (NULL != cache_key) g_string_free(cache_key, TRUE);
+			return LI_HANDLER_GO_ON;
+		}
+		if (NULL != cache_key) {
+			li_vrequest_add_filter_out(vr, deflate_filter_cache_store, deflate_filter_cache_store_free, deflate_cache_store_new(config->cache, cache_key));
+		}
 	}
 
 	li_http_header_insert(vr->response.headers, CONST_STR_LEN("Content-Encoding"), encoding_names[i], strlen(encoding_names[i]));
 	li_http_header_remove(vr->response.headers, CONST_STR_LEN("content-length"));
 
+	if (cache_hit) {
+		GString *tmp_str = vr->wrk->tmp_str;
+		g_string_truncate(tmp_str, 0);
+		li_string_append_int(tmp_str, hit.size);
+		li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Length"), GSTR_LEN(tmp_str));
+	}
+
 	return LI_HANDLER_GO_ON;
 }
 
 static void deflate_free(liServer *srv, gpointer param) {
 	deflate_config *conf = (deflate_config*) param;
-	UNUSED(srv);
 
+	deflate_cache_free(srv, conf->cache);
 	g_slice_free(deflate_config, conf);
 }
 
@@ -686,11 +1555,23 @@ static const GString
 	don_encodings = { CONST_STR_LEN("encodings"), 0 },
 	don_blocksize = { CONST_STR_LEN("blocksize"), 0 },
 	don_outputbuffer = { CONST_STR_LEN("output-buffer"), 0 },
-	don_compression_level = { CONST_STR_LEN("compression-level"), 0 }
+	don_compression_level = { CONST_STR_LEN("compression-level"), 0 },
+	don_brotli_quality = { CONST_STR_LEN("brotli-quality"), 0 },
+	don_brotli_window = { CONST_STR_LEN("brotli-window"), 0 },
+	don_zstd_level = { CONST_STR_LEN("zstd-level"), 0 },
+	don_zstd_window = { CONST_STR_LEN("zstd-window"), 0 },
+	don_offload = { CONST_STR_LEN("offload"), 0 },
+	don_offload_blocks = { CONST_STR_LEN("offload-blocks"), 0 },
+	don_cache_memory = { CONST_STR_LEN("cache-memory"), 0 },
+	don_cache_memory_entry = { CONST_STR_LEN("cache-memory-entry"), 0 },
+	don_cache_disk = { CONST_STR_LEN("cache-disk"), 0 },
+	don_cache_disk_size = { CONST_STR_LEN("cache-disk-size"), 0 }
 ;
 
 static liAction* deflate_create(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
 	deflate_config *conf;
+	goffset cache_memory = 0, cache_memory_entry = 64*1024, cache_disk_size = 64*1024*1024;
+	GString *cache_disk = NULL;
 	UNUSED(wrk); UNUSED(userdata);
 
 	if (val && val->type != LI_VALUE_HASH) {
@@ -704,6 +1585,12 @@ static liAction* deflate_create(liServer *srv, liWorker *wrk, liPlugin* p, liVal
 	conf->blocksize = 16*1024;
 	conf->output_buffer = 4*1024;
 	conf->compression_level = 1;
+	conf->brotli_quality = 4;
+	conf->brotli_window = 22;
+	conf->zstd_level = 3;
+	conf->zstd_window = 0; /* 0: derived from level */
+	conf->offload = 0;
+	conf->offload_blocks = 4;
 
 	if (val) {
 		GHashTable *ht = val->data.hash;
@@ -739,6 +1626,67 @@ static liAction* deflate_create(liServer *srv, liWorker *wrk, liPlugin* p, liVal
 					goto option_failed;
 				}
 				conf->compression_level = value->data.number;
+			} else if (g_string_equal(key, &don_brotli_quality)) {
+				if (value->type != LI_VALUE_NUMBER || value->data.number < 0 || value->data.number > 11) {
+					ERROR(srv, "deflate option '%s' expects an integer between 0 and 11 as parameter", don_brotli_quality.str);
+					goto option_failed;
+				}
+				conf->brotli_quality = value->data.number;
+			} else if (g_string_equal(key, &don_brotli_window)) {
+				if (value->type != LI_VALUE_NUMBER || value->data.number < 10 || value->data.number > 24) {
+					ERROR(srv, "deflate option '%s' expects an integer between 10 and 24 as parameter", don_brotli_window.str);
+					goto option_failed;
+				}
+				conf->brotli_window = value->data.number;
+			} else if (g_string_equal(key, &don_zstd_level)) {
+				if (value->type != LI_VALUE_NUMBER || value->data.number <= 0 || value->data.number > 19) {
+					ERROR(srv, "deflate option '%s' expects an integer between 1 and 19 as parameter", don_zstd_level.str);
+					goto option_failed;
+				}
+				conf->zstd_level = value->data.number;
+			} else if (g_string_equal(key, &don_zstd_window)) {
+				if (value->type != LI_VALUE_NUMBER || (value->data.number != 0 && (value->data.number < 10 || value->data.number > 27))) {
+					ERROR(srv, "deflate option '%s' expects 0 or an integer between 10 and 27 as parameter", don_zstd_window.str);
+					goto option_failed;
+				}
+				conf->zstd_window = value->data.number;
+			} else if (g_string_equal(key, &don_offload)) {
+				if (value->type != LI_VALUE_NUMBER || value->data.number < 0) {
+					ERROR(srv, "deflate option '%s' expects non-negative integer as parameter", don_offload.str);
+					goto option_failed;
+				}
+				conf->offload = value->data.number;
+			} else if (g_string_equal(key, &don_offload_blocks)) {
+				if (value->type != LI_VALUE_NUMBER || value->data.number <= 0 || value->data.number > 64) {
+					ERROR(srv, "deflate option '%s' expects an integer between 1 and 64 as parameter", don_offload_blocks.str);
+					goto option_failed;
+				}
+				conf->offload_blocks = value->data.number;
+			} else if (g_string_equal(key, &don_cache_memory)) {
+				if (value->type != LI_VALUE_NUMBER || value->data.number < 0) {
+					ERROR(srv, "deflate option '%s' expects non-negative integer as parameter", don_cache_memory.str);
+					goto option_failed;
+				}
+				cache_memory = value->data.number;
+			} else if (g_string_equal(key, &don_cache_memory_entry)) {
+				if (value->type != LI_VALUE_NUMBER || value->data.number <= 0) {
+					ERROR(srv, "deflate option '%s' expects positive integer as parameter", don_cache_memory_entry.str);
+					goto option_failed;
+				}
+				cache_memory_entry = value->data.number;
+			} else if (g_string_equal(key, &don_cache_disk)) {
+				if (value->type != LI_VALUE_STRING) {
+					ERROR(srv, "deflate option '%s' expects string as parameter", don_cache_disk.str);
+					goto option_failed;
+				}
+				if (NULL != cache_disk) g_string_free(cache_disk, TRUE);
+				cache_disk = li_value_extract_string(value);
+			} else if (g_string_equal(key, &don_cache_disk_size)) {
+				if (value->type != LI_VALUE_NUMBER || value->data.number <= 0) {
+					ERROR(srv, "deflate option '%s' expects positive integer as parameter", don_cache_disk_size.str);
+					goto option_failed;
+				}
+				cache_disk_size = value->data.number;
 			} else {
 				ERROR(srv, "unknown option for deflate '%s'", key->str);
 				goto option_failed;
@@ -746,9 +1694,14 @@ static liAction* deflate_create(liServer *srv, liWorker *wrk, liPlugin* p, liVal
 		}
 	}
 
+	if (cache_memory > 0 || NULL != cache_disk) {
+		conf->cache = deflate_cache_new(srv, cache_memory, cache_memory_entry, cache_disk, cache_disk_size);
+	}
+
 	return li_action_new_function(deflate_handle, NULL, deflate_free, conf);
 
 option_failed:
+	if (NULL != cache_disk) g_string_free(cache_disk, TRUE);
 	g_slice_free(deflate_config, conf);
 	return NULL;
 }
@@ -25,6 +25,23 @@
  *     limit.req_ip <limit> [=> action];
  *         - <limit> is the number of requests per second per IP
  *         - [action] is an action to be executed if the limit is reached
+ *     limit.rate <options> [=> action];
+ *         - <options> is a hash of:
+ *             "mode" => "token_bucket" (default), "sliding_window" or "memcached"
+ *               sliding_window keeps a timestamp per request in the window ("rate" <= 10000); all keys of one
+ *               action keep at most 2^20 timestamps (8 MiB), beyond that the least recently used keys are dropped
+ *             "rate" => number of requests allowed per period (required)
+ *             "period" => length of the period in seconds (default 1)
+ *             "burst" => token_bucket only: bucket size, i.e. how many requests may arrive at once (default: rate)
+ *             "key" => pattern the requests are grouped by (default "%{req.remoteip}")
+ *             "cookie" => name of a cookie whose value is appended to the key
+ *             "max-keys" => maximum number of keys to remember (default 10000); the least recently used keys are dropped first
+ *           memcached mode only (counts requests per period in memcached, shared by all servers using it):
+ *             "server" => memcached server or list of servers (default "127.0.0.1:11211")
+ *             "protocol" => "ascii" (default) or "binary"
+ *             "batch" => number of requests a worker leases from the shared counter at once (default 10)
+ *             "prefix" => prefix for the memcached keys (default "lighttpd/limit/")
+ *         - [action] is an action to be executed if the limit is reached
  *
  * Example config:
  *     if req.path =^ "/downloads/" {
@@ -40,6 +57,21 @@
  *
  *     This config snippet will write a message to the log containing the clien IP address if the /login page is hit more than once in a second.
  *
+ *     if req.path =^ "/api/" {
+ *         limit.rate [ "rate" => 100, "period" => 60, "burst" => 20, "key" => "%{req.header[X-Api-Key]}" ];
+ *     }
+ *
+ *     This config snippet allows 100 requests per minute for each API key, with at most 20 requests in a burst.
+ *
+ * Implementation:
+ *     limit.con uses an atomic counter, limit.req a counter with its own lock; the per IP pools are split into
+ *     32 shards with their own locks.
+ *     limit.rate keeps a hash table and an LRU list per shard; idle keys are dropped from the LRU tail.
+ *     In memcached mode each worker leases "batch" requests with a single incr and requests the next batch
+ *     when half of them are used; leased but unused requests expire with the period, so up to
+ *     "batch" requests per worker and key may be rejected too early. While memcached isn't reachable
+ *     requests are not limited.
+ *
  * Todo:
  *     -
  *
@@ -51,42 +83,138 @@
 
 #include <lighttpd/base.h>
 #include <lighttpd/radix.h>
+#include <lighttpd/pattern.h>
+#include <lighttpd/memcached.h>
 
 LI_API gboolean mod_limit_init(liModules *mods, liModule *mod);
 LI_API gboolean mod_limit_free(liModules *mods, liModule *mod);
 
+/* per-IP pools are split into shards (selected by a hash of the IP), each with its own lock,
+ * so workers rarely wait for each other. must be a power of 2 */
+#define ML_SHARDS 32
+
 typedef enum {
 	ML_TYPE_CON,
 	ML_TYPE_CON_IP,
 	ML_TYPE_REQ,
-	ML_TYPE_REQ_IP
+	ML_TYPE_REQ_IP,
+	ML_TYPE_RATE
 } mod_limit_context_type;
 
+typedef enum {
+	ML_RATE_TOKEN_BUCKET,
+	ML_RATE_SLIDING_WINDOW,
+	ML_RATE_MEMCACHED
+} mod_limit_rate_mode;
+
+typedef enum {
+	ML_RATE_ALLOWED,
+	ML_RATE_LIMITED,
+	ML_RATE_WAIT
+} mod_limit_rate_result;
+
+/* upper bound for "rate" in sliding_window mode, as every key keeps a timestamp per request */
+#define ML_RATE_WINDOW_MAX 10000
+/* upper bound for the timestamps of all keys of one limit.rate action (8 MiB); split evenly between the shards */
+#define ML_RATE_WINDOW_ENTRIES (1 << 20)
+
+struct mod_limit_shard {
+	GMutex *mutex;
+	liRadixTree *tree;
+};
+typedef struct mod_limit_shard mod_limit_shard;
+
+struct mod_limit_rate_entry {
+	GString *key;
+	GList lru_link;          /* data points to the entry itself */
+	ev_tstamp last;          /* token_bucket: last refill */
+	gdouble tokens;
+
+	ev_tstamp *log;          /* sliding_window: ring buffer of request timestamps, grows up to "rate" entries */
+	guint log_head, log_len, log_size;
+};
+typedef struct mod_limit_rate_entry mod_limit_rate_entry;
+
+struct mod_limit_rate_shard {
+	GMutex *mutex;
+	GHashTable *entries;     /* GString* key => mod_limit_rate_entry* */
+	GQueue lru;              /* most recently used at the head */
+	guint log_entries;       /* sliding_window: allocated timestamps of all entries */
+};
+typedef struct mod_limit_rate_shard mod_limit_rate_shard;
+
+typedef struct mod_limit_context mod_limit_context;
+typedef struct mod_limit_cluster_worker mod_limit_cluster_worker;
+
+/* tokens leased from the shared counter of the current period; only used by one worker */
+struct mod_limit_lease {
+	GString *key;            /* key as built from the pattern */
+	GString *mc_key;         /* memcached key of the period the last lease was requested for */
+	gint64 period;           /* period the tokens belong to */
+	gint64 lease_period;     /* period of the pending lease */
+	guint tokens;
+	gboolean exhausted;      /* shared counter reached "rate" in this period */
+	gboolean pending;        /* incr/add in flight; holds a reference to ctx */
+	GPtrArray *waiting;      /* liJobRef* of requests waiting for the pending lease */
+
+	mod_limit_context *ctx;
+	mod_limit_cluster_worker *cw;
+};
+typedef struct mod_limit_lease mod_limit_lease;
+
+struct mod_limit_cluster_worker {
+	liWorker *wrk;
+	liMemcachedPool *pool;
+	GHashTable *leases;      /* GString* key => mod_limit_lease* */
+	gint64 period;           /* leases of older periods are dropped when this changes */
+};
+
+struct mod_limit_rate {
+	mod_limit_rate_mode mode;
+	guint rate;
+	guint burst;
+	ev_tstamp period;
+	liPattern *pattern;
+	GString *cookie;
+	guint max_keys;          /* per shard */
+	mod_limit_rate_shard shards[ML_SHARDS];
+
+	/* memcached mode */
+	liSocketAddress *addrs;
+	guint addrs_count;
+	liMemcachedProtocol protocol;
+	guint batch;
+	GString *prefix;
+	mod_limit_cluster_worker *workers; /* allocated by the first request, srv->worker_count entries */
+	guint worker_count;
+};
+typedef struct mod_limit_rate mod_limit_rate;
+
 struct mod_limit_context {
 	mod_limit_context_type type;
 	gint limit;
 	gint refcount;
-	GMutex *mutex;           /* used when type != ML_TYPE_CON */
 	liPlugin *plugin;
 	liAction *action_limit_reached;
 
 	union {
-		gint con;            /* decreased on vr_close */
-		liRadixTree *con_ip; /* radix tree contains gint, removed on vr_close */
+		gint con;                /* decreased on vr_close */
+		mod_limit_shard *con_ip; /* ML_SHARDS radix trees containing gint, removed on vr_close */
 		struct {
+			GMutex *mutex;
 			gint num;
-			time_t ts;
-		} req;               /* reset when now - ts > 1 */
-		liRadixTree *req_ip; /* radix tree contains (mod_limit_req_ip_data*), removed via waitqueue timer */
+			gint ts;
+		} req;                   /* reset when the current second != ts; reset and increment under one lock */
+		mod_limit_shard *req_ip; /* ML_SHARDS radix trees containing (mod_limit_req_ip_data*), removed via waitqueue timer */
+		mod_limit_rate *rate;    /* keys are dropped on LRU eviction or when idle */
 	} pool;
 };
-typedef struct mod_limit_context mod_limit_context;
 
 struct mod_limit_req_ip_data {
 	gint requests;
 	liWaitQueueElem timeout_elem;
 	liSocketAddress ip;
-	mod_limit_context *ctx;
+	mod_limit_shard *shard;
 };
 typedef struct mod_limit_req_ip_data mod_limit_req_ip_data;
 
@@ -96,6 +224,247 @@ struct mod_limit_data {
 typedef struct mod_limit_data mod_limit_data;
 
 
+static mod_limit_shard* mod_limit_shards_new(void) {
+	mod_limit_shard *shards = g_new0(mod_limit_shard, ML_SHARDS);
+
+	for (guint i = 0; i < ML_SHARDS; i++) {
+		shards[i].mutex = g_mutex_new();
+		shards[i].tree = li_radixtree_new();
+	}
+
+	return shards;
+}
+
+static void mod_limit_shards_free(mod_limit_shard *shards) {
+	for (guint i = 0; i < ML_SHARDS; i++) {
+		g_mutex_free(shards[i].mutex);
+		li_radixtree_free(shards[i].tree, NULL, NULL);
+	}
+
+	g_free(shards);
+}
+
+static mod_limit_shard* mod_limit_shard_get(mod_limit_shard *shards, gpointer addr, guint32 bits) {
+	const guint32 *a = addr;
+	guint32 h = a[0];
+
+	if (bits > 32) h ^= a[1] ^ a[2] ^ a[3];
+
+	/* fibonacci hashing, the upper bits are mixed best */
+	h *= 2654435769u;
+
+	return &shards[(h >> 16) & (ML_SHARDS - 1)];
+}
+
+static void mod_limit_rate_entry_free(gpointer data) {
+	mod_limit_rate_entry *e = data;
+
+	g_string_free(e->key, TRUE);
+	g_free(e->log);
+	g_slice_free(mod_limit_rate_entry, e);
+}
+
+static mod_limit_rate* mod_limit_rate_new(void) {
+	mod_limit_rate *rate = g_slice_new0(mod_limit_rate);
+
+	rate->mode = ML_RATE_TOKEN_BUCKET;
+	rate->period = 1;
+	rate->max_keys = 10000;
+
+	for (guint i = 0; i < ML_SHARDS; i++) {
+		rate->shards[i].mutex = g_mutex_new();
+		rate->shards[i].entries = g_hash_table_new_full((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal, NULL, mod_limit_rate_entry_free);
+		g_queue_init(&rate->shards[i].lru);
+	}
+
+	return rate;
+}
+
+static void mod_limit_lease_free(gpointer data) {
+	mod_limit_lease *lease = data;
+
+	g_string_free(lease->key, TRUE);
+	g_string_free(lease->mc_key, TRUE);
+	g_ptr_array_free(lease->waiting, TRUE);
+	g_slice_free(mod_limit_lease, lease);
+}
+
+static void mod_limit_rate_free(mod_limit_rate *rate) {
+	for (guint i = 0; i < ML_SHARDS; i++) {
+		g_mutex_free(rate->shards[i].mutex);
+		g_hash_table_destroy(rate->shards[i].entries);
+	}
+
+	if (rate->workers) {
+		/* no lease can be pending, they keep the context alive */
+		for (guint i = 0; i < rate->worker_count; i++) {
+			li_memcached_pool_free(rate->workers[i].pool);
+			if (rate->workers[i].leases)
+				g_hash_table_destroy(rate->workers[i].leases);
+		}
+		g_free(rate->workers);
+	}
+
+	for (guint i = 0; i < rate->addrs_count; i++) {
+		li_sockaddr_clear(&rate->addrs[i]);
+	}
+	g_free(rate->addrs);
+	if (rate->prefix)
+		g_string_free(rate->prefix, TRUE);
+
+	if (rate->pattern)
+		li_pattern_free(rate->pattern);
+	if (rate->cookie)
+		g_string_free(rate->cookie, TRUE);
+
+	g_slice_free(mod_limit_rate, rate);
+}
+
+/* a key is idle if forgetting it doesn't change the outcome of its next request */
+static gboolean mod_limit_rate_entry_idle(mod_limit_rate *rate, mod_limit_rate_entry *e, ev_tstamp now) {
+	if (rate->mode == ML_RATE_TOKEN_BUCKET) {
+		return e->tokens + (now - e->last) * rate->rate / rate->period >= rate->burst;
+	} else {
+		return e->log_len == 0 || e->log[(e->log_head + e->log_len - 1) % e->log_size] <= now - rate->period;
+	}
+}
+
+static void mod_limit_rate_entry_remove(mod_limit_rate_shard *shard, mod_limit_rate_entry *e) {
+	g_queue_unlink(&shard->lru, &e->lru_link);
+	shard->log_entries -= e->log_size;
+	g_hash_table_remove(shard->entries, e->key);
+}
+
+/* returns TRUE if the request is allowed; e must be the most recently used entry of shard */
+static gboolean mod_limit_rate_entry_hit(mod_limit_rate *rate, mod_limit_rate_shard *shard, mod_limit_rate_entry *e, ev_tstamp now) {
+	if (rate->mode == ML_RATE_TOKEN_BUCKET) {
+		if (now > e->last) {
+			e->tokens = MIN((gdouble) rate->burst, e->tokens + (now - e->last) * rate->rate / rate->period);
+			e->last = now;
+		}
+
+		if (e->tokens < 1)
+			return FALSE;
+
+		e->tokens -= 1;
+		return TRUE;
+	}
+
+	/* sliding window: drop timestamps that left the window */
+	while (e->log_len > 0 && e->log[e->log_head] <= now - rate->period) {
+		e->log_head = (e->log_head + 1) % e->log_size;
+		e->log_len--;
+	}
+
+	if (e->log_len >= rate->rate)
+		return FALSE;
+
+	if (e->log_len == e->log_size) {
+		/* grow and linearize the ring buffer */
+		guint size = MIN(rate->rate, MAX(8, e->log_size * 2));
+		ev_tstamp *log;
+
+		/* keep the shard within its share of ML_RATE_WINDOW_ENTRIES: forget the least recently used keys */
+		while (shard->log_entries + size - e->log_size > ML_RATE_WINDOW_ENTRIES / ML_SHARDS && shard->lru.length > 1) {
+			mod_limit_rate_entry_remove(shard, g_queue_peek_tail_link(&shard->lru)->data);
+		}
+
+		log = g_new(ev_tstamp, size);
+		shard->log_entries += size - e->log_size;
+
+		for (guint i = 0; i < e->log_len; i++)
+			log[i] = e->log[(e->log_head + i) % e->log_size];
+
+		g_free(e->log);
+		e->log = log;
+		e->log_head = 0;
+		e->log_size = size;
+	}
+
+	e->log[(e->log_head + e->log_len) % e->log_size] = now;
+	e->log_len++;
+
+	return TRUE;
+}
+
+/* appends the value of the first cookie named rate->cookie to dest */
+static void mod_limit_rate_append_cookie(liVRequest *vr, mod_limit_rate *rate, GString *dest) {
+	GList *l;
+
+	for (l = li_http_header_find_first(vr->request.headers, CONST_STR_LEN("cookie")); l; l = li_http_header_find_next(l, CONST_STR_LEN("cookie"))) {
+		liHttpHeader *hh = l->data;
+		const gchar *value;
+		gsize value_len;
+
+		if (li_cookie_find(LI_HEADER_VALUE_LEN(hh), GSTR_LEN(rate->cookie), &value, &value_len)) {
+			g_string_append_c(dest, '|');
+			g_string_append_len(dest, value, value_len);
+			return;
+		}
+	}
+}
+
+static void mod_limit_rate_build_key(liVRequest *vr, mod_limit_rate *rate, GString *key) {
+	GMatchInfo *match_info = NULL;
+
+	if (vr->action_stack.regex_stack->len) {
+		GArray *rs = vr->action_stack.regex_stack;
+		match_info = g_array_index(rs, liActionRegexStackElement, rs->len - 1).match_info;
+	}
+
+	g_string_truncate(key, 0);
+	li_pattern_eval(vr, key, rate->pattern, NULL, NULL, li_pattern_regex_cb, match_info);
+	if (rate->cookie)
+		mod_limit_rate_append_cookie(vr, rate, key);
+}
+
+static gboolean mod_limit_rate_check(liVRequest *vr, mod_limit_rate *rate) {
+	GString *key = vr->wrk->tmp_str;
+	mod_limit_rate_shard *shard;
+	mod_limit_rate_entry *e;
+	ev_tstamp now = CUR_TS(vr->wrk);
+	gboolean allowed;
+	guint h, i;
+
+	mod_limit_rate_build_key(vr, rate, key);
+
+	h = g_string_hash(key) * 2654435769u;
+	shard = &rate->shards[(h >> 16) & (ML_SHARDS - 1)];
+
+	g_mutex_lock(shard->mutex);
+
+	e = g_hash_table_lookup(shard->entries, key);
+	if (e) {
+		g_queue_unlink(&shard->lru, &e->lru_link);
+	} else {
+		if (g_hash_table_size(shard->entries) >= rate->max_keys) {
+			/* evict least recently used key */
+			mod_limit_rate_entry_remove(shard, g_queue_peek_tail_link(&shard->lru)->data);
+		}
+
+		e = g_slice_new0(mod_limit_rate_entry);
+		e->key = g_string_new_len(GSTR_LEN(key));
+		e->lru_link.data = e;
+		e->last = now;
+		e->tokens = rate->burst;
+		g_hash_table_insert(shard->entries, e->key, e);
+	}
+	g_queue_push_head_link(&shard->lru, &e->lru_link);
+
+	allowed = mod_limit_rate_entry_hit(rate, shard, e, now);
+
+	/* drop a few idle keys on every request so memory follows the number of active clients */
+	for (i = 0; i < 2 && shard->lru.length > 1; i++) {
+		mod_limit_rate_entry *old = g_queue_peek_tail_link(&shard->lru)->data;
+		if (!mod_limit_rate_entry_idle(rate, old, now)) break;
+		mod_limit_rate_entry_remove(shard, old);
+	}
+
+	g_mutex_unlock(shard->mutex);
+
+	return allowed;
+}
+
 static mod_limit_context* mod_limit_context_new(mod_limit_context_type type, gint limit, liAction *action_limit_reached, liPlugin *plugin) {
 	mod_limit_context *ctx = g_slice_new0(mod_limit_context);
 	ctx->type = type;
@@ -109,16 +478,18 @@ static mod_limit_context* mod_limit_context_new(mod_limit_context_type type, gin
 		ctx->pool.con = 0;
 		break;
 	case ML_TYPE_CON_IP:
-		ctx->pool.con_ip = li_radixtree_new();
-		ctx->mutex = g_mutex_new();
+		ctx->pool.con_ip = mod_limit_shards_new();
 		break;
 	case ML_TYPE_REQ:
+		ctx->pool.req.mutex = g_mutex_new();
 		ctx->pool.req.num = 0;
 		ctx->pool.req.ts = 0;
 		break;
 	case ML_TYPE_REQ_IP:
-		ctx->pool.req_ip = li_radixtree_new();
-		ctx->mutex = g_mutex_new();
+		ctx->pool.req_ip = mod_limit_shards_new();
+		break;
+	case ML_TYPE_RATE:
+		ctx->pool.rate = NULL; /* set by mod_limit_action_rate_create */
 		break;
 	}
 
@@ -126,9 +497,6 @@ static mod_limit_context* mod_limit_context_new(mod_limit_context_type type, gin
 }
 
 static void mod_limit_context_free(liServer *srv, mod_limit_context *ctx) {
-	if (ctx->mutex)
-		g_mutex_free(ctx->mutex);
-
 	if (ctx->action_limit_reached) {
 		li_action_release(srv, ctx->action_limit_reached);
 	}
@@ -137,18 +505,272 @@ static void mod_limit_context_free(liServer *srv, mod_limit_context *ctx) {
 	case ML_TYPE_CON:
 		break;
 	case ML_TYPE_CON_IP:
-		li_radixtree_free(ctx->pool.con_ip, NULL, NULL);
+		mod_limit_shards_free(ctx->pool.con_ip);
 		break;
 	case ML_TYPE_REQ:
+		g_mutex_free(ctx->pool.req.mutex);
 		break;
 	case ML_TYPE_REQ_IP:
-		li_radixtree_free(ctx->pool.req_ip, NULL, NULL);
+		mod_limit_shards_free(ctx->pool.req_ip);
+		break;
+	case ML_TYPE_RATE:
+		if (ctx->pool.rate)
+			mod_limit_rate_free(ctx->pool.rate);
 		break;
 	}
 
 	g_slice_free(mod_limit_context, ctx);
 }
 
+/* memcached mode: all servers count the requests of a period in a shared counter ("<prefix><key>/<period>").
+ * each worker leases "batch" requests at once with an incr and hands them out locally,
+ * the next lease is requested in the background when half of the tokens are used up.
+ */
+
+static void mod_limit_lease_incr_cb(liMemcachedRequest *request, liMemcachedResult result, liMemcachedItem *item, GError **err);
+
+static void mod_limit_lease_grant(mod_limit_lease *lease, guint64 count) {
+	mod_limit_rate *rate = lease->ctx->pool.rate;
+	guint64 before = (count >= rate->batch) ? count - rate->batch : 0;
+
+	if (lease->lease_period != lease->period) {
+		/* new period started while the lease was pending */
+		lease->period = lease->lease_period;
+		lease->tokens = 0;
+		lease->exhausted = FALSE;
+	}
+
+	if (count <= rate->rate) {
+		lease->tokens += rate->batch;
+	} else {
+		if (before < rate->rate)
+			lease->tokens += rate->rate - before;
+		lease->exhausted = TRUE;
+	}
+}
+
+static void mod_limit_lease_done(mod_limit_lease *lease) {
+	mod_limit_context *ctx = lease->ctx;
+	liServer *srv = lease->cw->wrk->srv;
+	guint i;
+
+	lease->pending = FALSE;
+
+	for (i = 0; i < lease->waiting->len; i++) {
+		liJobRef *ref = g_ptr_array_index(lease->waiting, i);
+		li_job_later_ref(ref);
+		li_job_ref_release(ref);
+	}
+	g_ptr_array_set_size(lease->waiting, 0);
+
+	/* may free the lease */
+	if (g_atomic_int_dec_and_test(&ctx->refcount)) {
+		mod_limit_context_free(srv, ctx);
+	}
+}
+
+static void mod_limit_lease_failed(mod_limit_lease *lease, GError **err) {
+	liServer *srv = lease->cw->wrk->srv;
+
+	if (err && *err) {
+		if (LI_MEMCACHED_DISABLED != (*err)->code) {
+			ERROR(srv, "limit.rate: memcached error: %s", (*err)->message);
+		}
+	} else {
+		ERROR(srv, "limit.rate: memcached error: %s", "unexpected result");
+	}
+
+	/* fail open: requests are not limited while the shared counter isn't reachable */
+	lease->lease_period = lease->period;
+	lease->tokens = lease->ctx->pool.rate->batch;
+}
+
+static void mod_limit_lease_add_cb(liMemcachedRequest *request, liMemcachedResult result, liMemcachedItem *item, GError **err) {
+	mod_limit_lease *lease = request->cb_data;
+	mod_limit_rate *rate = lease->ctx->pool.rate;
+	GError *incr_err = NULL;
+	UNUSED(item);
+
+	switch (result) {
+	case LI_MEMCACHED_OK:
+		mod_limit_lease_grant(lease, rate->batch);
+		break;
+	case LI_MEMCACHED_NOT_STORED:
+	case LI_MEMCACHED_EXISTS:
+		/* someone else created the counter in the meantime */
+		if (NULL != li_memcached_pool_incr(lease->cw->pool, lease->mc_key, rate->batch, mod_limit_lease_incr_cb, lease, &incr_err)) return;
+		mod_limit_lease_failed(lease, &incr_err);
+		g_clear_error(&incr_err);
+		break;
+	default:
+		mod_limit_lease_failed(lease, err);
+		break;
+	}
+
+	mod_limit_lease_done(lease);
+}
+
+static void mod_limit_lease_incr_cb(liMemcachedRequest *request, liMemcachedResult result, liMemcachedItem *item, GError **err) {
+	mod_limit_lease *lease = request->cb_data;
+	mod_limit_rate *rate = lease->ctx->pool.rate;
+	mod_limit_cluster_worker *cw = lease->cw;
+
+	switch (result) {
+	case LI_MEMCACHED_OK:
+		mod_limit_lease_grant(lease, item->value);
+		break;
+	case LI_MEMCACHED_NOT_FOUND: {
+		/* first lease in this period: create the counter. it expires after the next period */
+		GError *add_err = NULL;
+		liBuffer *buf;
+		gchar value[32];
+		gint len = g_snprintf(value, sizeof(value), "%u", rate->batch);
+
+		buf = li_buffer_new_slice(len);
+		memcpy(buf->addr, value, len);
+		buf->used = len;
+
+		if (NULL != li_memcached_pool_add(cw->pool, lease->mc_key, 0, 2 * rate->period, buf, mod_limit_lease_add_cb, lease, &add_err)) {
+			li_buffer_release(buf);
+			return;
+		}
+
+		li_buffer_release(buf);
+		mod_limit_lease_failed(lease, &add_err);
+		g_clear_error(&add_err);
+		break;
+	}
+	default:
+		mod_limit_lease_failed(lease, err);
+		break;
+	}
+
+	mod_limit_lease_done(lease);
+}
+
+/* sends an incr for the next batch of tokens; lease->pending is set if the request was sent */
+static void mod_limit_lease_request(mod_limit_lease *lease) {
+	mod_limit_rate *rate = lease->ctx->pool.rate;
+	mod_limit_cluster_worker *cw = lease->cw;
+	GError *err = NULL;
+
+	if (lease->pending) return;
+
+	lease->lease_period = cw->period;
+	g_string_truncate(lease->mc_key, 0);
+	g_string_append_len(lease->mc_key, GSTR_LEN(rate->prefix));
+	g_string_append_len(lease->mc_key, GSTR_LEN(lease->key));
+	g_string_append_printf(lease->mc_key, "/%" G_GINT64_FORMAT, lease->lease_period);
+	li_memcached_mutate_key(lease->mc_key);
+
+	g_atomic_int_inc(&lease->ctx->refcount);
+	lease->pending = TRUE;
+
+	if (NULL == li_memcached_pool_incr(cw->pool, lease->mc_key, rate->batch, mod_limit_lease_incr_cb, lease, &err)) {
+		lease->pending = FALSE;
+		g_atomic_int_add(&lease->ctx->refcount, -1);
+		mod_limit_lease_failed(lease, &err);
+		g_clear_error(&err);
+	}
+}
+
+static gboolean mod_limit_lease_idle(gpointer key, gpointer value, gpointer data) {
+	mod_limit_lease *lease = value;
+	UNUSED(key); UNUSED(data);
+
+	return !lease->pending;
+}
+
+static mod_limit_cluster_worker* mod_limit_cluster_worker_get(liWorker *wrk, mod_limit_rate *rate) {
+	mod_limit_cluster_worker *workers = g_atomic_pointer_get(&rate->workers);
+	mod_limit_cluster_worker *cw;
+
+	if (NULL == workers) {
+		/* worker_count is only fixed after the config was loaded */
+		guint count = wrk->srv->worker_count;
+
+		workers = g_new0(mod_limit_cluster_worker, count);
+		if (g_atomic_pointer_compare_and_exchange((gpointer*) &rate->workers, NULL, workers)) {
+			rate->worker_count = count;
+		} else {
+			g_free(workers);
+			workers = g_atomic_pointer_get(&rate->workers);
+		}
+	}
+
+	cw = &workers[wrk->ndx];
+	if (NULL == cw->pool) {
+		cw->wrk = wrk;
+		cw->pool = li_memcached_pool_new(wrk->loop, rate->addrs, rate->addrs_count, rate->protocol, 30);
+		cw->leases = g_hash_table_new_full((GHashFunc) g_string_hash, (GEqualFunc) g_string_equal, NULL, mod_limit_lease_free);
+	}
+
+	return cw;
+}
+
+static mod_limit_rate_result mod_limit_cluster_check(liVRequest *vr, mod_limit_context *ctx) {
+	mod_limit_rate *rate = ctx->pool.rate;
+	mod_limit_cluster_worker *cw = mod_limit_cluster_worker_get(vr->wrk, rate);
+	GString *key = vr->wrk->tmp_str;
+	gint64 period = (gint64) (CUR_TS(vr->wrk) / rate->period);
+	mod_limit_lease *lease;
+
+	if (cw->period != period) {
+		/* the counters of the last period are useless now */
+		g_hash_table_foreach_remove(cw->leases, mod_limit_lease_idle, NULL);
+		cw->period = period;
+	}
+
+	mod_limit_rate_build_key(vr, rate, key);
+
+	lease = g_hash_table_lookup(cw->leases, key);
+	if (!lease) {
+		if (g_hash_table_size(cw->leases) >= rate->max_keys * ML_SHARDS) {
+			g_hash_table_foreach_remove(cw->leases, mod_limit_lease_idle, NULL);
+		}
+
+		lease = g_slice_new0(mod_limit_lease);
+		lease->key = g_string_new_len(GSTR_LEN(key));
+		lease->mc_key = g_string_sized_new(0);
+		lease->period = period;
+		lease->waiting = g_ptr_array_new();
+		lease->ctx = ctx;
+		lease->cw = cw;
+		g_hash_table_insert(cw->leases, lease->key, lease);
+	} else if (lease->period != period && !lease->pending) {
+		lease->period = period;
+		lease->tokens = 0;
+		lease->exhausted = FALSE;
+	}
+
+	if (lease->period == period) {
+		if (lease->tokens > 0) {
+			lease->tokens--;
+			if (lease->tokens <= rate->batch / 2 && !lease->exhausted)
+				mod_limit_lease_request(lease);
+			return ML_RATE_ALLOWED;
+		}
+
+		if (lease->exhausted)
+			return ML_RATE_LIMITED;
+	}
+
+	mod_limit_lease_request(lease);
+
+	if (lease->pending) {
+		g_ptr_array_add(lease->waiting, li_vrequest_get_ref(vr));
+		return ML_RATE_WAIT;
+	}
+
+	/* lease failed right away */
+	if (lease->tokens > 0) {
+		lease->tokens--;
+		return ML_RATE_ALLOWED;
+	}
+
+	return ML_RATE_LIMITED;
+}
+
 static void mod_limit_timeout_callback(liWaitQueue *wq, gpointer data) {
 	liWaitQueueElem *wqe;
 	mod_limit_req_ip_data *rid;
@@ -169,9 +791,9 @@ static void mod_limit_timeout_callback(liWaitQueue *wq, gpointer data) {
 			bits = 128;
 		}
 
-		g_mutex_lock(rid->ctx->mutex);
-		li_radixtree_remove(rid->ctx->pool.req_ip, addr, bits);
-		g_mutex_unlock(rid->ctx->mutex);
+		g_mutex_lock(rid->shard->mutex);
+		li_radixtree_remove(rid->shard->tree, addr, bits);
+		g_mutex_unlock(rid->shard->mutex);
 		li_sockaddr_clear(&rid->ip);
 		g_slice_free(mod_limit_req_ip_data, rid);
 	}
@@ -185,6 +807,7 @@ static void mod_limit_vrclose(liVRequest *vr, liPlugin *p) {
 	guint i;
 	gint cons;
 	liSocketAddress *remote_addr = &vr->coninfo->remote_addr;
+	mod_limit_shard *shard;
 	gpointer addr;
 	guint32 bits;
 
@@ -208,15 +831,16 @@ static void mod_limit_vrclose(liVRequest *vr, liPlugin *p) {
 				bits = 128;
 			}
 
-			g_mutex_lock(ctx->mutex);
-			cons = GPOINTER_TO_INT(li_radixtree_lookup_exact(ctx->pool.con_ip, addr, bits));
+			shard = mod_limit_shard_get(ctx->pool.con_ip, addr, bits);
+			g_mutex_lock(shard->mutex);
+			cons = GPOINTER_TO_INT(li_radixtree_lookup_exact(shard->tree, addr, bits));
 			cons--;
 			if (!cons) {
-				li_radixtree_remove(ctx->pool.con_ip, addr, bits);
+				li_radixtree_remove(shard->tree, addr, bits);
 			} else {
-				li_radixtree_insert(ctx->pool.con_ip, addr, bits, GINT_TO_POINTER(cons));
+				li_radixtree_insert(shard->tree, addr, bits, GINT_TO_POINTER(cons));
 			}
-			g_mutex_unlock(ctx->mutex);
+			g_mutex_unlock(shard->mutex);
 			break;
 		default:
 			break;
@@ -234,9 +858,10 @@ static liHandlerResult mod_limit_action_handle(liVRequest *vr, gpointer param, g
 	gboolean limit_reached = FALSE;
 	mod_limit_context *ctx = (mod_limit_context*) param;
 	GPtrArray *arr = g_ptr_array_index(vr->plugin_ctx, ctx->plugin->id);
-	gint cons;
+	gint cons, now;
 	mod_limit_req_ip_data *rid;
 	liSocketAddress *remote_addr = &vr->coninfo->remote_addr;
+	mod_limit_shard *shard;
 	gpointer addr;
 	guint32 bits;
 
@@ -281,42 +906,47 @@ static liHandlerResult mod_limit_action_handle(liVRequest *vr, gpointer param, g
 		}
 		break;
 	case ML_TYPE_CON_IP:
-		g_mutex_lock(ctx->mutex);
-		cons = GPOINTER_TO_INT(li_radixtree_lookup_exact(ctx->pool.con_ip, addr, bits));
+		shard = mod_limit_shard_get(ctx->pool.con_ip, addr, bits);
+		g_mutex_lock(shard->mutex);
+		cons = GPOINTER_TO_INT(li_radixtree_lookup_exact(shard->tree, addr, bits));
 		if (cons < ctx->limit) {
-			li_radixtree_insert(ctx->pool.con_ip, addr, bits, GINT_TO_POINTER(cons+1));
+			li_radixtree_insert(shard->tree, addr, bits, GINT_TO_POINTER(cons+1));
 		} else {
 			limit_reached = TRUE;
 			VR_DEBUG(vr, "limit.con_ip: limit reached (%d active connections)", ctx->limit);
 		}
-		g_mutex_unlock(ctx->mutex);
+		g_mutex_unlock(shard->mutex);
 		break;
 	case ML_TYPE_REQ:
-		g_mutex_lock(ctx->mutex);
-		if (CUR_TS(vr->wrk) - ctx->pool.req.ts > 1.0) {
-			/* reset pool */
-			ctx->pool.req.ts = CUR_TS(vr->wrk);
-			ctx->pool.req.num = 1;
-		} else {
+		now = (gint) CUR_TS(vr->wrk);
+		/* a reset separate from the increment could drop requests counted for the new second in between */
+		g_mutex_lock(ctx->pool.req.mutex);
+		if (now != ctx->pool.req.ts) {
+			/* new second: reset pool */
+			ctx->pool.req.ts = now;
+			ctx->pool.req.num = 0;
+		}
+		if (ctx->pool.req.num < ctx->limit) {
 			ctx->pool.req.num++;
-			if (ctx->pool.req.num > ctx->limit) {
-				limit_reached = TRUE;
-				VR_DEBUG(vr, "limit.req: limit reached (%d req/s)", ctx->limit);
-			}
+		} else {
+			limit_reached = TRUE;
 		}
-		g_mutex_unlock(ctx->mutex);
+		g_mutex_unlock(ctx->pool.req.mutex);
+		if (limit_reached)
+			VR_DEBUG(vr, "limit.req: limit reached (%d req/s)", ctx->limit);
 		break;
 	case ML_TYPE_REQ_IP:
-		g_mutex_lock(ctx->mutex);
-		rid = li_radixtree_lookup_exact(ctx->pool.req_ip, addr, bits);
+		shard = mod_limit_shard_get(ctx->pool.req_ip, addr, bits);
+		g_mutex_lock(shard->mutex);
+		rid = li_radixtree_lookup_exact(shard->tree, addr, bits);
 		if (!rid) {
 			/* IP not known */
 			rid = g_slice_new0(mod_limit_req_ip_data);
 			rid->requests = 1;
 			rid->ip = li_sockaddr_dup(*remote_addr);
-			rid->ctx = ctx;
+			rid->shard = shard;
 			rid->timeout_elem.data = rid;
-			li_radixtree_insert(ctx->pool.req_ip, addr, bits, rid);
+			li_radixtree_insert(shard->tree, addr, bits, rid);
 			li_waitqueue_push(&(((mod_limit_data*)ctx->plugin->data)->timeout_queues[vr->wrk->ndx]), &rid->timeout_elem);
 		} else if (rid->requests < ctx->limit) {
 			rid->requests++;
@@ -324,7 +954,25 @@ static liHandlerResult mod_limit_action_handle(liVRequest *vr, gpointer param, g
 			limit_reached = TRUE;
 			VR_DEBUG(vr, "limit.req_ip: limit reached (%d req/s)", ctx->limit);
 		}
-		g_mutex_unlock(ctx->mutex);
+		g_mutex_unlock(shard->mutex);
+		break;
+	case ML_TYPE_RATE:
+		if (ctx->pool.rate->mode == ML_RATE_MEMCACHED) {
+			switch (mod_limit_cluster_check(vr, ctx)) {
+			case ML_RATE_ALLOWED:
+				break;
+			case ML_RATE_LIMITED:
+				limit_reached = TRUE;
+				break;
+			case ML_RATE_WAIT:
+				return LI_HANDLER_WAIT_FOR_EVENT;
+			}
+		} else if (!mod_limit_rate_check(vr, ctx->pool.rate)) {
+			limit_reached = TRUE;
+		}
+		if (limit_reached) {
+			VR_DEBUG(vr, "limit.rate: limit reached (%d requests per %.1f s) for key '%s'", ctx->limit, ctx->pool.rate->period, vr->wrk->tmp_str->str);
+		}
 		break;
 	}
 
@@ -392,6 +1040,242 @@ static liAction* mod_limit_action_create(liServer *srv, liPlugin *p, mod_limit_c
 	return li_action_new_function(mod_limit_action_handle, NULL, mod_limit_action_free, ctx);
 }
 
+static const GString ml_rate_mode = { CONST_STR_LEN("mode"), 0 };
+static const GString ml_rate_rate = { CONST_STR_LEN("rate"), 0 };
+static const GString ml_rate_period = { CONST_STR_LEN("period"), 0 };
+static const GString ml_rate_burst = { CONST_STR_LEN("burst"), 0 };
+static const GString ml_rate_key = { CONST_STR_LEN("key"), 0 };
+static const GString ml_rate_cookie = { CONST_STR_LEN("cookie"), 0 };
+static const GString ml_rate_max_keys = { CONST_STR_LEN("max-keys"), 0 };
+static const GString ml_rate_server = { CONST_STR_LEN("server"), 0 };
+static const GString ml_rate_protocol = { CONST_STR_LEN("protocol"), 0 };
+static const GString ml_rate_batch = { CONST_STR_LEN("batch"), 0 };
+static const GString ml_rate_prefix = { CONST_STR_LEN("prefix"), 0 };
+
+static gboolean mod_limit_rate_parse_server(liServer *srv, mod_limit_rate *rate, liValue *value) {
+	GArray *list;
+	guint i;
+
+	for (i = 0; i < rate->addrs_count; i++) {
+		li_sockaddr_clear(&rate->addrs[i]);
+	}
+	g_free(rate->addrs);
+	rate->addrs = NULL;
+	rate->addrs_count = 0;
+
+	if (value->type == LI_VALUE_STRING) {
+		rate->addrs = g_new0(liSocketAddress, 1);
+		rate->addrs_count = 1;
+		rate->addrs[0] = li_sockaddr_from_string(value->data.string, 11211);
+		if (NULL == rate->addrs[0].addr) {
+			ERROR(srv, "invalid socket address: '%s'", value->data.string->str);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	if (value->type != LI_VALUE_LIST || 0 == value->data.list->len) {
+		ERROR(srv, "limit.rate option '%s' expects string or list of strings as parameter", ml_rate_server.str);
+		return FALSE;
+	}
+
+	list = value->data.list;
+	rate->addrs = g_new0(liSocketAddress, list->len);
+	rate->addrs_count = list->len;
+
+	for (i = 0; i < list->len; i++) {
+		liValue *v = g_array_index(list, liValue*, i);
+
+		if (v->type != LI_VALUE_STRING) {
+			ERROR(srv, "limit.rate option '%s' expects string or list of strings as parameter", ml_rate_server.str);
+			return FALSE;
+		}
+
+		rate->addrs[i] = li_sockaddr_from_string(v->data.string, 11211);
+		if (NULL == rate->addrs[i].addr) {
+			ERROR(srv, "invalid socket address: '%s'", v->data.string->str);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static liAction* mod_limit_action_rate_create(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
+	mod_limit_context *ctx;
+	mod_limit_rate *rate;
+	liAction *action_limit_reached = NULL;
+	gint burst = -1, batch = -1;
+	guint max_keys = 10000;
+	GHashTableIter it;
+	gpointer pkey, pvalue;
+
+	UNUSED(wrk); UNUSED(userdata);
+
+	if (val && val->type == LI_VALUE_LIST && val->data.list->len == 2
+	&& g_array_index(val->data.list, liValue*, 0)->type == LI_VALUE_HASH
+	&& g_array_index(val->data.list, liValue*, 1)->type == LI_VALUE_ACTION) {
+		action_limit_reached = li_value_extract_action(g_array_index(val->data.list, liValue*, 1));
+		val = g_array_index(val->data.list, liValue*, 0);
+	} else if (!val || val->type != LI_VALUE_HASH) {
+		ERROR(srv, "%s", "limit.rate expects either a hash of options as parameter, or a list of (hash,action)");
+		return NULL;
+	}
+
+	rate = mod_limit_rate_new();
+
+	g_hash_table_iter_init(&it, val->data.hash);
+	while (g_hash_table_iter_next(&it, &pkey, &pvalue)) {
+		GString *key = pkey;
+		liValue *value = pvalue;
+
+		if (g_string_equal(key, &ml_rate_mode)) {
+			if (value->type != LI_VALUE_STRING) {
+				ERROR(srv, "limit.rate option '%s' expects string as parameter", ml_rate_mode.str);
+				goto option_failed;
+			}
+			if (g_str_equal(value->data.string->str, "token_bucket")) {
+				rate->mode = ML_RATE_TOKEN_BUCKET;
+			} else if (g_str_equal(value->data.string->str, "sliding_window")) {
+				rate->mode = ML_RATE_SLIDING_WINDOW;
+			} else if (g_str_equal(value->data.string->str, "memcached")) {
+				rate->mode = ML_RATE_MEMCACHED;
+			} else {
+				ERROR(srv, "limit.rate: unknown mode '%s' (expected \"token_bucket\", \"sliding_window\" or \"memcached\")", value->data.string->str);
+				goto option_failed;
+			}
+		} else if (g_string_equal(key, &ml_rate_rate)) {
+			if (value->type != LI_VALUE_NUMBER || value->data.number <= 0) {
+				ERROR(srv, "limit.rate option '%s' expects positive integer as parameter", ml_rate_rate.str);
+				goto option_failed;
+			}
+			rate->rate = value->data.number;
+		} else if (g_string_equal(key, &ml_rate_period)) {
+			if (value->type != LI_VALUE_NUMBER || value->data.number <= 0) {
+				ERROR(srv, "limit.rate option '%s' expects positive integer as parameter", ml_rate_period.str);
+				goto option_failed;
+			}
+			rate->period = value->data.number;
+		} else if (g_string_equal(key, &ml_rate_burst)) {
+			if (value->type != LI_VALUE_NUMBER || value->data.number <= 0) {
+				ERROR(srv, "limit.rate option '%s' expects positive integer as parameter", ml_rate_burst.str);
+				goto option_failed;
+			}
+			burst = value->data.number;
+		} else if (g_string_equal(key, &ml_rate_key)) {
+			if (value->type != LI_VALUE_STRING) {
+				ERROR(srv, "limit.rate option '%s' expects string as parameter", ml_rate_key.str);
+				goto option_failed;
+			}
+			if (rate->pattern)
+				li_pattern_free(rate->pattern);
+			rate->pattern = li_pattern_new(srv, value->data.string->str);
+			if (NULL == rate->pattern) {
+				ERROR(srv, "limit.rate: couldn't parse pattern for key '%s'", value->data.string->str);
+				goto option_failed;
+			}
+		} else if (g_string_equal(key, &ml_rate_cookie)) {
+			if (value->type != LI_VALUE_STRING || value->data.string->len == 0) {
+				ERROR(srv, "limit.rate option '%s' expects non-empty string as parameter", ml_rate_cookie.str);
+				goto option_failed;
+			}
+			if (rate->cookie)
+				g_string_free(rate->cookie, TRUE);
+			rate->cookie = g_string_new_len(GSTR_LEN(value->data.string));
+		} else if (g_string_equal(key, &ml_rate_max_keys)) {
+			if (value->type != LI_VALUE_NUMBER || value->data.number <= 0) {
+				ERROR(srv, "limit.rate option '%s' expects positive integer as parameter", ml_rate_max_keys.str);
+				goto option_failed;
+			}
+			max_keys = value->data.number;
+		} else if (g_string_equal(key, &ml_rate_server)) {
+			if (!mod_limit_rate_parse_server(srv, rate, value)) goto option_failed;
+		} else if (g_string_equal(key, &ml_rate_protocol)) {
+			if (value->type != LI_VALUE_STRING) {
+				ERROR(srv, "limit.rate option '%s' expects string as parameter", ml_rate_protocol.str);
+				goto option_failed;
+			}
+			if (g_str_equal(value->data.string->str, "ascii")) {
+				rate->protocol = LI_MEMCACHED_PROTOCOL_ASCII;
+			} else if (g_str_equal(value->data.string->str, "binary")) {
+				rate->protocol = LI_MEMCACHED_PROTOCOL_BINARY;
+			} else {
+				ERROR(srv, "limit.rate: unknown protocol '%s' (expected \"ascii\" or \"binary\")", value->data.string->str);
+				goto option_failed;
+			}
+		} else if (g_string_equal(key, &ml_rate_batch)) {
+			if (value->type != LI_VALUE_NUMBER || value->data.number <= 0) {
+				ERROR(srv, "limit.rate option '%s' expects positive integer as parameter", ml_rate_batch.str);
+				goto option_failed;
+			}
+			batch = value->data.number;
+		} else if (g_string_equal(key, &ml_rate_prefix)) {
+			if (value->type != LI_VALUE_STRING) {
+				ERROR(srv, "limit.rate option '%s' expects string as parameter", ml_rate_prefix.str);
+				goto option_failed;
+			}
+			if (rate->prefix)
+				g_string_free(rate->prefix, TRUE);
+			rate->prefix = g_string_new_len(GSTR_LEN(value->data.string));
+		} else {
+			ERROR(srv, "unknown option for limit.rate '%s'", key->str);
+			goto option_failed;
+		}
+	}
+
+	if (0 == rate->rate) {
+		ERROR(srv, "limit.rate: option '%s' is required", ml_rate_rate.str);
+		goto option_failed;
+	}
+
+	if (rate->mode == ML_RATE_SLIDING_WINDOW) {
+		if (rate->rate > ML_RATE_WINDOW_MAX) {
+			ERROR(srv, "limit.rate: '%s' must not exceed %d in sliding_window mode", ml_rate_rate.str, ML_RATE_WINDOW_MAX);
+			goto option_failed;
+		}
+	}
+
+	if (rate->mode != ML_RATE_TOKEN_BUCKET && burst != -1) {
+		ERROR(srv, "limit.rate: option '%s' is only supported in token_bucket mode", ml_rate_burst.str);
+		goto option_failed;
+	}
+
+	if (rate->mode == ML_RATE_MEMCACHED) {
+		if (NULL == rate->addrs) {
+			GString def_server = li_const_gstring(CONST_STR_LEN("127.0.0.1:11211"));
+			rate->addrs = g_new0(liSocketAddress, 1);
+			rate->addrs_count = 1;
+			rate->addrs[0] = li_sockaddr_from_string(&def_server, 11211);
+		}
+		if (NULL == rate->prefix) {
+			rate->prefix = g_string_new("lighttpd/limit/");
+		}
+		/* leasing more than the limit at once makes no sense */
+		rate->batch = MIN(rate->rate, (batch != -1) ? (guint) batch : 10);
+	} else if (NULL != rate->addrs || NULL != rate->prefix || batch != -1) {
+		ERROR(srv, "%s", "limit.rate: the options 'server', 'batch' and 'prefix' are only supported in memcached mode");
+		goto option_failed;
+	}
+
+	rate->burst = (burst != -1) ? (guint) burst : rate->rate;
+	rate->max_keys = MAX(1, (max_keys + ML_SHARDS - 1) / ML_SHARDS);
+
+	if (!rate->pattern) {
+		rate->pattern = li_pattern_new(srv, "%{req.remoteip}");
+	}
+
+	ctx = mod_limit_context_new(ML_TYPE_RATE, rate->rate, action_limit_reached, p);
+	ctx->pool.rate = rate;
+
+	return li_action_new_function(mod_limit_action_handle, NULL, mod_limit_action_free, ctx);
+
+option_failed:
+	mod_limit_rate_free(rate);
+	if (action_limit_reached)
+		li_action_release(srv, action_limit_reached);
+	return NULL;
+}
+
 static liAction* mod_limit_action_con_create(liServer *srv, liWorker *wrk, liPlugin *p, liValue *val, gpointer userdata) {
 	UNUSED(wrk); UNUSED(userdata);
 
@@ -430,6 +1314,7 @@ static const liPluginAction actions[] = {
 	{ "limit.con_ip", mod_limit_action_con_ip_create, NULL },
 	{ "limit.req", mod_limit_action_req_create, NULL },
 	{ "limit.req_ip", mod_limit_action_req_ip_create, NULL },
+	{ "limit.rate", mod_limit_action_rate_create, NULL },
 
 	{ NULL, NULL, NULL }
 };
@@ -13,7 +13,10 @@
  *     memcached.lookup <options>, <action-hit>, <action-miss>
  *     memcached.store  <options>
  *        options: hash of
- *            - server: socket address as string (default: 127.0.0.1:11211)
+ *            - server: socket address as string or list of socket addresses (default: 127.0.0.1:11211)
+ *              keys are distributed over a list of servers with consistent hashing (ketama)
+ *            - retry: seconds a failed server is removed from the list (default: 30)
+ *            - protocol: "ascii" or "binary" (default: "ascii")
  *            - flags: flags for storing (default 0)
  *            - ttl: ttl for storing (default 0 - forever)
  *            - maxsize: maximum size in bytes we want to store
@@ -27,7 +30,10 @@
  *
  *     memcached.lookup ["key": "%{req.scheme}://%{req.host}%{req.path}"];
  *
- * Exports a lua api to per-worker luaStates too.
+ *     memcached.lookup ["server": ("10.0.0.1:11211", "10.0.0.2:11211", "10.0.0.3:11211")];
+ *
+ * Exports a lua api to per-worker luaStates too:
+ *     memcached.new(address [, protocol]) with protocol "ascii" (default) or "binary"
  *
  * Todo:
  *  - store/lookup headers too
@@ -55,8 +61,11 @@ typedef struct memcached_ctx memcached_ctx;
 struct memcached_ctx {
 	int refcount;
 
-	liMemcachedCon **worker_client_ctx;
-	liSocketAddress addr;
+	liMemcachedPool **worker_client_ctx;
+	liSocketAddress *addrs;
+	guint addrs_count;
+	ev_tstamp retry;
+	liMemcachedProtocol protocol;
 	liPattern *pattern;
 	guint flags;
 	ev_tstamp ttl;
@@ -88,6 +97,8 @@ typedef struct {
 /* memcache option names */
 static const GString
 	mon_server = { CONST_STR_LEN("server"), 0 },
+	mon_retry = { CONST_STR_LEN("retry"), 0 },
+	mon_protocol = { CONST_STR_LEN("protocol"), 0 },
 	mon_flags = { CONST_STR_LEN("flags"), 0 },
 	mon_ttl = { CONST_STR_LEN("ttl"), 0 },
 	mon_maxsize = { CONST_STR_LEN("maxsize"), 0 },
@@ -100,6 +111,59 @@ static void mc_ctx_acquire(memcached_ctx* ctx) {
 	g_atomic_int_inc(&ctx->refcount);
 }
 
+static void mc_ctx_clear_addrs(memcached_ctx *ctx) {
+	guint i;
+
+	for (i = 0; i < ctx->addrs_count; i++) {
+		li_sockaddr_clear(&ctx->addrs[i]);
+	}
+	if (ctx->addrs) g_slice_free1(sizeof(liSocketAddress) * ctx->addrs_count, ctx->addrs);
+	ctx->addrs = NULL;
+	ctx->addrs_count = 0;
+}
+
+static gboolean mc_ctx_parse_server(liServer *srv, memcached_ctx *ctx, liValue *value) {
+	guint i;
+
+	mc_ctx_clear_addrs(ctx);
+
+	if (value->type == LI_VALUE_STRING) {
+		ctx->addrs_count = 1;
+		ctx->addrs = g_slice_alloc0(sizeof(liSocketAddress));
+		ctx->addrs[0] = li_sockaddr_from_string(value->data.string, 11211);
+		if (NULL == ctx->addrs[0].addr) {
+			ERROR(srv, "invalid socket address: '%s'", value->data.string->str);
+			return FALSE;
+		}
+		return TRUE;
+	}
+
+	if (value->type != LI_VALUE_LIST || 0 == value->data.list->len) {
+		ERROR(srv, "memcache option '%s' expects string or list of strings as parameter", mon_server.str);
+		return FALSE;
+	}
+
+	ctx->addrs_count = value->data.list->len;
+	ctx->addrs = g_slice_alloc0(sizeof(liSocketAddress) * ctx->addrs_count);
+
+	for (i = 0; i < ctx->addrs_count; i++) {
+		liValue *v = g_array_index(value->data.list, liValue*, i);
+
+		if (v->type != LI_VALUE_STRING) {
+			ERROR(srv, "memcache option '%s' expects string or list of strings as parameter", mon_server.str);
+			return FALSE;
+		}
+
+		ctx->addrs[i] = li_sockaddr_from_string(v->data.string, 11211);
+		if (NULL == ctx->addrs[i].addr) {
+			ERROR(srv, "invalid socket address: '%s'", v->data.string->str);
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
 static void mc_ctx_release(liServer *srv, gpointer param) {
 	memcached_ctx *ctx = param;
 	guint i;
@@ -111,12 +175,12 @@ static void mc_ctx_release(liServer *srv, gpointer param) {
 
 	if (ctx->worker_client_ctx) {
 		for (i = 0; i < srv->worker_count; i++) {
-			li_memcached_con_release(ctx->worker_client_ctx[i]);
+			li_memcached_pool_free(ctx->worker_client_ctx[i]);
 		}
-		g_slice_free1(sizeof(liMemcachedCon*) * srv->worker_count, ctx->worker_client_ctx);
+		g_slice_free1(sizeof(liMemcachedPool*) * srv->worker_count, ctx->worker_client_ctx);
 	}
 
-	li_sockaddr_clear(&ctx->addr);
+	mc_ctx_clear_addrs(ctx);
 
 	li_pattern_free(ctx->pattern);
 
@@ -146,7 +210,11 @@ static memcached_ctx* mc_ctx_parse(liServer *srv, liPlugin *p, liValue *config)
 	ctx->refcount = 1;
 	ctx->p = p;
 
-	ctx->addr = li_sockaddr_from_string(&def_server, 11211);
+	ctx->addrs_count = 1;
+	ctx->addrs = g_slice_alloc0(sizeof(liSocketAddress));
+	ctx->addrs[0] = li_sockaddr_from_string(&def_server, 11211);
+	ctx->retry = 30;
+	ctx->protocol = LI_MEMCACHED_PROTOCOL_ASCII;
 
 	ctx->pattern = li_pattern_new(srv, "%{req.path}");
 
@@ -166,14 +234,24 @@ static memcached_ctx* mc_ctx_parse(liServer *srv, liPlugin *p, liValue *config)
 			liValue *value = pvalue;
 
 			if (g_string_equal(key, &mon_server)) {
+				if (!mc_ctx_parse_server(srv, ctx, value)) goto option_failed;
+			} else if (g_string_equal(key, &mon_retry)) {
+				if (value->type != LI_VALUE_NUMBER || value->data.number <= 0) {
+					ERROR(srv, "memcache option '%s' expects positive integer as parameter", mon_retry.str);
+					goto option_failed;
+				}
+				ctx->retry = value->data.number;
+			} else if (g_string_equal(key, &mon_protocol)) {
 				if (value->type != LI_VALUE_STRING) {
-					ERROR(srv, "memcache option '%s' expects string as parameter", mon_server.str);
+					ERROR(srv, "memcache option '%s' expects string as parameter", mon_protocol.str);
 					goto option_failed;
 				}
-				li_sockaddr_clear(&ctx->addr);
-				ctx->addr = li_sockaddr_from_string(value->data.string, 11211);
-				if (NULL == ctx->addr.addr) {
-					ERROR(srv, "invalid socket address: '%s'", value->data.string->str);
+				if (g_str_equal(value->data.string->str, "ascii")) {
+					ctx->protocol = LI_MEMCACHED_PROTOCOL_ASCII;
+				} else if (g_str_equal(value->data.string->str, "binary")) {
+					ctx->protocol = LI_MEMCACHED_PROTOCOL_BINARY;
+				} else {
+					ERROR(srv, "memcache: unknown protocol '%s' (expected \"ascii\" or \"binary\")", value->data.string->str);
 					goto option_failed;
 				}
 			} else if (g_string_equal(key, &mon_key)) {
@@ -223,7 +301,7 @@ static memcached_ctx* mc_ctx_parse(liServer *srv, liPlugin *p, liValue *config)
 	}
 
 	if (LI_SERVER_INIT != g_atomic_int_get(&srv->state)) {
-		ctx->worker_client_ctx = g_slice_alloc0(sizeof(liMemcachedCon*) * srv->worker_count);
+		ctx->worker_client_ctx = g_slice_alloc0(sizeof(liMemcachedPool*) * srv->worker_count);
 	} else {
 		ctx->mconf_link.data = ctx;
 		g_queue_push_tail_link(&mconf->prepare_ctx, &ctx->mconf_link);
@@ -250,15 +328,15 @@ static void mc_ctx_build_key(GString *dest, memcached_ctx *ctx, liVRequest *vr)
 	li_memcached_mutate_key(dest);
 }
 
-static liMemcachedCon* mc_ctx_prepare(memcached_ctx *ctx, liWorker *wrk) {
-	liMemcachedCon *con = ctx->worker_client_ctx[wrk->ndx];
+static liMemcachedPool* mc_ctx_prepare(memcached_ctx *ctx, liWorker *wrk) {
+	liMemcachedPool *pool = ctx->worker_client_ctx[wrk->ndx];
 
-	if (!con) {
-		con = li_memcached_con_new(wrk->loop, ctx->addr);
-		ctx->worker_client_ctx[wrk->ndx] = con;
+	if (!pool) {
+		pool = li_memcached_pool_new(wrk->loop, ctx->addrs, ctx->addrs_count, ctx->protocol, ctx->retry);
+		ctx->worker_client_ctx[wrk->ndx] = pool;
 	}
 
-	return con;
+	return pool;
 }
 
 static void memcache_callback(liMemcachedRequest *request, liMemcachedResult result, liMemcachedItem *item, GError **err) {
@@ -352,7 +430,7 @@ static liHandlerResult mc_handle_lookup(liVRequest *vr, gpointer param, gpointer
 		if (ctx->act_found) li_action_enter(vr, ctx->act_found);
 		return LI_HANDLER_GO_ON;
 	} else {
-		liMemcachedCon *con;
+		liMemcachedPool *pool;
 		GError *err = NULL;
 
 		if (li_vrequest_is_handled(vr)) {
@@ -362,7 +440,7 @@ static liHandlerResult mc_handle_lookup(liVRequest *vr, gpointer param, gpointer
 			return LI_HANDLER_GO_ON;
 		}
 
-		con = mc_ctx_prepare(ctx, vr->wrk);
+		pool = mc_ctx_prepare(ctx, vr->wrk);
 		mc_ctx_build_key(vr->wrk->tmp_str, ctx, vr);
 
 		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
@@ -370,7 +448,7 @@ static liHandlerResult mc_handle_lookup(liVRequest *vr, gpointer param, gpointer
 		}
 
 		req = g_slice_new0(memcache_request);
-		req->req = li_memcached_get(con, vr->wrk->tmp_str, memcache_callback, req, &err);
+		req->req = li_memcached_pool_get(pool, vr->wrk->tmp_str, memcache_callback, req, &err);
 
 		if (NULL == req->req) {
 			if (NULL != err) {
@@ -481,21 +559,21 @@ static liHandlerResult memcache_store_filter(liVRequest *vr, liFilter *f) {
 	if (f->in->is_closed) {
 		/* finally: store response in memcached */
 
-		liMemcachedCon *con;
+		liMemcachedPool *pool;
 		GError *err = NULL;
 		liMemcachedRequest *req;
 		memcached_ctx *ctx = mf->ctx;
 
 		f->out->is_closed = TRUE;
 
-		con = mc_ctx_prepare(ctx, vr->wrk);
+		pool = mc_ctx_prepare(ctx, vr->wrk);
 		mc_ctx_build_key(vr->wrk->tmp_str, ctx, vr);
 
 		if (CORE_OPTION(LI_CORE_OPTION_DEBUG_REQUEST_HANDLING).boolean) {
 			VR_DEBUG(vr, "memcached.store: storing response for key '%s'", vr->wrk->tmp_str->str);
 		}
 
-		req = li_memcached_set(con, vr->wrk->tmp_str, ctx->flags, ctx->ttl, mf->buf, NULL, NULL, &err);
+		req = li_memcached_pool_set(pool, vr->wrk->tmp_str, ctx->flags, ctx->ttl, mf->buf, NULL, NULL, &err);
 		li_buffer_release(mf->buf);
 		mf->buf = NULL;
 
@@ -1055,16 +1133,34 @@ static int li_lua_push_memcached_req(lua_State *L, mc_lua_request *req) {
 	return 1;
 }
 
+/* memcached.new(address [, protocol]) */
 static int mc_lua_new(lua_State *L) {
 	liWorker *wrk;
 	liMemcachedCon *con;
+	liMemcachedProtocol protocol = LI_MEMCACHED_PROTOCOL_ASCII;
 	liSocketAddress addr;
 	const char *buf;
 	size_t len = 0;
 	GString fakestr;
+	int ndx = 1;
 
 	wrk = (liWorker*) lua_touserdata(L, lua_upvalueindex(1));
 
+	if (lua_istable(L, 1)) ndx = 2; /* memcached:new(...) */
+
+	if (!lua_isnoneornil(L, ndx + 1)) {
+		const char *proto = lua_tostring(L, ndx + 1);
+
+		if (NULL != proto && 0 == strcmp(proto, "binary")) {
+			protocol = LI_MEMCACHED_PROTOCOL_BINARY;
+		} else if (NULL == proto || 0 != strcmp(proto, "ascii")) {
+			lua_pushliteral(L, "[mod_memcached] mc_lua_new: unknown protocol (expected \"ascii\" or \"binary\")");
+			lua_error(L);
+		}
+	}
+
+	lua_settop(L, ndx);
+
 	if (lua_type(L, -1) != LUA_TSTRING) {
 		/* duplicate */
 		lua_pushvalue(L, -1);
@@ -1085,7 +1181,7 @@ static int mc_lua_new(lua_State *L) {
 		lua_error(L);
 	}
 
-	con = li_memcached_con_new(wrk->loop, addr);
+	con = li_memcached_con_new(wrk->loop, addr, protocol);
 	return li_lua_push_memcached_con(L, con);
 }
 
@@ -1112,7 +1208,7 @@ static void memcached_prepare(liServer *srv, liPlugin *p) {
 
 	while (NULL != (conf_link = g_queue_pop_head_link(&mconf->prepare_ctx))) {
 		ctx = conf_link->data;
-		ctx->worker_client_ctx = g_slice_alloc0(sizeof(liMemcachedCon*) * srv->worker_count);
+		ctx->worker_client_ctx = g_slice_alloc0(sizeof(liMemcachedPool*) * srv->worker_count);
 		conf_link->data = NULL;
 	}
 }
@@ -13,6 +13,16 @@
  * Actions:
  *     status.info           - returns the status info page to the client
  *     status.info "short"   - returns only "non-sensitive" data; no connection details, no runtime section
+ *     status.metrics        - returns counters, gauges and latency histograms in the OpenMetrics text format
+ *                             (per worker, per status class and per backend); meant to be scraped often,
+ *                             only counters are collected, no connection details
+ *     stats.label "name"    - accounts requests, traffic and duration of the current request to the label "name"
+ *                             (shown by status.info and status.metrics); the last label set for a request wins.
+ *                             names may only contain alphanumeric characters and "-_.:"
+ *
+ *  The status page also shows time-to-first-byte and total duration percentiles of all requests since start,
+ *  how long the event loops of the workers were busy per iteration (a long busy time delays all other connections
+ *  of that worker), the time spent in the job queues and the actions that took the most time (sampled).
  *
  *  The status page accepts parameters in the query-string:
  *   - mode=runtimes : show runtime information
@@ -24,6 +34,12 @@
  *         status.css = "http://mydomain/status.css";
  *         status.info;
  *     }
+ *     req.path == "/metrics" {
+ *         status.metrics;
+ *     }
+ *     req.host == "customer1.example.com" {
+ *         stats.label "customer1";
+ *     }
  *
  * Todo:
  *     -
@@ -46,6 +62,9 @@
 # include <sys/resource.h>
 #endif
 
+/* number of actions shown in the "Slowest actions" table */
+#define STATUS_TOP_ACTIONS 10
+
 LI_API gboolean mod_status_init(liModules *mods, liModule *mod);
 LI_API gboolean mod_status_free(liModules *mods, liModule *mod);
 
@@ -171,6 +190,72 @@ static const gchar html_worker_row_avg[] =
 	"				<td>%s</td>\n"
 	"				<td>%u</td>\n"
 	"			</tr>\n";
+static const gchar html_latency_th[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 100px;\"></th>\n"
+	"				<th style=\"width: 100px;\">Requests</th>\n"
+	"				<th style=\"width: 100px;\">TTFB p50</th>\n"
+	"				<th style=\"width: 100px;\">TTFB p99</th>\n"
+	"				<th style=\"width: 100px;\">TTFB p99.9</th>\n"
+	"				<th style=\"width: 100px;\">Duration p50</th>\n"
+	"				<th style=\"width: 100px;\">Duration p99</th>\n"
+	"				<th style=\"width: 100px;\">Duration p99.9</th>\n"
+	"				<th style=\"width: 100px;\">Duration max</th>\n"
+	"			</tr>\n";
+static const gchar html_latency_row[] =
+	"			<tr class=\"%s\">\n"
+	"				<td class=\"left\">%s</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"%s"
+	"			</tr>\n";
+static const gchar html_loop_th[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 100px;\"></th>\n"
+	"				<th style=\"width: 100px;\">Iterations</th>\n"
+	"				<th style=\"width: 100px;\">Busy p50</th>\n"
+	"				<th style=\"width: 100px;\">Busy p99</th>\n"
+	"				<th style=\"width: 100px;\">Busy p99.9</th>\n"
+	"				<th style=\"width: 100px;\">Busy max</th>\n"
+	"				<th style=\"width: 100px;\">Jobs</th>\n"
+	"				<th style=\"width: 100px;\">Job time</th>\n"
+	"				<th style=\"width: 100px;\">Longest job run</th>\n"
+	"			</tr>\n";
+static const gchar html_actions_th[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 175px;\">Action</th>\n"
+	"				<th style=\"width: 100px;\">Samples</th>\n"
+	"				<th style=\"width: 100px;\">Avg</th>\n"
+	"				<th style=\"width: 100px;\">Max</th>\n"
+	"				<th style=\"width: 100px;\">Share</th>\n"
+	"			</tr>\n";
+static const gchar html_actions_row[] =
+	"			<tr>\n"
+	"				<td class=\"left\">%s</td>\n"
+	"				<td>%" G_GUINT64_FORMAT "</td>\n"
+	"%s"
+	"				<td>%" G_GUINT64_FORMAT "%%</td>\n"
+	"			</tr>\n";
+static const gchar html_labels_th[] =
+	"		<table cellspacing=\"0\">\n"
+	"			<tr>\n"
+	"				<th style=\"width: 100px;\"></th>\n"
+	"				<th style=\"width: 175px;\">Requests</th>\n"
+	"				<th style=\"width: 175px;\">Traffic in</th>\n"
+	"				<th style=\"width: 175px;\">Traffic out</th>\n"
+	"				<th style=\"width: 175px;\">Duration avg</th>\n"
+	"				<th style=\"width: 175px;\">Duration max</th>\n"
+	"			</tr>\n";
+static const gchar html_labels_row[] =
+	"			<tr>\n"
+	"				<td class=\"left\">%s</td>\n"
+	"				<td>%s</td>\n"
+	"				<td>%s</td>\n"
+	"				<td>%s</td>\n"
+	"				<td>%s</td>\n"
+	"			</tr>\n";
 static const gchar html_connections_sum[] =
 	"		<table cellspacing=\"0\">\n"
 	"			<tr>\n"
@@ -346,6 +431,38 @@ static guint64 mod_status_response_codes[] = {
 	0, /*5xx*/
 };
 
+/* responses per status class, counted per worker (no locking); index 0 counts responses handled directly */
+typedef struct mod_status_backend_counters mod_status_backend_counters;
+struct mod_status_backend_counters {
+	const gchar *name; /* NULL if unused */
+	guint64 responses[5];
+};
+
+/* traffic per stats.label, counted per worker */
+typedef struct mod_status_label_counters mod_status_label_counters;
+struct mod_status_label_counters {
+	guint64 requests;
+	guint64 bytes_in;
+	guint64 bytes_out;
+	guint64 duration; /* sum, in microseconds */
+	guint64 duration_max;
+};
+
+typedef struct mod_status_data mod_status_data;
+struct mod_status_data {
+	GArray **worker_backends; /* per worker: (mod_status_backend_counters), indexed by backend plugin id + 1 */
+	GArray **worker_labels; /* per worker: (mod_status_label_counters), indexed by label index */
+
+	GMutex *labels_mutex;
+	GPtrArray *labels; /* label names (GString*), protected by labels_mutex */
+};
+
+typedef struct mod_status_label_param mod_status_label_param;
+struct mod_status_label_param {
+	liPlugin *p;
+	guint ndx;
+};
+
 typedef struct mod_status_param mod_status_param;
 
 struct mod_status_param {
@@ -379,6 +496,9 @@ struct mod_status_con_data {
 struct mod_status_wrk_data {
 	guint worker_ndx;
 	liStatistics stats;
+	GArray *labels; /* copy of the worker label counters */
+	GArray *action_times; /* copy of wrk->action_times */
+	guint64 jobs_run, job_usec, job_usec_max;
 	GArray *connections;
 	guint connection_count[6];
 };
@@ -390,14 +510,56 @@ struct mod_status_job {
 	gboolean short_info;
 };
 
+typedef struct mod_status_metrics_data mod_status_metrics_data;
+struct mod_status_metrics_data {
+	guint worker_ndx;
+	liStatistics stats;
+	guint connection_count[6];
+	GArray *backends; /* copy of the worker counters */
+	GArray *labels; /* copy of the worker label counters */
+};
+
+static GArray *status_copy_labels(liPlugin *p, liWorker *wrk) {
+	mod_status_data *pd = p->data;
+	GArray *labels = pd->worker_labels ? pd->worker_labels[wrk->ndx] : NULL;
+	GArray *copy = g_array_sized_new(FALSE, FALSE, sizeof(mod_status_label_counters), labels ? labels->len : 0);
+
+	if (labels) g_array_append_vals(copy, labels->data, labels->len);
+
+	return copy;
+}
+
+/* adds the label counters of a worker to the totals */
+static void status_sum_labels(GArray *totals, GArray *labels) {
+	guint i;
+
+	if (labels->len > totals->len) g_array_set_size(totals, labels->len);
+
+	for (i = 0; i < labels->len; i++) {
+		mod_status_label_counters *src = &g_array_index(labels, mod_status_label_counters, i);
+		mod_status_label_counters *dest = &g_array_index(totals, mod_status_label_counters, i);
+
+		dest->requests += src->requests;
+		dest->bytes_in += src->bytes_in;
+		dest->bytes_out += src->bytes_out;
+		dest->duration += src->duration;
+		dest->duration_max = MAX(dest->duration_max, src->duration_max);
+	}
+}
+
 
 /* the CollectFunc */
 static gpointer status_collect_func(liWorker *wrk, gpointer fdata) {
 	mod_status_wrk_data *sd = g_slice_new0(mod_status_wrk_data);
-	UNUSED(fdata);
 
 	sd->stats = wrk->stats;
 	sd->worker_ndx = wrk->ndx;
+	sd->labels = status_copy_labels(((mod_status_job*) fdata)->p, wrk);
+	sd->action_times = g_array_sized_new(FALSE, FALSE, sizeof(liActionTime), wrk->action_times->len);
+	g_array_append_vals(sd->action_times, wrk->action_times->data, wrk->action_times->len);
+	sd->jobs_run = wrk->jobqueue.jobs_run;
+	sd->job_usec = wrk->jobqueue.run_usec;
+	sd->job_usec_max = wrk->jobqueue.run_usec_max;
 	/* gather connection info */
 	sd->connections = g_array_sized_new(FALSE, TRUE, sizeof(mod_status_con_data), wrk->connections_active);
 	g_array_set_size(sd->connections, wrk->connections_active);
@@ -458,6 +620,8 @@ static void status_collect_cb(gpointer cbdata, gpointer fdata, GPtrArray *result
 			}
 
 			g_array_free(sd->connections, TRUE);
+			g_array_free(sd->labels, TRUE);
+			g_array_free(sd->action_times, TRUE);
 			g_slice_free(mod_status_wrk_data, sd);
 		}
 
@@ -512,6 +676,10 @@ static void status_collect_cb(gpointer cbdata, gpointer fdata, GPtrArray *result
 			totals.peak.requests += sd->stats.peak.requests;
 			totals.peak.active_cons += sd->stats.peak.active_cons;
 
+			li_histogram_merge(&totals.ttfb, &sd->stats.ttfb);
+			li_histogram_merge(&totals.duration, &sd->stats.duration);
+			li_histogram_merge(&totals.loop_busy, &sd->stats.loop_busy);
+
 			connection_count[0] += sd->connection_count[0];
 			connection_count[1] += sd->connection_count[1];
 			connection_count[2] += sd->connection_count[2];
@@ -551,11 +719,77 @@ static void status_collect_cb(gpointer cbdata, gpointer fdata, GPtrArray *result
 			}
 
 			g_array_free(sd->connections, TRUE);
+			g_array_free(sd->labels, TRUE);
+			g_array_free(sd->action_times, TRUE);
 			g_slice_free(mod_status_wrk_data, sd);
 		}
 	}
 }
 
+static void status_format_latency(GString *dest, guint64 usec) {
+	if (usec < 1000)
+		g_string_append_printf(dest, "%" G_GUINT64_FORMAT " us", usec);
+	else if (usec < 1000000)
+		g_string_append_printf(dest, "%.1f ms", usec / 1000.0);
+	else
+		g_string_append_printf(dest, "%.2f s", usec / 1000000.0);
+}
+
+/* appends the percentile cells of a latency row */
+static void status_latency_cells(GString *dest, liStatistics *stats) {
+	static const gdouble percentiles[] = { 50, 99, 99.9 };
+	guint i;
+
+	g_string_truncate(dest, 0);
+
+	for (i = 0; i < G_N_ELEMENTS(percentiles); i++) {
+		g_string_append_len(dest, CONST_STR_LEN("				<td>"));
+		status_format_latency(dest, li_histogram_percentile(&stats->ttfb, percentiles[i]));
+		g_string_append_len(dest, CONST_STR_LEN("</td>\n"));
+	}
+
+	for (i = 0; i < G_N_ELEMENTS(percentiles); i++) {
+		g_string_append_len(dest, CONST_STR_LEN("				<td>"));
+		status_format_latency(dest, li_histogram_percentile(&stats->duration, percentiles[i]));
+		g_string_append_len(dest, CONST_STR_LEN("</td>\n"));
+	}
+
+	g_string_append_len(dest, CONST_STR_LEN("				<td>"));
+	status_format_latency(dest, stats->duration.max);
+	g_string_append_len(dest, CONST_STR_LEN("</td>\n"));
+}
+
+/* appends the cells of an event loop row */
+static void status_loop_cells(GString *dest, liHistogram *busy, guint64 jobs_run, guint64 job_usec, guint64 job_usec_max) {
+	static const gdouble percentiles[] = { 50, 99, 99.9 };
+	guint i;
+
+	g_string_truncate(dest, 0);
+
+	for (i = 0; i < G_N_ELEMENTS(percentiles); i++) {
+		g_string_append_len(dest, CONST_STR_LEN("				<td>"));
+		status_format_latency(dest, li_histogram_percentile(busy, percentiles[i]));
+		g_string_append_len(dest, CONST_STR_LEN("</td>\n"));
+	}
+
+	g_string_append_len(dest, CONST_STR_LEN("				<td>"));
+	status_format_latency(dest, busy->max);
+	g_string_append_printf(dest, "</td>\n				<td>%" G_GUINT64_FORMAT "</td>\n				<td>", jobs_run);
+	status_format_latency(dest, job_usec);
+	g_string_append_len(dest, CONST_STR_LEN("</td>\n				<td>"));
+	status_format_latency(dest, job_usec_max);
+	g_string_append_len(dest, CONST_STR_LEN("</td>\n"));
+}
+
+/* orders indices into an array of liActionTime by sampled time, descending */
+static gint status_action_time_cmp(gconstpointer a, gconstpointer b, gpointer user_data) {
+	GArray *times = user_data;
+	guint64 ta = g_array_index(times, liActionTime, *(const guint*) a).usec;
+	guint64 tb = g_array_index(times, liActionTime, *(const guint*) b).usec;
+
+	return (ta < tb) ? 1 : ((ta > tb) ? -1 : 0);
+}
+
 static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_info, GPtrArray *result, guint uptime, liStatistics *totals, guint total_connections, guint *connection_count) {
 	GString *html, *css, *count_req, *count_bin, *count_bout, *count_mem, *tmpstr;
 	gchar *val;
@@ -736,6 +970,155 @@ static GString *status_info_full(liVRequest *vr, liPlugin *p, gboolean short_inf
 	g_string_append_len(html, CONST_STR_LEN("		</table>\n"));
 
 
+	/* worker information, request latencies */
+	g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Latency</strong> (since start)</div>\n"));
+	g_string_append_len(html, CONST_STR_LEN(html_latency_th));
+
+	{
+		GString *cells = g_string_sized_new(255);
+
+		for (i = 0; i < result->len; i++) {
+			mod_status_wrk_data *sd = g_ptr_array_index(result, i);
+
+			status_latency_cells(cells, &sd->stats);
+			g_string_printf(tmpstr, "Worker #%u", i+1);
+			g_string_append_printf(html, html_latency_row, "", tmpstr->str, sd->stats.duration.count, cells->str);
+		}
+
+		status_latency_cells(cells, totals);
+		g_string_append_printf(html, html_latency_row, "totals", "Total", totals->duration.count, cells->str);
+
+		g_string_free(cells, TRUE);
+	}
+	g_string_append_len(html, CONST_STR_LEN("		</table>\n"));
+
+
+	/* worker information, event loop */
+	g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Event loop</strong> (since start)</div>\n"));
+	g_string_append_len(html, CONST_STR_LEN(html_loop_th));
+
+	{
+		GString *cells = g_string_sized_new(255);
+		guint64 jobs_run = 0, job_usec = 0, job_usec_max = 0;
+
+		for (i = 0; i < result->len; i++) {
+			mod_status_wrk_data *sd = g_ptr_array_index(result, i);
+
+			status_loop_cells(cells, &sd->stats.loop_busy, sd->jobs_run, sd->job_usec, sd->job_usec_max);
+			g_string_printf(tmpstr, "Worker #%u", i+1);
+			g_string_append_printf(html, html_latency_row, "", tmpstr->str, sd->stats.loop_busy.count, cells->str);
+
+			jobs_run += sd->jobs_run;
+			job_usec += sd->job_usec;
+			job_usec_max = MAX(job_usec_max, sd->job_usec_max);
+		}
+
+		status_loop_cells(cells, &totals->loop_busy, jobs_run, job_usec, job_usec_max);
+		g_string_append_printf(html, html_latency_row, "totals", "Total", totals->loop_busy.count, cells->str);
+
+		g_string_free(cells, TRUE);
+	}
+	g_string_append_len(html, CONST_STR_LEN("		</table>\n"));
+
+
+	/* time spent in actions, the slowest first */
+	{
+		GPtrArray *names = vr->wrk->srv->action_names;
+		GArray *times = g_array_new(FALSE, TRUE, sizeof(liActionTime));
+		GArray *order;
+		guint64 total_usec = 0;
+
+		for (i = 0; i < result->len; i++) {
+			GArray *wtimes = ((mod_status_wrk_data*) g_ptr_array_index(result, i))->action_times;
+
+			if (wtimes->len > times->len) g_array_set_size(times, wtimes->len);
+
+			for (j = 0; j < wtimes->len; j++) {
+				liActionTime *src = &g_array_index(wtimes, liActionTime, j);
+				liActionTime *dest = &g_array_index(times, liActionTime, j);
+
+				dest->samples += src->samples;
+				dest->usec += src->usec;
+				dest->usec_max = MAX(dest->usec_max, src->usec_max);
+				total_usec += src->usec;
+			}
+		}
+
+		order = g_array_sized_new(FALSE, FALSE, sizeof(guint), times->len);
+		for (i = 0; i < times->len; i++) {
+			if (g_array_index(times, liActionTime, i).samples) g_array_append_val(order, i);
+		}
+		g_array_sort_with_data(order, status_action_time_cmp, times);
+
+		if (order->len) {
+			GString *cells = g_string_sized_new(63);
+
+			g_string_append_printf(html, "<div class=\"title\"><strong>Slowest actions</strong> (since start, every %uth action sampled)</div>\n", LI_ACTION_TIME_SAMPLE);
+			g_string_append_len(html, CONST_STR_LEN(html_actions_th));
+
+			for (i = 0; i < MIN(order->len, STATUS_TOP_ACTIONS); i++) {
+				guint ndx = g_array_index(order, guint, i);
+				liActionTime *at = &g_array_index(times, liActionTime, ndx);
+
+				g_string_truncate(cells, 0);
+				g_string_append_len(cells, CONST_STR_LEN("				<td>"));
+				status_format_latency(cells, at->usec / at->samples);
+				g_string_append_len(cells, CONST_STR_LEN("</td>\n				<td>"));
+				status_format_latency(cells, at->usec_max);
+				g_string_append_len(cells, CONST_STR_LEN("</td>\n"));
+
+				g_string_append_printf(html, html_actions_row,
+					ndx < names->len ? (gchar*) g_ptr_array_index(names, ndx) : "?",
+					at->samples, cells->str, total_usec ? at->usec * 100 / total_usec : G_GUINT64_CONSTANT(0));
+			}
+
+			g_string_append_len(html, CONST_STR_LEN("		</table>\n"));
+			g_string_free(cells, TRUE);
+		}
+
+		g_array_free(order, TRUE);
+		g_array_free(times, TRUE);
+	}
+
+
+	/* traffic per label */
+	{
+		mod_status_data *pd = p->data;
+		GArray *labels = g_array_new(FALSE, TRUE, sizeof(mod_status_label_counters));
+
+		for (i = 0; i < result->len; i++) {
+			status_sum_labels(labels, ((mod_status_wrk_data*) g_ptr_array_index(result, i))->labels);
+		}
+
+		if (labels->len) {
+			GString *cells = g_string_sized_new(63);
+
+			g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Labels</strong> (since start)</div>\n"));
+			g_string_append_len(html, CONST_STR_LEN(html_labels_th));
+
+			g_mutex_lock(pd->labels_mutex);
+			for (i = 0; i < labels->len; i++) {
+				mod_status_label_counters *lc = &g_array_index(labels, mod_status_label_counters, i);
+				GString *name = g_ptr_array_index(pd->labels, i);
+
+				li_counter_format(lc->requests, COUNTER_UNITS, count_req);
+				li_counter_format(lc->bytes_in, COUNTER_BYTES, count_bin);
+				li_counter_format(lc->bytes_out, COUNTER_BYTES, count_bout);
+				g_string_truncate(cells, 0);
+				status_format_latency(cells, lc->requests ? lc->duration / lc->requests : 0);
+				g_string_append_len(cells, CONST_STR_LEN("</td>\n				<td>"));
+				status_format_latency(cells, lc->duration_max);
+				g_string_append_printf(html, html_labels_row, name->str, count_req->str, count_bin->str, count_bout->str, cells->str);
+			}
+			g_mutex_unlock(pd->labels_mutex);
+
+			g_string_append_len(html, CONST_STR_LEN("		</table>\n"));
+			g_string_free(cells, TRUE);
+		}
+
+		g_array_free(labels, TRUE);
+	}
+
 	/* connection counts */
 	g_string_append_len(html, CONST_STR_LEN("<div class=\"title\"><strong>Active connections</strong> (states, sum)</div>\n"));
 	g_string_append_printf(html, html_connections_sum, connection_count[2],
@@ -874,6 +1257,30 @@ static GString *status_info_plain(liVRequest *vr, guint uptime, liStatistics *to
 	li_string_append_int(html, connection_count[5]);
 	g_string_append_len(html, CONST_STR_LEN("\nconnection_state_keep_alive: "));
 	li_string_append_int(html, connection_count[1]);
+	/* latencies */
+	g_string_append_len(html, CONST_STR_LEN("\n\n# Latency in microseconds (since start)\nttfb_p50: "));
+	li_string_append_int(html, li_histogram_percentile(&totals->ttfb, 50));
+	g_string_append_len(html, CONST_STR_LEN("\nttfb_p99: "));
+	li_string_append_int(html, li_histogram_percentile(&totals->ttfb, 99));
+	g_string_append_len(html, CONST_STR_LEN("\nttfb_p999: "));
+	li_string_append_int(html, li_histogram_percentile(&totals->ttfb, 99.9));
+	g_string_append_len(html, CONST_STR_LEN("\nduration_p50: "));
+	li_string_append_int(html, li_histogram_percentile(&totals->duration, 50));
+	g_string_append_len(html, CONST_STR_LEN("\nduration_p99: "));
+	li_string_append_int(html, li_histogram_percentile(&totals->duration, 99));
+	g_string_append_len(html, CONST_STR_LEN("\nduration_p999: "));
+	li_string_append_int(html, li_histogram_percentile(&totals->duration, 99.9));
+	g_string_append_len(html, CONST_STR_LEN("\nduration_max: "));
+	li_string_append_int(html, totals->duration.max);
+	/* event loop */
+	g_string_append_len(html, CONST_STR_LEN("\n\n# Event loop busy time per iteration in microseconds (since start)\nloop_busy_p50: "));
+	li_string_append_int(html, li_histogram_percentile(&totals->loop_busy, 50));
+	g_string_append_len(html, CONST_STR_LEN("\nloop_busy_p99: "));
+	li_string_append_int(html, li_histogram_percentile(&totals->loop_busy, 99));
+	g_string_append_len(html, CONST_STR_LEN("\nloop_busy_p999: "));
+	li_string_append_int(html, li_histogram_percentile(&totals->loop_busy, 99.9));
+	g_string_append_len(html, CONST_STR_LEN("\nloop_busy_max: "));
+	li_string_append_int(html, totals->loop_busy.max);
 	/* status cpdes */
 	g_string_append_len(html, CONST_STR_LEN("\n\n# Status Codes (since start)\nstatus_1xx: "));
 	li_string_append_int(html, mod_status_response_codes[0]);
@@ -1024,6 +1431,305 @@ error_free_param:
 	return NULL;
 }
 
+/* the CollectFunc for status.metrics: only copies counters */
+static gpointer status_metrics_collect_func(liWorker *wrk, gpointer fdata) {
+	mod_status_job *job = fdata;
+	mod_status_data *pd = job->p->data;
+	mod_status_metrics_data *md = g_slice_new0(mod_status_metrics_data);
+	guint i;
+
+	md->worker_ndx = wrk->ndx;
+	md->stats = wrk->stats;
+	md->labels = status_copy_labels(job->p, wrk);
+
+	for (i = 0; i < wrk->connections_active; i++) {
+		liConnection *c = g_array_index(wrk->connections, liConnection*, i);
+		md->connection_count[c->state]++;
+	}
+
+	if (pd->worker_backends) {
+		GArray *backends = pd->worker_backends[wrk->ndx];
+		md->backends = g_array_sized_new(FALSE, FALSE, sizeof(mod_status_backend_counters), backends->len);
+		g_array_append_vals(md->backends, backends->data, backends->len);
+	} else {
+		md->backends = g_array_new(FALSE, FALSE, sizeof(mod_status_backend_counters));
+	}
+
+	return md;
+}
+
+static void status_metrics_free_result(GPtrArray *result) {
+	guint i;
+
+	for (i = 0; i < result->len; i++) {
+		mod_status_metrics_data *md = g_ptr_array_index(result, i);
+
+		g_array_free(md->backends, TRUE);
+		g_array_free(md->labels, TRUE);
+		g_slice_free(mod_status_metrics_data, md);
+	}
+}
+
+static void status_metrics_family(GString *dest, const gchar *name, const gchar *type, const gchar *help) {
+	g_string_append_printf(dest, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+static void status_metrics_histogram(GString *dest, const gchar *name, const gchar *help, liHistogram *h) {
+	/* upper bounds in microseconds */
+	static const guint64 bounds[] = { 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000 };
+	guint i;
+
+	status_metrics_family(dest, name, "histogram", help);
+
+	for (i = 0; i < G_N_ELEMENTS(bounds); i++) {
+		g_string_append_printf(dest, "%s_bucket{le=\"%g\"} %" G_GUINT64_FORMAT "\n",
+			name, bounds[i] / 1000000.0, li_histogram_count_upto(h, bounds[i]));
+	}
+
+	g_string_append_printf(dest, "%s_bucket{le=\"+Inf\"} %" G_GUINT64_FORMAT "\n", name, h->count);
+	g_string_append_printf(dest, "%s_count %" G_GUINT64_FORMAT "\n", name, h->count);
+	g_string_append_printf(dest, "%s_sum %f\n", name, h->sum / 1000000.0);
+}
+
+static GString *status_metrics_build(liVRequest *vr, liPlugin *p, GPtrArray *result) {
+	static const gchar *states[] = { "dead", "keep_alive", "request_start", "read_request_header", "handle_request", "write_response" };
+	static const gchar *classes[] = { "1xx", "2xx", "3xx", "4xx", "5xx" };
+	GString *out = g_string_sized_new(4 * 1024 - 1);
+	GArray *backends = g_array_new(FALSE, TRUE, sizeof(mod_status_backend_counters));
+	liHistogram *ttfb = g_slice_new0(liHistogram), *duration = g_slice_new0(liHistogram), *loop_busy = g_slice_new0(liHistogram);
+	guint i, j, k;
+
+	status_metrics_family(out, "lighttpd_uptime_seconds", "gauge", "Seconds since the server was started.");
+	g_string_append_printf(out, "lighttpd_uptime_seconds %" G_GUINT64_FORMAT "\n", (guint64) (CUR_TS(vr->wrk) - vr->wrk->srv->started));
+	status_metrics_family(out, "lighttpd_memory_usage_bytes", "gauge", "Memory used by the process.");
+	g_string_append_printf(out, "lighttpd_memory_usage_bytes %" G_GUINT64_FORMAT "\n", (guint64) li_memory_usage());
+
+	#define STATUS_METRICS_WORKER_COUNTER(name, field, help) \
+		status_metrics_family(out, name, "counter", help); \
+		for (i = 0; i < result->len; i++) { \
+			mod_status_metrics_data *md = g_ptr_array_index(result, i); \
+			g_string_append_printf(out, name "_total{worker=\"%u\"} %" G_GUINT64_FORMAT "\n", md->worker_ndx, md->stats.field); \
+		}
+
+	STATUS_METRICS_WORKER_COUNTER("lighttpd_requests", requests, "Requests handled.")
+	STATUS_METRICS_WORKER_COUNTER("lighttpd_traffic_in_bytes", bytes_in, "Bytes received.")
+	STATUS_METRICS_WORKER_COUNTER("lighttpd_traffic_out_bytes", bytes_out, "Bytes sent.")
+	STATUS_METRICS_WORKER_COUNTER("lighttpd_actions_executed", actions_executed, "Actions executed.")
+
+	#undef STATUS_METRICS_WORKER_COUNTER
+
+	status_metrics_family(out, "lighttpd_connections", "gauge", "Active connections by state.");
+	for (i = 0; i < result->len; i++) {
+		mod_status_metrics_data *md = g_ptr_array_index(result, i);
+
+		for (j = 1; j < G_N_ELEMENTS(states); j++) {
+			g_string_append_printf(out, "lighttpd_connections{worker=\"%u\",state=\"%s\"} %u\n", md->worker_ndx, states[j], md->connection_count[j]);
+		}
+	}
+
+	/* sum up the backends over all workers */
+	for (i = 0; i < result->len; i++) {
+		mod_status_metrics_data *md = g_ptr_array_index(result, i);
+
+		if (md->backends->len > backends->len) g_array_set_size(backends, md->backends->len);
+
+		for (j = 0; j < md->backends->len; j++) {
+			mod_status_backend_counters *src = &g_array_index(md->backends, mod_status_backend_counters, j);
+			mod_status_backend_counters *dest = &g_array_index(backends, mod_status_backend_counters, j);
+
+			if (!src->name) continue;
+			dest->name = src->name;
+			for (k = 0; k < G_N_ELEMENTS(classes); k++) dest->responses[k] += src->responses[k];
+		}
+
+		li_histogram_merge(ttfb, &md->stats.ttfb);
+		li_histogram_merge(duration, &md->stats.duration);
+		li_histogram_merge(loop_busy, &md->stats.loop_busy);
+	}
+
+	status_metrics_family(out, "lighttpd_responses", "counter", "Responses by status class.");
+	for (i = 0; i < result->len; i++) {
+		mod_status_metrics_data *md = g_ptr_array_index(result, i);
+
+		for (k = 0; k < G_N_ELEMENTS(classes); k++) {
+			guint64 count = 0;
+
+			for (j = 0; j < md->backends->len; j++) {
+				count += g_array_index(md->backends, mod_status_backend_counters, j).responses[k];
+			}
+
+			g_string_append_printf(out, "lighttpd_responses_total{worker=\"%u\",class=\"%s\"} %" G_GUINT64_FORMAT "\n", md->worker_ndx, classes[k], count);
+		}
+	}
+
+	status_metrics_family(out, "lighttpd_backend_responses", "counter", "Responses by backend and status class.");
+	for (j = 0; j < backends->len; j++) {
+		mod_status_backend_counters *bc = &g_array_index(backends, mod_status_backend_counters, j);
+
+		if (!bc->name) continue;
+
+		for (k = 0; k < G_N_ELEMENTS(classes); k++) {
+			g_string_append_printf(out, "lighttpd_backend_responses_total{backend=\"%s\",class=\"%s\"} %" G_GUINT64_FORMAT "\n", bc->name, classes[k], bc->responses[k]);
+		}
+	}
+
+	/* traffic per label */
+	{
+		mod_status_data *pd = p->data;
+		GArray *labels = g_array_new(FALSE, TRUE, sizeof(mod_status_label_counters));
+
+		for (i = 0; i < result->len; i++) {
+			status_sum_labels(labels, ((mod_status_metrics_data*) g_ptr_array_index(result, i))->labels);
+		}
+
+		#define STATUS_METRICS_LABEL_COUNTER(name, help, format, value) \
+			status_metrics_family(out, name, "counter", help); \
+			for (j = 0; j < labels->len; j++) { \
+				mod_status_label_counters *lc = &g_array_index(labels, mod_status_label_counters, j); \
+				GString *label = g_ptr_array_index(pd->labels, j); \
+				g_string_append_printf(out, name "_total{label=\"%s\"} " format "\n", label->str, value); \
+			}
+
+		g_mutex_lock(pd->labels_mutex);
+		STATUS_METRICS_LABEL_COUNTER("lighttpd_label_requests", "Requests by stats.label.", "%" G_GUINT64_FORMAT, lc->requests)
+		STATUS_METRICS_LABEL_COUNTER("lighttpd_label_traffic_in_bytes", "Bytes received by stats.label.", "%" G_GUINT64_FORMAT, lc->bytes_in)
+		STATUS_METRICS_LABEL_COUNTER("lighttpd_label_traffic_out_bytes", "Bytes sent by stats.label.", "%" G_GUINT64_FORMAT, lc->bytes_out)
+		STATUS_METRICS_LABEL_COUNTER("lighttpd_label_duration_seconds", "Summed up request durations by stats.label.", "%f", lc->duration / 1000000.0)
+		g_mutex_unlock(pd->labels_mutex);
+
+		#undef STATUS_METRICS_LABEL_COUNTER
+
+		g_array_free(labels, TRUE);
+	}
+
+	status_metrics_histogram(out, "lighttpd_request_ttfb_seconds", "Time until the response headers were sent.", ttfb);
+	status_metrics_histogram(out, "lighttpd_request_duration_seconds", "Time until the response was completely sent.", duration);
+	status_metrics_histogram(out, "lighttpd_loop_busy_seconds", "Time per event loop iteration spent handling events.", loop_busy);
+
+	g_string_append_len(out, CONST_STR_LEN("# EOF\n"));
+
+	g_array_free(backends, TRUE);
+	g_slice_free(liHistogram, ttfb);
+	g_slice_free(liHistogram, duration);
+	g_slice_free(liHistogram, loop_busy);
+
+	li_http_header_overwrite(vr->response.headers, CONST_STR_LEN("Content-Type"), CONST_STR_LEN("application/openmetrics-text; version=1.0.0; charset=utf-8"));
+
+	return out;
+}
+
+/* the CollectCallback for status.metrics */
+static void status_metrics_collect_cb(gpointer cbdata, gpointer fdata, GPtrArray *result, gboolean complete) {
+	mod_status_job *job = fdata;
+	liVRequest *vr = job->vr;
+
+	UNUSED(cbdata);
+
+	if (complete) {
+		/* clear context so it doesn't get cleaned up anymore */
+		*(job->context) = NULL;
+
+		li_chunkqueue_append_string(vr->out, status_metrics_build(vr, job->p, result));
+		vr->response.http_status = 200;
+		li_vrequest_handle_direct(vr);
+		li_vrequest_joblist_append(vr);
+	}
+
+	status_metrics_free_result(result);
+	g_slice_free(mod_status_job, job);
+}
+
+static liHandlerResult status_metrics(liVRequest *vr, gpointer param, gpointer *context) {
+	liCollectInfo *ci;
+	mod_status_job *j;
+
+	if (*context)
+		return LI_HANDLER_WAIT_FOR_EVENT;
+
+	switch (vr->request.http_method) {
+	case LI_HTTP_METHOD_GET:
+	case LI_HTTP_METHOD_HEAD:
+		break;
+	default:
+		return LI_HANDLER_GO_ON;
+	}
+
+	if (li_vrequest_is_handled(vr)) return LI_HANDLER_GO_ON;
+
+	j = g_slice_new0(mod_status_job);
+	j->vr = vr;
+	j->context = context;
+	j->p = param;
+
+	ci = li_collect_start(vr->wrk, status_metrics_collect_func, j, status_metrics_collect_cb, NULL);
+	*context = ci; /* may be NULL */
+	return ci ? LI_HANDLER_WAIT_FOR_EVENT : LI_HANDLER_GO_ON;
+}
+
+static liAction* status_metrics_create(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
+	UNUSED(wrk); UNUSED(userdata);
+
+	if (val) {
+		ERROR(srv, "%s", "status.metrics doesn't expect any parameters");
+		return NULL;
+	}
+
+	return li_action_new_function(status_metrics, status_info_cleanup, NULL, p);
+}
+
+static liHandlerResult stats_label(liVRequest *vr, gpointer param, gpointer *context) {
+	mod_status_label_param *lp = param;
+	UNUSED(context);
+
+	g_ptr_array_index(vr->plugin_ctx, lp->p->id) = GUINT_TO_POINTER(lp->ndx + 1);
+
+	return LI_HANDLER_GO_ON;
+}
+
+static void stats_label_free(liServer *srv, gpointer param) {
+	UNUSED(srv);
+
+	g_slice_free(mod_status_label_param, param);
+}
+
+static liAction* stats_label_create(liServer *srv, liWorker *wrk, liPlugin* p, liValue *val, gpointer userdata) {
+	mod_status_data *pd = p->data;
+	mod_status_label_param *lp;
+	GString *name;
+	guint i;
+	UNUSED(wrk); UNUSED(userdata);
+
+	if (!val || val->type != LI_VALUE_STRING || !val->data.string->len) {
+		ERROR(srv, "%s", "stats.label expects a non-empty string as parameter");
+		return NULL;
+	}
+
+	name = val->data.string;
+	for (i = 0; i < name->len; i++) {
+		gchar c = name->str[i];
+		if (!g_ascii_isalnum(c) && c != '-' && c != '_' && c != '.' && c != ':') {
+			ERROR(srv, "stats.label: invalid character '%c' in label '%s'", c, name->str);
+			return NULL;
+		}
+	}
+
+	lp = g_slice_new(mod_status_label_param);
+	lp->p = p;
+
+	/* labels are never removed, so the index stays valid */
+	g_mutex_lock(pd->labels_mutex);
+	for (i = 0; i < pd->labels->len; i++) {
+		if (g_string_equal(g_ptr_array_index(pd->labels, i), name)) break;
+	}
+	if (i == pd->labels->len) {
+		g_ptr_array_add(pd->labels, g_string_new_len(GSTR_LEN(name)));
+	}
+	lp->ndx = i;
+	g_mutex_unlock(pd->labels_mutex);
+
+	return li_action_new_function(stats_label, NULL, stats_label_free, lp);
+}
+
 static gint str_comp(gconstpointer a, gconstpointer b) {
 	return strcmp(*(const gchar**)a, *(const gchar**)b);
 }
@@ -1263,8 +1969,25 @@ static liHandlerResult status_info_runtime(liVRequest *vr, liPlugin *p) {
 }
 
 static void status_handle_vrclose(liVRequest *vr, liPlugin *p) {
+	mod_status_data *sd = p->data;
 	gint http_status = vr->response.http_status;
-	UNUSED(p);
+	guint label = GPOINTER_TO_UINT(g_ptr_array_index(vr->plugin_ctx, p->id));
+
+	if (label && sd->worker_labels) {
+		GArray *labels = sd->worker_labels[vr->wrk->ndx];
+		mod_status_label_counters *lc;
+		ev_tstamp duration = CUR_TS(vr->wrk) - vr->ts_started;
+		guint64 usec = (duration > 0) ? (guint64) (duration * 1000000) : 0;
+
+		if (label > labels->len) g_array_set_size(labels, label);
+
+		lc = &g_array_index(labels, mod_status_label_counters, label - 1);
+		lc->requests++;
+		lc->bytes_in += vr->vr_in->bytes_in;
+		lc->bytes_out += MAX(0, vr->vr_out->bytes_out - vr->coninfo->out_queue_length);
+		lc->duration += usec;
+		lc->duration_max = MAX(lc->duration_max, usec);
+	}
 
 	if ((http_status < 100 && http_status != 0) || http_status > 599) {
 		VR_ERROR(vr, "unknown status code: %d", http_status);
@@ -1272,6 +1995,57 @@ static void status_handle_vrclose(liVRequest *vr, liPlugin *p) {
 	}
 
 	mod_status_response_codes[(http_status / 100)-1]++;
+
+	if (http_status != 0 && sd->worker_backends) {
+		GArray *backends = sd->worker_backends[vr->wrk->ndx];
+		guint ndx = vr->backend ? vr->backend->id + 1 : 0;
+		mod_status_backend_counters *bc;
+
+		if (ndx >= backends->len) g_array_set_size(backends, ndx + 1);
+
+		bc = &g_array_index(backends, mod_status_backend_counters, ndx);
+		if (!bc->name) bc->name = vr->backend ? vr->backend->name : "direct";
+		bc->responses[(http_status / 100)-1]++;
+	}
+}
+
+static void status_prepare(liServer *srv, liPlugin *p) {
+	mod_status_data *sd = p->data;
+	guint i;
+
+	sd->worker_backends = g_new0(GArray*, srv->worker_count);
+	sd->worker_labels = g_new0(GArray*, srv->worker_count);
+	for (i = 0; i < srv->worker_count; i++) {
+		sd->worker_backends[i] = g_array_sized_new(FALSE, TRUE, sizeof(mod_status_backend_counters), 4);
+		sd->worker_labels[i] = g_array_sized_new(FALSE, TRUE, sizeof(mod_status_label_counters), sd->labels->len);
+	}
+}
+
+static void plugin_status_free(liServer *srv, liPlugin *p) {
+	mod_status_data *sd = p->data;
+	guint i;
+
+	if (sd->worker_backends) {
+		for (i = 0; i < srv->worker_count; i++) {
+			g_array_free(sd->worker_backends[i], TRUE);
+		}
+		g_free(sd->worker_backends);
+	}
+
+	if (sd->worker_labels) {
+		for (i = 0; i < srv->worker_count; i++) {
+			g_array_free(sd->worker_labels[i], TRUE);
+		}
+		g_free(sd->worker_labels);
+	}
+
+	for (i = 0; i < sd->labels->len; i++) {
+		g_string_free(g_ptr_array_index(sd->labels, i), TRUE);
+	}
+	g_ptr_array_free(sd->labels, TRUE);
+	g_mutex_free(sd->labels_mutex);
+
+	g_slice_free(mod_status_data, sd);
 }
 
 
@@ -1288,6 +2062,8 @@ static const liPluginOptionPtr optionptrs[] = {
 
 static const liPluginAction actions[] = {
 	{ "status.info", status_info_create, NULL },
+	{ "status.metrics", status_metrics_create, NULL },
+	{ "stats.label", stats_label_create, NULL },
 
 	{ NULL, NULL, NULL }
 };
@@ -1300,12 +2076,21 @@ static const liPluginSetup setups[] = {
 static void plugin_status_init(liServer *srv, liPlugin *p, gpointer userdata) {
 	UNUSED(srv); UNUSED(userdata);
 
+	{
+		mod_status_data *sd = g_slice_new0(mod_status_data);
+		sd->labels_mutex = g_mutex_new();
+		sd->labels = g_ptr_array_new();
+		p->data = sd;
+	}
+
 	p->options = options;
 	p->optionptrs = optionptrs;
 	p->actions = actions;
 	p->setups = setups;
 
 	p->handle_vrclose = status_handle_vrclose;
+	p->handle_prepare = status_prepare;
+	p->free = plugin_status_free;
 }
 
 
@@ -0,0 +1,400 @@
+
+/* microbenchmarks for the hot paths of request handling; run with "make bench"
+ *
+ * every benchmark runs with a growing number of iterations until it takes at least --time seconds;
+ * the best of --repeat runs is reported, as ns/op and glib allocations/op.
+ * allocations are counted with a glib memory vtable, and g_slice is forced to use malloc for it.
+ */
+
+#include <lighttpd/base.h>
+#include <lighttpd/http_request_parser.h>
+#include <lighttpd/pattern.h>
+#include <lighttpd/radix.h>
+
+typedef struct bench_result bench_result;
+struct bench_result {
+	guint64 iterations;
+	gdouble seconds;
+	guint64 allocs;
+};
+
+typedef struct bench_entry bench_entry;
+struct bench_entry {
+	const gchar *name;
+	void (*func)(guint64 iterations, bench_result *res);
+};
+
+static guint64 bench_allocs = 0;
+static GTimer *bench_timer = NULL;
+static guint64 bench_allocs_start = 0;
+
+static gpointer bench_malloc(gsize n_bytes) {
+	bench_allocs++;
+	return malloc(n_bytes);
+}
+
+static gpointer bench_realloc(gpointer mem, gsize n_bytes) {
+	if (!mem) bench_allocs++;
+	return realloc(mem, n_bytes);
+}
+
+static gpointer bench_calloc(gsize n_blocks, gsize n_bytes) {
+	bench_allocs++;
+	return calloc(n_blocks, n_bytes);
+}
+
+static void bench_free(gpointer mem) {
+	free(mem);
+}
+
+/* the timed part of a benchmark is wrapped with bench_start/bench_stop, setup and teardown are not measured */
+static void bench_start(void) {
+	bench_allocs_start = bench_allocs;
+	g_timer_start(bench_timer);
+}
+
+static void bench_stop(guint64 iterations, bench_result *res) {
+	g_timer_stop(bench_timer);
+	res->seconds = g_timer_elapsed(bench_timer, NULL);
+	res->allocs = bench_allocs - bench_allocs_start;
+	res->iterations = iterations;
+}
+
+static const gchar bench_request[] =
+	"GET /static/images/logo.png?v=3 HTTP/1.1\r\n"
+	"Host: www.example.com\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:60.0) Gecko/20100101 Firefox/60.0\r\n"
+	"Accept: image/webp,*/*\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Referer: http://www.example.com/index.html\r\n"
+	"Cookie: session=0123456789abcdef; theme=dark\r\n"
+	"Connection: keep-alive\r\n"
+	"If-Modified-Since: Sat, 01 Jan 2011 00:00:00 GMT\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"\r\n";
+
+static void bench_request_parser(guint64 iterations, bench_result *res) {
+	liChunkQueue *cq = li_chunkqueue_new();
+	liHttpRequestCtx ctx;
+	liRequest req;
+	guint64 i;
+
+	li_request_init(&req);
+	li_http_request_parser_init(&ctx, &req, cq);
+
+	bench_start();
+	for (i = 0; i < iterations; i++) {
+		li_chunkqueue_append_mem(cq, CONST_STR_LEN(bench_request));
+		if (LI_HANDLER_GO_ON != li_http_request_parse(NULL, &ctx)) g_error("parsing the request failed");
+		li_http_request_parser_reset(&ctx);
+		li_request_reset(&req);
+	}
+	bench_stop(iterations, res);
+
+	li_http_request_parser_clear(&ctx);
+	li_request_clear(&req);
+	li_chunkqueue_free(cq);
+}
+
+static liHttpHeaders* bench_headers_new(void) {
+	liHttpHeaders *headers = li_http_headers_new();
+
+	li_http_header_insert(headers, CONST_STR_LEN("Host"), CONST_STR_LEN("www.example.com"));
+	li_http_header_insert(headers, CONST_STR_LEN("User-Agent"), CONST_STR_LEN("Mozilla/5.0 (X11; Linux x86_64; rv:60.0)"));
+	li_http_header_insert(headers, CONST_STR_LEN("Accept"), CONST_STR_LEN("image/webp,*/*"));
+	li_http_header_insert(headers, CONST_STR_LEN("Accept-Language"), CONST_STR_LEN("en-US,en;q=0.5"));
+	li_http_header_insert(headers, CONST_STR_LEN("Referer"), CONST_STR_LEN("http://www.example.com/index.html"));
+	li_http_header_insert(headers, CONST_STR_LEN("Cookie"), CONST_STR_LEN("session=0123456789abcdef"));
+	li_http_header_insert(headers, CONST_STR_LEN("Cookie"), CONST_STR_LEN("theme=dark"));
+	li_http_header_insert(headers, CONST_STR_LEN("Connection"), CONST_STR_LEN("keep-alive"));
+	li_http_header_insert(headers, CONST_STR_LEN("Cache-Control"), CONST_STR_LEN("max-age=0"));
+	li_http_header_insert(headers, CONST_STR_LEN("Accept-Encoding"), CONST_STR_LEN("gzip, deflate, br"));
+
+	return headers;
+}
+
+static void bench_header_lookup(guint64 iterations, bench_result *res) {
+	liHttpHeaders *headers = bench_headers_new();
+	guint64 i;
+
+	bench_start();
+	for (i = 0; i < iterations; i++) {
+		if (NULL == li_http_header_lookup(headers, CONST_STR_LEN("accept-encoding"))) g_error("header not found");
+		if (NULL != li_http_header_lookup(headers, CONST_STR_LEN("x-forwarded-for"))) g_error("unexpected header");
+	}
+	bench_stop(iterations, res);
+
+	li_http_headers_free(headers);
+}
+
+static void bench_header_get_all(guint64 iterations, bench_result *res) {
+	liHttpHeaders *headers = bench_headers_new();
+	GString *tmp = g_string_sized_new(127);
+	guint64 i;
+
+	bench_start();
+	for (i = 0; i < iterations; i++) {
+		li_http_header_get_all(tmp, headers, CONST_STR_LEN("cookie"));
+	}
+	bench_stop(iterations, res);
+
+	g_string_free(tmp, TRUE);
+	li_http_headers_free(headers);
+}
+
+static void bench_chunkqueue(guint64 iterations, bench_result *res) {
+	liChunkQueue *in = li_chunkqueue_new(), *out = li_chunkqueue_new();
+	gchar buf[1024];
+	guint64 i;
+
+	memset(buf, 'x', sizeof(buf));
+
+	bench_start();
+	for (i = 0; i < iterations; i++) {
+		li_chunkqueue_append_mem(in, buf, sizeof(buf));
+		li_chunkqueue_append_mem(in, buf, sizeof(buf));
+		li_chunkqueue_steal_len(out, in, sizeof(buf) + sizeof(buf) / 2);
+		li_chunkqueue_skip(out, sizeof(buf));
+		li_chunkqueue_skip_all(out);
+		li_chunkqueue_skip_all(in);
+	}
+	bench_stop(iterations, res);
+
+	li_chunkqueue_free(in);
+	li_chunkqueue_free(out);
+}
+
+#define BENCH_MEMPOOL_PTRS 64
+
+static void bench_mempool(guint64 iterations, bench_result *res) {
+	mempool_ptr ptrs[BENCH_MEMPOOL_PTRS];
+	guint64 i;
+	guint j;
+
+	bench_start();
+	for (i = 0; i < iterations; i++) {
+		j = i % BENCH_MEMPOOL_PTRS;
+		if (i >= BENCH_MEMPOOL_PTRS) mempool_free(ptrs[j], 4096);
+		ptrs[j] = mempool_alloc(4096);
+	}
+	bench_stop(iterations, res);
+
+	for (i = 0; i < MIN(iterations, BENCH_MEMPOOL_PTRS); i++) {
+		mempool_free(ptrs[i], 4096);
+	}
+}
+
+#define BENCH_RADIX_NETS 1024
+
+static void bench_radix_lookup(guint64 iterations, bench_result *res) {
+	liRadixTree *tree = li_radixtree_new();
+	guint64 i;
+	guint32 ip;
+
+	/* 10.x.y.0/24 and 10.x.0.0/16 networks */
+	for (i = 0; i < BENCH_RADIX_NETS; i++) {
+		ip = htonl(0x0a000000u | ((guint32) i << 8) | ((guint32) (i * 7) << 16));
+		li_radixtree_insert(tree, &ip, 24, GUINT_TO_POINTER(1));
+		ip = htonl(0x0a000000u | ((guint32) i << 16));
+		li_radixtree_insert(tree, &ip, 16, GUINT_TO_POINTER(2));
+	}
+
+	bench_start();
+	for (i = 0; i < iterations; i++) {
+		ip = htonl(0x0a000000u | ((guint32) (i * 2654435761u) & 0x00ffffffu));
+		li_radixtree_lookup(tree, &ip, 32);
+	}
+	bench_stop(iterations, res);
+
+	li_radixtree_free(tree, NULL, NULL);
+}
+
+/* conditions only need the parts of a vrequest they look at */
+typedef struct bench_vrequest bench_vrequest;
+struct bench_vrequest {
+	liWorker wrk;
+	liVRequest vr;
+};
+
+static bench_vrequest* bench_vrequest_new(void) {
+	bench_vrequest *bvr = g_slice_new0(bench_vrequest);
+
+	bvr->wrk.tmp_str = g_string_sized_new(255);
+	bvr->vr.wrk = &bvr->wrk;
+	li_request_init(&bvr->vr.request);
+	li_action_stack_init(&bvr->vr.action_stack);
+
+	g_string_assign(bvr->vr.request.uri.path, "/static/images/logo.png");
+	g_string_assign(bvr->vr.request.uri.host, "www.example.com");
+	li_http_header_insert(bvr->vr.request.headers, CONST_STR_LEN("User-Agent"), CONST_STR_LEN("Mozilla/5.0 (X11; Linux x86_64; rv:60.0)"));
+
+	return bvr;
+}
+
+static void bench_vrequest_free(bench_vrequest *bvr) {
+	g_array_free(bvr->vr.action_stack.stack, TRUE);
+	g_array_free(bvr->vr.action_stack.backend_stack, TRUE);
+	g_array_free(bvr->vr.action_stack.regex_stack, TRUE);
+	li_request_clear(&bvr->vr.request);
+	g_string_free(bvr->wrk.tmp_str, TRUE);
+	g_slice_free(bench_vrequest, bvr);
+}
+
+static void bench_condition_check(liVRequest *vr, liCondition *cond) {
+	GArray *rs = vr->action_stack.regex_stack;
+	gboolean result;
+
+	if (LI_HANDLER_GO_ON != li_condition_check(vr, cond, &result) || !result) g_error("condition check failed");
+
+	/* pop the regex stack like the action stack does */
+	while (rs->len) {
+		liActionRegexStackElement *arse = &g_array_index(rs, liActionRegexStackElement, rs->len - 1);
+		if (arse->string) g_string_free(arse->string, TRUE);
+		g_match_info_free(arse->match_info);
+		g_array_set_size(rs, rs->len - 1);
+	}
+}
+
+static void bench_condition(guint64 iterations, bench_result *res) {
+	bench_vrequest *bvr = bench_vrequest_new();
+	liCondition *cond_prefix, *cond_host, *cond_regex;
+	guint64 i;
+
+	cond_prefix = li_condition_new_string(NULL, LI_CONFIG_COND_PREFIX,
+		li_condition_lvalue_new(LI_COMP_REQUEST_PATH, NULL), g_string_new("/static/"));
+	cond_host = li_condition_new_string(NULL, LI_CONFIG_COND_EQ,
+		li_condition_lvalue_new(LI_COMP_REQUEST_HOST, NULL), g_string_new("www.example.com"));
+	cond_regex = li_condition_new_string(NULL, LI_CONFIG_COND_MATCH,
+		li_condition_lvalue_new(LI_COMP_REQUEST_HEADER, g_string_new("User-Agent")), g_string_new("(Firefox|Mozilla)/([0-9.]+)"));
+
+	bench_start();
+	for (i = 0; i < iterations; i++) {
+		bench_condition_check(&bvr->vr, cond_prefix);
+		bench_condition_check(&bvr->vr, cond_host);
+		bench_condition_check(&bvr->vr, cond_regex);
+	}
+	bench_stop(iterations, res);
+
+	li_condition_release(NULL, cond_prefix);
+	li_condition_release(NULL, cond_host);
+	li_condition_release(NULL, cond_regex);
+	bench_vrequest_free(bvr);
+}
+
+static void bench_pattern_eval(guint64 iterations, bench_result *res) {
+	liPattern *pattern = li_pattern_new(NULL, "/var/www/$1/htdocs/%2-%1.html");
+	GString *dest = g_string_sized_new(255);
+	GArray *captures = g_array_sized_new(FALSE, TRUE, sizeof(GString*), 3);
+	GString *s;
+	guint64 i;
+
+	s = g_string_new("/images/logo.png"); g_array_append_val(captures, s);
+	s = g_string_new("www.example.com"); g_array_append_val(captures, s);
+	s = g_string_new("example"); g_array_append_val(captures, s);
+
+	bench_start();
+	for (i = 0; i < iterations; i++) {
+		g_string_truncate(dest, 0);
+		li_pattern_eval(NULL, dest, pattern, li_pattern_array_cb, captures, li_pattern_array_cb, captures);
+	}
+	bench_stop(iterations, res);
+
+	for (i = 0; i < captures->len; i++) {
+		g_string_free(g_array_index(captures, GString*, i), TRUE);
+	}
+	g_array_free(captures, TRUE);
+	g_string_free(dest, TRUE);
+	li_pattern_free(pattern);
+}
+
+static const bench_entry bench_entries[] = {
+	{ "request_parser", bench_request_parser },
+	{ "header_lookup", bench_header_lookup },
+	{ "header_get_all", bench_header_get_all },
+	{ "chunkqueue_append_steal_skip", bench_chunkqueue },
+	{ "mempool_alloc_free", bench_mempool },
+	{ "radix_lookup", bench_radix_lookup },
+	{ "condition_check", bench_condition },
+	{ "pattern_eval", bench_pattern_eval },
+	{ NULL, NULL }
+};
+
+static void bench_run(const bench_entry *entry, gdouble min_time, gint repeat) {
+	bench_result res, best;
+	gint r;
+
+	memset(&best, 0, sizeof(best));
+
+	for (r = 0; r < repeat; r++) {
+		guint64 iterations = 1;
+
+		for (;;) {
+			entry->func(iterations, &res);
+			if (res.seconds >= min_time || iterations >= (G_GUINT64_CONSTANT(1) << 40)) break;
+
+			/* aim 20% above the wanted time, but grow at most 100x per step */
+			if (res.seconds * 100 <= min_time) {
+				iterations *= 100;
+			} else {
+				iterations = MAX(iterations + 1, (guint64) (iterations * min_time * 1.2 / res.seconds));
+			}
+		}
+
+		if (0 == r || res.seconds / res.iterations < best.seconds / best.iterations) best = res;
+	}
+
+	g_print("%-32s %12" G_GUINT64_FORMAT " ops %12.1f ns/op %10.2f allocs/op\n",
+		entry->name, best.iterations, best.seconds * 1e9 / best.iterations, (gdouble) best.allocs / best.iterations);
+}
+
+int main(int argc, char **argv) {
+	static GMemVTable vtable = { bench_malloc, bench_realloc, bench_free, bench_calloc, NULL, NULL };
+	GError *error = NULL;
+	GOptionContext *context;
+	const bench_entry *entry;
+	gboolean res;
+
+	gchar *filter = NULL;
+	gdouble min_time = 0.5;
+	gint repeat = 3;
+
+	GOptionEntry entries[] = {
+		{ "filter", 'f', 0, G_OPTION_ARG_STRING, &filter, "only run benchmarks containing STR in their name", "STR" },
+		{ "time", 't', 0, G_OPTION_ARG_DOUBLE, &min_time, "minimum time per run (default: 0.5)", "SECONDS" },
+		{ "repeat", 'r', 0, G_OPTION_ARG_INT, &repeat, "number of runs, the best is reported (default: 3)", "N" },
+		{ NULL, 0, 0, 0, NULL, NULL, NULL }
+	};
+
+	/* has to happen before anything is allocated */
+	g_mem_set_vtable(&vtable);
+	g_setenv("G_SLICE", "always-malloc", TRUE);
+
+	context = g_option_context_new("- lighttpd2 microbenchmarks");
+	g_option_context_add_main_entries(context, entries, NULL);
+
+	res = g_option_context_parse(context, &argc, &argv, &error);
+
+	g_option_context_free(context);
+
+	if (!res) {
+		g_printerr("failed to parse command line arguments: %s\n", error->message);
+		g_error_free(error);
+		return 1;
+	}
+
+	if (repeat < 1) repeat = 1;
+
+	bench_timer = g_timer_new();
+
+	for (entry = bench_entries; entry->name; entry++) {
+		if (filter && !strstr(entry->name, filter)) continue;
+		bench_run(entry, min_time, repeat);
+	}
+
+	g_timer_destroy(bench_timer);
+	g_free(filter);
+	mempool_cleanup();
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+
+#include <lighttpd/histogram.h>
+
+static void test_histogram_buckets(void) {
+	guint64 value;
+
+	/* small values are exact */
+	for (value = 0; value < 2 * LI_HISTOGRAM_SUB_BUCKETS; value++) {
+		g_assert_cmpuint(li_histogram_bucket(value), ==, value);
+	}
+
+	/* every value lies within its bucket, and the error is bounded */
+	for (value = 1; value < G_GUINT64_CONSTANT(1) << 40; value = value * 3 + 7) {
+		guint bucket = li_histogram_bucket(value);
+
+		g_assert_cmpuint(li_histogram_bucket_lower(bucket), <=, value);
+		g_assert_cmpuint(li_histogram_bucket_upper(bucket), >=, value);
+		if (bucket < LI_HISTOGRAM_BUCKETS - 1) {
+			g_assert_cmpuint(li_histogram_bucket_upper(bucket) - li_histogram_bucket_lower(bucket), <=, value / LI_HISTOGRAM_SUB_BUCKETS);
+		}
+	}
+
+	/* buckets are adjacent */
+	for (value = 0; value < LI_HISTOGRAM_BUCKETS - 1; value++) {
+		g_assert_cmpuint(li_histogram_bucket_upper(value) + 1, ==, li_histogram_bucket_lower(value + 1));
+	}
+}
+
+static void test_histogram_percentile(void) {
+	liHistogram h, h2;
+	guint64 i, p50, p99;
+
+	li_histogram_reset(&h);
+	g_assert_cmpuint(li_histogram_percentile(&h, 50), ==, 0);
+
+	for (i = 1; i <= 1000; i++) {
+		li_histogram_record(&h, i);
+	}
+
+	g_assert_cmpuint(h.count, ==, 1000);
+	g_assert_cmpuint(h.max, ==, 1000);
+	g_assert_cmpuint(h.sum, ==, 500500);
+
+	p50 = li_histogram_percentile(&h, 50);
+	p99 = li_histogram_percentile(&h, 99);
+	g_assert_cmpuint(p50, >=, 500);
+	g_assert_cmpuint(p50, <=, 500 + 500 / LI_HISTOGRAM_SUB_BUCKETS);
+	g_assert_cmpuint(p99, >=, 990);
+	g_assert_cmpuint(p99, <=, 1000);
+	g_assert_cmpuint(li_histogram_percentile(&h, 100), ==, 1000);
+
+	g_assert_cmpuint(li_histogram_count_upto(&h, 0), ==, 0);
+	g_assert_cmpuint(li_histogram_count_upto(&h, 20), ==, 20);
+	/* 500 is within [496, 511]: that bucket is left out */
+	g_assert_cmpuint(li_histogram_count_upto(&h, 500), ==, 495);
+	g_assert_cmpuint(li_histogram_count_upto(&h, 500), >=, 500 - 500 / LI_HISTOGRAM_SUB_BUCKETS);
+	g_assert_cmpuint(li_histogram_count_upto(&h, 5000), ==, 1000);
+
+	/* merging the same values again doesn't change the percentiles */
+	h2 = h;
+	li_histogram_merge(&h, &h2);
+	g_assert_cmpuint(h.count, ==, 2000);
+	g_assert_cmpuint(li_histogram_percentile(&h, 50), ==, p50);
+	g_assert_cmpuint(li_histogram_percentile(&h, 99), ==, p99);
+}
+
+static void test_histogram_count_upto(void) {
+	liHistogram h;
+	guint bucket;
+	guint64 lower, upper;
+
+	li_histogram_reset(&h);
+
+	/* one value at each edge of a bucket, and one above */
+	bucket = li_histogram_bucket(1000);
+	lower = li_histogram_bucket_lower(bucket);
+	upper = li_histogram_bucket_upper(bucket);
+	g_assert_cmpuint(lower, ==, 992);
+	g_assert_cmpuint(upper, ==, 1023);
+
+	li_histogram_record(&h, 5);
+	li_histogram_record(&h, lower);
+	li_histogram_record(&h, upper);
+	li_histogram_record(&h, upper + 1);
+
+	g_assert_cmpuint(li_histogram_count_upto(&h, 4), ==, 0);
+	g_assert_cmpuint(li_histogram_count_upto(&h, 5), ==, 1);
+	g_assert_cmpuint(li_histogram_count_upto(&h, lower - 1), ==, 1);
+
+	/* the bucket only counts once the bound reaches its upper edge */
+	g_assert_cmpuint(li_histogram_count_upto(&h, lower), ==, 1);
+	g_assert_cmpuint(li_histogram_count_upto(&h, 1000), ==, 1);
+	g_assert_cmpuint(li_histogram_count_upto(&h, upper - 1), ==, 1);
+	g_assert_cmpuint(li_histogram_count_upto(&h, upper), ==, 3);
+
+	/* the bucket above ends at 1087, but no value is above the bound once it reaches max */
+	g_assert_cmpuint(li_histogram_bucket_upper(li_histogram_bucket(upper + 1)), ==, 1087);
+	g_assert_cmpuint(li_histogram_count_upto(&h, upper + 1), ==, 4);
+	g_assert_cmpuint(li_histogram_count_upto(&h, G_MAXUINT64), ==, 4);
+
+	/* the last bucket is open-ended */
+	li_histogram_record(&h, G_GUINT64_CONSTANT(1) << 40);
+	g_assert_cmpuint(li_histogram_count_upto(&h, upper + 1), ==, 3);
+	g_assert_cmpuint(li_histogram_count_upto(&h, (G_GUINT64_CONSTANT(1) << 40) - 1), ==, 4);
+	g_assert_cmpuint(li_histogram_count_upto(&h, G_GUINT64_CONSTANT(1) << 40), ==, 5);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/histogram/buckets", test_histogram_buckets);
+	g_test_add_func("/histogram/percentile", test_histogram_percentile);
+	g_test_add_func("/histogram/count-upto", test_histogram_count_upto);
+
+	return g_test_run();
+}
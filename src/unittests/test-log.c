@@ -0,0 +1,242 @@
+
+#include <lighttpd/base.h>
+
+#define TEST_QUEUE_LIMIT 40 /* bytes: 10 entries of 4 bytes */
+#define TEST_BUFFER_RECORDS 1500 /* records per target: two full blocks and a rest */
+#define TEST_BUFFER_RECORD_SIZE 100
+#define TEST_PIPE_CHUNK 512
+
+typedef struct {
+	liServer *srv;
+	gchar dir[64];
+	GString *path_a, *path_b;
+	liLogShard *shard_a, *shard_b;
+} test_logs;
+
+static liLogShard* test_shard(liServer *srv, GString *path) {
+	/* same as log_shard() in log.c */
+	return &srv->logs.shards[g_string_hash(path) % srv->logs.shard_count];
+}
+
+static void test_write(test_logs *t, GString *path, const gchar *prefix, guint from, guint to) {
+	guint i;
+
+	for (i = from; i < to; i++) {
+		GString *msg = g_string_sized_new(7);
+		g_string_printf(msg, "%s-%02u", prefix, i);
+		li_log_write_direct(t->srv, NULL, path, msg);
+	}
+}
+
+static gsize test_queued_bytes(liLogShard *shard) {
+	gsize bytes;
+
+	g_static_mutex_lock(&shard->write_queue_mutex);
+	bytes = shard->queued_bytes;
+	g_static_mutex_unlock(&shard->write_queue_mutex);
+
+	return bytes;
+}
+
+static void test_check_file(GString *path, const gchar *expected) {
+	gchar *contents = NULL;
+
+	g_assert(g_file_get_contents(path->str, &contents, NULL, NULL));
+	g_assert_cmpstr(contents, ==, expected);
+	g_free(contents);
+	unlink(path->str);
+}
+
+static void test_log_queue_limit(void) {
+	test_logs t;
+	guint i;
+
+	memset(&t, 0, sizeof(t));
+	g_strlcpy(t.dir, "/tmp/lighttpd2-test-log-XXXXXX", sizeof(t.dir));
+	g_assert(NULL != mkdtemp(t.dir));
+
+	t.srv = g_slice_new0(liServer);
+	li_log_init(t.srv);
+	g_assert(li_log_set_threads(t.srv, 2));
+	t.srv->logs.queue_limit = TEST_QUEUE_LIMIT;
+
+	/* targets on different shards: a full queue only drops the entries of its own shard */
+	t.path_a = g_string_new(t.dir);
+	g_string_append(t.path_a, "/a.log");
+	t.shard_a = test_shard(t.srv, t.path_a);
+	t.path_b = g_string_sized_new(0);
+	for (i = 0; ; i++) {
+		g_string_printf(t.path_b, "%s/b%u.log", t.dir, i);
+		if (test_shard(t.srv, t.path_b) != t.shard_a) break;
+	}
+	t.shard_b = test_shard(t.srv, t.path_b);
+
+	/* the writer threads aren't running yet: everything stays queued */
+	test_write(&t, t.path_a, "a", 0, 20);
+	test_write(&t, t.path_b, "b", 0, 5);
+
+	g_assert_cmpuint(test_queued_bytes(t.shard_a), ==, TEST_QUEUE_LIMIT);
+	g_assert_cmpuint(t.shard_a->dropped, ==, 10);
+	g_assert_cmpuint(t.shard_a->dropped_bytes, ==, 40);
+	g_assert_cmpuint(test_queued_bytes(t.shard_b), ==, 20);
+	g_assert_cmpuint(t.shard_b->dropped, ==, 0);
+
+	/* queued entries are written, the queue accepts new ones afterwards */
+	li_log_thread_wakeup(t.srv);
+	for (i = 0; i < 5000 && 0 != test_queued_bytes(t.shard_a); i++) g_usleep(1000);
+	g_assert_cmpuint(test_queued_bytes(t.shard_a), ==, 0);
+
+	test_write(&t, t.path_a, "a", 20, 25);
+
+	li_log_cleanup(t.srv);
+
+	/* the first entries are kept in order, the overflow is dropped */
+	test_check_file(t.path_a,
+		"a-00\na-01\na-02\na-03\na-04\na-05\na-06\na-07\na-08\na-09\n"
+		"a-20\na-21\na-22\na-23\na-24\n");
+	test_check_file(t.path_b, "b-00\nb-01\nb-02\nb-03\nb-04\n");
+
+	rmdir(t.dir);
+	g_string_free(t.path_a, TRUE);
+	g_string_free(t.path_b, TRUE);
+	g_slice_free(liServer, t.srv);
+}
+
+static void test_buffer_record(GString *dest, const gchar *prefix, guint i) {
+	g_string_append_printf(dest, "%s-%06u %087u\n", prefix, i, i);
+}
+
+static gpointer test_pipe_reader(gpointer data) {
+	gint fd = GPOINTER_TO_INT(data);
+	GString *contents = g_string_sized_new(0);
+	gchar buf[TEST_PIPE_CHUNK];
+	ssize_t r;
+
+	/* read slowly, so the writer keeps running into a full pipe */
+	while (0 != (r = read(fd, buf, sizeof(buf)))) {
+		if (-1 == r) {
+			g_assert_cmpint(errno, ==, EINTR);
+			continue;
+		}
+		g_string_append_len(contents, buf, r);
+		g_usleep(10);
+	}
+	close(fd);
+
+	return contents;
+}
+
+static void test_log_buffer(void) {
+	gchar dir[64];
+	liServer *srv;
+	liWorker *wrk;
+	GString *path_file, *path_pipe, *expected_file, *expected_pipe, *contents;
+	liLogTarget *pipe_target;
+	GThread *reader;
+	GList *link;
+	gint fds[2];
+	guint i, blocks = 0;
+	gchar *file_contents = NULL;
+
+	g_strlcpy(dir, "/tmp/lighttpd2-test-log-XXXXXX", sizeof(dir));
+	g_assert(NULL != mkdtemp(dir));
+
+	srv = g_slice_new0(liServer);
+	li_log_init(srv);
+
+	wrk = g_slice_new0(liWorker);
+	wrk->srv = srv;
+	wrk->loop = ev_loop_new(EVFLAG_AUTO);
+	li_log_worker_init(wrk);
+
+	path_file = g_string_new(dir);
+	g_string_append(path_file, "/buffer.log");
+	path_pipe = g_string_new(dir);
+	g_string_append(path_pipe, "/pipe.log");
+
+	/* the pipe target is opened before the writer thread sees it: a non-blocking pipe only takes
+	 * 64KiB, so writing a block always ends in partial writev() calls and EAGAIN */
+	g_assert_cmpint(pipe(fds), ==, 0);
+	li_fd_no_block(fds[1]);
+	pipe_target = g_slice_new0(liLogTarget);
+	pipe_target->type = LI_LOG_TYPE_FILE;
+	pipe_target->path = g_string_new_len(GSTR_LEN(path_pipe));
+	pipe_target->fd = fds[1];
+	pipe_target->wqelem.data = pipe_target;
+	li_radixtree_insert(srv->logs.shards[0].targets, pipe_target->path->str, pipe_target->path->len * 8, pipe_target);
+	reader = g_thread_create(test_pipe_reader, GINT_TO_POINTER(fds[0]), TRUE, NULL);
+	g_assert(NULL != reader);
+
+	expected_file = g_string_sized_new(0);
+	expected_pipe = g_string_sized_new(0);
+
+	for (i = 0; i < TEST_BUFFER_RECORDS; i++) {
+		liLogBuffer *buf;
+
+		buf = li_log_buffer_get(wrk, path_file);
+		test_buffer_record(buf->data, "file", i);
+		li_log_buffer_commit(wrk, buf);
+		g_assert_cmpuint(buf->data->len, <, LI_LOG_BUFFER_BLOCK_SIZE);
+		test_buffer_record(expected_file, "file", i);
+
+		buf = li_log_buffer_get(wrk, path_pipe);
+		test_buffer_record(buf->data, "pipe", i);
+		li_log_buffer_commit(wrk, buf);
+		g_assert_cmpuint(buf->data->len, <, LI_LOG_BUFFER_BLOCK_SIZE);
+		test_buffer_record(expected_pipe, "pipe", i);
+	}
+
+	/* full buffers were handed off as blocks of whole records */
+	for (link = g_queue_peek_head_link(&wrk->logs.log_queue); link; link = link->next) {
+		liLogEntry *log_entry = link->data;
+
+		g_assert_cmpuint(log_entry->msg->len, >=, LI_LOG_BUFFER_BLOCK_SIZE);
+		g_assert_cmpuint(log_entry->msg->len % TEST_BUFFER_RECORD_SIZE, ==, 0);
+		g_assert_cmpint(log_entry->msg->str[log_entry->msg->len - 1], ==, '\n');
+		blocks++;
+	}
+	g_assert_cmpuint(blocks, ==, 4);
+
+	/* the rest goes out with the next flush */
+	li_log_worker_flush(wrk);
+	g_assert_cmpuint(g_queue_get_length(&wrk->logs.log_queue), ==, 6);
+	g_assert_cmpuint(li_log_buffer_get(wrk, path_file)->data->len, ==, 0);
+	g_assert_cmpuint(li_log_buffer_get(wrk, path_pipe)->data->len, ==, 0);
+
+	li_log_worker_submit(wrk);
+	li_log_thread_wakeup(srv);
+
+	li_log_worker_cleanup(wrk);
+	ev_loop_destroy(wrk->loop);
+	g_slice_free(liWorker, wrk);
+
+	/* closes the write end of the pipe */
+	li_log_cleanup(srv);
+
+	g_assert(g_file_get_contents(path_file->str, &file_contents, NULL, NULL));
+	g_assert_cmpstr(file_contents, ==, expected_file->str);
+	g_free(file_contents);
+	unlink(path_file->str);
+
+	contents = g_thread_join(reader);
+	g_assert_cmpuint(contents->len, ==, expected_pipe->len);
+	g_assert_cmpstr(contents->str, ==, expected_pipe->str);
+	g_string_free(contents, TRUE);
+
+	rmdir(dir);
+	g_string_free(expected_file, TRUE);
+	g_string_free(expected_pipe, TRUE);
+	g_string_free(path_file, TRUE);
+	g_string_free(path_pipe, TRUE);
+	g_slice_free(liServer, srv);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/log/queue-limit", test_log_queue_limit);
+	g_test_add_func("/log/buffer", test_log_buffer);
+
+	return g_test_run();
+}
@@ -0,0 +1,517 @@
+
+#include <lighttpd/base.h>
+#include <lighttpd/memcached.h>
+
+#include <signal.h>
+#include <sys/un.h>
+
+#define TEST_KEYS 10000
+
+typedef struct {
+	guint calls;
+	liMemcachedResult result;
+	GString *data;
+	guint32 flags;
+	guint64 cas, value;
+} test_result;
+
+static void test_result_cb(liMemcachedRequest *request, liMemcachedResult result, liMemcachedItem *item, GError **err) {
+	test_result *res = request->cb_data;
+	UNUSED(err);
+
+	res->calls++;
+	res->result = result;
+	if (NULL != item) {
+		res->flags = item->flags;
+		res->cas = item->cas;
+		res->value = item->value;
+		if (NULL != item->data) g_string_append_len(g_string_truncate(res->data, 0), item->data->addr, item->data->used);
+	}
+}
+
+static void test_result_init(test_result *res) {
+	memset(res, 0, sizeof(*res));
+	res->result = LI_MEMCACHED_RESULT_ERROR;
+	res->data = g_string_sized_new(0);
+}
+
+static void test_result_clear(test_result *res) {
+	g_string_free(res->data, TRUE);
+}
+
+static GString* test_key(GString *key, guint i) {
+	g_string_printf(key, "key-%u", i);
+	return key;
+}
+
+static liMemcachedPool* test_pool_new(struct ev_loop *loop, const gchar **addrs, guint count, ev_tstamp retry_timeout) {
+	liSocketAddress *saddrs = g_new0(liSocketAddress, count);
+	liMemcachedPool *pool;
+	guint i;
+
+	for (i = 0; i < count; i++) {
+		GString *str = g_string_new(addrs[i]);
+		saddrs[i] = li_sockaddr_from_string(str, 11211);
+		g_assert(NULL != saddrs[i].addr);
+		g_string_free(str, TRUE);
+	}
+
+	pool = li_memcached_pool_new(loop, saddrs, count, LI_MEMCACHED_PROTOCOL_ASCII, retry_timeout);
+
+	for (i = 0; i < count; i++) li_sockaddr_clear(&saddrs[i]);
+	g_free(saddrs);
+
+	return pool;
+}
+
+static void test_ketama_distribution(void) {
+	const gchar *addrs[] = { "127.0.0.1:11211", "127.0.0.1:11212", "127.0.0.1:11213", "127.0.0.1:11214" };
+	struct ev_loop *loop = ev_loop_new(EVFLAG_AUTO);
+	liMemcachedPool *pool = test_pool_new(loop, addrs, 4, 30);
+	GString *key = g_string_sized_new(0);
+	guint counts[4] = { 0, 0, 0, 0 };
+	guint i;
+
+	for (i = 0; i < TEST_KEYS; i++) {
+		gint ndx = li_memcached_pool_lookup(pool, test_key(key, i));
+
+		g_assert_cmpint(ndx, >=, 0);
+		g_assert_cmpint(ndx, <, 4);
+		counts[ndx]++;
+
+		/* stable */
+		g_assert_cmpint(li_memcached_pool_lookup(pool, key), ==, ndx);
+	}
+
+	/* expected: TEST_KEYS / 4 each */
+	for (i = 0; i < 4; i++) {
+		g_assert_cmpuint(counts[i], >, TEST_KEYS * 15 / 100);
+		g_assert_cmpuint(counts[i], <, TEST_KEYS * 35 / 100);
+	}
+
+	g_string_free(key, TRUE);
+	li_memcached_pool_free(pool);
+	ev_loop_destroy(loop);
+}
+
+static void test_ketama_remap(void) {
+	const gchar *addrs[] = { "127.0.0.1:11211", "127.0.0.1:11212", "127.0.0.1:11213", "127.0.0.1:11214", "127.0.0.1:11215" };
+	struct ev_loop *loop = ev_loop_new(EVFLAG_AUTO);
+	liMemcachedPool *pool4 = test_pool_new(loop, addrs, 4, 30), *pool5 = test_pool_new(loop, addrs, 5, 30);
+	GString *key = g_string_sized_new(0);
+	guint i, moved = 0;
+
+	for (i = 0; i < TEST_KEYS; i++) {
+		gint ndx4 = li_memcached_pool_lookup(pool4, test_key(key, i));
+		gint ndx5 = li_memcached_pool_lookup(pool5, key);
+
+		/* keys only move to the new server */
+		if (ndx4 != ndx5) {
+			g_assert_cmpint(ndx5, ==, 4);
+			moved++;
+		}
+	}
+
+	/* expected: TEST_KEYS / 5 */
+	g_assert_cmpuint(moved, >, TEST_KEYS * 10 / 100);
+	g_assert_cmpuint(moved, <, TEST_KEYS * 30 / 100);
+
+	g_string_free(key, TRUE);
+	li_memcached_pool_free(pool4);
+	li_memcached_pool_free(pool5);
+	ev_loop_destroy(loop);
+}
+
+static int test_listen(const gchar *path) {
+	struct sockaddr_un sun;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	g_assert(-1 != fd);
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	g_strlcpy(sun.sun_path, path, sizeof(sun.sun_path));
+	g_assert(-1 != bind(fd, (struct sockaddr*) &sun, sizeof(sun)));
+	g_assert(-1 != listen(fd, 8));
+
+	return fd;
+}
+
+/* runs the loop until cond is TRUE (the watchers of a connection don't keep the loop alive) */
+#define TEST_LOOP_UNTIL(loop, cond) do { \
+		guint _i; \
+		for (_i = 0; _i < 5000 && !(cond); _i++) { \
+			ev_loop(loop, EVLOOP_NONBLOCK); \
+			if (!(cond)) g_usleep(1000); \
+		} \
+		g_assert(cond); \
+	} while (0)
+
+static void test_pool_eject(void) {
+	gchar dir[] = "/tmp/lighttpd2-test-memcached-XXXXXX";
+	gchar *path_missing, *path_a, *path_b, *addr_missing, *addr_a, *addr_b;
+	const gchar *addrs[3];
+	struct ev_loop *loop = ev_loop_new(EVFLAG_AUTO);
+	liMemcachedPool *pool;
+	GString *key = g_string_sized_new(0);
+	GError *err = NULL;
+	test_result res;
+	gint mapping[1000], target;
+	int fd_a, fd_b, fd_con;
+	guint i, key_ndx;
+
+	g_assert(NULL != mkdtemp(dir));
+	path_missing = g_build_filename(dir, "missing.sock", NULL);
+	path_a = g_build_filename(dir, "a.sock", NULL);
+	path_b = g_build_filename(dir, "b.sock", NULL);
+	addrs[0] = addr_missing = g_strconcat("unix:", path_missing, NULL);
+	addrs[1] = addr_a = g_strconcat("unix:", path_a, NULL);
+	addrs[2] = addr_b = g_strconcat("unix:", path_b, NULL);
+
+	/* connecting to a and b succeeds (the connections wait in the backlog), missing doesn't exist */
+	fd_a = test_listen(path_a);
+	fd_b = test_listen(path_b);
+
+	pool = test_pool_new(loop, addrs, 3, 0.05);
+
+	for (i = 0; i < G_N_ELEMENTS(mapping); i++) {
+		mapping[i] = li_memcached_pool_lookup(pool, test_key(key, i));
+	}
+	for (key_ndx = 0; key_ndx < G_N_ELEMENTS(mapping) && 0 != mapping[key_ndx]; key_ndx++) ;
+	g_assert_cmpuint(key_ndx, <, G_N_ELEMENTS(mapping));
+
+	/* the request moves on to the next server on the continuum */
+	test_result_init(&res);
+	g_assert(NULL != li_memcached_pool_get(pool, test_key(key, key_ndx), test_result_cb, &res, &err));
+	g_assert_no_error(err);
+	target = li_memcached_pool_lookup(pool, key);
+	g_assert_cmpint(target, >, 0);
+
+	for (i = 0; i < G_N_ELEMENTS(mapping); i++) {
+		gint ndx = li_memcached_pool_lookup(pool, test_key(key, i));
+
+		if (0 == mapping[i]) {
+			g_assert_cmpint(ndx, !=, 0);
+		} else {
+			g_assert_cmpint(ndx, ==, mapping[i]);
+		}
+	}
+
+	/* a lost connection cancels the pending request */
+	fd_con = accept((1 == target) ? fd_a : fd_b, NULL, NULL);
+	g_assert(-1 != fd_con);
+	close(fd_con);
+	TEST_LOOP_UNTIL(loop, 1 == res.calls);
+	g_assert_cmpint(res.result, ==, LI_MEMCACHED_RESULT_ERROR);
+	test_result_clear(&res);
+
+	/* rejoins after retry_timeout */
+	g_usleep(100000);
+	ev_now_update(loop);
+	g_assert_cmpint(li_memcached_pool_lookup(pool, test_key(key, key_ndx)), ==, 0);
+
+	/* all servers down */
+	close(fd_a);
+	close(fd_b);
+	unlink(path_a);
+	unlink(path_b);
+	ev_now_update(loop);
+	test_result_init(&res);
+	for (i = 0; i < G_N_ELEMENTS(mapping); i++) {
+		if (NULL == li_memcached_pool_get(pool, test_key(key, i), test_result_cb, &res, &err)) break;
+	}
+	g_assert_error(err, LI_MEMCACHED_ERROR, LI_MEMCACHED_DISABLED);
+	g_clear_error(&err);
+	g_assert_cmpint(li_memcached_pool_lookup(pool, key), ==, -1);
+	test_result_clear(&res);
+
+	li_memcached_pool_free(pool);
+	ev_loop_destroy(loop);
+	rmdir(dir);
+	g_string_free(key, TRUE);
+	g_free(path_missing); g_free(path_a); g_free(path_b);
+	g_free(addr_missing); g_free(addr_a); g_free(addr_b);
+}
+
+/* binary protocol */
+
+typedef struct {
+	struct ev_loop *loop;
+	gchar dir[64];
+	gchar *path;
+	int fd_listen, fd;
+	liMemcachedCon *con;
+	GString *buf;
+} test_server;
+
+static void test_server_init(test_server *srv, liMemcachedProtocol protocol) {
+	GString *addrstr;
+	liSocketAddress addr;
+
+	srv->loop = ev_loop_new(EVFLAG_AUTO);
+	g_strlcpy(srv->dir, "/tmp/lighttpd2-test-memcached-XXXXXX", sizeof(srv->dir));
+	g_assert(NULL != mkdtemp(srv->dir));
+	srv->path = g_build_filename(srv->dir, "mc.sock", NULL);
+	srv->fd_listen = test_listen(srv->path);
+	srv->buf = g_string_sized_new(0);
+
+	addrstr = g_string_new("unix:");
+	g_string_append(addrstr, srv->path);
+	addr = li_sockaddr_from_string(addrstr, 0);
+	srv->con = li_memcached_con_new(srv->loop, addr, protocol);
+	li_sockaddr_clear(&addr);
+	g_string_free(addrstr, TRUE);
+
+	srv->fd = accept(srv->fd_listen, NULL, NULL);
+	g_assert(-1 != srv->fd);
+}
+
+static void test_server_clear(test_server *srv) {
+	li_memcached_con_release(srv->con);
+	close(srv->fd);
+	close(srv->fd_listen);
+	unlink(srv->path);
+	rmdir(srv->dir);
+	g_free(srv->path);
+	g_string_free(srv->buf, TRUE);
+	ev_loop_destroy(srv->loop);
+}
+
+/* reads exactly len bytes the client sent into srv->buf */
+static void test_server_read(test_server *srv, gsize len) {
+	guint i;
+
+	g_string_truncate(srv->buf, 0);
+	for (i = 0; i < 5000 && srv->buf->len < len; i++) {
+		gchar tmp[256];
+		ssize_t r;
+
+		ev_loop(srv->loop, EVLOOP_NONBLOCK);
+		r = recv(srv->fd, tmp, MIN(sizeof(tmp), len - srv->buf->len), MSG_DONTWAIT);
+		if (r > 0) {
+			g_string_append_len(srv->buf, tmp, r);
+		} else {
+			g_usleep(1000);
+		}
+	}
+	g_assert_cmpuint(srv->buf->len, ==, len);
+}
+
+static void test_server_write(test_server *srv, const gchar *data, gsize len) {
+	g_assert_cmpint(write(srv->fd, data, len), ==, (ssize_t) len);
+}
+
+static guint64 test_bin_uint(const GString *buf, gsize pos, guint bytes) {
+	guint64 value = 0;
+	guint i;
+
+	g_assert_cmpuint(pos + bytes, <=, buf->len);
+	for (i = 0; i < bytes; i++) value = (value << 8) | (guchar) buf->str[pos + i];
+	return value;
+}
+
+static void test_bin_append_uint(GString *str, guint64 value, guint bytes) {
+	while (bytes-- > 0) g_string_append_c(str, (gchar) ((value >> (8*bytes)) & 0xff));
+}
+
+/* response header; extras, key and value follow */
+static void test_bin_response(GString *str, guint8 opcode, guint16 status, guint8 extlen, guint32 bodylen, guint32 opaque, guint64 cas) {
+	test_bin_append_uint(str, 0x81, 1);
+	test_bin_append_uint(str, opcode, 1);
+	test_bin_append_uint(str, 0, 2);
+	test_bin_append_uint(str, extlen, 1);
+	test_bin_append_uint(str, 0, 1);
+	test_bin_append_uint(str, status, 2);
+	test_bin_append_uint(str, bodylen, 4);
+	test_bin_append_uint(str, opaque, 4);
+	test_bin_append_uint(str, cas, 8);
+}
+
+static void test_binary_codec(void) {
+	test_server srv;
+	test_result res, res2;
+	GString *key = g_string_sized_new(0), *resp = g_string_sized_new(0);
+	liBuffer *value;
+	GError *err = NULL;
+	guint32 opaque, opaque2;
+
+	test_server_init(&srv, LI_MEMCACHED_PROTOCOL_BINARY);
+
+	/* SET: header, extras (flags, ttl), key, value */
+	value = li_buffer_new_slice(16);
+	memcpy(value->addr, "hello", 5);
+	value->used = 5;
+	test_result_init(&res);
+	g_string_assign(key, "k1");
+	g_assert(NULL != li_memcached_set(srv.con, key, 0x1234, 60, value, test_result_cb, &res, &err));
+	li_buffer_release(value);
+
+	test_server_read(&srv, 24 + 8 + 2 + 5);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 0, 1), ==, 0x80);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 1, 1), ==, 0x01);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 2, 2), ==, 2);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 4, 1), ==, 8);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 8, 4), ==, 8 + 2 + 5);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 16, 8), ==, 0);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 24, 4), ==, 0x1234);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 28, 4), ==, 60);
+	g_assert(0 == memcmp(srv.buf->str + 32, "k1hello", 7));
+	opaque = test_bin_uint(srv.buf, 12, 4);
+
+	test_bin_response(resp, 0x01, 0x0000, 0, 0, opaque, 42);
+	test_server_write(&srv, GSTR_LEN(resp));
+	TEST_LOOP_UNTIL(srv.loop, 1 == res.calls);
+	g_assert_cmpint(res.result, ==, LI_MEMCACHED_OK);
+	test_result_clear(&res);
+
+	/* GET hit: flags in the extras, cas in the header */
+	test_result_init(&res);
+	g_assert(NULL != li_memcached_get(srv.con, key, test_result_cb, &res, &err));
+
+	test_server_read(&srv, 24 + 2);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 1, 1), ==, 0x00);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 4, 1), ==, 0);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 8, 4), ==, 2);
+	opaque = test_bin_uint(srv.buf, 12, 4);
+
+	g_string_truncate(resp, 0);
+	test_bin_response(resp, 0x00, 0x0000, 4, 4 + 5, opaque, 42);
+	test_bin_append_uint(resp, 0x1234, 4);
+	g_string_append(resp, "hello");
+	test_server_write(&srv, GSTR_LEN(resp));
+	TEST_LOOP_UNTIL(srv.loop, 1 == res.calls);
+	g_assert_cmpint(res.result, ==, LI_MEMCACHED_OK);
+	g_assert_cmpstr(res.data->str, ==, "hello");
+	g_assert_cmpuint(res.flags, ==, 0x1234);
+	g_assert_cmpuint(res.cas, ==, 42);
+	test_result_clear(&res);
+
+	/* multi-get: a quiet GET isn't answered on a miss */
+	test_result_init(&res);
+	test_result_init(&res2);
+	g_string_assign(key, "k2");
+	g_assert(NULL != li_memcached_get(srv.con, key, test_result_cb, &res, &err));
+	g_string_assign(key, "k3");
+	g_assert(NULL != li_memcached_get(srv.con, key, test_result_cb, &res2, &err));
+
+	test_server_read(&srv, 2 * (24 + 2));
+	g_assert_cmpuint(test_bin_uint(srv.buf, 1, 1), ==, 0x09);
+	g_assert(0 == memcmp(srv.buf->str + 24, "k2", 2));
+	g_assert_cmpuint(test_bin_uint(srv.buf, 26 + 1, 1), ==, 0x00);
+	g_assert(0 == memcmp(srv.buf->str + 26 + 24, "k3", 2));
+	opaque2 = test_bin_uint(srv.buf, 26 + 12, 4);
+
+	g_string_truncate(resp, 0);
+	test_bin_response(resp, 0x00, 0x0000, 4, 4 + 3, opaque2, 7);
+	test_bin_append_uint(resp, 0, 4);
+	g_string_append(resp, "abc");
+	test_server_write(&srv, GSTR_LEN(resp));
+	TEST_LOOP_UNTIL(srv.loop, 1 == res2.calls);
+	g_assert_cmpuint(res.calls, ==, 1);
+	g_assert_cmpint(res.result, ==, LI_MEMCACHED_NOT_FOUND);
+	g_assert_cmpint(res2.result, ==, LI_MEMCACHED_OK);
+	g_assert_cmpstr(res2.data->str, ==, "abc");
+	test_result_clear(&res);
+	test_result_clear(&res2);
+
+	/* INCR: extras (delta, initial, expiration), the new value is the body */
+	test_result_init(&res);
+	g_string_assign(key, "counter");
+	g_assert(NULL != li_memcached_incr(srv.con, key, 5, test_result_cb, &res, &err));
+
+	test_server_read(&srv, 24 + 20 + 7);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 1, 1), ==, 0x05);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 4, 1), ==, 20);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 24, 8), ==, 5);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 40, 4), ==, 0xffffffff);
+	opaque = test_bin_uint(srv.buf, 12, 4);
+
+	g_string_truncate(resp, 0);
+	test_bin_response(resp, 0x05, 0x0000, 0, 8, opaque, 0);
+	test_bin_append_uint(resp, 12, 8);
+	test_server_write(&srv, GSTR_LEN(resp));
+	TEST_LOOP_UNTIL(srv.loop, 1 == res.calls);
+	g_assert_cmpint(res.result, ==, LI_MEMCACHED_OK);
+	g_assert_cmpuint(res.value, ==, 12);
+	test_result_clear(&res);
+
+	/* INCR on a missing key */
+	test_result_init(&res);
+	g_assert(NULL != li_memcached_incr(srv.con, key, 5, test_result_cb, &res, &err));
+
+	test_server_read(&srv, 24 + 20 + 7);
+	opaque = test_bin_uint(srv.buf, 12, 4);
+
+	g_string_truncate(resp, 0);
+	test_bin_response(resp, 0x05, 0x0001, 0, 9, opaque, 0);
+	g_string_append(resp, "Not found");
+	test_server_write(&srv, GSTR_LEN(resp));
+	TEST_LOOP_UNTIL(srv.loop, 1 == res.calls);
+	g_assert_cmpint(res.result, ==, LI_MEMCACHED_NOT_FOUND);
+	test_result_clear(&res);
+
+	g_assert_no_error(err);
+
+	g_string_free(key, TRUE);
+	g_string_free(resp, TRUE);
+	test_server_clear(&srv);
+}
+
+/* add on an existing key reports LI_MEMCACHED_NOT_STORED for both protocols */
+static void test_add_exists(void) {
+	test_server srv;
+	test_result res;
+	GString *key = g_string_new("counter"), *resp = g_string_sized_new(0);
+	liBuffer *value = li_buffer_new_slice(16);
+	GError *err = NULL;
+	guint32 opaque;
+
+	memcpy(value->addr, "5", 1);
+	value->used = 1;
+
+	test_server_init(&srv, LI_MEMCACHED_PROTOCOL_ASCII);
+	test_result_init(&res);
+	g_assert(NULL != li_memcached_add(srv.con, key, 0, 60, value, test_result_cb, &res, &err));
+	test_server_read(&srv, sizeof("add counter 0 60 1\r\n5\r\n") - 1);
+	g_assert(0 == memcmp(srv.buf->str, CONST_STR_LEN("add counter 0 60 1\r\n5\r\n")));
+	test_server_write(&srv, CONST_STR_LEN("NOT_STORED\r\n"));
+	TEST_LOOP_UNTIL(srv.loop, 1 == res.calls);
+	g_assert_cmpint(res.result, ==, LI_MEMCACHED_NOT_STORED);
+	test_result_clear(&res);
+	test_server_clear(&srv);
+
+	test_server_init(&srv, LI_MEMCACHED_PROTOCOL_BINARY);
+	test_result_init(&res);
+	g_assert(NULL != li_memcached_add(srv.con, key, 0, 60, value, test_result_cb, &res, &err));
+	test_server_read(&srv, 24 + 8 + 7 + 1);
+	g_assert_cmpuint(test_bin_uint(srv.buf, 1, 1), ==, 0x02);
+	opaque = test_bin_uint(srv.buf, 12, 4);
+
+	test_bin_response(resp, 0x02, 0x0002, 0, 11, opaque, 0);
+	g_string_append(resp, "Data exists");
+	test_server_write(&srv, GSTR_LEN(resp));
+	TEST_LOOP_UNTIL(srv.loop, 1 == res.calls);
+	g_assert_cmpint(res.result, ==, LI_MEMCACHED_NOT_STORED);
+	test_result_clear(&res);
+	test_server_clear(&srv);
+
+	g_assert_no_error(err);
+
+	li_buffer_release(value);
+	g_string_free(key, TRUE);
+	g_string_free(resp, TRUE);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	/* writing to a closed test server */
+	signal(SIGPIPE, SIG_IGN);
+
+	g_test_add_func("/memcached/ketama/distribution", test_ketama_distribution);
+	g_test_add_func("/memcached/ketama/remap", test_ketama_remap);
+	g_test_add_func("/memcached/pool/eject", test_pool_eject);
+	g_test_add_func("/memcached/binary/codec", test_binary_codec);
+	g_test_add_func("/memcached/add/exists", test_add_exists);
+
+	return g_test_run();
+}
@@ -0,0 +1,151 @@
+
+#include <lighttpd/base.h>
+
+#define TEST_READS 20000
+
+typedef struct {
+	liStatsShmWorker *slot;
+	gint stop;
+} test_writer;
+
+static gchar* test_dir(void) {
+	gchar *dir = g_strdup("/tmp/lighttpd2-test-stats-shm-XXXXXX");
+
+	g_assert(NULL != mkdtemp(dir));
+
+	return dir;
+}
+
+static guint test_worker_count(const gchar *path) {
+	GError *err = NULL;
+	liStatsShm *shm = li_stats_shm_open(path, &err);
+	guint count;
+
+	g_assert_no_error(err);
+	g_assert(NULL != shm);
+	count = shm->header->worker_count;
+	li_stats_shm_free(shm);
+
+	return count;
+}
+
+static void test_stats_shm_replace(void) {
+	GError *err = NULL;
+	gchar *dir = test_dir();
+	gchar *path = g_build_filename(dir, "stats", NULL);
+	liStatsShm *old_shm, *new_shm;
+
+	old_shm = li_stats_shm_create(path, 1, &err);
+	g_assert_no_error(err);
+	g_assert_cmpuint(test_worker_count(path), ==, 1);
+
+	/* graceful restart: the new instance replaces the file while the old one is still running */
+	new_shm = li_stats_shm_create(path, 2, &err);
+	g_assert_no_error(err);
+	g_assert_cmpuint(test_worker_count(path), ==, 2);
+
+	/* the old instance keeps its own mapping, and doesn't remove the new file when it exits */
+	li_stats_shm_write_begin(li_stats_shm_worker(old_shm, 0));
+	li_stats_shm_worker(old_shm, 0)->requests = 1;
+	li_stats_shm_write_end(li_stats_shm_worker(old_shm, 0));
+	li_stats_shm_free(old_shm);
+	g_assert(g_file_test(path, G_FILE_TEST_EXISTS));
+	g_assert_cmpuint(test_worker_count(path), ==, 2);
+
+	li_stats_shm_free(new_shm);
+	g_assert(!g_file_test(path, G_FILE_TEST_EXISTS));
+
+	/* no temporary files are left behind */
+	g_assert_cmpint(rmdir(dir), ==, 0);
+
+	g_free(path);
+	g_free(dir);
+}
+
+static gpointer test_writer_thread(gpointer data) {
+	test_writer *w = data;
+	guint64 i;
+	guint j;
+
+	for (i = 1; !g_atomic_int_get(&w->stop); i++) {
+		/* the whole slot changes, like merging the worker histograms does */
+		li_stats_shm_write_begin(w->slot);
+		w->slot->requests = i;
+		for (j = 0; j < LI_HISTOGRAM_BUCKETS; j++) {
+			w->slot->ttfb.buckets[j] = i;
+		}
+		w->slot->bytes_out = i;
+		li_stats_shm_write_end(w->slot);
+
+		/* leave the reader a chance, a worker only updates its slot once a second */
+		g_usleep(1);
+	}
+
+	return NULL;
+}
+
+static void test_stats_shm_seqlock(void) {
+	GError *err = NULL;
+	gchar *dir = test_dir();
+	gchar *path = g_build_filename(dir, "stats", NULL);
+	liStatsShm *shm, *reader;
+	liStatsShmWorker *slot, copy;
+	test_writer w;
+	GThread *thread;
+	guint i, consistent = 0;
+	guint64 last = 0;
+
+	shm = li_stats_shm_create(path, 1, &err);
+	g_assert_no_error(err);
+	reader = li_stats_shm_open(path, &err);
+	g_assert_no_error(err);
+	slot = li_stats_shm_worker(reader, 0);
+
+	/* a slot in the middle of an update can't be read */
+	li_stats_shm_write_begin(li_stats_shm_worker(shm, 0));
+	g_assert(!li_stats_shm_read(slot, &copy));
+	li_stats_shm_write_end(li_stats_shm_worker(shm, 0));
+	g_assert(li_stats_shm_read(slot, &copy));
+	g_assert_cmpint(copy.seq, ==, 2);
+
+	/* the reader uses its own mapping, like lighttpd2-stats */
+	w.slot = li_stats_shm_worker(shm, 0);
+	w.stop = 0;
+	thread = g_thread_create(test_writer_thread, &w, TRUE, NULL);
+	g_assert(NULL != thread);
+
+	for (i = 0; i < TEST_READS; i++) {
+		if (!li_stats_shm_read(slot, &copy)) continue;
+		consistent++;
+
+		/* a snapshot never mixes two updates, and doesn't go back in time */
+		g_assert_cmpint(copy.seq & 1, ==, 0);
+		g_assert_cmpuint(copy.ttfb.buckets[0], ==, copy.requests);
+		g_assert_cmpuint(copy.ttfb.buckets[LI_HISTOGRAM_BUCKETS - 1], ==, copy.requests);
+		g_assert_cmpuint(copy.bytes_out, ==, copy.requests);
+		g_assert_cmpuint(copy.requests, >=, last);
+		last = copy.requests;
+	}
+
+	g_atomic_int_set(&w.stop, 1);
+	g_thread_join(thread);
+
+	g_assert_cmpuint(consistent, >, 0);
+
+	li_stats_shm_free(reader);
+	li_stats_shm_free(shm);
+	g_assert_cmpint(rmdir(dir), ==, 0);
+
+	g_free(path);
+	g_free(dir);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/stats-shm/replace", test_stats_shm_replace);
+	g_test_add_func("/stats-shm/seqlock", test_stats_shm_seqlock);
+
+	return g_test_run();
+}
@@ -0,0 +1,277 @@
+
+#include <lighttpd/base.h>
+
+#define TEST_RATE 500000 /* bytes/s of the shared parent pool */
+#define TEST_IP_RATE 10000000 /* IP pools are effectively unlimited */
+#define TEST_ROUNDS 25
+#define TEST_ROUND_USEC 20000
+
+typedef struct {
+	liVRequest vr;
+	liConInfo coninfo;
+	guint64 sent;
+} test_con;
+
+static gboolean test_check_io(liVRequest *vr) {
+	UNUSED(vr);
+	return TRUE;
+}
+
+static const liConCallbacks test_callbacks = {
+	NULL, NULL, NULL, NULL, test_check_io
+};
+
+static liWorker* test_worker_new(void) {
+	liServer *srv = g_slice_new0(liServer);
+	liWorker *wrk = g_slice_new0(liWorker);
+
+	/* new pools allocate their worker data right away */
+	srv->state = LI_SERVER_RUNNING;
+	srv->worker_count = 1;
+	srv->action_mutex = g_mutex_new();
+	srv->throttle_pools = g_array_new(FALSE, TRUE, sizeof(liThrottlePool*));
+	srv->throttle_ip_pools = li_radixtree_new();
+
+	wrk->srv = srv;
+	wrk->ndx = 0;
+	wrk->loop = ev_loop_new(EVFLAG_AUTO);
+	li_timerwheel_init(&wrk->throttle_wheel, wrk->loop, li_throttle_cb, ((gdouble)THROTTLE_GRANULARITY) / 1000, wrk);
+
+	return wrk;
+}
+
+static void test_worker_free(liWorker *wrk) {
+	liServer *srv = wrk->srv;
+
+	g_assert_cmpuint(srv->throttle_pools->len, ==, 0);
+
+	li_timerwheel_stop(&wrk->throttle_wheel);
+	ev_loop_destroy(wrk->loop);
+	g_slice_free(liWorker, wrk);
+
+	g_array_free(srv->throttle_pools, TRUE);
+	li_radixtree_free(srv->throttle_ip_pools, NULL, NULL);
+	g_mutex_free(srv->action_mutex);
+	g_slice_free(liServer, srv);
+}
+
+static void test_con_init(test_con *con, liWorker *wrk, const gchar *addr) {
+	GString *addrstr = g_string_new(addr);
+
+	memset(con, 0, sizeof(*con));
+	con->vr.wrk = wrk;
+	con->vr.state = LI_VRS_HANDLE_RESPONSE_HEADERS;
+	con->vr.coninfo = &con->coninfo;
+	con->vr.throttle.timer_elem.data = &con->vr;
+	con->coninfo.callbacks = &test_callbacks;
+	con->coninfo.remote_addr = li_sockaddr_from_string(addrstr, 0);
+
+	g_string_free(addrstr, TRUE);
+}
+
+static void test_con_clear(test_con *con) {
+	li_throttle_reset(&con->vr);
+	li_sockaddr_clear(&con->coninfo.remote_addr);
+}
+
+/* same as io.throttle_ip with a parent pool */
+static void test_con_throttle_ip(test_con *con, liThrottlePool *parent) {
+	liThrottlePool *pool = li_throttle_pool_new(con->vr.wrk->srv, LI_THROTTLE_POOL_IP, &con->coninfo.remote_addr, TEST_IP_RATE, parent);
+	li_throttle_pool_acquire(&con->vr, pool);
+}
+
+/* what the throttle timer does for each connection, then the connection sends all it got */
+static void test_round(liWorker *wrk, test_con *cons, guint count) {
+	guint i;
+
+	g_usleep(TEST_ROUND_USEC);
+	ev_now_update(wrk->loop);
+
+	for (i = 0; i < count; i++) {
+		liVRequest *vr = &cons[i].vr;
+		gint magazine;
+
+		li_timerwheel_remove(&wrk->throttle_wheel, &vr->throttle.timer_elem);
+		li_throttle_cb(&wrk->throttle_wheel, &vr->throttle.timer_elem, wrk);
+
+		magazine = MAX(0, vr->throttle.magazine);
+		cons[i].sent += magazine;
+		li_throttle_update(vr, magazine, 0);
+	}
+}
+
+static void test_throttle_parent_shared(void) {
+	liWorker *wrk = test_worker_new();
+	liThrottlePool *vhost;
+	test_con cons[3];
+	ev_tstamp start;
+	guint64 total;
+	guint i;
+
+	vhost = li_throttle_pool_new(wrk->srv, LI_THROTTLE_POOL_NAME, g_string_new("vhost"), TEST_RATE, NULL);
+	start = ev_time();
+
+	/* io.throttle_pool "vhost"; io.throttle_ip (..., "vhost"); - one client with one, one with two connections */
+	test_con_init(&cons[0], wrk, "192.0.2.1");
+	test_con_init(&cons[1], wrk, "192.0.2.2");
+	test_con_init(&cons[2], wrk, "192.0.2.2");
+	for (i = 0; i < 3; i++) {
+		li_throttle_pool_acquire(&cons[i].vr, vhost);
+		test_con_throttle_ip(&cons[i], vhost);
+
+		/* vhost is only charged through the IP pools */
+		g_assert(NULL == cons[i].vr.throttle.pool.ptr);
+		g_assert(NULL != cons[i].vr.throttle.ip.ptr);
+		g_assert(vhost == cons[i].vr.throttle.ip.ptr->parent);
+	}
+	g_assert(cons[1].vr.throttle.ip.ptr == cons[2].vr.throttle.ip.ptr);
+	g_assert_cmpuint(vhost->worker_queues[0]->length, ==, 0);
+
+	/* the named pool doesn't take the connection back once it is in an IP pool below it */
+	li_throttle_pool_acquire(&cons[0].vr, vhost);
+	g_assert(NULL == cons[0].vr.throttle.pool.ptr);
+
+	for (i = 0; i < TEST_ROUNDS; i++) {
+		test_round(wrk, cons, 3);
+		g_assert_cmpuint(vhost->worker_queues[0]->length, ==, 0);
+		g_assert_cmpuint(vhost->worker_child_queues[0]->length, <=, 2);
+	}
+
+	total = cons[0].sent + cons[1].sent + cons[2].sent;
+	g_test_message("sent: %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT ", %.3f s",
+		cons[0].sent, cons[1].sent, cons[2].sent, ev_time() - start);
+
+	/* the parent rate is used, but not exceeded */
+	g_assert_cmpfloat((gdouble) total, <=, TEST_RATE * (ev_time() - start) + THROTTLE_QUANTUM_MIN);
+	g_assert_cmpfloat((gdouble) total, >=, 0.7 * TEST_RATE * TEST_ROUNDS * TEST_ROUND_USEC / 1000000);
+
+	/* split per client, then per connection of the client */
+	g_assert_cmpfloat((gdouble) cons[0].sent, >=, 0.8 * (cons[1].sent + cons[2].sent));
+	g_assert_cmpfloat((gdouble) cons[0].sent, <=, 1.25 * (cons[1].sent + cons[2].sent));
+	g_assert_cmpfloat((gdouble) cons[1].sent, >=, 0.8 * cons[2].sent);
+	g_assert_cmpfloat((gdouble) cons[1].sent, <=, 1.25 * cons[2].sent);
+
+	for (i = 0; i < 3; i++) test_con_clear(&cons[i]);
+	li_throttle_pool_free(wrk->srv, vhost);
+	test_worker_free(wrk);
+}
+
+static void test_throttle_pool_switch(void) {
+	liWorker *wrk = test_worker_new();
+	liThrottlePool *vhost, *other;
+	test_con con;
+
+	vhost = li_throttle_pool_new(wrk->srv, LI_THROTTLE_POOL_NAME, g_string_new("vhost"), TEST_RATE, NULL);
+	other = li_throttle_pool_new(wrk->srv, LI_THROTTLE_POOL_NAME, g_string_new("other"), TEST_RATE, NULL);
+	test_con_init(&con, wrk, "192.0.2.1");
+
+	/* IP pool first: the parent isn't acquired directly */
+	test_con_throttle_ip(&con, vhost);
+	li_throttle_pool_acquire(&con.vr, vhost);
+	g_assert(NULL == con.vr.throttle.pool.ptr);
+
+	/* an unrelated named pool still applies on its own */
+	li_throttle_pool_acquire(&con.vr, other);
+	g_assert(other == con.vr.throttle.pool.ptr);
+	g_assert_cmpint(other->refcount, ==, 2);
+
+	li_throttle_reset(&con.vr);
+	g_assert(NULL == con.vr.throttle.pool.ptr);
+	g_assert(NULL == con.vr.throttle.ip.ptr);
+	g_assert_cmpint(other->refcount, ==, 1);
+	/* the IP pool is gone, with its reference to the parent */
+	g_assert_cmpint(vhost->refcount, ==, 1);
+
+	test_con_clear(&con);
+	li_throttle_pool_free(wrk->srv, other);
+	li_throttle_pool_free(wrk->srv, vhost);
+	test_worker_free(wrk);
+}
+
+static void test_throttle_many_cons(void) {
+	/* more queued connections than bytes per rearm interval and connection */
+	const guint count = 3000, rate = 100000;
+	liWorker *wrk = test_worker_new();
+	liThrottlePool *pool;
+	test_con *cons = g_new0(test_con, count);
+	ev_tstamp start;
+	guint64 total = 0;
+	guint i;
+
+	pool = li_throttle_pool_new(wrk->srv, LI_THROTTLE_POOL_NAME, g_string_new("many"), rate, NULL);
+	start = ev_time();
+
+	for (i = 0; i < count; i++) {
+		test_con_init(&cons[i], wrk, "192.0.2.1");
+		li_throttle_pool_acquire(&cons[i].vr, pool);
+	}
+
+	for (i = 0; i < 10; i++) test_round(wrk, cons, count);
+
+	for (i = 0; i < count; i++) total += cons[i].sent;
+	g_test_message("sent: %" G_GUINT64_FORMAT ", %.3f s", total, ev_time() - start);
+
+	/* the pool doesn't starve */
+	g_assert_cmpfloat((gdouble) total, >=, 0.7 * rate * 10 * TEST_ROUND_USEC / 1000000);
+	g_assert_cmpfloat((gdouble) total, <=, rate * (ev_time() - start) + THROTTLE_QUANTUM_MIN);
+
+	for (i = 0; i < count; i++) test_con_clear(&cons[i]);
+	g_free(cons);
+	li_throttle_pool_free(wrk->srv, pool);
+	test_worker_free(wrk);
+}
+
+static void test_throttle_idle_child(void) {
+	liWorker *wrk = test_worker_new();
+	liThrottlePool *vhost, *ip;
+	test_con con;
+
+	vhost = li_throttle_pool_new(wrk->srv, LI_THROTTLE_POOL_NAME, g_string_new("vhost"), TEST_RATE, NULL);
+	test_con_init(&con, wrk, "192.0.2.1");
+	test_con_throttle_ip(&con, vhost);
+	ip = con.vr.throttle.ip.ptr;
+	g_assert(NULL != con.vr.throttle.ip.queue);
+
+	/* the parent hasn't granted anything yet: the IP pool waits in the parent */
+	g_usleep(TEST_ROUND_USEC);
+	ev_now_update(wrk->loop);
+	li_throttle_cb(&wrk->throttle_wheel, &con.vr.throttle.timer_elem, wrk);
+	g_assert(ip == ip->worker_parent_lnk[0].data);
+	g_assert_cmpuint(vhost->worker_child_queues[0]->length, ==, 1);
+
+	/* the IP pool serves its last connection from an earlier grant while the parent was just
+	 * rearmed (by some other connection), so the parent doesn't pop it from its queue */
+	g_usleep(TEST_ROUND_USEC);
+	ev_now_update(wrk->loop);
+	ip->worker_parent_magazine[0] = THROTTLE_QUANTUM_MIN;
+	vhost->worker_last_rearm[0] = THROTTLE_EVTSTAMP_TO_GINT(CUR_TS(wrk)) - 1;
+	li_throttle_cb(&wrk->throttle_wheel, &con.vr.throttle.timer_elem, wrk);
+	g_assert_cmpint(con.vr.throttle.magazine, >, 0);
+	g_assert(NULL == con.vr.throttle.ip.queue);
+
+	/* an idle child isn't queued in the parent anymore */
+	g_assert(NULL == ip->worker_parent_lnk[0].data);
+	g_assert_cmpuint(vhost->worker_child_queues[0]->length, ==, 0);
+	g_assert_cmpint(vhost->worker_num_cons_queued[0], ==, 0);
+
+	/* the connection goes away before it queues again: the IP pool is freed and mustn't be left in the parent */
+	li_throttle_reset(&con.vr);
+	g_assert_cmpuint(vhost->worker_child_queues[0]->length, ==, 0);
+	g_assert_cmpint(vhost->refcount, ==, 1);
+
+	test_con_clear(&con);
+	li_throttle_pool_free(wrk->srv, vhost);
+	test_worker_free(wrk);
+}
+
+int main(int argc, char **argv) {
+	g_thread_init(NULL);
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/throttle/parent-shared", test_throttle_parent_shared);
+	g_test_add_func("/throttle/pool-switch", test_throttle_pool_switch);
+	g_test_add_func("/throttle/idle-child", test_throttle_idle_child);
+	g_test_add_func("/throttle/many-connections", test_throttle_many_cons);
+
+	return g_test_run();
+}
@@ -0,0 +1,97 @@
+
+#include <lighttpd/base.h>
+
+#define TEST_TICK 0.001
+
+typedef struct {
+	liTimerWheelElem elem;
+	ev_tstamp added;
+	gdouble delay;
+	guint fired;
+	guint order;
+} test_timer;
+
+static guint test_fired_count;
+
+static void test_timerwheel_cb(liTimerWheel *tw, liTimerWheelElem *elem, gpointer data) {
+	test_timer *t = elem->data;
+	UNUSED(data);
+
+	g_assert(NULL == elem->slot);
+	g_assert_cmpfloat(ev_now(tw->loop) - t->added, >=, t->delay - TEST_TICK);
+
+	t->fired++;
+	t->order = ++test_fired_count;
+}
+
+static void test_timer_add(liTimerWheel *tw, test_timer *t, gdouble delay) {
+	memset(t, 0, sizeof(*t));
+	t->elem.data = t;
+	t->delay = delay;
+	t->added = ev_now(tw->loop);
+	li_timerwheel_add(tw, &t->elem, delay);
+}
+
+static void test_timerwheel_order(void) {
+	struct ev_loop *loop = ev_loop_new(EVFLAG_AUTO);
+	liTimerWheel tw;
+	test_timer t1, t2, t3;
+
+	test_fired_count = 0;
+	li_timerwheel_init(&tw, loop, test_timerwheel_cb, TEST_TICK, NULL);
+
+	/* t2 is beyond the first level (256 ticks) and has to be cascaded */
+	test_timer_add(&tw, &t1, 0.05);
+	test_timer_add(&tw, &t2, 0.3);
+	test_timer_add(&tw, &t3, 0.002);
+
+	/* the timer stops as soon as the wheel is empty */
+	ev_loop(loop, 0);
+
+	g_assert_cmpuint(tw.length, ==, 0);
+	g_assert_cmpuint(t1.fired, ==, 1);
+	g_assert_cmpuint(t2.fired, ==, 1);
+	g_assert_cmpuint(t3.fired, ==, 1);
+	g_assert_cmpuint(t3.order, ==, 1);
+	g_assert_cmpuint(t1.order, ==, 2);
+	g_assert_cmpuint(t2.order, ==, 3);
+
+	li_timerwheel_stop(&tw);
+	ev_loop_destroy(loop);
+}
+
+static void test_timerwheel_remove(void) {
+	struct ev_loop *loop = ev_loop_new(EVFLAG_AUTO);
+	liTimerWheel tw;
+	test_timer t1, t2;
+
+	test_fired_count = 0;
+	li_timerwheel_init(&tw, loop, test_timerwheel_cb, TEST_TICK, NULL);
+
+	test_timer_add(&tw, &t1, 0.01);
+	test_timer_add(&tw, &t2, 0.02);
+	li_timerwheel_remove(&tw, &t1.elem);
+	g_assert(NULL == t1.elem.slot);
+	g_assert_cmpuint(tw.length, ==, 1);
+
+	/* removing twice is fine */
+	li_timerwheel_remove(&tw, &t1.elem);
+	g_assert_cmpuint(tw.length, ==, 1);
+
+	ev_loop(loop, 0);
+
+	g_assert_cmpuint(t1.fired, ==, 0);
+	g_assert_cmpuint(t2.fired, ==, 1);
+
+	li_timerwheel_stop(&tw);
+	ev_loop_destroy(loop);
+}
+
+int main(int argc, char **argv) {
+	g_test_init(&argc, &argv, NULL);
+
+	g_test_add_func("/timerwheel/order", test_timerwheel_order);
+	g_test_add_func("/timerwheel/remove", test_timerwheel_remove);
+
+	return g_test_run();
+}
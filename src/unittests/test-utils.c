@@ -159,6 +159,34 @@ static void test_url_decode(void) {
 	g_string_free(url, TRUE);
 }
 
+static void test_cookie_find_check(const gchar *cookies, const gchar *name, const gchar *expected) {
+	const gchar *value = NULL;
+	gsize value_len = 0;
+	gboolean found = li_cookie_find(cookies, strlen(cookies), name, strlen(name), &value, &value_len);
+
+	if (!expected) {
+		g_assert(!found);
+	} else {
+		gchar *v;
+		g_assert(found);
+		v = g_strndup(value, value_len);
+		g_assert_cmpstr(v, ==, expected);
+		g_free(v);
+	}
+}
+
+static void test_cookie_find(void) {
+	test_cookie_find_check("a=1; b=2", "a", "1");
+	test_cookie_find_check("a=1; b=2", "b", "2");
+	test_cookie_find_check("a=1;b=2;", "b", "2");
+	/* joined headers */
+	test_cookie_find_check("a=1, b=2", "b", "2");
+	test_cookie_find_check("a=1; a=2", "a", "1");
+	test_cookie_find_check("b=; a=1", "b", "");
+	test_cookie_find_check("ab=1; xb=2; b", "b", NULL);
+	test_cookie_find_check("", "a", NULL);
+}
+
 int main(int argc, char **argv) {
 	g_test_init(&argc, &argv, NULL);
 
@@ -168,6 +196,7 @@ int main(int argc, char **argv) {
 	g_test_add_func("/utils/apr_sha1_base64/2", test_apr_sha1_base64_2);
 	g_test_add_func("/utils/apr_md5_crypt", test_apr_md5_crypt);
 	g_test_add_func("/utils/url_decode", test_url_decode);
+	g_test_add_func("/utils/cookie_find", test_cookie_find);
 
 	return g_test_run();
 }
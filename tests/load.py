@@ -0,0 +1,199 @@
+# -*- coding: utf-8 -*-
+
+"""
+Load test mode: runtests.py --load <path to lighttpd2-loadgen>
+
+Instead of the t-*.py tests the load tests below are run against the spawned server;
+each drives its vhost with lighttpd2-loadgen (see --load-* options) and reports
+requests/s, latency percentiles, and the CPU time and memory usage of the server.
+The memory usage is the li_memory_usage() value the server reports in status.metrics.
+
+A load test fails if the load generator reports errors or bad status codes.
+"""
+
+import os
+import sys
+import socket
+import subprocess
+import httplib
+import json
+
+import base
+from base import *
+from service import Service
+
+__all__ = [ "LoadTests" ]
+
+class LoadFastCGI(Service):
+	name = "load_fastcgi"
+
+	def __init__(self):
+		self.sockfile = os.path.join(Env.dir, "tmp", "sockets", self.name + ".sock")
+		super(LoadFastCGI, self).__init__()
+
+	def Prepare(self):
+		self.tests.PrepareDir(os.path.join("tmp", "sockets"))
+		sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+		sock.bind(os.path.relpath(self.sockfile))
+		sock.listen(128)
+		self.fork(Env.loadgen, '--fastcgi', '--size', str(Env.load_size), inp = sock)
+
+	def Cleanup(self):
+		try:
+			os.remove(self.sockfile)
+		except BaseException, e:
+			print >>sys.stderr, "Couldn't delete socket '%s': %s" % (self.sockfile, e)
+		self.tests.CleanupDir(os.path.join("tmp", "sockets"))
+
+class LoadBackend(Service):
+	name = "load_backend"
+	PORT = 1 # offset to Env.port
+
+	def Prepare(self):
+		port = Env.port + self.PORT
+		self.portfree(port)
+		sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		sock.bind(("127.0.0.1", port))
+		sock.listen(128)
+		self.fork(Env.loadgen, '--http-backend', '--size', str(Env.load_size), inp = sock)
+
+def server_cpu_seconds(pgid):
+	"""user+system time of all processes in the process group of the server (linux only)"""
+	ticks = 0
+	for pid in os.listdir("/proc"):
+		if not pid.isdigit(): continue
+		try:
+			f = open(os.path.join("/proc", pid, "stat"))
+			stat = f.read()
+			f.close()
+		except IOError:
+			continue
+		# the command name may contain spaces; the fields after it are fixed
+		fields = stat[stat.rfind(')') + 2:].split()
+		if int(fields[2]) != pgid: continue
+		ticks += int(fields[11]) + int(fields[12])
+	return float(ticks) / os.sysconf(os.sysconf_names['SC_CLK_TCK'])
+
+def server_memory_usage():
+	conn = httplib.HTTPConnection("127.0.0.1", Env.port)
+	conn.request("GET", "/", headers = { "Host": "status.load" })
+	body = conn.getresponse().read()
+	conn.close()
+	for line in body.splitlines():
+		if line.startswith("lighttpd_memory_usage_bytes "):
+			return int(line.split()[1])
+	return 0
+
+class LoadTest(TestBase):
+	URL = None
+
+	def Run(self):
+		server = self.tests.services[0].proc
+		args = [ Env.loadgen,
+			'--connections', str(Env.load_connections),
+			'--threads', str(Env.load_threads),
+			'--duration', str(Env.load_duration),
+			'--pipeline', str(Env.load_pipeline),
+			'--host', self.vhost ]
+		if Env.load_no_keepalive: args.append('--no-keepalive')
+		args += [ '127.0.0.1', str(Env.port), self.URL ]
+
+		print >> Env.log, "Running load generator: %s" % (' '.join(args))
+		cpu = server_cpu_seconds(server.pid)
+		proc = subprocess.Popen(args, stdout = subprocess.PIPE, close_fds = True)
+		output = proc.communicate()[0]
+		cpu = server_cpu_seconds(server.pid) - cpu
+		if 0 != proc.returncode:
+			raise BaseException("load generator failed with returncode %i" % (proc.returncode))
+
+		result = { 'test': self.name }
+		for line in output.splitlines():
+			(key, value) = line.split(':', 1)
+			value = value.strip()
+			result[key] = float(value) if '.' in value else int(value)
+		result['server_cpu_seconds'] = cpu
+		result['server_memory_bytes'] = server_memory_usage()
+		self.tests.load_results.append(result)
+
+		print >> Env.log, output
+		print >> sys.stdout, Env.COLOR_BLUE + (" %-30s %10.1f req/s   p50 %6i us   p99 %6i us   p999 %6i us   cpu %5.1f%%   mem %6i KiB" % (
+			self.name, result['requests_per_sec'], result['latency_us_p50'], result['latency_us_p99'], result['latency_us_p999'],
+			100 * cpu / result['seconds'], result['server_memory_bytes'] / 1024)) + Env.COLOR_RESET
+
+		return 0 == result['errors'] and 0 == result['bad_status']
+
+class TestStaticSmall(LoadTest):
+	URL = "/small.txt"
+	config = "static;"
+
+	def Prepare(self):
+		self.PrepareVHostFile("small.txt", "x" * Env.load_size)
+
+class TestStaticLarge(LoadTest):
+	URL = "/large.bin"
+	config = "static;"
+
+	def Prepare(self):
+		self.PrepareVHostFile("large.bin", "x" * (64 * 1024))
+
+class TestFastCGI(LoadTest):
+	URL = "/fcgi"
+
+	def FeatureCheck(self):
+		fcgi = LoadFastCGI()
+		self.config = """
+fastcgi "unix:%s";
+""" % (fcgi.sockfile)
+		self.tests.add_service(fcgi)
+		return True
+
+class TestProxy(LoadTest):
+	URL = "/proxy"
+
+	def FeatureCheck(self):
+		backend = LoadBackend()
+		self.config = """
+proxy "127.0.0.1:%i";
+""" % (Env.port + backend.PORT)
+		self.tests.add_service(backend)
+		return True
+
+class TestStatus(TestBase):
+	runnable = False
+	vhost = "status.load"
+	config = """
+status.metrics;
+"""
+
+class Test(GroupTest):
+	group = [
+		TestStatus,
+		TestStaticSmall,
+		TestStaticLarge,
+		TestFastCGI,
+		TestProxy,
+	]
+
+	plain_config = """
+setup { module_load ( "mod_fastcgi", "mod_proxy", "mod_status" ); }
+"""
+
+class LoadTests(Tests):
+	def __init__(self):
+		super(LoadTests, self).__init__()
+		self.load_results = []
+
+	def LoadTests(self):
+		t = Test()
+		t.name = base.fix_test_name("load")
+		t._register(self)
+
+	def Run(self):
+		result = super(LoadTests, self).Run()
+		if None != Env.load_json:
+			f = open(Env.load_json, "a")
+			for r in self.load_results:
+				print >> f, json.dumps(r, sort_keys = True)
+			f.close()
+		return result
@@ -52,6 +52,14 @@ parser.add_option("--strace", help = "Strace services", action = "store_true", d
 parser.add_option("--truss", help = "Truss services", action = "store_true", default = False)
 parser.add_option("--debug-requests", help = "Dump requests", action = "store_true", default = False)
 parser.add_option("--no-angel", help = "Spawn lighttpd worker directly", action = "store_true", default = False)
+parser.add_option("--load", help = "Run the load tests instead of the tests, with the given load generator (lighttpd2-loadgen)")
+parser.add_option("--load-duration", help = "Seconds per load test (default: 10)", default = 10, type = "int")
+parser.add_option("--load-connections", help = "Connections per load test (default: 64)", default = 64, type = "int")
+parser.add_option("--load-threads", help = "Threads of the load generator (default: 2)", default = 2, type = "int")
+parser.add_option("--load-pipeline", help = "Pipelined requests per connection (default: 1)", default = 1, type = "int")
+parser.add_option("--load-no-keepalive", help = "One request per connection", action = "store_true", default = False)
+parser.add_option("--load-size", help = "Size of the small responses in bytes (default: 100)", default = 100, type = "int")
+parser.add_option("--load-json", help = "Append the load test results as json lines to this file")
 
 (options, args) = parser.parse_args()
 
@@ -73,6 +81,14 @@ Env.debugRequests = options.debug_requests
 Env.strace = options.strace
 Env.truss = options.truss
 Env.no_angel = options.no_angel
+Env.loadgen = options.load and os.path.abspath(options.load)
+Env.load_duration = options.load_duration
+Env.load_connections = options.load_connections
+Env.load_threads = options.load_threads
+Env.load_pipeline = options.load_pipeline
+Env.load_no_keepalive = options.load_no_keepalive
+Env.load_size = options.load_size
+Env.load_json = options.load_json
 
 Env.color = sys.stdin.isatty()
 Env.COLOR_RESET = Env.color and "\033[0m" or ""
@@ -97,7 +113,11 @@ failed = False
 
 try:
 	# run tests
-	tests = Tests()
+	if Env.loadgen:
+		from load import LoadTests
+		tests = LoadTests()
+	else:
+		tests = Tests()
 	tests.LoadTests()
 	failed = True
 	try:
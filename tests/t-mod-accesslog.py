@@ -0,0 +1,103 @@
+# -*- coding: utf-8 -*-
+
+import os
+import time
+import json
+import struct
+import pycurl
+
+from base import *
+from requests import *
+
+class AccesslogRequest(CurlRequest):
+	# records are buffered per worker and written by the log thread; wait for them
+	URL = "/"
+	EXPECT_RESPONSE_CODE = 200
+	REQUEST_HEADERS = []
+
+	def PrepareRequest(self):
+		self.curl.setopt(pycurl.HTTPHEADER, ["Host: " + self.vhost] + self.REQUEST_HEADERS)
+
+	def Run(self):
+		self.year_start = time.localtime().tm_year
+		super(AccesslogRequest, self).Run()
+		path = os.path.join(Env.dir, "log", "access.log-%s" % self.vhost)
+		data = ""
+		for i in range(50):
+			data = open(path, "rb").read()
+			if data: break
+			time.sleep(0.1)
+		if not data:
+			raise BaseException("No accesslog record written")
+		years = [ str(self.year_start), str(time.localtime().tm_year) ]
+		return self.CheckLog(data, years)
+
+	def CheckLog(self, data, years):
+		return True
+
+class TestText(AccesslogRequest):
+	config = """
+accesslog.format "%{%Y}t %{a}C %{b}C %{missing}C %>s";
+respond 200 => "ok";
+"""
+	REQUEST_HEADERS = [ "Cookie: a=1; b=two" ]
+
+	def CheckLog(self, data, years):
+		if not data in [ "%s 1 two - 200\n" % y for y in years ]:
+			print >> Env.log, repr(data)
+			raise BaseException("Unexpected text record")
+		return True
+
+class TestJson(AccesslogRequest):
+	config = """
+accesslog.format "%h %a %b %B %s %>s %{sec}t %{%Y}t \\"%{Referer}i\\" %{Missing}i";
+accesslog.type "json";
+respond 200 => "ok";
+"""
+	REQUEST_HEADERS = [ "Referer: ref" ]
+
+	def CheckLog(self, data, years):
+		if data.count('\n') != 1 or data.count('"status":') != 1:
+			print >> Env.log, repr(data)
+			raise BaseException("Expected one json record with unique keys")
+		r = json.loads(data)
+		expect = {
+			"remote_host": "127.0.0.1",
+			"remote_addr": "127.0.0.1",
+			"bytes_response": r["bytes_response_clf"],
+			"status": 200,
+			"request_header.Referer": "ref",
+			"request_header.Missing": None,
+		}
+		for (k, v) in expect.items():
+			if not r.has_key(k) or r[k] != v:
+				print >> Env.log, repr(data)
+				raise BaseException("Unexpected json field '%s'" % k)
+		if not type(r["time_sec"]) in (int, long) or not r["time.%Y"] in years:
+			print >> Env.log, repr(data)
+			raise BaseException("Unexpected json time fields")
+		return True
+
+class TestBinary(AccesslogRequest):
+	config = """
+accesslog.format "%s %{Referer}i %{Missing}i";
+accesslog.type "binary";
+respond 200 => "ok";
+"""
+	REQUEST_HEADERS = [ "Referer: ref" ]
+
+	def CheckLog(self, data, years):
+		# u32 length; fields: u8 format character, u8 type (0 none, 1 int, 2 string), value
+		expect = struct.pack(">cBq", "s", 1, 200) + struct.pack(">cBI", "i", 2, 3) + "ref" + struct.pack(">cB", "i", 0)
+		expect = struct.pack(">I", len(expect)) + expect
+		if data != expect:
+			print >> Env.log, repr(data)
+			raise BaseException("Unexpected binary record")
+		return True
+
+class Test(GroupTest):
+	group = [
+		TestText,
+		TestJson,
+		TestBinary,
+	]
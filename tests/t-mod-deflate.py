@@ -0,0 +1,290 @@
+# -*- coding: utf-8 -*-
+
+import os
+import bz2
+import zlib
+import random
+import pycurl
+import StringIO
+
+from base import *
+from requests import *
+
+def deflate_module_has(symbol):
+	"""whether mod_deflate was built with the library providing the symbol"""
+	path = os.path.join(Env.plugindir, "libmod_deflate.so")
+	try:
+		return symbol in open(path, "rb").read()
+	except IOError:
+		return False
+
+# (encoding, library symbol) in order of preference, see mod_deflate.c
+ENCODINGS = [
+	("br", "BrotliEncoderCreateInstance"),
+	("zstd", "ZSTD_compressStream2"),
+	("bzip2", "BZ2_bzCompressInit"),
+	("gzip", "deflateInit2_"),
+	("deflate", "deflateInit2_"),
+]
+
+def text_body(lines):
+	return "".join([ "%06i: The quick brown fox jumps over the lazy dog.\n" % i for i in range(lines) ])
+
+def random_body(size, seed):
+	r = random.Random(seed)
+	return "".join([ chr(r.randint(0, 255)) for i in range(size) ])
+
+class DeflateRequest(TestBase):
+	FILES = { "test.txt": text_body(100) }
+
+	def Prepare(self):
+		for (name, content) in self.FILES.items():
+			self.PrepareVHostFile(name, content)
+
+	def Get(self, path, accept_encoding, abort_after = None):
+		"""returns (headers, body); the body is not decoded"""
+		c = pycurl.Curl()
+		b = StringIO.StringIO()
+		h = StringIO.StringIO()
+		def write(data):
+			b.write(data)
+			if None != abort_after and b.tell() >= abort_after: return -1
+		c.setopt(pycurl.URL, "http://127.0.0.1:%i%s" % (Env.port, path))
+		c.setopt(pycurl.HTTPHEADER, [ "Host: " + self.vhost, "Accept-Encoding: " + accept_encoding ])
+		c.setopt(pycurl.WRITEFUNCTION, write)
+		c.setopt(pycurl.HEADERFUNCTION, h.write)
+		try:
+			c.perform()
+		except pycurl.error:
+			if None == abort_after: raise
+			c.close()
+			return (None, None)
+		code = c.getinfo(pycurl.RESPONSE_CODE)
+		c.close()
+		if code != 200:
+			raise BaseException("Unexpected response code %i for %s" % (code, path))
+		headers = { }
+		for line in h.getvalue().split("\r\n")[1:]:
+			if ":" in line:
+				(k, v) = line.split(":", 1)
+				headers[k.strip().lower()] = v.strip()
+		return (headers, b.getvalue())
+
+	def Decode(self, encoding, data):
+		if encoding == "gzip":
+			return zlib.decompress(data, 16 + zlib.MAX_WBITS)
+		if encoding == "deflate":
+			return zlib.decompress(data, -zlib.MAX_WBITS)
+		if encoding == "bzip2":
+			return bz2.decompress(data)
+		if encoding == "zstd" and data[:4] != "\x28\xb5\x2f\xfd":
+			raise BaseException("Not a zstd frame")
+		try:
+			if encoding == "br":
+				import brotli
+				return brotli.decompress(data)
+			if encoding == "zstd":
+				import zstandard
+				return zstandard.ZstdDecompressor().decompress(data, max_output_size = 64*1024*1024)
+		except ImportError:
+			return None # can't decode it here
+		raise BaseException("Unknown encoding '%s'" % encoding)
+
+	def CheckEncoded(self, name, encoding, headers, body):
+		if headers.get("content-encoding") != encoding:
+			raise BaseException("Expected Content-Encoding '%s', got '%s'" % (encoding, headers.get("content-encoding")))
+		if not "Accept-Encoding" in headers.get("vary", ""):
+			raise BaseException("Missing 'Vary: Accept-Encoding'")
+		decoded = self.Decode(encoding, body)
+		if None != decoded and decoded != self.FILES[name]:
+			raise BaseException("%s response doesn't decode to '%s'" % (encoding, name))
+
+class EncodingRequest(DeflateRequest):
+	config = """
+static;
+deflate [ "encodings" => "deflate,gzip,bzip2,br,zstd" ];
+"""
+	ACCEPT_ENCODING = None
+	ENCODING = None
+
+	def Run(self):
+		(headers, body) = self.Get("/test.txt", self.ACCEPT_ENCODING)
+		self.CheckEncoded("test.txt", self.ENCODING, headers, body)
+		return True
+
+class TestGzip(EncodingRequest):
+	ACCEPT_ENCODING = "gzip"
+	ENCODING = "gzip"
+
+class TestDeflate(EncodingRequest):
+	ACCEPT_ENCODING = "deflate"
+	ENCODING = "deflate"
+
+class TestBrotli(EncodingRequest):
+	ACCEPT_ENCODING = "br"
+	ENCODING = "br"
+
+	def FeatureCheck(self):
+		if not deflate_module_has("BrotliEncoderCreateInstance"):
+			return self.MissingFeature("brotli")
+		return True
+
+class TestZstd(EncodingRequest):
+	ACCEPT_ENCODING = "zstd"
+	ENCODING = "zstd"
+
+	def FeatureCheck(self):
+		if not deflate_module_has("ZSTD_compressStream2"):
+			return self.MissingFeature("zstd")
+		return True
+
+class TestPreference(EncodingRequest):
+	# the client's order doesn't matter, the best available encoding wins
+	ACCEPT_ENCODING = "deflate, gzip, bzip2, zstd, br"
+
+	def Prepare(self):
+		super(TestPreference, self).Prepare()
+		self.ENCODING = filter(lambda (e, symbol): deflate_module_has(symbol), ENCODINGS)[0][0]
+
+class TestIdentity(DeflateRequest):
+	config = """
+static;
+deflate;
+"""
+
+	def Run(self):
+		(headers, body) = self.Get("/test.txt", "identity")
+		if headers.has_key("content-encoding") or body != self.FILES["test.txt"]:
+			raise BaseException("Expected an unencoded response")
+		return True
+
+class TestOffload(DeflateRequest):
+	# compressed in the tasklet pool, in several tasklets
+	FILES = { "big.txt": text_body(40000) }
+	config = """
+static;
+deflate [ "encodings" => "gzip,deflate", "offload" => 4096, "offload-blocks" => 2, "blocksize" => 4096 ];
+"""
+
+	def Run(self):
+		for encoding in [ "gzip", "deflate" ]:
+			(headers, body) = self.Get("/big.txt", encoding)
+			self.CheckEncoded("big.txt", encoding, headers, body)
+		return True
+
+class TestOffloadAbort(TestOffload):
+	# the client goes away while tasklets are running; the stream is detached and the server keeps working
+	def Run(self):
+		for i in range(5):
+			self.Get("/big.txt", "gzip", abort_after = 1)
+		return super(TestOffloadAbort, self).Run()
+
+class CacheRequest(DeflateRequest):
+	def GetCached(self, path):
+		"""requests the variant until it is served from the cache; returns the first and the cached response"""
+		(headers, first) = self.Get(path, "gzip")
+		self.CheckEncoded(path[1:], "gzip", headers, first)
+		if headers.has_key("content-length"):
+			raise BaseException("First response for '%s' shouldn't come from the cache" % path)
+		for i in range(10):
+			(headers, body) = self.Get(path, "gzip")
+			self.CheckEncoded(path[1:], "gzip", headers, body)
+			if headers.has_key("content-length"): break
+		if not headers.has_key("content-length"):
+			raise BaseException("'%s' wasn't served from the cache" % path)
+		if int(headers["content-length"]) != len(body) or body != first:
+			raise BaseException("Cached variant of '%s' differs from the compressed response" % path)
+		return (first, body)
+
+class TestCacheMemory(CacheRequest):
+	config = """
+static;
+deflate [ "encodings" => "gzip", "cache-memory" => 1048576 ];
+"""
+
+	def Run(self):
+		self.GetCached("/test.txt")
+		return True
+
+class TestCacheDisk(CacheRequest):
+	# too big for memory entries: stored in a private subdirectory of the cache directory
+	FILES = { "big.txt": text_body(40000) }
+
+	def Prepare(self):
+		super(TestCacheDisk, self).Prepare()
+		self.cachedir = self.PrepareDir("tmp/deflate-cache")
+		self.config = """
+static;
+deflate [ "encodings" => "gzip", "cache-memory" => 1048576, "cache-memory-entry" => 1024, "cache-disk" => "%s" ];
+""" % (self.cachedir)
+
+	def Run(self):
+		(first, body) = self.GetCached("/big.txt")
+		files = [ ]
+		for d in os.listdir(self.cachedir):
+			if not d.startswith("deflate-"): continue
+			files += [ os.path.join(self.cachedir, d, f) for f in os.listdir(os.path.join(self.cachedir, d)) ]
+		if len(files) != 1 or os.path.getsize(files[0]) != len(body):
+			raise BaseException("Expected one cache file with the compressed variant, got %s" % repr(files))
+		return True
+
+class TestCacheEvict(CacheRequest):
+	# random data doesn't compress: only one variant fits into the memory limit
+	FILES = { "a.bin": random_body(3000, 1), "b.bin": random_body(3000, 2) }
+	config = """
+static;
+deflate [ "encodings" => "gzip", "cache-memory" => 4500 ];
+"""
+
+	def Run(self):
+		self.GetCached("/a.bin")
+		self.GetCached("/b.bin")
+		# a.bin was the least recently used entry and got evicted
+		(headers, body) = self.Get("/a.bin", "gzip")
+		self.CheckEncoded("a.bin", "gzip", headers, body)
+		if headers.has_key("content-length"):
+			raise BaseException("Evicted variant was served from the cache")
+		return True
+
+class TestCachePrivate(CacheRequest):
+	config = """
+header.add "Cache-Control" => "private";
+static;
+deflate [ "encodings" => "gzip", "cache-memory" => 1048576 ];
+"""
+
+	def Run(self):
+		for i in range(3):
+			(headers, body) = self.Get("/test.txt", "gzip")
+			self.CheckEncoded("test.txt", "gzip", headers, body)
+			if headers.has_key("content-length"):
+				raise BaseException("Private response was served from the cache")
+		return True
+
+class Test(GroupTest):
+	group = [
+		TestGzip,
+		TestDeflate,
+		TestBrotli,
+		TestZstd,
+		TestPreference,
+		TestIdentity,
+		TestOffload,
+		TestOffloadAbort,
+		TestCacheMemory,
+		TestCacheDisk,
+		TestCacheEvict,
+		TestCachePrivate,
+	]
+
+	plain_config = """
+setup {
+	module_load "mod_deflate";
+	tasklet_pool.threads 2;
+}
+"""
+
+	def FeatureCheck(self):
+		if not deflate_module_has("deflateInit2_"):
+			return self.MissingFeature("mod_deflate with zlib")
+		return True
@@ -0,0 +1,264 @@
+# -*- coding: utf-8 -*-
+
+import time
+import socket
+import struct
+import threading
+import pycurl
+import StringIO
+
+from base import *
+from requests import *
+from service import Service
+
+class RateRequests(TestBase):
+	# list of (delay before the request in seconds, Cookie header or None, expected status)
+	REQUESTS = []
+
+	def Run(self):
+		codes = []
+		# one keep-alive connection: all requests are handled by the same worker
+		c = pycurl.Curl()
+		c.setopt(pycurl.URL, "http://127.0.0.1:%i/" % (Env.port))
+		c.setopt(pycurl.WRITEFUNCTION, StringIO.StringIO().write)
+		for (delay, cookie, expect) in self.REQUESTS:
+			if delay: time.sleep(delay)
+			headers = ["Host: " + self.vhost]
+			if cookie: headers.append("Cookie: " + cookie)
+			c.setopt(pycurl.HTTPHEADER, headers)
+			c.perform()
+			codes.append(c.getinfo(pycurl.RESPONSE_CODE))
+		c.close()
+		expected = map(lambda x: x[2], self.REQUESTS)
+		if codes != expected:
+			print >> Env.log, "Got status codes %s, expected %s" % (repr(codes), repr(expected))
+			raise BaseException("Unexpected response codes")
+		return True
+
+class TestTokenBucket(RateRequests):
+	config = """
+limit.rate [ "rate" => 2, "period" => 60 ];
+respond 200 => "ok";
+"""
+	REQUESTS = [ (0, None, 200), (0, None, 200), (0, None, 503) ]
+
+class TestTokenBucketRefill(RateRequests):
+	# one token per second, no burst
+	config = """
+limit.rate [ "rate" => 1, "period" => 1, "burst" => 1 ];
+respond 200 => "ok";
+"""
+	REQUESTS = [ (0, None, 200), (0, None, 503), (1.2, None, 200), (0, None, 503) ]
+
+class TestSlidingWindow(RateRequests):
+	config = """
+limit.rate [ "mode" => "sliding_window", "rate" => 2, "period" => 60 ];
+respond 200 => "ok";
+"""
+	REQUESTS = [ (0, None, 200), (0, None, 200), (0, None, 503), (0, None, 503) ]
+
+class TestSlidingWindowExpire(RateRequests):
+	config = """
+limit.rate [ "mode" => "sliding_window", "rate" => 2, "period" => 1 ];
+respond 200 => "ok";
+"""
+	REQUESTS = [ (0, None, 200), (0, None, 200), (0, None, 503), (1.2, None, 200), (0, None, 200), (0, None, 503) ]
+
+class TestCookieKey(RateRequests):
+	# the cookie value is part of the key; separators of joined headers are accepted too
+	config = """
+limit.rate [ "mode" => "sliding_window", "rate" => 1, "period" => 60, "cookie" => "session" ];
+respond 200 => "ok";
+"""
+	REQUESTS = [
+		(0, "session=a", 200),
+		(0, "x=1; session=a", 503),
+		(0, "session=b", 200),
+		(0, "x=1, session=b", 503),
+		(0, "sessionx=a; session=c", 200),
+	]
+
+class MemcachedStandIn(Service):
+	"""minimal memcached (incr and add, ascii or binary protocol) running in a thread of the test runner.
+	the first incr of a key containing "race" misses, but creates the key with RACE_VALUE afterwards,
+	as if another server added the counter in the meantime."""
+	RACE_VALUE = 4
+
+	def __init__(self, name, port, binary):
+		super(MemcachedStandIn, self).__init__()
+		self.name = name
+		self.port = port
+		self.binary = binary
+		self.values = { }
+		self.lock = threading.Lock()
+		self.sock = None
+
+	def Prepare(self):
+		self.portfree(self.port)
+		self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		self.sock.bind(("127.0.0.1", self.port))
+		self.sock.listen(8)
+		t = threading.Thread(target = self._accept)
+		t.daemon = True
+		t.start()
+
+	def Stop(self):
+		if None != self.sock:
+			self.sock.close()
+			self.sock = None
+
+	def Cleanup(self):
+		self.Stop()
+
+	def incr(self, key, delta):
+		self.lock.acquire()
+		try:
+			if not self.values.has_key(key):
+				if "race" in key: self.values[key] = self.RACE_VALUE
+				return None
+			self.values[key] += delta
+			return self.values[key]
+		finally:
+			self.lock.release()
+
+	def add(self, key, value):
+		self.lock.acquire()
+		try:
+			if self.values.has_key(key): return False
+			self.values[key] = int(value)
+			return True
+		finally:
+			self.lock.release()
+
+	def _accept(self):
+		while True:
+			try:
+				(conn, addr) = self.sock.accept()
+			except:
+				return
+			t = threading.Thread(target = self._serve, args = (conn, ))
+			t.daemon = True
+			t.start()
+
+	def _serve(self, conn):
+		f = conn.makefile("rb")
+		try:
+			while True:
+				if self.binary:
+					if not self._serve_binary(conn, f): break
+				else:
+					if not self._serve_ascii(conn, f): break
+		except:
+			pass
+		f.close()
+		conn.close()
+
+	def _serve_ascii(self, conn, f):
+		line = f.readline()
+		if not line: return False
+		args = line.split()
+		if len(args) == 3 and args[0] == "incr":
+			value = self.incr(args[1], int(args[2]))
+			conn.sendall(None == value and "NOT_FOUND\r\n" or ("%d\r\n" % value))
+		elif len(args) == 5 and args[0] == "add":
+			data = f.read(int(args[4]) + 2)[:-2]
+			conn.sendall(self.add(args[1], data) and "STORED\r\n" or "NOT_STORED\r\n")
+		else:
+			conn.sendall("ERROR\r\n")
+		return True
+
+	def _serve_binary(self, conn, f):
+		header = f.read(24)
+		if len(header) < 24: return False
+		(magic, opcode, keylen, extlen, datatype, vbucket, bodylen, opaque, cas) = struct.unpack(">BBHBBHIIQ", header)
+		body = f.read(bodylen)
+		extras = body[:extlen]
+		key = body[extlen:extlen+keylen]
+		value = body[extlen+keylen:]
+		status = 0
+		cas = 0
+		if opcode == 0x05: # incr
+			(delta, ) = struct.unpack(">Q", extras[:8])
+			result = self.incr(key, delta)
+			if None == result:
+				(status, body) = (0x0001, "Not found")
+			else:
+				body = struct.pack(">Q", result)
+		elif opcode == 0x02: # add
+			if self.add(key, value):
+				(body, cas) = ("", 1)
+			else:
+				(status, body) = (0x0002, "Data exists")
+		else:
+			(status, body) = (0x0081, "Unknown command")
+		conn.sendall(struct.pack(">BBHBBHIIQ", 0x81, opcode, 0, 0, 0, status, len(body), opaque, cas) + body)
+		return True
+
+MEMCACHED_PORTS = { "ascii": 2, "binary": 3 } # offsets to Env.port
+MEMCACHED_DOWN_PORT = 4 # nothing listens there
+
+class MemcachedRate(RateRequests):
+	PROTOCOL = "ascii"
+	KEY = None
+	OPTIONS = ""
+	DOWN = False
+
+	def Prepare(self):
+		port = Env.port + (self.DOWN and MEMCACHED_DOWN_PORT or MEMCACHED_PORTS[self.PROTOCOL])
+		self.config = """
+limit.rate [ "mode" => "memcached", "server" => "127.0.0.1:%i", "protocol" => "%s", "key" => "%s", "period" => 86400 %s ];
+respond 200 => "ok";
+""" % (port, self.PROTOCOL, self.KEY, self.OPTIONS)
+
+class TestMemcachedLease(MemcachedRate):
+	# leases of 2 requests each: incr misses, add creates the counter, incr for the next leases; exactly "rate" are allowed
+	KEY = "lease"
+	OPTIONS = ', "rate" => 5, "batch" => 2'
+	REQUESTS = [ (0, None, 200) ] * 5 + [ (0, None, 503) ] * 3
+
+class TestMemcachedRace(MemcachedRate):
+	# another server adds the counter (with 4 requests) between our incr and add: add fails, incr again
+	KEY = "race"
+	OPTIONS = ', "rate" => 5, "batch" => 2'
+	REQUESTS = [ (0, None, 200), (0, None, 503), (0, None, 503) ]
+
+class TestMemcachedDown(MemcachedRate):
+	# requests are not limited while memcached isn't reachable
+	KEY = "down"
+	DOWN = True
+	OPTIONS = ', "rate" => 1, "batch" => 1'
+	REQUESTS = [ (0, None, 200) ] * 4
+
+class TestMemcachedLeaseBinary(TestMemcachedLease):
+	PROTOCOL = "binary"
+
+class TestMemcachedRaceBinary(TestMemcachedRace):
+	PROTOCOL = "binary"
+
+class TestMemcachedDownBinary(TestMemcachedDown):
+	PROTOCOL = "binary"
+
+class Test(GroupTest):
+	group = [
+		TestTokenBucket,
+		TestTokenBucketRefill,
+		TestSlidingWindow,
+		TestSlidingWindowExpire,
+		TestCookieKey,
+		TestMemcachedLease,
+		TestMemcachedRace,
+		TestMemcachedDown,
+		TestMemcachedLeaseBinary,
+		TestMemcachedRaceBinary,
+		TestMemcachedDownBinary,
+	]
+
+	plain_config = """
+setup { module_load "mod_limit"; }
+"""
+
+	def FeatureCheck(self):
+		for (protocol, offset) in MEMCACHED_PORTS.items():
+			self.tests.add_service(MemcachedStandIn("memcached_" + protocol, Env.port + offset, protocol == "binary"))
+		return True
@@ -0,0 +1,154 @@
+# -*- coding: utf-8 -*-
+
+import re
+import time
+import pycurl
+import StringIO
+
+from base import *
+from requests import *
+
+METRIC_NAME = r'[a-zA-Z_:][a-zA-Z0-9_:]*'
+METRIC_LABEL = r'[a-zA-Z_][a-zA-Z0-9_]*="(?:[^"\\\n]|\\.)*"'
+METRIC_SAMPLE = re.compile(r'^(%s)(?:\{(%s(?:,%s)*)\})? (\S+)$' % (METRIC_NAME, METRIC_LABEL, METRIC_LABEL))
+METRIC_LABELS = re.compile(r'([a-zA-Z_][a-zA-Z0-9_]*)="((?:[^"\\\n]|\\.)*)"')
+
+# sample name suffixes each metric type may use
+METRIC_SUFFIXES = {
+	"counter": [ "_total" ],
+	"gauge": [ "" ],
+	"histogram": [ "_bucket", "_count", "_sum" ],
+}
+
+class MetricsRequest(TestBase):
+	config = """
+if req.path == "/metrics" {
+	status.metrics;
+} else {
+	respond 200 => "ok";
+}
+"""
+
+	def Get(self, path, headers = None):
+		c = pycurl.Curl()
+		b = StringIO.StringIO()
+		h = StringIO.StringIO()
+		c.setopt(pycurl.URL, "http://127.0.0.1:%i%s" % (Env.port, path))
+		c.setopt(pycurl.HTTPHEADER, ["Host: " + self.vhost])
+		c.setopt(pycurl.WRITEFUNCTION, b.write)
+		c.setopt(pycurl.HEADERFUNCTION, h.write)
+		c.perform()
+		code = c.getinfo(pycurl.RESPONSE_CODE)
+		c.close()
+		if code != 200:
+			raise BaseException("Unexpected response code %i for %s" % (code, path))
+		if None != headers:
+			for line in h.getvalue().split("\r\n")[1:]:
+				if ":" in line:
+					(k, v) = line.split(":", 1)
+					headers[k.strip().lower()] = v.strip()
+		return b.getvalue()
+
+	def Fail(self, body, msg):
+		print >> Env.log, body
+		raise BaseException(msg)
+
+	def Parse(self, body):
+		"""checks the OpenMetrics text format and returns { sample name: [ (labels, value) ] }"""
+		samples = { }
+		families = { }
+		family = None
+		mtype = None
+		lines = body.split("\n")
+		if lines[-2:] != [ "# EOF", "" ]:
+			self.Fail(body, "Exposition doesn't end with '# EOF'")
+		for line in lines[:-2]:
+			if line.startswith("# TYPE "):
+				(family, mtype) = line[7:].split(" ", 1)
+				if families.has_key(family):
+					self.Fail(body, "Metric family '%s' isn't contiguous" % family)
+				if not METRIC_SUFFIXES.has_key(mtype) or not re.match("^%s$" % METRIC_NAME, family):
+					self.Fail(body, "Invalid TYPE line '%s'" % line)
+				families[family] = mtype
+				continue
+			if line.startswith("# HELP "):
+				if line[7:].split(" ", 1)[0] != family:
+					self.Fail(body, "HELP line '%s' doesn't follow its TYPE" % line)
+				continue
+			m = METRIC_SAMPLE.match(line)
+			if None == m:
+				self.Fail(body, "Invalid sample line '%s'" % line)
+			(name, labels, value) = m.groups()
+			if None == family or not name in [ family + s for s in METRIC_SUFFIXES[mtype] ]:
+				self.Fail(body, "Sample '%s' doesn't belong to the family '%s'" % (name, family))
+			labels = dict(METRIC_LABELS.findall(labels or ""))
+			samples.setdefault(name, []).append((labels, float(value)))
+		return samples
+
+	def Value(self, samples, name, **labels):
+		for (l, v) in samples.get(name, []):
+			if l == labels: return v
+		return None
+
+	def CheckHistogram(self, body, samples, name):
+		buckets = [ (l["le"], v) for (l, v) in samples.get(name + "_bucket", []) ]
+		if not buckets or buckets[-1][0] != "+Inf":
+			self.Fail(body, "Histogram '%s' has no +Inf bucket" % name)
+		bounds = [ float(le) for (le, v) in buckets ]
+		counts = [ v for (le, v) in buckets ]
+		if bounds != sorted(bounds) or counts != sorted(counts):
+			self.Fail(body, "Histogram '%s' buckets aren't cumulative" % name)
+		if counts[-1] != self.Value(samples, name + "_count") or None == self.Value(samples, name + "_sum"):
+			self.Fail(body, "Histogram '%s' +Inf bucket doesn't match its count" % name)
+
+class TestFormat(MetricsRequest):
+	def Run(self):
+		self.Get("/")
+		headers = { }
+		body = self.Get("/metrics", headers)
+		if not headers.get("content-type", "").startswith("application/openmetrics-text; version=1.0.0"):
+			self.Fail(body, "Unexpected Content-Type '%s'" % headers.get("content-type"))
+		samples = self.Parse(body)
+		for name in [ "lighttpd_request_ttfb_seconds", "lighttpd_request_duration_seconds", "lighttpd_loop_busy_seconds" ]:
+			self.CheckHistogram(body, samples, name)
+		requests = sum([ v for (l, v) in samples.get("lighttpd_requests_total", []) ])
+		if requests < 1 or len(samples["lighttpd_requests_total"]) != 2:
+			self.Fail(body, "Expected request counters of both workers")
+		return True
+
+class TestLabel(MetricsRequest):
+	# labels are accounted when the request is closed, which may happen after the next request started
+	config = """
+if req.path == "/metrics" {
+	status.metrics;
+} else {
+	stats.label "metrics_test";
+	respond 200 => "ok";
+}
+"""
+
+	def Run(self):
+		for i in range(3):
+			self.Get("/")
+		for i in range(50):
+			body = self.Get("/metrics")
+			samples = self.Parse(body)
+			if 3 == self.Value(samples, "lighttpd_label_requests_total", label = "metrics_test"): break
+			time.sleep(0.1)
+		if 3 != self.Value(samples, "lighttpd_label_requests_total", label = "metrics_test"):
+			self.Fail(body, "Expected 3 requests for label 'metrics_test'")
+		if not self.Value(samples, "lighttpd_label_traffic_out_bytes_total", label = "metrics_test") > 0:
+			self.Fail(body, "Expected outgoing traffic for label 'metrics_test'")
+		if None == self.Value(samples, "lighttpd_label_duration_seconds_total", label = "metrics_test"):
+			self.Fail(body, "Expected a duration for label 'metrics_test'")
+		return True
+
+class Test(GroupTest):
+	group = [
+		TestFormat,
+		TestLabel,
+	]
+
+	plain_config = """
+setup { module_load "mod_status"; }
+"""
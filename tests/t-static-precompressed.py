@@ -0,0 +1,64 @@
+# -*- coding: utf-8 -*-
+
+from base import *
+from requests import *
+
+# the server doesn't care whether the sidecars actually contain compressed data
+TEST_TXT="plain content\n"
+TEST_TXT_GZ="gzip content\n"
+TEST_TXT_BR="brotli content\n"
+
+class PrecompressedRequest(CurlRequest):
+	ACCEPT_ENCODING = None
+
+	def PrepareRequest(self):
+		headers = ["Host: " + self.vhost]
+		if None != self.ACCEPT_ENCODING:
+			headers.append("Accept-Encoding: " + self.ACCEPT_ENCODING)
+		self.curl.setopt(pycurl.HTTPHEADER, headers)
+
+class TestNoAcceptEncoding(PrecompressedRequest):
+	URL = "/test.txt"
+	EXPECT_RESPONSE_BODY = TEST_TXT
+	EXPECT_RESPONSE_CODE = 200
+	EXPECT_RESPONSE_HEADERS = [ ("Vary", "Accept-Encoding") ]
+
+class TestGzip(PrecompressedRequest):
+	URL = "/test.txt"
+	ACCEPT_ENCODING = "gzip, deflate"
+	EXPECT_RESPONSE_BODY = TEST_TXT_GZ
+	EXPECT_RESPONSE_CODE = 200
+	EXPECT_RESPONSE_HEADERS = [ ("Content-Encoding", "gzip"), ("Content-Type", "text/plain"), ("Vary", "Accept-Encoding") ]
+
+class TestBrotliPreferred(PrecompressedRequest):
+	URL = "/test.txt"
+	ACCEPT_ENCODING = "gzip, br"
+	EXPECT_RESPONSE_BODY = TEST_TXT_BR
+	EXPECT_RESPONSE_CODE = 200
+	EXPECT_RESPONSE_HEADERS = [ ("Content-Encoding", "br") ]
+
+class TestBrotliRejected(PrecompressedRequest):
+	URL = "/test.txt"
+	ACCEPT_ENCODING = "br;q=0, gzip"
+	EXPECT_RESPONSE_BODY = TEST_TXT_GZ
+	EXPECT_RESPONSE_CODE = 200
+	EXPECT_RESPONSE_HEADERS = [ ("Content-Encoding", "gzip") ]
+
+class TestNoSidecar(PrecompressedRequest):
+	URL = "/other.txt"
+	ACCEPT_ENCODING = "gzip, br"
+	EXPECT_RESPONSE_BODY = TEST_TXT
+	EXPECT_RESPONSE_CODE = 200
+
+class Test(GroupTest):
+	group = [TestNoAcceptEncoding,TestGzip,TestBrotliPreferred,TestBrotliRejected,TestNoSidecar]
+
+	def Prepare(self):
+		self.PrepareVHostFile("test.txt", TEST_TXT)
+		self.PrepareVHostFile("test.txt.gz", TEST_TXT_GZ)
+		self.PrepareVHostFile("test.txt.br", TEST_TXT_BR)
+		self.PrepareVHostFile("other.txt", TEST_TXT)
+		self.config = """
+mime_types ( ".txt" => "text/plain" );
+static.precompressed ( "br", "gzip" );
+"""